@@ -1145,8 +1145,9 @@ tSize hdfsRead(hdfsFS fs, hdfsFile f, void* buffer, tSize length)
         return -1;
     }
 
-    jthr = invokeMethod(env, &jVal, INSTANCE, jInputStream, HADOOP_ISTRM,
-                               "read", "([B)I", jbRarray);
+    static struct cachedMethod readMeth = CACHED_METHOD_INIT(INSTANCE,
+            HADOOP_ISTRM, "read", "([B)I");
+    jthr = invokeCachedMethod(env, &jVal, &readMeth, jInputStream, jbRarray);
     if (jthr) {
         destroyLocalReference(env, jbRarray);
         errno = printExceptionAndFree(env, jthr, PRINT_EXC_ALL,
@@ -1202,8 +1203,9 @@ tSize readDirect(hdfsFS fs, hdfsFile f, void* buffer, tSize length)
         return -1;
     }
 
-    jthr = invokeMethod(env, &jVal, INSTANCE, jInputStream,
-        HADOOP_ISTRM, "read", "(Ljava/nio/ByteBuffer;)I", bb);
+    static struct cachedMethod readMeth = CACHED_METHOD_INIT(INSTANCE,
+            HADOOP_ISTRM, "read", "(Ljava/nio/ByteBuffer;)I");
+    jthr = invokeCachedMethod(env, &jVal, &readMeth, jInputStream, bb);
     destroyLocalReference(env, bb);
     if (jthr) {
         errno = printExceptionAndFree(env, jthr, PRINT_EXC_ALL,
@@ -1213,13 +1215,102 @@ tSize readDirect(hdfsFS fs, hdfsFile f, void* buffer, tSize length)
     return (jVal.i < 0) ? 0 : jVal.i;
 }
 
-tSize hdfsPread(hdfsFS fs, hdfsFile f, tOffset position,
-                void* buffer, tSize length)
+/**
+ * Read from a position of a file that is open for reading.
+ *
+ * Reads of up to THREAD_BYTE_ARRAY_LENGTH bytes go through the thread's byte
+ * array, so that they don't allocate a Java array each time.
+ *
+ * @return          The number of bytes read, 0 at the end of the file, or -1
+ *                  with errno set
+ */
+static tSize preadImpl(JNIEnv *env, hdfsFile f, tOffset position,
+                       void* buffer, tSize length)
 {
-    JNIEnv* env;
+    static struct cachedMethod readMeth = CACHED_METHOD_INIT(INSTANCE,
+            HADOOP_ISTRM, "read", "(J[BII)I");
     jbyteArray jbRarray;
+    int ownArray;
     jvalue jVal;
     jthrowable jthr;
+    int ret;
+
+    // JAVA EQUIVALENT:
+    //  byte [] bR = new byte[length];
+    //  fis.read(pos, bR, 0, length);
+    ownArray = length > THREAD_BYTE_ARRAY_LENGTH;
+    if (ownArray) {
+        jbRarray = (*env)->NewByteArray(env, length);
+        if (!jbRarray) {
+            errno = printPendingExceptionAndFree(env, PRINT_EXC_ALL,
+                "hdfsPread: NewByteArray");
+            return -1;
+        }
+    } else {
+        jthr = getThreadByteArray(env, &jbRarray);
+        if (jthr) {
+            errno = printExceptionAndFree(env, jthr, PRINT_EXC_ALL,
+                "hdfsPread: getThreadByteArray");
+            return -1;
+        }
+    }
+    jthr = invokeCachedMethod(env, &jVal, &readMeth, f->file,
+                     position, jbRarray, 0, length);
+    if (jthr) {
+        errno = printExceptionAndFree(env, jthr, PRINT_EXC_ALL,
+            "hdfsPread: FSDataInputStream#read");
+        ret = -1;
+        goto done;
+    }
+    if (jVal.i < 0) {
+        // EOF
+        ret = 0;
+        goto done;
+    } else if (jVal.i == 0) {
+        errno = EINTR;
+        ret = -1;
+        goto done;
+    }
+    (*env)->GetByteArrayRegion(env, jbRarray, 0, jVal.i, buffer);
+    if ((*env)->ExceptionCheck(env)) {
+        errno = printPendingExceptionAndFree(env, PRINT_EXC_ALL,
+            "hdfsPread: GetByteArrayRegion");
+        ret = -1;
+        goto done;
+    }
+    ret = jVal.i;
+done:
+    if (ownArray) {
+        destroyLocalReference(env, jbRarray);
+    }
+    return ret;
+}
+
+/**
+ * Check that a file can be read from a position.
+ *
+ * @return          0 if it can; -1 with errno set otherwise
+ */
+static int preadPrepare(hdfsFile f)
+{
+    if (!f || f->type == UNINITIALIZED) {
+        errno = EBADF;
+        return -1;
+    }
+
+    //Error checking... make sure that this file is 'readable'
+    if (f->type != INPUT) {
+        fprintf(stderr, "Cannot read from a non-InputStream object!\n");
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+tSize hdfsPread(hdfsFS fs, hdfsFile f, tOffset position,
+                void* buffer, tSize length)
+{
+    JNIEnv* env;
 
     if (length == 0) {
         return 0;
@@ -1227,8 +1318,7 @@ tSize hdfsPread(hdfsFS fs, hdfsFile f, tOffset position,
         errno = EINVAL;
         return -1;
     }
-    if (!f || f->type == UNINITIALIZED) {
-        errno = EBADF;
+    if (preadPrepare(f) == -1) {
         return -1;
     }
 
@@ -1237,48 +1327,46 @@ tSize hdfsPread(hdfsFS fs, hdfsFile f, tOffset position,
       errno = EINTERNAL;
       return -1;
     }
+    return preadImpl(env, f, position, buffer, length);
+}
 
-    //Error checking... make sure that this file is 'readable'
-    if (f->type != INPUT) {
-        fprintf(stderr, "Cannot read from a non-InputStream object!\n");
-        errno = EINVAL;
-        return -1;
-    }
+int hdfsPreadFully(hdfsFS fs, hdfsFile f, tOffset position,
+                   void* buffer, tSize length)
+{
+    JNIEnv* env;
+    tSize ret;
 
-    // JAVA EQUIVALENT:
-    //  byte [] bR = new byte[length];
-    //  fis.read(pos, bR, 0, length);
-    jbRarray = (*env)->NewByteArray(env, length);
-    if (!jbRarray) {
-        errno = printPendingExceptionAndFree(env, PRINT_EXC_ALL,
-            "hdfsPread: NewByteArray");
+    if (length < 0) {
+        errno = EINVAL;
         return -1;
     }
-    jthr = invokeMethod(env, &jVal, INSTANCE, f->file, HADOOP_ISTRM,
-                     "read", "(J[BII)I", position, jbRarray, 0, length);
-    if (jthr) {
-        destroyLocalReference(env, jbRarray);
-        errno = printExceptionAndFree(env, jthr, PRINT_EXC_ALL,
-            "hdfsPread: FSDataInputStream#read");
+    if (preadPrepare(f) == -1) {
         return -1;
     }
-    if (jVal.i < 0) {
-        // EOF
-        destroyLocalReference(env, jbRarray);
-        return 0;
-    } else if (jVal.i == 0) {
-        destroyLocalReference(env, jbRarray);
-        errno = EINTR;
-        return -1;
+
+    env = getJNIEnv();
+    if (env == NULL) {
+      errno = EINTERNAL;
+      return -1;
     }
-    (*env)->GetByteArrayRegion(env, jbRarray, 0, jVal.i, buffer);
-    destroyLocalReference(env, jbRarray);
-    if ((*env)->ExceptionCheck(env)) {
-        errno = printPendingExceptionAndFree(env, PRINT_EXC_ALL,
-            "hdfsPread: GetByteArrayRegion");
-        return -1;
+    while (length > 0) {
+        ret = preadImpl(env, f, position, buffer, length);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        } else if (ret == 0) {
+            fprintf(stderr, "hdfsPreadFully: end of file at position %"
+                    PRId64 " with %d bytes left to read\n", position, length);
+            errno = EIO;
+            return -1;
+        }
+        position += ret;
+        buffer = (char*)buffer + ret;
+        length -= ret;
     }
-    return jVal.i;
+    return 0;
 }
 
 tSize hdfsWrite(hdfsFS fs, hdfsFile f, const void* buffer, tSize length)
@@ -1337,8 +1425,9 @@ tSize hdfsWrite(hdfsFS fs, hdfsFile f, const void* buffer, tSize length)
             "hdfsWrite(length = %d): SetByteArrayRegion", length);
         return -1;
     }
-    jthr = invokeMethod(env, NULL, INSTANCE, jOutputStream,
-            HADOOP_OSTRM, "write", "([B)V", jbWarray);
+    static struct cachedMethod writeMeth = CACHED_METHOD_INIT(INSTANCE,
+            HADOOP_OSTRM, "write", "([B)V");
+    jthr = invokeCachedMethod(env, NULL, &writeMeth, jOutputStream, jbWarray);
     destroyLocalReference(env, jbWarray);
     if (jthr) {
         errno = printExceptionAndFree(env, jthr, PRINT_EXC_ALL,
@@ -1369,8 +1458,10 @@ int hdfsSeek(hdfsFS fs, hdfsFile f, tOffset desiredPos)
     }
 
     jobject jInputStream = f->file;
-    jthrowable jthr = invokeMethod(env, NULL, INSTANCE, jInputStream,
-            HADOOP_ISTRM, "seek", "(J)V", desiredPos);
+    static struct cachedMethod seekMeth = CACHED_METHOD_INIT(INSTANCE,
+            HADOOP_ISTRM, "seek", "(J)V");
+    jthrowable jthr = invokeCachedMethod(env, NULL, &seekMeth, jInputStream,
+            desiredPos);
     if (jthr) {
         errno = printExceptionAndFree(env, jthr, PRINT_EXC_ALL,
             "hdfsSeek(desiredPos=%" PRId64 ")"
@@ -1402,11 +1493,13 @@ tOffset hdfsTell(hdfsFS fs, hdfsFile f)
 
     //Parameters
     jobject jStream = f->file;
-    const char* interface = (f->type == INPUT) ?
-        HADOOP_ISTRM : HADOOP_OSTRM;
+    static struct cachedMethod inputGetPosMeth = CACHED_METHOD_INIT(INSTANCE,
+            HADOOP_ISTRM, "getPos", "()J");
+    static struct cachedMethod outputGetPosMeth = CACHED_METHOD_INIT(INSTANCE,
+            HADOOP_OSTRM, "getPos", "()J");
     jvalue jVal;
-    jthrowable jthr = invokeMethod(env, &jVal, INSTANCE, jStream,
-                     interface, "getPos", "()J");
+    jthrowable jthr = invokeCachedMethod(env, &jVal, (f->type == INPUT) ?
+            &inputGetPosMeth : &outputGetPosMeth, jStream);
     if (jthr) {
         errno = printExceptionAndFree(env, jthr, PRINT_EXC_ALL,
             "hdfsTell: %s#getPos",
@@ -1434,8 +1527,9 @@ int hdfsFlush(hdfsFS fs, hdfsFile f)
         errno = EBADF;
         return -1;
     }
-    jthrowable jthr = invokeMethod(env, NULL, INSTANCE, f->file, 
-                     HADOOP_OSTRM, "flush", "()V");
+    static struct cachedMethod flushMeth = CACHED_METHOD_INIT(INSTANCE,
+            HADOOP_OSTRM, "flush", "()V");
+    jthrowable jthr = invokeCachedMethod(env, NULL, &flushMeth, f->file);
     if (jthr) {
         errno = printExceptionAndFree(env, jthr, PRINT_EXC_ALL,
             "hdfsFlush: FSDataInputStream#flush");
@@ -1460,8 +1554,10 @@ int hdfsHFlush(hdfsFS fs, hdfsFile f)
     }
 
     jobject jOutputStream = f->file;
-    jthrowable jthr = invokeMethod(env, NULL, INSTANCE, jOutputStream,
-                     HADOOP_OSTRM, "hflush", "()V");
+    static struct cachedMethod hflushMeth = CACHED_METHOD_INIT(INSTANCE,
+            HADOOP_OSTRM, "hflush", "()V");
+    jthrowable jthr = invokeCachedMethod(env, NULL, &hflushMeth,
+            jOutputStream);
     if (jthr) {
         errno = printExceptionAndFree(env, jthr, PRINT_EXC_ALL,
             "hdfsHFlush: FSDataOutputStream#hflush");
@@ -1486,8 +1582,10 @@ int hdfsHSync(hdfsFS fs, hdfsFile f)
     }
 
     jobject jOutputStream = f->file;
-    jthrowable jthr = invokeMethod(env, NULL, INSTANCE, jOutputStream,
-                     HADOOP_OSTRM, "hsync", "()V");
+    static struct cachedMethod hsyncMeth = CACHED_METHOD_INIT(INSTANCE,
+            HADOOP_OSTRM, "hsync", "()V");
+    jthrowable jthr = invokeCachedMethod(env, NULL, &hsyncMeth,
+            jOutputStream);
     if (jthr) {
         errno = printExceptionAndFree(env, jthr, PRINT_EXC_ALL,
             "hdfsHSync: FSDataOutputStream#hsync");
@@ -1517,8 +1615,10 @@ int hdfsAvailable(hdfsFS fs, hdfsFile f)
     //Parameters
     jobject jInputStream = f->file;
     jvalue jVal;
-    jthrowable jthr = invokeMethod(env, &jVal, INSTANCE, jInputStream,
-                     HADOOP_ISTRM, "available", "()I");
+    static struct cachedMethod availableMeth = CACHED_METHOD_INIT(INSTANCE,
+            HADOOP_ISTRM, "available", "()I");
+    jthrowable jthr = invokeCachedMethod(env, &jVal, &availableMeth,
+            jInputStream);
     if (jthr) {
         errno = printExceptionAndFree(env, jthr, PRINT_EXC_ALL,
             "hdfsAvailable: FSDataInputStream#available");
@@ -2383,6 +2483,10 @@ done:
 struct hadoopRzBuffer* hadoopReadZero(hdfsFile file,
             struct hadoopRzOptions *opts, int32_t maxLength)
 {
+    static struct cachedMethod readMeth = CACHED_METHOD_INIT(INSTANCE,
+        HADOOP_ISTRM, "read",
+        "(Lorg/apache/hadoop/io/ByteBufferPool;ILjava/util/EnumSet;)"
+        "Ljava/nio/ByteBuffer;");
     JNIEnv *env;
     jthrowable jthr = NULL;
     jvalue jVal;
@@ -2411,9 +2515,8 @@ struct hadoopRzBuffer* hadoopReadZero(hdfsFile file,
                 "hadoopReadZero: hadoopRzOptionsGetEnumSet failed: ");
         goto done;
     }
-    jthr = invokeMethod(env, &jVal, INSTANCE, file->file, HADOOP_ISTRM, "read",
-        "(Lorg/apache/hadoop/io/ByteBufferPool;ILjava/util/EnumSet;)"
-        "Ljava/nio/ByteBuffer;", opts->byteBufferPool, maxLength, enumSet);
+    jthr = invokeCachedMethod(env, &jVal, &readMeth, file->file,
+        opts->byteBufferPool, maxLength, enumSet);
     if (jthr) {
         ret = translateZCRException(env, jthr);
         goto done;
@@ -2465,6 +2568,8 @@ const void *hadoopRzBufferGet(const struct hadoopRzBuffer *buffer)
 
 void hadoopRzBufferFree(hdfsFile file, struct hadoopRzBuffer *buffer)
 {
+    static struct cachedMethod releaseBufferMeth = CACHED_METHOD_INIT(INSTANCE,
+        HADOOP_ISTRM, "releaseBuffer", "(Ljava/nio/ByteBuffer;)V");
     jvalue jVal;
     jthrowable jthr;
     JNIEnv* env;
@@ -2475,9 +2580,8 @@ void hadoopRzBufferFree(hdfsFile file, struct hadoopRzBuffer *buffer)
         return;
     }
     if (buffer->byteBuffer) {
-        jthr = invokeMethod(env, &jVal, INSTANCE, file->file,
-                    HADOOP_ISTRM, "releaseBuffer",
-                    "(Ljava/nio/ByteBuffer;)V", buffer->byteBuffer);
+        jthr = invokeCachedMethod(env, &jVal, &releaseBufferMeth, file->file,
+                    buffer->byteBuffer);
         if (jthr) {
             printExceptionAndFree(env, jthr, PRINT_EXC_ALL,
                     "hadoopRzBufferFree: releaseBuffer failed: ");
@@ -405,6 +405,20 @@ extern  "C" {
     tSize hdfsPread(hdfsFS fs, hdfsFile file, tOffset position,
                     void* buffer, tSize length);
 
+    /**
+     * hdfsPreadFully - Positional read of exactly length bytes from an open
+     * file, which reads again until the buffer is full.
+     * @param fs The configured filesystem handle.
+     * @param file The file handle.
+     * @param position Position from which to read
+     * @param buffer The buffer to copy read bytes into.
+     * @param length The length of the buffer.
+     * @return Returns 0 on success, -1 on error.  If the file ends before
+     *         length bytes are read, errno is set to EIO.
+     */
+    int hdfsPreadFully(hdfsFS fs, hdfsFile file, tOffset position,
+                       void* buffer, tSize length);
+
 
     /** 
      * hdfsWrite - Write data into an open file.
@@ -23,9 +23,11 @@
 #include <stdio.h> 
 #include <string.h> 
 
+/**
+ * Protects additions to the class table. Lookups don't take it.
+ */
 static pthread_mutex_t hdfsHashMutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t jvmMutex = PTHREAD_MUTEX_INITIALIZER;
-static volatile int hashTableInited = 0;
 
 #define LOCK_HASH_TABLE() pthread_mutex_lock(&hdfsHashMutex)
 #define UNLOCK_HASH_TABLE() pthread_mutex_unlock(&hdfsHashMutex)
@@ -45,23 +47,46 @@ static volatile int hashTableInited = 0;
 #define JDOUBLE       'D'
 
 
+/** The number of chains in the class table */
+#define CLASS_TABLE_SIZE 256
+
 /**
- * MAX_HASH_TABLE_ELEM: The maximum no. of entries in the hashtable.
- * It's set to 4096 to account for (classNames + No. of threads)
+ * A global reference to a class, by its name.
+ *
+ * The class table is a chained hash table of these.  Entries are only ever
+ * added, at the head of a chain, and each is written completely before it is
+ * linked in.  So threads can search the table without locking while another
+ * thread adds to it.
  */
-#define MAX_HASH_TABLE_ELEM 4096
+struct classEntry {
+    struct classEntry *next;
+    jclass cls;
+    char *name;
+};
+
+static struct classEntry * volatile classTable[CLASS_TABLE_SIZE];
 
 /** Key that allows us to retrieve thread-local storage */
 static pthread_key_t gTlsKey;
 
-/** nonzero if we succeeded in initializing gTlsKey. Protected by the jvmMutex */
-static int gTlsKeyInitialized = 0;
+/** Makes sure that gTlsKey is created once */
+static pthread_once_t gTlsKeyOnce = PTHREAD_ONCE_INIT;
+
+/** The error from creating gTlsKey, or 0 if it was created */
+static int gTlsKeyError = 0;
 
 /** Pthreads thread-local storage for each library thread. */
 struct hdfsTls {
     JNIEnv *env;
+    /** A global reference to the thread's byte array, or NULL */
+    jbyteArray byteArray;
 };
 
+#ifdef HAVE_BETTER_TLS
+/** The thread's hdfsTls, which is quicker to get than with gTlsKey */
+static __thread struct hdfsTls *quickTls = NULL;
+#endif
+
 /**
  * The function that is called whenever a thread with libhdfs thread local data
  * is destroyed.
@@ -75,6 +100,12 @@ static void hdfsThreadDestructor(void *v)
     JNIEnv *env = tls->env;
     jint ret;
 
+#ifdef HAVE_BETTER_TLS
+    quickTls = NULL;
+#endif
+    if (tls->byteArray) {
+        (*env)->DeleteGlobalRef(env, tls->byteArray);
+    }
     ret = (*env)->GetJavaVM(env, &vm);
     if (ret) {
         fprintf(stderr, "hdfsThreadDestructor: GetJavaVM failed with "
@@ -138,93 +169,86 @@ jthrowable newCStr(JNIEnv *env, jstring jstr, char **out)
     return NULL;
 }
 
-static int hashTableInit(void)
+static unsigned int classTableHash(const char *className)
 {
-    if (!hashTableInited) {
-        LOCK_HASH_TABLE();
-        if (!hashTableInited) {
-            if (hcreate(MAX_HASH_TABLE_ELEM) == 0) {
-                fprintf(stderr, "error creating hashtable, <%d>: %s\n",
-                        errno, strerror(errno));
-                UNLOCK_HASH_TABLE();
-                return 0;
-            } 
-            hashTableInited = 1;
-        }
-        UNLOCK_HASH_TABLE();
+    unsigned int hash = 5381;
+
+    while (*className) {
+        hash = (hash * 33) ^ (unsigned char)*className++;
     }
-    return 1;
+    return hash % CLASS_TABLE_SIZE;
 }
 
-
-static int insertEntryIntoTable(const char *key, void *data)
+static jclass searchClassTable(struct classEntry *entry, const char *className)
 {
-    ENTRY e, *ep;
-    if (key == NULL || data == NULL) {
-        return 0;
-    }
-    if (! hashTableInit()) {
-      return -1;
+    for (; entry; entry = entry->next) {
+        if (!strcmp(entry->name, className)) {
+            return entry->cls;
+        }
     }
-    e.data = data;
-    e.key = (char*)key;
-    LOCK_HASH_TABLE();
-    ep = hsearch(e, ENTER);
-    UNLOCK_HASH_TABLE();
-    if (ep == NULL) {
-        fprintf(stderr, "warn adding key (%s) to hash table, <%d>: %s\n",
-                key, errno, strerror(errno));
-    }  
-    return 0;
+    return NULL;
 }
 
-
-
-static void* searchEntryFromTable(const char *key)
+/**
+ * Add a class to the class table, unless another thread added it first.
+ *
+ * @param className The name of the class
+ * @param cls       A global reference to the class.  It is kept by the table,
+ *                  or deleted if the table already has the class.
+ *
+ * @return          The global reference in the table, or NULL on OOM
+ */
+static jclass insertClassIntoTable(JNIEnv *env, const char *className,
+                                   jclass cls)
 {
-    ENTRY e,*ep;
-    if (key == NULL) {
+    unsigned int hash = classTableHash(className);
+    struct classEntry *entry;
+    jclass existing;
+
+    LOCK_HASH_TABLE();
+    existing = searchClassTable(classTable[hash], className);
+    if (existing) {
+        UNLOCK_HASH_TABLE();
+        (*env)->DeleteGlobalRef(env, cls);
+        return existing;
+    }
+    entry = malloc(sizeof(struct classEntry));
+    if (entry) {
+        entry->name = strdup(className);
+        if (!entry->name) {
+            free(entry);
+            entry = NULL;
+        }
+    }
+    if (!entry) {
+        UNLOCK_HASH_TABLE();
+        (*env)->DeleteGlobalRef(env, cls);
         return NULL;
     }
-    hashTableInit();
-    e.key = (char*)key;
-    LOCK_HASH_TABLE();
-    ep = hsearch(e, FIND);
+    entry->cls = cls;
+    entry->next = classTable[hash];
+    // Publish the entry only once it is complete.
+    __sync_synchronize();
+    classTable[hash] = entry;
     UNLOCK_HASH_TABLE();
-    if (ep != NULL) {
-        return ep->data;
-    }
-    return NULL;
+    return cls;
 }
 
-
-
-jthrowable invokeMethod(JNIEnv *env, jvalue *retval, MethType methType,
-                 jobject instObj, const char *className,
-                 const char *methName, const char *methSignature, ...)
+/**
+ * Call a method, given its class and method ID.
+ */
+static jthrowable invokeMethodV(JNIEnv *env, jvalue *retval, MethType methType,
+                 jobject instObj, jclass cls, jmethodID mid,
+                 const char *methSignature, va_list args)
 {
-    va_list args;
-    jclass cls;
-    jmethodID mid;
     jthrowable jthr;
     const char *str; 
     char returnType;
     
-    jthr = validateMethodType(env, methType);
-    if (jthr)
-        return jthr;
-    jthr = globalClassReference(className, env, &cls);
-    if (jthr)
-        return jthr;
-    jthr = methodIdFromClass(className, methName, methSignature, 
-                            methType, env, &mid);
-    if (jthr)
-        return jthr;
     str = methSignature;
     while (*str != ')') str++;
     str++;
     returnType = *str;
-    va_start(args, methSignature);
     if (returnType == JOBJECT || returnType == JARRAYOBJECT) {
         jobject jobj = NULL;
         if (methType == STATIC) {
@@ -283,7 +307,6 @@ jthrowable invokeMethod(JNIEnv *env, jvalue *retval, MethType methType,
         }
         retval->i = ji;
     }
-    va_end(args);
 
     jthr = (*env)->ExceptionOccurred(env);
     if (jthr) {
@@ -293,6 +316,70 @@ jthrowable invokeMethod(JNIEnv *env, jvalue *retval, MethType methType,
     return NULL;
 }
 
+jthrowable invokeMethod(JNIEnv *env, jvalue *retval, MethType methType,
+                 jobject instObj, const char *className,
+                 const char *methName, const char *methSignature, ...)
+{
+    va_list args;
+    jclass cls;
+    jmethodID mid;
+    jthrowable jthr;
+    
+    jthr = validateMethodType(env, methType);
+    if (jthr)
+        return jthr;
+    jthr = globalClassReference(className, env, &cls);
+    if (jthr)
+        return jthr;
+    jthr = methodIdFromClass(className, methName, methSignature, 
+                            methType, env, &mid);
+    if (jthr)
+        return jthr;
+    va_start(args, methSignature);
+    jthr = invokeMethodV(env, retval, methType, instObj, cls, mid,
+                         methSignature, args);
+    va_end(args);
+    return jthr;
+}
+
+jthrowable invokeCachedMethod(JNIEnv *env, jvalue *retval,
+                 struct cachedMethod *meth, jobject instObj, ...)
+{
+    va_list args;
+    jclass cls;
+    jmethodID mid;
+    jthrowable jthr;
+
+    mid = meth->mid;
+    if (mid) {
+        // Pairs with the barrier below, so that we see the class that was
+        // stored before the method ID.
+        __sync_synchronize();
+        cls = meth->cls;
+    } else {
+        // Threads that get here at the same time look up the same class and
+        // method ID, so it doesn't matter which of them stores it last.
+        jthr = validateMethodType(env, meth->methType);
+        if (jthr)
+            return jthr;
+        jthr = globalClassReference(meth->className, env, &cls);
+        if (jthr)
+            return jthr;
+        jthr = methodIdFromClass(meth->className, meth->methName,
+                meth->methSignature, meth->methType, env, &mid);
+        if (jthr)
+            return jthr;
+        meth->cls = cls;
+        __sync_synchronize();
+        meth->mid = mid;
+    }
+    va_start(args, instObj);
+    jthr = invokeMethodV(env, retval, meth->methType, instObj, cls, mid,
+                         meth->methSignature, args);
+    va_end(args);
+    return jthr;
+}
+
 jthrowable constructNewObjectOfClass(JNIEnv *env, jobject *out, const char *className, 
                                   const char *ctorSignature, ...)
 {
@@ -351,7 +438,13 @@ jthrowable methodIdFromClass(const char *className, const char *methName,
 jthrowable globalClassReference(const char *className, JNIEnv *env, jclass *out)
 {
     jclass clsLocalRef;
-    jclass cls = searchEntryFromTable(className);
+    struct classEntry *chain;
+    jclass cls;
+
+    chain = classTable[classTableHash(className)];
+    // Pairs with the barrier in insertClassIntoTable.
+    __sync_synchronize();
+    cls = searchClassTable(chain, className);
     if (cls) {
         *out = cls;
         return NULL;
@@ -366,7 +459,11 @@ jthrowable globalClassReference(const char *className, JNIEnv *env, jclass *out)
         return getPendingExceptionAndClear(env);
     }
     (*env)->DeleteLocalRef(env, clsLocalRef);
-    insertEntryIntoTable(className, cls);
+    cls = insertClassIntoTable(env, className, cls);
+    if (!cls) {
+        return newRuntimeError(env, "globalClassReference(%s): out of memory",
+                className);
+    }
     *out = cls;
     return NULL;
 }
@@ -535,6 +632,11 @@ static JNIEnv* getGlobalJNIEnv(void)
     return env;
 }
 
+static void hdfsTlsKeyInit(void)
+{
+    gTlsKeyError = pthread_key_create(&gTlsKey, hdfsThreadDestructor);
+}
+
 /**
  * getJNIEnv: A helper function to get the JNIEnv* for the given thread.
  * If no JVM exists, then one will be created. JVM command line arguments
@@ -545,11 +647,11 @@ static JNIEnv* getGlobalJNIEnv(void)
  * will detach the thread from the Java VM when the thread terminates.  If we
  * failt to do this, it will cause a memory leak.
  *
- * However, POSIX TLS is not the most efficient way to do things.  It requires a
- * key to be initialized before it can be used.  Since we don't know if this key
- * is initialized at the start of this function, we have to lock a mutex first
- * and check.  Luckily, most operating systems support the more efficient
- * __thread construct, which is initialized by the linker.
+ * The key is created once with pthread_once, so a thread that is already
+ * attached finds its JNIEnv without taking a lock.  Only attaching a thread,
+ * or creating the JVM, is done under the jvmMutex.  Most operating systems
+ * also support the more efficient __thread construct, which is initialized
+ * by the linker, and which we check before the POSIX TLS.
  *
  * @param: None.
  * @return The JNIEnv* corresponding to the thread.
@@ -561,27 +663,24 @@ JNIEnv* getJNIEnv(void)
     int ret;
 
 #ifdef HAVE_BETTER_TLS
-    static __thread struct hdfsTls *quickTls = NULL;
     if (quickTls)
         return quickTls->env;
 #endif
-    pthread_mutex_lock(&jvmMutex);
-    if (!gTlsKeyInitialized) {
-        ret = pthread_key_create(&gTlsKey, hdfsThreadDestructor);
-        if (ret) {
-            pthread_mutex_unlock(&jvmMutex);
-            fprintf(stderr, "getJNIEnv: pthread_key_create failed with "
-                "error %d\n", ret);
-            return NULL;
-        }
-        gTlsKeyInitialized = 1;
+    pthread_once(&gTlsKeyOnce, hdfsTlsKeyInit);
+    if (gTlsKeyError) {
+        fprintf(stderr, "getJNIEnv: pthread_key_create failed with "
+            "error %d\n", gTlsKeyError);
+        return NULL;
     }
     tls = pthread_getspecific(gTlsKey);
     if (tls) {
-        pthread_mutex_unlock(&jvmMutex);
+#ifdef HAVE_BETTER_TLS
+        quickTls = tls;
+#endif
         return tls->env;
     }
 
+    pthread_mutex_lock(&jvmMutex);
     env = getGlobalJNIEnv();
     pthread_mutex_unlock(&jvmMutex);
     if (!env) {
@@ -608,6 +707,35 @@ JNIEnv* getJNIEnv(void)
     return env;
 }
 
+jthrowable getThreadByteArray(JNIEnv *env, jbyteArray *out)
+{
+    struct hdfsTls *tls;
+    jbyteArray jarray;
+
+#ifdef HAVE_BETTER_TLS
+    tls = quickTls;
+#else
+    tls = pthread_getspecific(gTlsKey);
+#endif
+    if (!tls) {
+        return newRuntimeError(env, "getThreadByteArray: the thread has "
+                "no JNIEnv from getJNIEnv");
+    }
+    if (!tls->byteArray) {
+        jarray = (*env)->NewByteArray(env, THREAD_BYTE_ARRAY_LENGTH);
+        if (!jarray) {
+            return getPendingExceptionAndClear(env);
+        }
+        tls->byteArray = (*env)->NewGlobalRef(env, jarray);
+        (*env)->DeleteLocalRef(env, jarray);
+        if (!tls->byteArray) {
+            return getPendingExceptionAndClear(env);
+        }
+    }
+    *out = tls->byteArray;
+    return NULL;
+}
+
 int javaObjectIsOfClass(JNIEnv *env, jobject obj, const char *name)
 {
     jclass clazz;
@@ -88,7 +88,39 @@ jthrowable invokeMethod(JNIEnv *env, jvalue *retval, MethType methType,
                  jobject instObj, const char *className, const char *methName, 
                  const char *methSignature, ...);
 
-jthrowable constructNewObjectOfClass(JNIEnv *env, jobject *out, const char *className, 
+/**
+ * A method for invokeCachedMethod to call.  Its class and method ID are
+ * looked up by the first call, and the calls after it use them without
+ * taking any lock.  Declare a static one at each call site on a hot path,
+ * initialized with CACHED_METHOD_INIT.
+ */
+struct cachedMethod {
+    const char *className;
+    const char *methName;
+    const char *methSignature;
+    MethType methType;
+    jclass cls;
+    jmethodID mid;
+};
+
+#define CACHED_METHOD_INIT(methType, className, methName, methSignature) \
+    { className, methName, methSignature, methType, NULL, NULL }
+
+/**
+ * Invoke a method, as invokeMethod does, looking it up only once.
+ *
+ * @param env       The JNI environment
+ * @param retval    (out param) The return value of the method
+ * @param meth      The method, which caches its class and method ID
+ * @param instObj   The object to invoke an INSTANCE method on
+ * Arguments (the method arguments) must be passed after instObj
+ *
+ * @return          NULL on success; the exception otherwise
+ */
+jthrowable invokeCachedMethod(JNIEnv *env, jvalue *retval,
+                 struct cachedMethod *meth, jobject instObj, ...);
+
+jthrowable constructNewObjectOfClass(JNIEnv *env, jobject *out, const char *className,
                                   const char *ctorSignature, ...);
 
 jthrowable methodIdFromClass(const char *className, const char *methName, 
@@ -114,6 +146,22 @@ jthrowable classNameOfObject(jobject jobj, JNIEnv *env, char **name);
  * */
 JNIEnv* getJNIEnv(void);
 
+/** The length of the byte array that getThreadByteArray gives */
+#define THREAD_BYTE_ARRAY_LENGTH (64 * 1024)
+
+/**
+ * Get a byte array of THREAD_BYTE_ARRAY_LENGTH bytes that belongs to the
+ * calling thread, to read into instead of allocating a new array for each
+ * read.  The array is kept until the thread exits.
+ *
+ * @param env       The JNI environment, from getJNIEnv
+ * @param out       (out param) a global reference to the array, which the
+ *                  caller must not delete
+ *
+ * @return          NULL on success; the exception otherwise
+ */
+jthrowable getThreadByteArray(JNIEnv *env, jbyteArray *out);
+
 /**
  * Figure out if a Java object is an instance of a particular class.
  *
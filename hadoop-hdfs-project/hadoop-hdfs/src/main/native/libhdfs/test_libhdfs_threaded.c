@@ -181,6 +181,15 @@ static int doTestHdfsOperations(struct tlhThreadInfo *ti, hdfsFS fs)
     EXPECT_INT_EQ(expected, readStats->totalBytesRead);
     hdfsFileFreeReadStatistics(readStats);
     EXPECT_ZERO(memcmp(prefix, tmp, expected));
+
+    memset(tmp, 0, sizeof(tmp));
+    EXPECT_INT_EQ(expected - 1, hdfsPread(fs, file, 1, tmp, sizeof(tmp)));
+    EXPECT_ZERO(memcmp(prefix + 1, tmp, expected - 1));
+    memset(tmp, 0, sizeof(tmp));
+    EXPECT_ZERO(hdfsPreadFully(fs, file, 0, tmp, expected));
+    EXPECT_ZERO(memcmp(prefix, tmp, expected));
+    EXPECT_NEGATIVE_ONE_WITH_ERRNO(hdfsPreadFully(fs, file, 1, tmp, expected),
+                                   EIO);
     EXPECT_ZERO(hdfsCloseFile(fs, file));
 
     // TODO: Non-recursive delete should fail?
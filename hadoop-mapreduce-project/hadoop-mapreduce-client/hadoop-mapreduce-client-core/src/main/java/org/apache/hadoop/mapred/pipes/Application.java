@@ -55,6 +55,7 @@
 import org.apache.hadoop.mapreduce.security.token.JobTokenSecretManager;
 import org.apache.hadoop.security.token.Token;
 import org.apache.hadoop.util.ReflectionUtils;
+import org.apache.hadoop.util.ShutdownHookManager;
 import org.apache.hadoop.util.StringUtils;
 
 /**
@@ -72,6 +73,102 @@
   static final boolean WINDOWS
   = System.getProperty("os.name").startsWith("Windows");
 
+  public static final int SHUTDOWN_HOOK_PRIORITY = 20;
+
+  /**
+   * The child that finished the last task and is waiting for another one,
+   * if task reuse is on.
+   */
+  private static Application<?, ?, ?, ?> idleApplication = null;
+  private static boolean shutdownHookAdded = false;
+
+  /**
+   * Can the child run another task once this one is done?
+   */
+  private final boolean reusable;
+  /**
+   * Which tasks the child can run.
+   */
+  private final String reuseKey;
+  private boolean finished = false;
+
+  /**
+   * Get a child process to handle the task for us. The child that ran the
+   * last task of the same job in this JVM is reused if task reuse is on,
+   * otherwise a new one is started.
+   * @param conf the task's configuration
+   * @param recordReader the fake record reader to update progress with
+   * @param output the collector to send output to
+   * @param reporter the reporter for the task
+   * @param outputKeyClass the class of the output keys
+   * @param outputValueClass the class of the output values
+   * @return the application to run the task with
+   * @throws IOException
+   * @throws InterruptedException
+   */
+  @SuppressWarnings("unchecked")
+  static <K1 extends WritableComparable, V1 extends Writable,
+          K2 extends WritableComparable, V2 extends Writable>
+  Application<K1, V1, K2, V2> launch(JobConf conf,
+                      RecordReader<FloatWritable, NullWritable> recordReader,
+                      OutputCollector<K2,V2> output, Reporter reporter,
+                      Class<? extends K2> outputKeyClass,
+                      Class<? extends V2> outputValueClass
+                      ) throws IOException, InterruptedException {
+    Application<?, ?, ?, ?> idle;
+    synchronized (Application.class) {
+      idle = idleApplication;
+      idleApplication = null;
+    }
+    if (idle != null) {
+      if (idle.reuseKey.equals(getReuseKey(conf, outputKeyClass,
+                                           outputValueClass))) {
+        Application<K1, V1, K2, V2> result = 
+          (Application<K1, V1, K2, V2>) idle;
+        try {
+          result.restart(conf, recordReader, output, reporter);
+          return result;
+        } catch (IOException e) {
+          LOG.warn("Could not reuse the pipes child: " + 
+                   StringUtils.stringifyException(e));
+        }
+      }
+      idle.close();
+    }
+    return new Application<K1, V1, K2, V2>(conf, recordReader, output,
+                                           reporter, outputKeyClass,
+                                           outputValueClass);
+  }
+
+  /**
+   * Close the child that is waiting for another task, if there is one.
+   * @throws IOException
+   */
+  static void closeIdleApplication() throws IOException {
+    Application<?, ?, ?, ?> idle;
+    synchronized (Application.class) {
+      idle = idleApplication;
+      idleApplication = null;
+    }
+    if (idle != null) {
+      idle.close();
+    }
+  }
+
+  /**
+   * Get the key that tells whether a child can run a task. It must be the
+   * same program, running tasks of the same job with the same output types.
+   */
+  private static String getReuseKey(JobConf conf, Class<?> outputKeyClass,
+                                    Class<?> outputValueClass
+                                    ) throws IOException {
+    TaskAttemptID taskid = 
+      TaskAttemptID.forName(conf.get(MRJobConfig.TASK_ATTEMPT_ID));
+    return taskid.getJobID() + " " + conf.get(Submitter.INTERPRETOR) + " " +
+      DistributedCache.getLocalCacheFiles(conf)[0] + " " +
+      outputKeyClass.getName() + " " + outputValueClass.getName();
+  }
+
   /**
    * Start the child process to handle the task for us.
    * @param conf the task's configuration
@@ -89,6 +186,9 @@
               Class<? extends K2> outputKeyClass,
               Class<? extends V2> outputValueClass
               ) throws IOException, InterruptedException {
+    reusable = Submitter.getProtocolVersion(conf) >= 2 && 
+      Submitter.getTaskReuse(conf);
+    reuseKey = getReuseKey(conf, outputKeyClass, outputValueClass);
     serverSocket = new ServerSocket(0);
     Map<String, String> env = new HashMap<String,String>();
     // add TMPDIR environment variable with the value of java.io.tmpdir
@@ -153,6 +253,21 @@
     downlink.setJobConf(conf);
   }
 
+  /**
+   * Hand another task to the child, which has finished its last one.
+   */
+  private void restart(JobConf conf,
+                       RecordReader<FloatWritable, NullWritable> recordReader,
+                       OutputCollector<K2,V2> output, Reporter reporter
+                       ) throws IOException {
+    LOG.info("Reusing the pipes child for " + 
+             conf.get(MRJobConfig.TASK_ATTEMPT_ID));
+    finished = false;
+    handler.reset(output, reporter, recordReader);
+    downlink.reset();
+    downlink.setJobConf(conf);
+  }
+
   private String getSecurityChallenge() {
     Random rand = new Random(System.currentTimeMillis());
     //Use 4 random integers so as to have 16 random bytes.
@@ -202,7 +317,8 @@ void waitForAuthentication() throws IOException,
    */
   boolean waitForFinish() throws Throwable {
     downlink.flush();
-    return handler.waitForFinish();
+    finished = handler.waitForFinish();
+    return finished;
   }
 
   /**
@@ -229,10 +345,53 @@ void abort(Throwable t) throws IOException {
   }
   
   /**
-   * Clean up the child procress and socket.
+   * Clean up the child procress and socket. If task reuse is on and the task
+   * finished, the child is kept waiting for the next task instead.
    * @throws IOException
    */
   void cleanup() throws IOException {
+    if (reusable && finished) {
+      Application<?, ?, ?, ?> previous;
+      synchronized (Application.class) {
+        previous = idleApplication;
+        idleApplication = this;
+        if (!shutdownHookAdded) {
+          ShutdownHookManager.get().addShutdownHook(new Runnable() {
+              public void run() {
+                try {
+                  closeIdleApplication();
+                } catch (IOException e) {
+                  LOG.warn("Problem closing the pipes child: " + 
+                           StringUtils.stringifyException(e));
+                }
+              }
+            }, SHUTDOWN_HOOK_PRIORITY);
+          shutdownHookAdded = true;
+        }
+      }
+      if (previous != null) {
+        previous.close();
+      }
+      LOG.debug("Keeping the pipes child for the next task");
+    } else {
+      close();
+    }
+  }
+
+  /**
+   * Close the child's socket, which ends a child that is waiting for
+   * another task.
+   * @throws IOException
+   */
+  private void close() throws IOException {
+    if (reusable && finished) {
+      try {
+        downlink.endOfInput();
+        downlink.flush();
+      } catch (IOException e) {
+        // IGNORE cleanup problems
+      }
+    }
     serverSocket.close();
     try {
       downlink.close();
@@ -20,7 +20,10 @@
 
 import java.io.BufferedInputStream;
 import java.io.BufferedOutputStream;
+import java.io.ByteArrayInputStream;
+import java.io.DataInput;
 import java.io.DataInputStream;
+import java.io.DataOutput;
 import java.io.DataOutputStream;
 import java.io.FileOutputStream;
 import java.io.FilterOutputStream;
@@ -40,6 +43,8 @@
 import org.apache.hadoop.io.Writable;
 import org.apache.hadoop.io.WritableComparable;
 import org.apache.hadoop.io.WritableUtils;
+import org.apache.hadoop.io.compress.Lz4Codec;
+import org.apache.hadoop.io.compress.lz4.Lz4Decompressor;
 import org.apache.hadoop.mapred.InputSplit;
 import org.apache.hadoop.mapred.JobConf;
 import org.apache.hadoop.util.StringUtils;
@@ -51,14 +56,23 @@
                      K2 extends WritableComparable, V2 extends Writable>
   implements DownwardProtocol<K1, V1> {
   
-  public static final int CURRENT_PROTOCOL_VERSION = 0;
+  public static final int CURRENT_PROTOCOL_VERSION = 2;
   /**
    * The buffer size for the command socket
    */
   private static final int BUFFER_SIZE = 128*1024;
+  /**
+   * The number of bytes of map inputs collected before they are sent as one
+   * MAP_ITEMS command in protocol version 1.
+   */
+  private static final int BATCH_SIZE = 64*1024;
 
   private DataOutputStream stream;
   private DataOutputBuffer buffer = new DataOutputBuffer();
+  private final int protocolVersion;
+  private DataOutputBuffer batch = new DataOutputBuffer();
+  private int batchRecords = 0;
+  private final boolean reusable;
   private static final Log LOG = 
     LogFactory.getLog(BinaryProtocol.class.getName());
   private UplinkReaderThread uplink;
@@ -78,6 +92,8 @@ private static enum MessageType { START(0),
                                     CLOSE(8),
                                     ABORT(9),
                                     AUTHENTICATION_REQ(10),
+                                    MAP_ITEMS(11),
+                                    RESET(12),
                                     OUTPUT(50),
                                     PARTITIONED_OUTPUT(51),
                                     STATUS(52),
@@ -85,7 +101,10 @@ private static enum MessageType { START(0),
                                     DONE(54),
                                     REGISTER_COUNTER(55),
                                     INCREMENT_COUNTER(56),
-                                    AUTHENTICATION_RESP(57);
+                                    AUTHENTICATION_RESP(57),
+                                    OUTPUTS(58),
+                                    PARTITIONED_OUTPUTS(59),
+                                    COMPRESSED_OUTPUTS(60);
     final int code;
     MessageType(int code) {
       this.code = code;
@@ -95,24 +114,40 @@ private static enum MessageType { START(0),
   private static class UplinkReaderThread<K2 extends WritableComparable,
                                           V2 extends Writable>  
     extends Thread {
+
+    /**
+     * The largest batch of outputs the C++ side compresses.
+     */
+    private static final int MAX_COMPRESSED_BATCH = 256*1024;
     
     private DataInputStream inStream;
     private UpwardProtocol<K2, V2> handler;
     private K2 key;
     private V2 value;
     private boolean authPending = true;
+    private Lz4Decompressor decompressor = null;
+    private byte[] compressedBatch;
+    private byte[] uncompressedBatch;
+    /**
+     * Whether the child may run another task after it is done.
+     */
+    private final boolean reusable;
+    private volatile boolean closing = false;
     
     public UplinkReaderThread(InputStream stream,
                               UpwardProtocol<K2, V2> handler, 
-                              K2 key, V2 value) throws IOException{
+                              K2 key, V2 value,
+                              boolean reusable) throws IOException{
       inStream = new DataInputStream(new BufferedInputStream(stream, 
                                                              BUFFER_SIZE));
       this.handler = handler;
       this.key = key;
       this.value = value;
+      this.reusable = reusable;
     }
 
     public void closeConnection() throws IOException {
+      closing = true;
       inStream.close();
     }
 
@@ -132,14 +167,23 @@ public void run() {
                 + "complete. Ignoring");
             continue;
           } else if (cmd == MessageType.OUTPUT.code) {
-            readObject(key);
-            readObject(value);
+            readObject(inStream, key);
+            readObject(inStream, value);
             handler.output(key, value);
           } else if (cmd == MessageType.PARTITIONED_OUTPUT.code) {
             int part = WritableUtils.readVInt(inStream);
-            readObject(key);
-            readObject(value);
+            readObject(inStream, key);
+            readObject(inStream, value);
             handler.partitionedOutput(part, key, value);
+          } else if (cmd == MessageType.OUTPUTS.code ||
+                     cmd == MessageType.PARTITIONED_OUTPUTS.code) {
+            int records = WritableUtils.readVInt(inStream);
+            readOutputs(inStream, cmd, records);
+          } else if (cmd == MessageType.COMPRESSED_OUTPUTS.code) {
+            int batchCmd = WritableUtils.readVInt(inStream);
+            int records = WritableUtils.readVInt(inStream);
+            int length = WritableUtils.readVInt(inStream);
+            readOutputs(readCompressedBatch(length), batchCmd, records);
           } else if (cmd == MessageType.STATUS.code) {
             handler.status(Text.readString(inStream));
           } else if (cmd == MessageType.PROGRESS.code) {
@@ -156,13 +200,19 @@ public void run() {
           } else if (cmd == MessageType.DONE.code) {
             LOG.debug("Pipe child done");
             handler.done();
-            return;
+            if (!reusable) {
+              return;
+            }
           } else {
             throw new IOException("Bad command code: " + cmd);
           }
         } catch (InterruptedException e) {
           return;
         } catch (Throwable e) {
+          if (closing) {
+            // a child waiting for its next task was shut down
+            return;
+          }
           LOG.error(StringUtils.stringifyException(e));
           handler.failed(e);
           return;
@@ -170,22 +220,81 @@ public void run() {
       }
     }
     
-    private void readObject(Writable obj) throws IOException {
-      int numBytes = WritableUtils.readVInt(inStream);
+    /**
+     * Pass a batch of outputs on to the handler.
+     * @param in the stream holding the records
+     * @param cmd OUTPUTS or PARTITIONED_OUTPUTS
+     * @param records the number of records in the batch
+     * @throws IOException
+     */
+    private void readOutputs(DataInput in, int cmd, 
+                             int records) throws IOException {
+      for(int i=0; i < records; ++i) {
+        if (cmd == MessageType.PARTITIONED_OUTPUTS.code) {
+          int part = WritableUtils.readVInt(in);
+          readObject(in, key);
+          readObject(in, value);
+          handler.partitionedOutput(part, key, value);
+        } else if (cmd == MessageType.OUTPUTS.code) {
+          readObject(in, key);
+          readObject(in, value);
+          handler.output(key, value);
+        } else {
+          throw new IOException("Bad batch command code: " + cmd);
+        }
+      }
+    }
+
+    /**
+     * Read an LZ4 compressed batch of outputs from the socket.
+     * @param length the uncompressed length of the batch
+     * @return a stream over the uncompressed batch
+     * @throws IOException
+     */
+    private DataInput readCompressedBatch(int length) throws IOException {
+      int compressedLength = WritableUtils.readVInt(inStream);
+      if (length > MAX_COMPRESSED_BATCH || 
+          compressedLength > MAX_COMPRESSED_BATCH) {
+        throw new IOException("Compressed batch too large: " + length);
+      }
+      if (decompressor == null) {
+        decompressor = new Lz4Decompressor(MAX_COMPRESSED_BATCH);
+        compressedBatch = new byte[MAX_COMPRESSED_BATCH];
+        uncompressedBatch = new byte[MAX_COMPRESSED_BATCH];
+      }
+      inStream.readFully(compressedBatch, 0, compressedLength);
+      decompressor.reset();
+      decompressor.setInput(compressedBatch, 0, compressedLength);
+      int done = 0;
+      while (done < length) {
+        int n = decompressor.decompress(uncompressedBatch, done, 
+                                        length - done);
+        if (n <= 0) {
+          throw new IOException("Compressed batch is short by " + 
+                                (length - done) + " bytes");
+        }
+        done += n;
+      }
+      return new DataInputStream(new ByteArrayInputStream(uncompressedBatch, 0,
+                                                         length));
+    }
+
+    private void readObject(DataInput in, Writable obj) throws IOException {
+      int numBytes = WritableUtils.readVInt(in);
       byte[] buffer;
       // For BytesWritable and Text, use the specified length to set the length
       // this causes the "obvious" translations to work. So that if you emit
       // a string "abc" from C++, it shows up as "abc".
       if (obj instanceof BytesWritable) {
         buffer = new byte[numBytes];
-        inStream.readFully(buffer);
+        in.readFully(buffer);
         ((BytesWritable) obj).set(buffer, 0, numBytes);
       } else if (obj instanceof Text) {
         buffer = new byte[numBytes];
-        inStream.readFully(buffer);
+        in.readFully(buffer);
         ((Text) obj).set(buffer);
       } else {
-        obj.readFields(inStream);
+        obj.readFields(in);
       }
     }
   }
@@ -244,8 +353,14 @@ public BinaryProtocol(Socket sock,
     }
     stream = new DataOutputStream(new BufferedOutputStream(raw, 
                                                            BUFFER_SIZE)) ;
+    protocolVersion = Submitter.getProtocolVersion(config);
+    if (protocolVersion < 0 || protocolVersion > CURRENT_PROTOCOL_VERSION) {
+      throw new IOException("Pipes protocol version " + protocolVersion +
+                            " not supported");
+    }
+    reusable = protocolVersion >= 2 && Submitter.getTaskReuse(config);
     uplink = new UplinkReaderThread<K2, V2>(sock.getInputStream(),
-                                            handler, key, value);
+                                            handler, key, value, reusable);
     uplink.setName("pipe-uplink-handler");
     uplink.start();
   }
@@ -275,22 +390,45 @@ public void authenticate(String digest, String challenge)
   public void start() throws IOException {
     LOG.debug("starting downlink");
     WritableUtils.writeVInt(stream, MessageType.START.code);
-    WritableUtils.writeVInt(stream, CURRENT_PROTOCOL_VERSION);
+    WritableUtils.writeVInt(stream, protocolVersion);
   }
 
   public void setJobConf(JobConf job) throws IOException {
     WritableUtils.writeVInt(stream, MessageType.SET_JOB_CONF.code);
     List<String> list = new ArrayList<String>();
     for(Map.Entry<String, String> itm: job) {
-      list.add(itm.getKey());
-      list.add(itm.getValue());
+      if (!Submitter.UPLINK_COMPRESS.equals(itm.getKey())) {
+        list.add(itm.getKey());
+        list.add(itm.getValue());
+      }
     }
+    // the child is only asked to compress if we can decompress
+    list.add(Submitter.UPLINK_COMPRESS);
+    list.add(Boolean.toString(canCompressUplink(job)));
     WritableUtils.writeVInt(stream, list.size());
     for(String entry: list){
       Text.writeString(stream, entry);
     }
   }
 
+  /**
+   * Whether the outputs of a task with the given configuration can be sent
+   * compressed.
+   * @param job the task's configuration
+   * @return true if compression is asked for and will work
+   */
+  private boolean canCompressUplink(JobConf job) {
+    if (!Submitter.getCompressUplink(job) || protocolVersion < 1) {
+      return false;
+    }
+    if (!Lz4Codec.isNativeCodeLoaded()) {
+      LOG.warn(Submitter.UPLINK_COMPRESS + " is set, but the native hadoop " +
+               "library is not loaded, so outputs will not be compressed");
+      return false;
+    }
+    return true;
+  }
+
   public void setInputTypes(String keyType, 
                             String valueType) throws IOException {
     WritableUtils.writeVInt(stream, MessageType.SET_INPUT_TYPES.code);
@@ -301,16 +439,39 @@ public void setInputTypes(String keyType,
   public void runMap(InputSplit split, int numReduces, 
                      boolean pipedInput) throws IOException {
     WritableUtils.writeVInt(stream, MessageType.RUN_MAP.code);
-    writeObject(split);
+    writeObject(stream, split);
     WritableUtils.writeVInt(stream, numReduces);
     WritableUtils.writeVInt(stream, pipedInput ? 1 : 0);
   }
 
   public void mapItem(WritableComparable key, 
                       Writable value) throws IOException {
-    WritableUtils.writeVInt(stream, MessageType.MAP_ITEM.code);
-    writeObject(key);
-    writeObject(value);
+    if (protocolVersion == 0) {
+      WritableUtils.writeVInt(stream, MessageType.MAP_ITEM.code);
+      writeObject(stream, key);
+      writeObject(stream, value);
+    } else {
+      writeObject(batch, key);
+      writeObject(batch, value);
+      batchRecords += 1;
+      if (batch.getLength() >= BATCH_SIZE) {
+        flushBatch();
+      }
+    }
+  }
+
+  /**
+   * Send the map inputs collected so far as one MAP_ITEMS command.
+   * @throws IOException
+   */
+  private void flushBatch() throws IOException {
+    if (batchRecords > 0) {
+      WritableUtils.writeVInt(stream, MessageType.MAP_ITEMS.code);
+      WritableUtils.writeVInt(stream, batchRecords);
+      stream.write(batch.getData(), 0, batch.getLength());
+      batch.reset();
+      batchRecords = 0;
+    }
   }
 
   public void runReduce(int reduce, boolean pipedOutput) throws IOException {
@@ -321,25 +482,38 @@ public void runReduce(int reduce, boolean pipedOutput) throws IOException {
 
   public void reduceKey(WritableComparable key) throws IOException {
     WritableUtils.writeVInt(stream, MessageType.REDUCE_KEY.code);
-    writeObject(key);
+    writeObject(stream, key);
   }
 
   public void reduceValue(Writable value) throws IOException {
     WritableUtils.writeVInt(stream, MessageType.REDUCE_VALUE.code);
-    writeObject(value);
+    writeObject(stream, value);
   }
 
   public void endOfInput() throws IOException {
+    flushBatch();
     WritableUtils.writeVInt(stream, MessageType.CLOSE.code);
     LOG.debug("Sent close command");
   }
   
+  public void reset() throws IOException {
+    if (!reusable) {
+      throw new IOException("Pipes child can not be reused with protocol " +
+                            "version " + protocolVersion);
+    }
+    flushBatch();
+    WritableUtils.writeVInt(stream, MessageType.RESET.code);
+    LOG.debug("Sent reset command");
+  }
+
   public void abort() throws IOException {
+    flushBatch();
     WritableUtils.writeVInt(stream, MessageType.ABORT.code);
     LOG.debug("Sent abort command");
   }
 
   public void flush() throws IOException {
+    flushBatch();
     stream.flush();
   }
 
@@ -347,28 +521,30 @@ public void flush() throws IOException {
    * Write the given object to the stream. If it is a Text or BytesWritable,
    * write it directly. Otherwise, write it to a buffer and then write the
    * length and data to the stream.
+   * @param out the stream to write to
    * @param obj the object to write
    * @throws IOException
    */
-  private void writeObject(Writable obj) throws IOException {
+  private void writeObject(DataOutput out, 
+                           Writable obj) throws IOException {
     // For Text and BytesWritable, encode them directly, so that they end up
     // in C++ as the natural translations.
     if (obj instanceof Text) {
       Text t = (Text) obj;
       int len = t.getLength();
-      WritableUtils.writeVInt(stream, len);
-      stream.write(t.getBytes(), 0, len);
+      WritableUtils.writeVInt(out, len);
+      out.write(t.getBytes(), 0, len);
     } else if (obj instanceof BytesWritable) {
       BytesWritable b = (BytesWritable) obj;
       int len = b.getLength();
-      WritableUtils.writeVInt(stream, len);
-      stream.write(b.getBytes(), 0, len);
+      WritableUtils.writeVInt(out, len);
+      out.write(b.getBytes(), 0, len);
     } else {
       buffer.reset();
       obj.write(buffer);
       int length = buffer.getLength();
-      WritableUtils.writeVInt(stream, length);
-      stream.write(buffer.getData(), 0, length);
+      WritableUtils.writeVInt(out, length);
+      out.write(buffer.getData(), 0, length);
     }
   }
 }
@@ -104,6 +104,14 @@ void runMap(InputSplit split, int numReduces,
    * @throws IOException
    */
   void endOfInput() throws IOException;
+
+  /**
+   * Get a child that is done with its task ready for another one of the
+   * same job. The new task's job configuration must be sent next. This needs
+   * protocol version 2 and task reuse turned on.
+   * @throws IOException
+   */
+  void reset() throws IOException;
   
   /**
    * The task should stop as soon as possible, because something has gone wrong.
@@ -64,6 +64,27 @@ public OutputHandler(OutputCollector<K, V> collector, Reporter reporter,
     this.expectedDigest = expectedDigest;
   }
 
+  /**
+   * Get ready for another task run by the same child. This must only be
+   * called once the last task is done.
+   * @param collector the collector for the new task's output
+   * @param reporter the new task's reporter
+   * @param recordReader the new task's record reader, if the input is read
+   *   in Java
+   */
+  public synchronized void reset(OutputCollector<K, V> collector,
+                        Reporter reporter,
+                        RecordReader<FloatWritable,NullWritable> recordReader) {
+    this.collector = collector;
+    this.reporter = reporter;
+    this.recordReader = recordReader;
+    progressValue = 0.0f;
+    done = false;
+    exception = null;
+    // the child numbers its counters afresh for each task
+    registeredCounters.clear();
+  }
+
   /**
    * The task output a normal record.
    */
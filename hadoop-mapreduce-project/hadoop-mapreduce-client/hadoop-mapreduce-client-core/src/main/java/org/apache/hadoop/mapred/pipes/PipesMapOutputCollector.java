@@ -0,0 +1,492 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package org.apache.hadoop.mapred.pipes;
+
+import java.io.File;
+import java.io.IOException;
+import java.util.ArrayList;
+import java.util.Comparator;
+import java.util.List;
+import java.util.PriorityQueue;
+
+import org.apache.commons.logging.Log;
+import org.apache.commons.logging.LogFactory;
+import org.apache.hadoop.fs.FSDataOutputStream;
+import org.apache.hadoop.fs.FileSystem;
+import org.apache.hadoop.fs.LocalFileSystem;
+import org.apache.hadoop.fs.Path;
+import org.apache.hadoop.fs.RawLocalFileSystem;
+import org.apache.hadoop.io.DataInputBuffer;
+import org.apache.hadoop.io.DataOutputBuffer;
+import org.apache.hadoop.io.RawComparator;
+import org.apache.hadoop.io.compress.CompressionCodec;
+import org.apache.hadoop.io.compress.DefaultCodec;
+import org.apache.hadoop.io.serializer.SerializationFactory;
+import org.apache.hadoop.io.serializer.Serializer;
+import org.apache.hadoop.mapred.Counters;
+import org.apache.hadoop.mapred.IFile;
+import org.apache.hadoop.mapred.IndexRecord;
+import org.apache.hadoop.mapred.JobConf;
+import org.apache.hadoop.mapred.MapOutputCollector;
+import org.apache.hadoop.mapred.MapOutputFile;
+import org.apache.hadoop.mapred.MapTask;
+import org.apache.hadoop.mapred.Merger;
+import org.apache.hadoop.mapred.Merger.Segment;
+import org.apache.hadoop.mapred.RawKeyValueIterator;
+import org.apache.hadoop.mapred.SpillRecord;
+import org.apache.hadoop.mapred.Task.TaskReporter;
+import org.apache.hadoop.mapred.TaskAttemptID;
+import org.apache.hadoop.mapreduce.MRJobConfig;
+import org.apache.hadoop.mapreduce.TaskCounter;
+import org.apache.hadoop.mapreduce.TaskType;
+import org.apache.hadoop.util.Progress;
+import org.apache.hadoop.util.ReflectionUtils;
+
+/**
+ * The map output collector for Pipes jobs whose application sorts its map
+ * outputs, with mapreduce.pipes.map.sort. The outputs of each partition
+ * arrive as runs that are already sorted, so instead of sorting them again
+ * the collector only notes where each run starts, and merges the runs when
+ * it spills. A record whose key is smaller than the one before it in the
+ * same partition starts a new run, so outputs that are not sorted, or
+ * sorted in a different order than the job's output key comparator, are
+ * still written in order, just more slowly.
+ *
+ * Spills are written on the thread that collects, which holds up the
+ * application while the collector writes. Combiners are not supported.
+ */
+class PipesMapOutputCollector<K, V> implements MapOutputCollector<K, V> {
+  private static final Log LOG = 
+    LogFactory.getLog(PipesMapOutputCollector.class.getName());
+
+  // as in MapTask.MapOutputBuffer
+  private static final int APPROX_HEADER_LENGTH = 150;
+  private static final int INDEX_CACHE_MEMORY_LIMIT_DEFAULT = 1024 * 1024;
+  /**
+   * The bytes of the index kept for each record and each run.
+   */
+  private static final int RECORD_INDEX_SIZE = 12;
+  private static final int RUN_INDEX_SIZE = 4;
+
+  /**
+   * The records of one partition in the buffer, as the offsets of the key,
+   * the value and the end of each record, and the first record of each
+   * sorted run.
+   */
+  private static class Partition {
+    int[] records = new int[3 * 64];
+    int count = 0;
+    int[] runs = new int[4];
+    int runCount = 0;
+
+    void add(int keyStart, int valueStart, int end) {
+      if (3 * count == records.length) {
+        int[] bigger = new int[2 * records.length];
+        System.arraycopy(records, 0, bigger, 0, records.length);
+        records = bigger;
+      }
+      records[3 * count] = keyStart;
+      records[3 * count + 1] = valueStart;
+      records[3 * count + 2] = end;
+      count += 1;
+    }
+
+    void startRun() {
+      if (runCount == runs.length) {
+        int[] bigger = new int[2 * runs.length];
+        System.arraycopy(runs, 0, bigger, 0, runs.length);
+        runs = bigger;
+      }
+      runs[runCount++] = count;
+    }
+
+    void clear() {
+      count = 0;
+      runCount = 0;
+    }
+  }
+
+  private int partitions;
+  private JobConf job;
+  private TaskReporter reporter;
+  private Class<K> keyClass;
+  private Class<V> valClass;
+  private RawComparator<K> comparator;
+  private Serializer<K> keySerializer;
+  private Serializer<V> valSerializer;
+  private CompressionCodec codec;
+
+  private DataOutputBuffer buffer;
+  private Partition[] parts;
+  private int indexBytes = 0;
+  private int softLimit;
+  private final DataInputBuffer key = new DataInputBuffer();
+  private final DataInputBuffer value = new DataInputBuffer();
+
+  private int numSpills = 0;
+  private final List<SpillRecord> indexCacheList = 
+    new ArrayList<SpillRecord>();
+  private int totalIndexCacheMemory = 0;
+  private int indexCacheMemoryLimit;
+
+  private FileSystem rfs;
+  private TaskAttemptID mapId;
+  private MapOutputFile mapOutputFile;
+  private Progress sortPhase;
+  private Counters.Counter mapOutputByteCounter;
+  private Counters.Counter mapOutputRecordCounter;
+  private Counters.Counter fileOutputByteCounter;
+  private Counters.Counter spilledRecordsCounter;
+
+  @SuppressWarnings("unchecked")
+  public void init(MapOutputCollector.Context context
+                   ) throws IOException, ClassNotFoundException {
+    job = context.getJobConf();
+    reporter = context.getReporter();
+    MapTask mapTask = context.getMapTask();
+    mapId = mapTask.getTaskID();
+    mapOutputFile = mapTask.getMapOutputFile();
+    sortPhase = mapTask.getSortPhase();
+    partitions = job.getNumReduceTasks();
+    rfs = ((LocalFileSystem)FileSystem.getLocal(job)).getRaw();
+    if (job.getCombinerClass() != null || 
+        job.get(MRJobConfig.COMBINE_CLASS_ATTR) != null) {
+      throw new IOException(getClass().getName() + 
+                            " does not run combiners");
+    }
+
+    final float spillper =
+      job.getFloat(MRJobConfig.MAP_SORT_SPILL_PERCENT, (float)0.8);
+    final int sortmb = job.getInt(MRJobConfig.IO_SORT_MB, 100);
+    indexCacheMemoryLimit = job.getInt(MRJobConfig.INDEX_CACHE_MEMORY_LIMIT,
+                                       INDEX_CACHE_MEMORY_LIMIT_DEFAULT);
+    if (spillper > (float)1.0 || spillper <= (float)0.0) {
+      throw new IOException("Invalid \"" + MRJobConfig.MAP_SORT_SPILL_PERCENT +
+          "\": " + spillper);
+    }
+    if ((sortmb & 0x7FF) != sortmb) {
+      throw new IOException(
+          "Invalid \"" + MRJobConfig.IO_SORT_MB + "\": " + sortmb);
+    }
+    int maxMemUsage = sortmb << 20;
+    softLimit = (int)(maxMemUsage * spillper);
+    buffer = new DataOutputBuffer(maxMemUsage);
+    parts = new Partition[partitions];
+    for (int i = 0; i < partitions; ++i) {
+      parts[i] = new Partition();
+    }
+    LOG.info(MRJobConfig.IO_SORT_MB + ": " + sortmb + ", soft limit at " + 
+             softLimit);
+
+    // k/v serialization
+    comparator = job.getOutputKeyComparator();
+    keyClass = (Class<K>)job.getMapOutputKeyClass();
+    valClass = (Class<V>)job.getMapOutputValueClass();
+    SerializationFactory serializationFactory = new SerializationFactory(job);
+    keySerializer = serializationFactory.getSerializer(keyClass);
+    keySerializer.open(buffer);
+    valSerializer = serializationFactory.getSerializer(valClass);
+    valSerializer.open(buffer);
+
+    // output counters
+    mapOutputByteCounter = reporter.getCounter(TaskCounter.MAP_OUTPUT_BYTES);
+    mapOutputRecordCounter =
+      reporter.getCounter(TaskCounter.MAP_OUTPUT_RECORDS);
+    fileOutputByteCounter = reporter
+        .getCounter(TaskCounter.MAP_OUTPUT_MATERIALIZED_BYTES);
+    spilledRecordsCounter = reporter.getCounter(TaskCounter.SPILLED_RECORDS);
+
+    // compression
+    if (job.getCompressMapOutput()) {
+      Class<? extends CompressionCodec> codecClass =
+        job.getMapOutputCompressorClass(DefaultCodec.class);
+      codec = ReflectionUtils.newInstance(codecClass, job);
+    } else {
+      codec = null;
+    }
+  }
+
+  public synchronized void collect(K key, V value, int partition
+                                   ) throws IOException {
+    reporter.progress();
+    if (key.getClass() != keyClass) {
+      throw new IOException("Type mismatch in key from map: expected "
+                            + keyClass.getName() + ", received "
+                            + key.getClass().getName());
+    }
+    if (value.getClass() != valClass) {
+      throw new IOException("Type mismatch in value from map: expected "
+                            + valClass.getName() + ", received "
+                            + value.getClass().getName());
+    }
+    if (partition < 0 || partition >= partitions) {
+      throw new IOException("Illegal partition for " + key + " (" +
+          partition + ")");
+    }
+    int keyStart = buffer.getLength();
+    keySerializer.serialize(key);
+    int valueStart = buffer.getLength();
+    valSerializer.serialize(value);
+    int end = buffer.getLength();
+    mapOutputRecordCounter.increment(1);
+    mapOutputByteCounter.increment(end - keyStart);
+
+    Partition part = parts[partition];
+    if (part.count == 0 ||
+        compareKeys(part, part.count - 1, keyStart, valueStart) > 0) {
+      part.startRun();
+      indexBytes += RUN_INDEX_SIZE;
+    }
+    part.add(keyStart, valueStart, end);
+    indexBytes += RECORD_INDEX_SIZE;
+    if (buffer.getLength() + indexBytes >= softLimit) {
+      spill();
+    }
+  }
+
+  /**
+   * Compare the key of a record in the partition with the given key.
+   */
+  private int compareKeys(Partition part, int record, int keyStart,
+                          int keyEnd) {
+    byte[] data = buffer.getData();
+    int start = part.records[3 * record];
+    return comparator.compare(data, start, part.records[3 * record + 1] - start,
+                              data, keyStart, keyEnd - keyStart);
+  }
+
+  private void append(IFile.Writer<K, V> writer, Partition part,
+                      int record) throws IOException {
+    byte[] data = buffer.getData();
+    int keyStart = part.records[3 * record];
+    int valueStart = part.records[3 * record + 1];
+    key.reset(data, keyStart, valueStart - keyStart);
+    value.reset(data, valueStart, part.records[3 * record + 2] - valueStart);
+    writer.append(key, value);
+  }
+
+  /**
+   * Write the records of a partition in order, merging its runs.
+   */
+  private void writePartition(IFile.Writer<K, V> writer,
+                              final Partition part) throws IOException {
+    if (part.runCount <= 1) {
+      for (int i = 0; i < part.count; ++i) {
+        append(writer, part, i);
+      }
+      return;
+    }
+    // each entry is the next record of a run and the end of the run
+    PriorityQueue<int[]> queue = 
+      new PriorityQueue<int[]>(part.runCount, new Comparator<int[]>() {
+        public int compare(int[] a, int[] b) {
+          return compareKeys(part, a[0], part.records[3 * b[0]],
+                             part.records[3 * b[0] + 1]);
+        }
+      });
+    for (int i = 0; i < part.runCount; ++i) {
+      int end = i + 1 < part.runCount ? part.runs[i + 1] : part.count;
+      queue.add(new int[]{part.runs[i], end});
+    }
+    while (!queue.isEmpty()) {
+      int[] run = queue.poll();
+      append(writer, part, run[0]);
+      if (++run[0] < run[1]) {
+        queue.add(run);
+      }
+    }
+  }
+
+  private void spill() throws IOException {
+    long size = buffer.getLength() + partitions * APPROX_HEADER_LENGTH;
+    FSDataOutputStream out = null;
+    try {
+      final SpillRecord spillRec = new SpillRecord(partitions);
+      final Path filename =
+          mapOutputFile.getSpillFileForWrite(numSpills, size);
+      out = rfs.create(filename);
+      final IndexRecord rec = new IndexRecord();
+      for (int i = 0; i < partitions; ++i) {
+        IFile.Writer<K, V> writer = null;
+        try {
+          long segmentStart = out.getPos();
+          writer = new IFile.Writer<K, V>(job, out, keyClass, valClass, codec,
+                                          spilledRecordsCounter);
+          writePartition(writer, parts[i]);
+          writer.close();
+
+          // record offsets
+          rec.startOffset = segmentStart;
+          rec.rawLength = writer.getRawLength();
+          rec.partLength = writer.getCompressedLength();
+          spillRec.putIndex(rec, i);
+
+          writer = null;
+        } finally {
+          if (null != writer) writer.close();
+        }
+        parts[i].clear();
+      }
+
+      if (totalIndexCacheMemory >= indexCacheMemoryLimit) {
+        // create spill index file
+        Path indexFilename =
+            mapOutputFile.getSpillIndexFileForWrite(numSpills, partitions
+                * MapTask.MAP_OUTPUT_INDEX_RECORD_LENGTH);
+        spillRec.writeToFile(indexFilename, job);
+      } else {
+        indexCacheList.add(spillRec);
+        totalIndexCacheMemory +=
+          spillRec.size() * MapTask.MAP_OUTPUT_INDEX_RECORD_LENGTH;
+      }
+      LOG.info("Finished spill " + numSpills);
+      ++numSpills;
+    } finally {
+      if (out != null) out.close();
+    }
+    buffer.reset();
+    indexBytes = 0;
+  }
+
+  public synchronized void flush() throws IOException, InterruptedException,
+                                          ClassNotFoundException {
+    LOG.info("Starting flush of map output");
+    if (buffer.getLength() > 0) {
+      spill();
+    }
+    buffer = null;
+    mergeParts();
+    Path outputPath = mapOutputFile.getOutputFile();
+    fileOutputByteCounter.increment(rfs.getFileStatus(outputPath).getLen());
+  }
+
+  public void close() { }
+
+  /**
+   * Merge the spills into the map's output file, as MapOutputBuffer does.
+   */
+  private void mergeParts() throws IOException {
+    long finalOutFileSize = 0;
+    long finalIndexFileSize = 0;
+    final Path[] filename = new Path[numSpills];
+
+    for(int i = 0; i < numSpills; i++) {
+      filename[i] = mapOutputFile.getSpillFile(i);
+      finalOutFileSize += rfs.getFileStatus(filename[i]).getLen();
+    }
+    if (numSpills == 1) { //the spill is the final output
+      sameVolRename(filename[0],
+          mapOutputFile.getOutputFileForWriteInVolume(filename[0]));
+      if (indexCacheList.size() == 0) {
+        sameVolRename(mapOutputFile.getSpillIndexFile(0),
+          mapOutputFile.getOutputIndexFileForWriteInVolume(filename[0]));
+      } else {
+        indexCacheList.get(0).writeToFile(
+          mapOutputFile.getOutputIndexFileForWriteInVolume(filename[0]), job);
+      }
+      sortPhase.complete();
+      return;
+    }
+
+    // read in paged indices
+    for (int i = indexCacheList.size(); i < numSpills; ++i) {
+      Path indexFileName = mapOutputFile.getSpillIndexFile(i);
+      indexCacheList.add(new SpillRecord(indexFileName, job));
+    }
+
+    finalOutFileSize += partitions * APPROX_HEADER_LENGTH;
+    finalIndexFileSize = partitions * MapTask.MAP_OUTPUT_INDEX_RECORD_LENGTH;
+    Path finalOutputFile =
+        mapOutputFile.getOutputFileForWrite(finalOutFileSize);
+    Path finalIndexFile =
+        mapOutputFile.getOutputIndexFileForWrite(finalIndexFileSize);
+    FSDataOutputStream finalOut = rfs.create(finalOutputFile, true, 4096);
+    try {
+      if (numSpills > 0) {
+        sortPhase.addPhases(partitions);
+      }
+      IndexRecord rec = new IndexRecord();
+      final SpillRecord spillRec = new SpillRecord(partitions);
+      int mergeFactor = job.getInt(MRJobConfig.IO_SORT_FACTOR, 100);
+      for (int parts = 0; parts < partitions; parts++) {
+        long segmentStart = finalOut.getPos();
+        IFile.Writer<K, V> writer =
+          new IFile.Writer<K, V>(job, finalOut, keyClass, valClass, codec,
+                                 numSpills > 0 ? spilledRecordsCounter : null);
+        if (numSpills > 0) {
+          List<Segment<K,V>> segmentList =
+            new ArrayList<Segment<K, V>>(numSpills);
+          for(int i = 0; i < numSpills; i++) {
+            IndexRecord indexRecord = indexCacheList.get(i).getIndex(parts);
+            segmentList.add(new Segment<K,V>(job, rfs, filename[i],
+                                             indexRecord.startOffset,
+                                             indexRecord.partLength, codec,
+                                             true));
+          }
+          // sort the segments only if there are intermediate merges
+          boolean sortSegments = segmentList.size() > mergeFactor;
+          RawKeyValueIterator kvIter = Merger.merge(job, rfs,
+                         keyClass, valClass, codec,
+                         segmentList, mergeFactor,
+                         new Path(mapId.toString()),
+                         comparator, reporter, sortSegments,
+                         null, spilledRecordsCounter, sortPhase.phase(),
+                         TaskType.MAP);
+          Merger.writeFile(kvIter, writer, reporter, job);
+          sortPhase.startNextPhase();
+        }
+        writer.close();
+
+        // record offsets
+        rec.startOffset = segmentStart;
+        rec.rawLength = writer.getRawLength();
+        rec.partLength = writer.getCompressedLength();
+        spillRec.putIndex(rec, parts);
+      }
+      spillRec.writeToFile(finalIndexFile, job);
+    } finally {
+      finalOut.close();
+    }
+    if (numSpills == 0) {
+      sortPhase.complete();
+    }
+    for(int i = 0; i < numSpills; i++) {
+      rfs.delete(filename[i],true);
+    }
+  }
+
+  /**
+   * Rename srcPath to dstPath on the same volume, as MapOutputBuffer does.
+   */
+  private void sameVolRename(Path srcPath,
+      Path dstPath) throws IOException {
+    RawLocalFileSystem rfs = (RawLocalFileSystem)this.rfs;
+    File src = rfs.pathToFile(srcPath);
+    File dst = rfs.pathToFile(dstPath);
+    if (!dst.getParentFile().exists()) {
+      if (!dst.getParentFile().mkdirs()) {
+        throw new IOException("Unable to rename " + src + " to "
+            + dst + ": couldn't create parent directory"); 
+      }
+    }
+    if (!src.renameTo(dst)) {
+      throw new IOException("Unable to rename " + src + " to " + dst);
+    }
+  }
+}
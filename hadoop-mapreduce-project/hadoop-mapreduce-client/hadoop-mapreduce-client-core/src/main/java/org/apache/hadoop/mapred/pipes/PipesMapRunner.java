@@ -66,8 +66,7 @@ public void run(RecordReader<K1, V1> input, OutputCollector<K2, V2> output,
         (!Submitter.getIsJavaRecordReader(job) && 
          !Submitter.getIsJavaMapper(job)) ? 
 	  (RecordReader<FloatWritable, NullWritable>) input : null;
-      application = new Application<K1, V1, K2, V2>(job, fakeInput, output, 
-                                                    reporter,
+      application = Application.launch(job, fakeInput, output, reporter,
           (Class<? extends K2>) job.getOutputKeyClass(), 
           (Class<? extends V2>) job.getOutputValueClass());
     } catch (InterruptedException ie) {
@@ -79,9 +79,7 @@ private void startApplication(OutputCollector<K3, V3> output, Reporter reporter)
     if (application == null) {
       try {
         LOG.info("starting application");
-        application = 
-          new Application<K2, V2, K3, V3>(
-              job, null, output, reporter, 
+        application = Application.launch(job, null, output, reporter,
               (Class<? extends K3>) job.getOutputKeyClass(), 
               (Class<? extends V3>) job.getOutputValueClass());
         downlink = application.getDownlink();
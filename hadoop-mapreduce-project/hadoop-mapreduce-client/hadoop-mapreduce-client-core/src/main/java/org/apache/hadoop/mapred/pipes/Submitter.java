@@ -83,6 +83,12 @@ public class Submitter extends Configured implements Tool {
   public static final String PARTITIONER = "mapreduce.pipes.partitioner";
   public static final String INPUT_FORMAT = "mapreduce.pipes.inputformat";
   public static final String PORT = "mapreduce.pipes.command.port";
+  public static final String PROTOCOL_VERSION = 
+    "mapreduce.pipes.protocol.version";
+  public static final String UPLINK_COMPRESS = 
+    "mapreduce.pipes.uplink.compress";
+  public static final String TASK_REUSE = "mapreduce.pipes.task.reuse";
+  public static final String MAP_SORT = "mapreduce.pipes.map.sort";
   
   public Submitter() {
     this(new Configuration());
@@ -241,6 +247,89 @@ public static void setKeepCommandFile(JobConf conf, boolean keep) {
     conf.setBoolean(Submitter.PRESERVE_COMMANDFILE, keep);
   }
 
+  /**
+   * Get the version of the binary protocol to speak to the application.
+   * Version 1 sends map inputs and outputs in batches of records, but needs
+   * an application built against a library that understands it. Version 2
+   * can also run several tasks of a job through one application process.
+   * @param conf the configuration to check
+   * @return the protocol version, 0 by default
+   */
+  public static int getProtocolVersion(JobConf conf) {
+    return conf.getInt(Submitter.PROTOCOL_VERSION, 0);
+  }
+
+  /**
+   * Set the version of the binary protocol to speak to the application.
+   * @param conf the configuration to modify
+   * @param version the new protocol version
+   */
+  public static void setProtocolVersion(JobConf conf, int version) {
+    conf.setInt(Submitter.PROTOCOL_VERSION, version);
+  }
+
+  /**
+   * Does the application compress its batches of outputs with LZ4? This
+   * needs protocol version 1 and the native hadoop library. Without the
+   * library the outputs are sent uncompressed.
+   * @param conf the configuration to check
+   * @return are the outputs compressed?
+   */
+  public static boolean getCompressUplink(JobConf conf) {
+    return conf.getBoolean(Submitter.UPLINK_COMPRESS, false);
+  }
+
+  /**
+   * Set whether the application compresses its batches of outputs.
+   * @param conf the configuration to modify
+   * @param compress the new value
+   */
+  public static void setCompressUplink(JobConf conf, boolean compress) {
+    conf.setBoolean(Submitter.UPLINK_COMPRESS, compress);
+  }
+
+  /**
+   * Is the application process kept for the next task of the job that runs
+   * in the same JVM, as with uber tasks? This needs protocol version 2. The
+   * output of later tasks goes to the logs of the task that started the
+   * process.
+   * @param conf the configuration to check
+   * @return is the process reused?
+   */
+  public static boolean getTaskReuse(JobConf conf) {
+    return conf.getBoolean(Submitter.TASK_REUSE, false);
+  }
+
+  /**
+   * Set whether the application process is reused for later tasks.
+   * @param conf the configuration to modify
+   * @param reuse the new value
+   */
+  public static void setTaskReuse(JobConf conf, boolean reuse) {
+    conf.setBoolean(Submitter.TASK_REUSE, reuse);
+  }
+
+  /**
+   * Does the application sort its map outputs by partition and key? If the
+   * job has reduces and no combiner, the task then merges the sorted outputs
+   * instead of sorting them again. The application sorts by the raw bytes
+   * of the keys, which is the order of Text and BytesWritable keys.
+   * @param conf the configuration to check
+   * @return are the map outputs sorted by the application?
+   */
+  public static boolean getMapSort(JobConf conf) {
+    return conf.getBoolean(Submitter.MAP_SORT, false);
+  }
+
+  /**
+   * Set whether the application sorts its map outputs.
+   * @param conf the configuration to modify
+   * @param sort the new value
+   */
+  public static void setMapSort(JobConf conf, boolean sort) {
+    conf.setBoolean(Submitter.MAP_SORT, sort);
+  }
+
   /**
    * Submit a job to the map/reduce cluster. All of the necessary modifications
    * to the job to run under pipes are made to the configuration.
@@ -286,6 +375,13 @@ private static void setupPipesJob(JobConf conf) throws IOException {
       // Save the user's partitioner and hook in our's.
       setJavaPartitioner(conf, conf.getPartitionerClass());
       conf.setPartitionerClass(PipesPartitioner.class);
+      // merge the runs of an application that sorts its outputs
+      if (getMapSort(conf) && conf.getNumReduceTasks() > 0 &&
+          conf.getCombinerClass() == null && 
+          conf.get(MRJobConfig.COMBINE_CLASS_ATTR) == null) {
+        setIfUnset(conf, MRJobConfig.MAP_OUTPUT_COLLECTOR_CLASS_ATTR,
+                   PipesMapOutputCollector.class.getName());
+      }
     }
     if (!getIsJavaReducer(conf)) {
       conf.setReducerClass(PipesReducer.class);
@@ -0,0 +1,122 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package org.apache.hadoop.mapred.pipes;
+
+import java.io.IOException;
+
+import org.apache.hadoop.io.FloatWritable;
+import org.apache.hadoop.io.IntWritable;
+import org.apache.hadoop.io.NullWritable;
+import org.apache.hadoop.io.Text;
+import org.apache.hadoop.io.WritableUtils;
+
+/*
+ Stub for the task reuse test in TestPipeApplication. It runs map tasks until
+ it is told to close between tasks, and outputs the number of each task and
+ the number of records it read.
+ */
+
+public class PipeApplicationReuseStub extends CommonStub {
+
+  public static void main(String[] args) {
+    PipeApplicationReuseStub client = new PipeApplicationReuseStub();
+    client.binaryProtocolStub();
+  }
+
+  public void binaryProtocolStub() {
+    try {
+
+      initSoket();
+      int task = 0;
+      int cmd;
+      do {
+        task += 1;
+        int records = runTask();
+        System.out.println("task " + task + " records:" + records);
+
+        // OUTPUT
+        WritableUtils.writeVInt(dataOut, 50);
+        writeObject(new IntWritable(task), dataOut);
+        writeObject(new Text("records:" + records), dataOut);
+        // DONE
+        WritableUtils.writeVInt(dataOut, 54);
+        dataOut.flush();
+
+        // RESET or CLOSE
+        cmd = WritableUtils.readVInt(dataInput);
+        if (cmd == 12) {
+          readJobConf();
+        }
+      } while (cmd == 12);
+      System.out.println("tasks:" + task);
+
+      dataOut.close();
+
+    } catch (Exception x) {
+      x.printStackTrace();
+    } finally {
+      closeSoket();
+    }
+
+  }
+
+  /**
+   * Read the commands of a map task up to CLOSE.
+   * @return the number of map inputs
+   */
+  private int runTask() throws IOException {
+    int records = 0;
+    while (true) {
+      int cmd = WritableUtils.readVInt(dataInput);
+      if (cmd == 3) {
+        // RUN_MAP
+        readObject(new TestPipeApplication.FakeSplit(), dataInput);
+        WritableUtils.readVInt(dataInput);
+        WritableUtils.readVInt(dataInput);
+      } else if (cmd == 2) {
+        // SET_INPUT_TYPES
+        Text.readString(dataInput);
+        Text.readString(dataInput);
+      } else if (cmd == 4 || cmd == 11) {
+        // MAP_ITEM or MAP_ITEMS
+        int items = cmd == 4 ? 1 : WritableUtils.readVInt(dataInput);
+        for (int i = 0; i < items; ++i) {
+          readObject(new FloatWritable(), dataInput);
+          readObject(NullWritable.get(), dataInput);
+          records += 1;
+        }
+      } else if (cmd == 8) {
+        // CLOSE
+        return records;
+      } else {
+        throw new IOException("Unexpected command " + cmd);
+      }
+    }
+  }
+
+  private void readJobConf() throws IOException {
+    // should be MessageType.SET_JOB_CONF.code
+    WritableUtils.readVInt(dataInput);
+    int j = WritableUtils.readVInt(dataInput);
+    for (int i = 0; i < j; i += 2) {
+      Text.readString(dataInput);
+      Text.readString(dataInput);
+    }
+  }
+}
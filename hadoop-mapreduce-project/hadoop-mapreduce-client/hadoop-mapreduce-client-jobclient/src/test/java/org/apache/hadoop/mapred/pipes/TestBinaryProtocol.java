@@ -0,0 +1,363 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package org.apache.hadoop.mapred.pipes;
+
+import java.io.BufferedOutputStream;
+import java.io.DataInputStream;
+import java.io.DataOutputStream;
+import java.io.IOException;
+import java.net.InetAddress;
+import java.net.ServerSocket;
+import java.net.Socket;
+import java.util.ArrayList;
+import java.util.Arrays;
+import java.util.List;
+
+import org.apache.hadoop.io.DataOutputBuffer;
+import org.apache.hadoop.io.Text;
+import org.apache.hadoop.io.WritableUtils;
+import org.apache.hadoop.io.compress.Lz4Codec;
+import org.apache.hadoop.io.compress.lz4.Lz4Compressor;
+import org.apache.hadoop.mapred.JobConf;
+import org.junit.After;
+import org.junit.Assume;
+import org.junit.Before;
+import org.junit.Test;
+
+import static org.junit.Assert.*;
+
+/**
+ * Test the framing of the binary protocol by playing the part of the C++
+ * child on the other end of a socket.
+ */
+public class TestBinaryProtocol {
+  // the message codes, which must match BinaryProtocol.MessageType
+  private static final int START = 0;
+  private static final int SET_JOB_CONF = 1;
+  private static final int MAP_ITEMS = 11;
+  private static final int RESET = 12;
+  private static final int DONE = 54;
+  private static final int AUTHENTICATION_RESP = 57;
+  private static final int OUTPUTS = 58;
+  private static final int PARTITIONED_OUTPUTS = 59;
+  private static final int COMPRESSED_OUTPUTS = 60;
+
+  private ServerSocket server;
+  private Socket javaSide;
+  private Socket childSide;
+  private DataInputStream childIn;
+  private DataOutputStream childOut;
+
+  @Before
+  public void setUp() throws IOException {
+    server = new ServerSocket(0);
+    childSide = new Socket(InetAddress.getByName("127.0.0.1"),
+                           server.getLocalPort());
+    javaSide = server.accept();
+    childIn = new DataInputStream(childSide.getInputStream());
+    childOut = new DataOutputStream(
+                 new BufferedOutputStream(childSide.getOutputStream()));
+  }
+
+  @After
+  public void tearDown() throws IOException {
+    childSide.close();
+    javaSide.close();
+    server.close();
+  }
+
+  /**
+   * Records what the child sends up.
+   */
+  static class RecordingHandler implements UpwardProtocol<Text, Text> {
+    final List<String> records = new ArrayList<String>();
+    private boolean done = false;
+    private Throwable failure = null;
+
+    public void output(Text key, Text value) {
+      records.add(key + "\t" + value);
+    }
+
+    public void partitionedOutput(int reduce, Text key, Text value) {
+      records.add(reduce + ":" + key + "\t" + value);
+    }
+
+    public void status(String msg) {
+    }
+
+    public void progress(float progress) {
+    }
+
+    public synchronized void done() {
+      done = true;
+      notifyAll();
+    }
+
+    public synchronized void failed(Throwable e) {
+      failure = e;
+      notifyAll();
+    }
+
+    public void registerCounter(int id, String group, String name) {
+    }
+
+    public void incrementCounter(int id, long amount) {
+    }
+
+    public boolean authenticate(String digest) {
+      return true;
+    }
+
+    synchronized void reset() {
+      done = false;
+    }
+
+    synchronized void waitForDone() throws Throwable {
+      while (!done && failure == null) {
+        wait();
+      }
+      if (failure != null) {
+        throw failure;
+      }
+    }
+  }
+
+  private BinaryProtocol<Text, Text, Text, Text> createProtocol(
+      JobConf conf, RecordingHandler handler) throws IOException {
+    return new BinaryProtocol<Text, Text, Text, Text>(javaSide, handler,
+                                                      new Text(), new Text(),
+                                                      conf);
+  }
+
+  private static String repeat(char c, int length) {
+    char[] chars = new char[length];
+    Arrays.fill(chars, c);
+    return new String(chars);
+  }
+
+  /**
+   * Read a Text or BytesWritable as the C++ side sees it.
+   */
+  private String readRecordField() throws IOException {
+    return Text.readString(childIn);
+  }
+
+  /**
+   * Write a record as the C++ side does.
+   */
+  private void writeRecord(String key, String value) throws IOException {
+    Text.writeString(childOut, key);
+    Text.writeString(childOut, value);
+  }
+
+  @Test (timeout=30000)
+  public void testVersionHandshake() throws Exception {
+    JobConf conf = new JobConf(false);
+    Submitter.setProtocolVersion(conf,
+                                 BinaryProtocol.CURRENT_PROTOCOL_VERSION + 1);
+    try {
+      createProtocol(conf, new RecordingHandler());
+      fail("an unknown protocol version was accepted");
+    } catch (IOException e) {
+      assertTrue(e.getMessage().contains("not supported"));
+    }
+
+    Submitter.setProtocolVersion(conf, 1);
+    BinaryProtocol<Text, Text, Text, Text> protocol =
+      createProtocol(conf, new RecordingHandler());
+    protocol.start();
+    protocol.flush();
+    assertEquals(START, WritableUtils.readVInt(childIn));
+    assertEquals(1, WritableUtils.readVInt(childIn));
+    protocol.close();
+  }
+
+  /**
+   * Each record is exactly 1 KB on the wire, so 64 of them fill a batch and
+   * the 65th starts the next one.
+   */
+  @Test (timeout=30000)
+  public void testMapItemsBatchBoundary() throws Exception {
+    JobConf conf = new JobConf(false);
+    Submitter.setProtocolVersion(conf, 1);
+    BinaryProtocol<Text, Text, Text, Text> protocol =
+      createProtocol(conf, new RecordingHandler());
+    // 1 + 20 bytes of key and 3 + 1000 bytes of value
+    Text value = new Text(repeat('v', 1000));
+    for(int i=0; i < 65; ++i) {
+      protocol.mapItem(new Text(String.format("key-%016d", i)), value);
+    }
+    protocol.flush();
+
+    assertEquals(MAP_ITEMS, WritableUtils.readVInt(childIn));
+    assertEquals(64, WritableUtils.readVInt(childIn));
+    for(int i=0; i < 64; ++i) {
+      assertEquals(String.format("key-%016d", i), readRecordField());
+      assertEquals(value.toString(), readRecordField());
+    }
+    assertEquals(MAP_ITEMS, WritableUtils.readVInt(childIn));
+    assertEquals(1, WritableUtils.readVInt(childIn));
+    assertEquals(String.format("key-%016d", 64), readRecordField());
+    assertEquals(value.toString(), readRecordField());
+    assertEquals(0, childIn.available());
+    protocol.close();
+  }
+
+  @Test (timeout=30000)
+  public void testBatchedOutputs() throws Throwable {
+    JobConf conf = new JobConf(false);
+    Submitter.setProtocolVersion(conf, 1);
+    RecordingHandler handler = new RecordingHandler();
+    BinaryProtocol<Text, Text, Text, Text> protocol =
+      createProtocol(conf, handler);
+
+    WritableUtils.writeVInt(childOut, AUTHENTICATION_RESP);
+    Text.writeString(childOut, "digest");
+    WritableUtils.writeVInt(childOut, OUTPUTS);
+    WritableUtils.writeVInt(childOut, 2);
+    writeRecord("a", "1");
+    writeRecord("b", "2");
+    WritableUtils.writeVInt(childOut, PARTITIONED_OUTPUTS);
+    WritableUtils.writeVInt(childOut, 2);
+    WritableUtils.writeVInt(childOut, 1);
+    writeRecord("c", "3");
+    WritableUtils.writeVInt(childOut, 0);
+    writeRecord("d", "4");
+    WritableUtils.writeVInt(childOut, DONE);
+    childOut.flush();
+
+    handler.waitForDone();
+    assertEquals(Arrays.asList("a\t1", "b\t2", "1:c\t3", "0:d\t4"),
+                 handler.records);
+    protocol.close();
+  }
+
+  /**
+   * A reusable child goes on sending messages after it is done with a task.
+   */
+  @Test (timeout=30000)
+  public void testReset() throws Throwable {
+    JobConf conf = new JobConf(false);
+    Submitter.setProtocolVersion(conf, 2);
+    Submitter.setTaskReuse(conf, true);
+    RecordingHandler handler = new RecordingHandler();
+    BinaryProtocol<Text, Text, Text, Text> protocol =
+      createProtocol(conf, handler);
+
+    WritableUtils.writeVInt(childOut, AUTHENTICATION_RESP);
+    Text.writeString(childOut, "digest");
+    WritableUtils.writeVInt(childOut, OUTPUTS);
+    WritableUtils.writeVInt(childOut, 1);
+    writeRecord("first", "1");
+    WritableUtils.writeVInt(childOut, DONE);
+    childOut.flush();
+    handler.waitForDone();
+
+    handler.reset();
+    protocol.reset();
+    protocol.flush();
+    assertEquals(RESET, WritableUtils.readVInt(childIn));
+
+    WritableUtils.writeVInt(childOut, OUTPUTS);
+    WritableUtils.writeVInt(childOut, 1);
+    writeRecord("second", "2");
+    WritableUtils.writeVInt(childOut, DONE);
+    childOut.flush();
+    handler.waitForDone();
+    assertEquals(Arrays.asList("first\t1", "second\t2"), handler.records);
+    protocol.close();
+  }
+
+  /**
+   * The child is only asked to compress its outputs when they can be
+   * decompressed here.
+   */
+  @Test (timeout=30000)
+  public void testUplinkCompressionNeedsNativeCode() throws Exception {
+    JobConf conf = new JobConf(false);
+    Submitter.setProtocolVersion(conf, 1);
+    Submitter.setCompressUplink(conf, true);
+    BinaryProtocol<Text, Text, Text, Text> protocol =
+      createProtocol(conf, new RecordingHandler());
+    protocol.setJobConf(conf);
+    protocol.flush();
+    assertEquals(SET_JOB_CONF, WritableUtils.readVInt(childIn));
+    int entries = WritableUtils.readVInt(childIn);
+    String compress = null;
+    for(int i=0; i < entries; i += 2) {
+      String key = Text.readString(childIn);
+      String value = Text.readString(childIn);
+      if (Submitter.UPLINK_COMPRESS.equals(key)) {
+        assertNull("compression was sent twice", compress);
+        compress = value;
+      }
+    }
+    assertEquals(Boolean.toString(Lz4Codec.isNativeCodeLoaded()), compress);
+    protocol.close();
+  }
+
+  @Test (timeout=30000)
+  public void testCompressedOutputs() throws Throwable {
+    Assume.assumeTrue(Lz4Codec.isNativeCodeLoaded());
+    JobConf conf = new JobConf(false);
+    Submitter.setProtocolVersion(conf, 1);
+    RecordingHandler handler = new RecordingHandler();
+    BinaryProtocol<Text, Text, Text, Text> protocol =
+      createProtocol(conf, handler);
+
+    // a batch of partitioned outputs, compressed as the C++ side does it
+    DataOutputBuffer batch = new DataOutputBuffer();
+    List<String> expected = new ArrayList<String>();
+    String value = repeat('v', 100);
+    for(int i=0; i < 500; ++i) {
+      WritableUtils.writeVInt(batch, i % 3);
+      Text.writeString(batch, "key" + i);
+      Text.writeString(batch, value);
+      expected.add((i % 3) + ":key" + i + "\t" + value);
+    }
+    Lz4Compressor compressor = new Lz4Compressor(256 * 1024);
+    compressor.setInput(batch.getData(), 0, batch.getLength());
+    compressor.finish();
+    byte[] compressed = new byte[256 * 1024];
+    int compressedLength = compressor.compress(compressed, 0,
+                                               compressed.length);
+    assertTrue(compressor.finished());
+    assertTrue(compressedLength < batch.getLength());
+
+    WritableUtils.writeVInt(childOut, AUTHENTICATION_RESP);
+    Text.writeString(childOut, "digest");
+    WritableUtils.writeVInt(childOut, COMPRESSED_OUTPUTS);
+    WritableUtils.writeVInt(childOut, PARTITIONED_OUTPUTS);
+    WritableUtils.writeVInt(childOut, 500);
+    WritableUtils.writeVInt(childOut, batch.getLength());
+    WritableUtils.writeVInt(childOut, compressedLength);
+    childOut.write(compressed, 0, compressedLength);
+    // an uncompressed batch may follow a compressed one
+    WritableUtils.writeVInt(childOut, OUTPUTS);
+    WritableUtils.writeVInt(childOut, 1);
+    writeRecord("last", "1");
+    WritableUtils.writeVInt(childOut, DONE);
+    childOut.flush();
+
+    handler.waitForDone();
+    expected.add("last\t1");
+    assertEquals(expected, handler.records);
+    protocol.close();
+  }
+}
@@ -143,6 +143,71 @@ public void testRunner() throws Exception {
     }
   }
 
+  /**
+   * test that two map tasks of a job run through one child when task reuse
+   * is on
+   *
+   * @throws Exception
+   */
+  @Test
+  public void testTaskReuse() throws Exception {
+    File[] psw = cleanTokenPasswordFile();
+    try {
+      File fCommand = getFileCommand("org.apache.hadoop.mapred.pipes.PipeApplicationReuseStub");
+      Token<AMRMTokenIdentifier> token = new Token<AMRMTokenIdentifier>(
+              "user".getBytes(), "password".getBytes(), new Text("kind"), new Text(
+              "service"));
+      JobConf firstConf = null;
+      for (int task = 1; task <= 2; task++) {
+        JobConf conf = new JobConf();
+        conf.set(Submitter.IS_JAVA_RR, "true");
+        conf.set(MRJobConfig.TASK_ATTEMPT_ID,
+                "attempt_001_0002_m_00000" + task + "_0");
+        conf.set(MRJobConfig.CACHE_LOCALFILES, fCommand.getAbsolutePath());
+        Submitter.setProtocolVersion(conf, 2);
+        Submitter.setTaskReuse(conf, true);
+        TokenCache.setJobToken(token, conf.getCredentials());
+        if (firstConf == null) {
+          // the child writes to the logs of the task that started it
+          firstConf = conf;
+          initStdOut(conf);
+          TaskAttemptID taskId = TaskAttemptID.forName(conf
+                  .get(MRJobConfig.TASK_ATTEMPT_ID));
+          TaskLog.getTaskLogFile(taskId, false, TaskLog.LogName.STDOUT).delete();
+        }
+
+        final List<String> outputs = new ArrayList<String>();
+        OutputCollector<IntWritable, Text> output = new OutputCollector<IntWritable, Text>() {
+          public void collect(IntWritable key, Text value) {
+            outputs.add(key + "\t" + value);
+          }
+        };
+        PipesMapRunner<FloatWritable, NullWritable, IntWritable, Text> runner = new PipesMapRunner<FloatWritable, NullWritable, IntWritable, Text>();
+        runner.configure(conf);
+        runner.run(new ReaderPipesMapRunner(), output, new TestTaskReporter());
+
+        // the child counts the tasks it has run
+        assertEquals(1, outputs.size());
+        assertEquals(task + "\trecords:10", outputs.get(0));
+      }
+      Application.closeIdleApplication();
+
+      String stdOut = readStdOut(firstConf);
+      assertEquals(stdOut.indexOf("CURRENT_PROTOCOL_VERSION:2"),
+              stdOut.lastIndexOf("CURRENT_PROTOCOL_VERSION:2"));
+      assertTrue(stdOut.contains("CURRENT_PROTOCOL_VERSION:2"));
+      assertTrue(stdOut.contains("task 1 records:10"));
+      assertTrue(stdOut.contains("task 2 records:10"));
+    } finally {
+      if (psw != null) {
+        // remove password files
+        for (File file : psw) {
+          file.deleteOnExit();
+        }
+      }
+    }
+  }
+
   /**
    * test org.apache.hadoop.mapred.pipes.Application
    * test a internal functions: MessageType.REGISTER_COUNTER,  INCREMENT_COUNTER, STATUS, PROGRESS...
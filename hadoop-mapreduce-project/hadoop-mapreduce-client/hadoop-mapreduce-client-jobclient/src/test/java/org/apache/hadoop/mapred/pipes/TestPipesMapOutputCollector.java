@@ -0,0 +1,203 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package org.apache.hadoop.mapred.pipes;
+
+import java.io.File;
+import java.io.IOException;
+import java.util.ArrayList;
+import java.util.Collections;
+import java.util.List;
+import java.util.Random;
+
+import org.apache.hadoop.fs.FSDataInputStream;
+import org.apache.hadoop.fs.FileSystem;
+import org.apache.hadoop.fs.FileUtil;
+import org.apache.hadoop.fs.Path;
+import org.apache.hadoop.io.DataInputBuffer;
+import org.apache.hadoop.io.Text;
+import org.apache.hadoop.mapred.Counters;
+import org.apache.hadoop.mapred.IFile;
+import org.apache.hadoop.mapred.IndexRecord;
+import org.apache.hadoop.mapred.JobConf;
+import org.apache.hadoop.mapred.MROutputFiles;
+import org.apache.hadoop.mapred.MapOutputCollector;
+import org.apache.hadoop.mapred.MapOutputFile;
+import org.apache.hadoop.mapred.MapTask;
+import org.apache.hadoop.mapred.SpillRecord;
+import org.apache.hadoop.mapred.Task.TaskReporter;
+import org.apache.hadoop.mapred.TaskAttemptID;
+import org.apache.hadoop.mapreduce.MRConfig;
+import org.apache.hadoop.mapreduce.MRJobConfig;
+import org.apache.hadoop.mapreduce.TaskCounter;
+import org.apache.hadoop.util.Progress;
+import org.junit.After;
+import org.junit.Before;
+import org.junit.Test;
+
+import static org.junit.Assert.*;
+import static org.mockito.Mockito.mock;
+import static org.mockito.Mockito.when;
+
+/**
+ * Test that the collector for sorted Pipes map outputs writes each
+ * partition in order, whether or not the outputs arrive sorted.
+ */
+public class TestPipesMapOutputCollector {
+  private static final int PARTITIONS = 3;
+  private static final File workSpace = new File("target",
+      TestPipesMapOutputCollector.class.getName() + "-workSpace");
+
+  private JobConf job;
+  private MapOutputFile mapOutputFile;
+  private Counters counters;
+  private PipesMapOutputCollector<Text, Text> collector;
+
+  @Before
+  public void setUp() throws Exception {
+    FileUtil.fullyDelete(workSpace);
+    job = new JobConf();
+    job.set(MRConfig.LOCAL_DIR, workSpace.getAbsolutePath());
+    job.setNumReduceTasks(PARTITIONS);
+    job.setMapOutputKeyClass(Text.class);
+    job.setMapOutputValueClass(Text.class);
+    // spill every few thousand records
+    job.setInt(MRJobConfig.IO_SORT_MB, 1);
+    mapOutputFile = new MROutputFiles();
+    mapOutputFile.setConf(job);
+
+    MapTask mapTask = mock(MapTask.class);
+    when(mapTask.getTaskID()).thenReturn(
+        TaskAttemptID.forName("attempt_001_0002_m_000003_0"));
+    when(mapTask.getMapOutputFile()).thenReturn(mapOutputFile);
+    when(mapTask.getSortPhase()).thenReturn(new Progress());
+    counters = new Counters();
+    TaskReporter reporter = mock(TaskReporter.class);
+    for (TaskCounter counter : TaskCounter.values()) {
+      when(reporter.getCounter(counter))
+        .thenReturn(counters.findCounter(counter));
+    }
+    collector = new PipesMapOutputCollector<Text, Text>();
+    collector.init(new MapOutputCollector.Context(mapTask, job, reporter));
+  }
+
+  @After
+  public void tearDown() {
+    FileUtil.fullyDelete(workSpace);
+  }
+
+  private static String makeKey(int i) {
+    return String.format("key%08d", i);
+  }
+
+  /**
+   * Collect and flush the records, and read back the map output.
+   * @param keys the keys to collect, in order
+   * @return the keys of each partition in the output
+   */
+  private List<List<String>> collect(List<String> keys) throws Exception {
+    Text key = new Text();
+    Text value = new Text(String.format("%0100d", 0));
+    for (String k : keys) {
+      key.set(k);
+      collector.collect(key, value, (k.hashCode() & Integer.MAX_VALUE) % 
+                                    PARTITIONS);
+    }
+    collector.flush();
+    collector.close();
+    assertEquals(keys.size(),
+        counters.findCounter(TaskCounter.MAP_OUTPUT_RECORDS).getValue());
+
+    List<List<String>> result = new ArrayList<List<String>>();
+    Path output = mapOutputFile.getOutputFile();
+    SpillRecord index = 
+      new SpillRecord(mapOutputFile.getOutputIndexFile(), job);
+    FileSystem fs = FileSystem.getLocal(job).getRaw();
+    DataInputBuffer keyBuffer = new DataInputBuffer();
+    DataInputBuffer valueBuffer = new DataInputBuffer();
+    for (int i = 0; i < PARTITIONS; ++i) {
+      IndexRecord rec = index.getIndex(i);
+      FSDataInputStream in = fs.open(output);
+      in.seek(rec.startOffset);
+      IFile.Reader<Text, Text> reader = 
+        new IFile.Reader<Text, Text>(job, in, rec.partLength, null, null);
+      List<String> part = new ArrayList<String>();
+      while (reader.nextRawKey(keyBuffer)) {
+        key.readFields(keyBuffer);
+        reader.nextRawValue(valueBuffer);
+        value.readFields(valueBuffer);
+        part.add(key.toString());
+      }
+      reader.close();
+      result.add(part);
+    }
+    return result;
+  }
+
+  private void checkOutput(List<String> keys, 
+                           List<List<String>> output) {
+    List<String> all = new ArrayList<String>();
+    for (List<String> part : output) {
+      List<String> sorted = new ArrayList<String>(part);
+      Collections.sort(sorted);
+      assertEquals(sorted, part);
+      all.addAll(part);
+    }
+    List<String> expected = new ArrayList<String>(keys);
+    Collections.sort(expected);
+    Collections.sort(all);
+    assertEquals(expected, all);
+  }
+
+  /**
+   * The outputs of an application that sorted them in three spills of its
+   * own. They take a few spills here too, which don't line up with the
+   * application's.
+   */
+  @Test
+  public void testSortedRuns() throws Exception {
+    List<String> keys = new ArrayList<String>();
+    for (int run = 0; run < 3; ++run) {
+      for (int i = 0; i < 10000; ++i) {
+        keys.add(makeKey(3 * i + run));
+      }
+    }
+    List<List<String>> output = collect(keys);
+    checkOutput(keys, output);
+    assertTrue(counters.findCounter(TaskCounter.SPILLED_RECORDS).getValue()
+               > keys.size());
+  }
+
+  @Test
+  public void testUnsortedOutputs() throws Exception {
+    List<String> keys = new ArrayList<String>();
+    Random random = new Random(42);
+    for (int i = 0; i < 2000; ++i) {
+      keys.add(makeKey(random.nextInt(1000)));
+    }
+    checkOutput(keys, collect(keys));
+  }
+
+  @Test
+  public void testNoOutputs() throws Exception {
+    List<String> keys = new ArrayList<String>();
+    List<List<String>> output = collect(keys);
+    assertEquals(PARTITIONS, output.size());
+    checkOutput(keys, output);
+  }
+}
@@ -0,0 +1,1046 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Measures the Pipes runtime without a cluster. A synthetic binary command
+ * file, like the one the Java side would send, is generated and replayed
+ * through runTask with the file transport, or with the shared memory
+ * transport with the benchmark playing the task's side of the rings, and
+ * the upward file it writes is read back to count the output and to add up
+ * the phase timing counters of the task. With several tasks per run, the
+ * command file replays how the Java side reuses one child for all of them,
+ * with a RESET and the job configuration between the tasks.
+ */
+
+#include "hadoop/Pipes.hh"
+#include "hadoop/SerialUtils.hh"
+#include "hadoop/SharedRing.hh"
+#include "hadoop/StringUtils.hh"
+#include "hadoop/TemplateFactory.hh"
+#include "lz4.h"
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+using std::map;
+using std::string;
+using std::vector;
+
+/**
+ * The protocol commands used by the benchmark. These have to match the
+ * ones in HadoopPipes.cc.
+ */
+enum MESSAGE_TYPE {START_MESSAGE, SET_JOB_CONF, SET_INPUT_TYPES, RUN_MAP,
+                   MAP_ITEM, RUN_REDUCE, REDUCE_KEY, REDUCE_VALUE,
+                   CLOSE, ABORT, AUTHENTICATION_REQ, MAP_ITEMS, RESET,
+                   OUTPUT=50, PARTITIONED_OUTPUT, STATUS, PROGRESS, DONE,
+                   REGISTER_COUNTER, INCREMENT_COUNTER, AUTHENTICATION_RESP,
+                   OUTPUTS, PARTITIONED_OUTPUTS, COMPRESSED_OUTPUTS};
+
+/**
+ * The number of records in each MAP_ITEMS command, as sent by the Java side
+ * with its default batch size and small records.
+ */
+static const int MAP_ITEMS_BATCH = 256;
+
+/**
+ * The job configuration key that turns on the phase timing counters, and
+ * their group, as in HadoopPipes.cc.
+ */
+static const char* PHASE_TIMING = "mapreduce.pipes.phase.timing";
+static const char* PHASE_GROUP = "Pipes Phases";
+
+/**
+ * The job configuration key that lets the child run more than one task.
+ */
+static const char* TASK_REUSE = "mapreduce.pipes.task.reuse";
+
+/**
+ * The job configuration key that compresses the batches of outputs.
+ */
+static const char* UPLINK_COMPRESS = "mapreduce.pipes.uplink.compress";
+
+class IdentityMap: public HadoopPipes::Mapper {
+public:
+  IdentityMap(HadoopPipes::TaskContext& context) {}
+
+  void map(HadoopPipes::MapContext& context) {
+    size_t keyLength;
+    size_t valueLength;
+    const char* key = context.getInputKey(keyLength);
+    const char* value = context.getInputValue(valueLength);
+    context.emit(key, keyLength, value, valueLength);
+  }
+};
+
+class BatchIdentityMap: public HadoopPipes::BatchMapper {
+public:
+  BatchIdentityMap(HadoopPipes::TaskContext& context) {}
+
+  void map(HadoopPipes::MapContext& context,
+           const HadoopPipes::RecordBatch& input,
+           HadoopPipes::BatchEmitter& output) {
+    const char* keys = input.getKeyData();
+    const size_t* keyOffsets = input.getKeyOffsets();
+    const char* values = input.getValueData();
+    const size_t* valueOffsets = input.getValueOffsets();
+    for(size_t i=0; i < input.size(); ++i) {
+      output.emit(keys + keyOffsets[i], keyOffsets[i + 1] - keyOffsets[i],
+                  values + valueOffsets[i],
+                  valueOffsets[i + 1] - valueOffsets[i]);
+    }
+  }
+};
+
+class IdentityReduce: public HadoopPipes::Reducer {
+public:
+  IdentityReduce(HadoopPipes::TaskContext& context) {}
+
+  void reduce(HadoopPipes::ReduceContext& context) {
+    while (context.nextValue()) {
+      context.emit(context.getInputKey(), context.getInputValue());
+    }
+  }
+};
+
+class WordCountMap: public HadoopPipes::Mapper {
+private:
+  HadoopUtils::Tokenizer tokenizer;
+public:
+  WordCountMap(HadoopPipes::TaskContext& context): tokenizer(" ") {}
+
+  void map(HadoopPipes::MapContext& context) {
+    size_t length;
+    const char* value = context.getInputValue(length);
+    tokenizer.reset(value, length);
+    const char* word;
+    while (tokenizer.next(word, length)) {
+      context.emit(word, length, "1", 1);
+    }
+  }
+};
+
+class BatchWordCountMap: public HadoopPipes::BatchMapper {
+private:
+  HadoopUtils::Tokenizer tokenizer;
+public:
+  BatchWordCountMap(HadoopPipes::TaskContext& context): tokenizer(" ") {}
+
+  void map(HadoopPipes::MapContext& context,
+           const HadoopPipes::RecordBatch& input,
+           HadoopPipes::BatchEmitter& output) {
+    const char* values = input.getValueData();
+    const size_t* valueOffsets = input.getValueOffsets();
+    for(size_t i=0; i < input.size(); ++i) {
+      tokenizer.reset(values + valueOffsets[i],
+                      valueOffsets[i + 1] - valueOffsets[i]);
+      const char* word;
+      size_t length;
+      while (tokenizer.next(word, length)) {
+        output.emit(word, length, "1", 1);
+      }
+    }
+  }
+};
+
+class WordCountReduce: public HadoopPipes::Reducer {
+public:
+  WordCountReduce(HadoopPipes::TaskContext& context) {}
+
+  void reduce(HadoopPipes::ReduceContext& context) {
+    int sum = 0;
+    while (context.nextValue()) {
+      sum += HadoopUtils::toInt(context.getInputValue());
+    }
+    context.emit(context.getInputKey(), HadoopUtils::toString(sum));
+  }
+};
+
+/**
+ * A small, repeatable random number generator, so that runs with the same
+ * options replay the same data.
+ */
+class Random {
+private:
+  uint64_t state;
+public:
+  Random(uint64_t seed): state(seed * 2654435761ULL + 1) {}
+
+  uint64_t next() {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+  }
+
+  /**
+   * A number from min to max, inclusive.
+   */
+  size_t nextBetween(size_t min, size_t max) {
+    return min + (size_t) (next() % (max - min + 1));
+  }
+};
+
+struct Options {
+  bool reduce;
+  string application;
+  bool combiner;
+  bool batch;
+  int64_t records;
+  size_t minKey;
+  size_t maxKey;
+  size_t minValue;
+  size_t maxValue;
+  int vocabulary;
+  int fanIn;
+  int reduces;
+  int version;
+  int iterations;
+  int tasks;
+  bool switchCompression;
+  uint64_t ringSize;
+  string commandFile;
+  vector<string> conf;
+
+  Options() {
+    reduce = false;
+    application = "identity";
+    combiner = false;
+    batch = false;
+    records = 1000000;
+    minKey = 8;
+    maxKey = 8;
+    minValue = 10;
+    maxValue = 100;
+    vocabulary = 1000;
+    fanIn = 10;
+    reduces = 1;
+    version = 1;
+    iterations = 3;
+    tasks = 1;
+    switchCompression = false;
+    ringSize = 0;
+    commandFile = "pipes-bench.cmd";
+  }
+};
+
+static void usage(const char* program) {
+  fprintf(stderr,
+"Usage: %s [options]\n"
+"  -m map|reduce    the kind of task to run (default map)\n"
+"  -a identity|wordcount  the application to run (default identity)\n"
+"  -c               use the reducer as a combiner\n"
+"  -b               use the batch mapper interface\n"
+"  -n records       the number of input records of a task (default 1000000)\n"
+"  -k min[:max]     the key length in bytes (default 8)\n"
+"  -v min[:max]     the value length in bytes (default 10:100)\n"
+"  -w words         the number of distinct words in values (default 1000)\n"
+"  -f values        the values for each key of a reduce (default 10)\n"
+"  -r reduces       the number of reduces of a map (default 1)\n"
+"  -p version       the protocol version (default 1)\n"
+"  -i iterations    the number of times to replay the task (default 3)\n"
+"  -t tasks         the number of tasks to run through the child on each\n"
+"                   replay, which needs protocol version 2 (default 1)\n"
+"  -z               compress the outputs of every other task, so that the\n"
+"                   uplink changes between tasks, which needs -t\n"
+"  -o file          the command file to write (default pipes-bench.cmd)\n"
+"  -R, --ring size  replay through the shared memory transport, with rings\n"
+"                   of size bytes, a power of two\n"
+"  -D key=value     a job configuration value, may be repeated\n"
+"  --check          replay small tasks in the modes that run threads next\n"
+"                   to the task, and fail if any output is wrong\n"
+"The phase timing counters are on unless %s is set to false.\n",
+          program, PHASE_TIMING);
+  exit(2);
+}
+
+static void parseRange(const char* arg, size_t& min, size_t& max) {
+  vector<string> parts = HadoopUtils::splitString(arg, ":");
+  if (parts.size() < 1 || parts.size() > 2) {
+    throw HadoopUtils::Error(string("bad range ") + arg);
+  }
+  min = HadoopUtils::toInt(parts[0]);
+  max = parts.size() == 2 ? HadoopUtils::toInt(parts[1]) : min;
+  if (max < min) {
+    throw HadoopUtils::Error(string("bad range ") + arg);
+  }
+}
+
+/**
+ * Add a job configuration value, unless it was given with -D.
+ */
+static void setDefault(Options& options, const string& key,
+                       const string& value) {
+  for(size_t i=0; i < options.conf.size(); i += 2) {
+    if (options.conf[i] == key) {
+      return;
+    }
+  }
+  options.conf.push_back(key);
+  options.conf.push_back(value);
+}
+
+/**
+ * Parse the options.
+ * @return false if the checks should be run instead
+ */
+static bool parseOptions(int argc, char* argv[], Options& options) {
+  static const struct option longOptions[] = {
+    {"ring", required_argument, NULL, 'R'},
+    {"check", no_argument, NULL, 'C'},
+    {NULL, 0, NULL, 0}};
+  int opt;
+  optind = 1;
+  while ((opt = getopt_long(argc, argv, "m:a:cbn:k:v:w:f:r:p:i:t:zo:R:D:",
+                            longOptions, NULL)) != -1) {
+    switch (opt) {
+    case 'm':
+      if (strcmp(optarg, "reduce") == 0) {
+        options.reduce = true;
+      } else if (strcmp(optarg, "map") != 0) {
+        usage(argv[0]);
+      }
+      break;
+    case 'a':
+      options.application = optarg;
+      if (options.application != "identity" &&
+          options.application != "wordcount") {
+        usage(argv[0]);
+      }
+      break;
+    case 'c':
+      options.combiner = true;
+      break;
+    case 'b':
+      options.batch = true;
+      break;
+    case 'n':
+      options.records = strtoll(optarg, NULL, 10);
+      break;
+    case 'k':
+      parseRange(optarg, options.minKey, options.maxKey);
+      break;
+    case 'v':
+      parseRange(optarg, options.minValue, options.maxValue);
+      break;
+    case 'w':
+      options.vocabulary = HadoopUtils::toInt(optarg);
+      break;
+    case 'f':
+      options.fanIn = HadoopUtils::toInt(optarg);
+      break;
+    case 'r':
+      options.reduces = HadoopUtils::toInt(optarg);
+      break;
+    case 'p':
+      options.version = HadoopUtils::toInt(optarg);
+      break;
+    case 'i':
+      options.iterations = HadoopUtils::toInt(optarg);
+      break;
+    case 't':
+      options.tasks = HadoopUtils::toInt(optarg);
+      break;
+    case 'z':
+      options.switchCompression = true;
+      break;
+    case 'o':
+      options.commandFile = optarg;
+      break;
+    case 'R':
+      options.ringSize = strtoull(optarg, NULL, 10);
+      if (options.ringSize == 0 ||
+          (options.ringSize & (options.ringSize - 1)) != 0) {
+        usage(argv[0]);
+      }
+      break;
+    case 'D': {
+      const char* separator = strchr(optarg, '=');
+      if (separator == NULL) {
+        usage(argv[0]);
+      }
+      options.conf.push_back(string(optarg, separator - optarg));
+      options.conf.push_back(string(separator + 1));
+      break;
+    }
+    case 'C':
+      return false;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (options.records <= 0 || options.vocabulary <= 0 ||
+      options.fanIn <= 0 || options.iterations <= 0 ||
+      options.reduces < 0 || options.tasks <= 0 ||
+      (options.tasks > 1 && options.version < 2) ||
+      (options.switchCompression && options.tasks < 2)) {
+    usage(argv[0]);
+  }
+  setDefault(options, PHASE_TIMING, "true");
+  if (options.tasks > 1) {
+    setDefault(options, TASK_REUSE, "true");
+  }
+  return true;
+}
+
+static double getSeconds() {
+  timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/**
+ * Writes the command file for the task described by the options.
+ */
+class CommandGenerator {
+private:
+  const Options& options;
+  HadoopUtils::FileOutStream stream;
+  Random random;
+  vector<string> words;
+  string key;
+  string value;
+  int64_t bytes;
+
+  void fillKey(size_t length) {
+    key.resize(length);
+    for(size_t i=0; i < length; ++i) {
+      key[i] = 'a' + (char) (random.next() % 26);
+    }
+  }
+
+  /**
+   * Fill the value with words from the vocabulary, cut to the length.
+   */
+  void fillValue(size_t length) {
+    value.clear();
+    while (value.length() < length) {
+      if (!value.empty()) {
+        value += ' ';
+      }
+      value += words[random.next() % words.size()];
+    }
+    value.resize(length);
+  }
+
+  void writeHeader() {
+    HadoopUtils::serializeInt(AUTHENTICATION_REQ, stream);
+    HadoopUtils::serializeString("", stream);
+    HadoopUtils::serializeString("", stream);
+    HadoopUtils::serializeInt(START_MESSAGE, stream);
+    HadoopUtils::serializeInt(options.version, stream);
+  }
+
+  /**
+   * Write the job configuration of the given task, with the compression
+   * turned on for the odd ones if it is switched between tasks.
+   */
+  void writeJobConf(int task) {
+    vector<string> conf;
+    for(size_t i=0; i < options.conf.size(); i += 2) {
+      if (!options.switchCompression || options.conf[i] != UPLINK_COMPRESS) {
+        conf.push_back(options.conf[i]);
+        conf.push_back(options.conf[i + 1]);
+      }
+    }
+    if (options.switchCompression) {
+      conf.push_back(UPLINK_COMPRESS);
+      conf.push_back(task % 2 == 1 ? "true" : "false");
+    }
+    HadoopUtils::serializeInt(SET_JOB_CONF, stream);
+    HadoopUtils::serializeInt(conf.size(), stream);
+    for(size_t i=0; i < conf.size(); ++i) {
+      HadoopUtils::serializeString(conf[i], stream);
+    }
+  }
+
+  void writeMap() {
+    HadoopUtils::serializeInt(SET_INPUT_TYPES, stream);
+    HadoopUtils::serializeString("org.apache.hadoop.io.Text", stream);
+    HadoopUtils::serializeString("org.apache.hadoop.io.Text", stream);
+    HadoopUtils::serializeInt(RUN_MAP, stream);
+    HadoopUtils::serializeString("synthetic split", stream);
+    HadoopUtils::serializeInt(options.reduces, stream);
+    HadoopUtils::serializeInt(1, stream);
+    for(int64_t i=0; i < options.records; ++i) {
+      if (options.version == 0) {
+        HadoopUtils::serializeInt(MAP_ITEM, stream);
+      } else if (i % MAP_ITEMS_BATCH == 0) {
+        HadoopUtils::serializeInt(MAP_ITEMS, stream);
+        HadoopUtils::serializeInt(std::min((int64_t) MAP_ITEMS_BATCH,
+                                           options.records - i), stream);
+      }
+      fillKey(random.nextBetween(options.minKey, options.maxKey));
+      fillValue(random.nextBetween(options.minValue, options.maxValue));
+      HadoopUtils::serializeString(key, stream);
+      HadoopUtils::serializeString(value, stream);
+      bytes += key.length() + value.length();
+    }
+  }
+
+  /**
+   * Write the keys in sorted order, as the framework would, each with
+   * fanIn values. The keys are numbered so that they sort, and are zero
+   * padded to the minimum key length.
+   */
+  void writeReduce() {
+    HadoopUtils::serializeInt(RUN_REDUCE, stream);
+    HadoopUtils::serializeInt(0, stream);
+    HadoopUtils::serializeInt(1, stream);
+    char buffer[32];
+    int digits = snprintf(buffer, sizeof(buffer), "%lld",
+                          (long long) options.records);
+    int width = std::max(digits, (int) options.minKey);
+    bool counts = options.application == "wordcount";
+    for(int64_t i=0; i < options.records; ++i) {
+      if (i % options.fanIn == 0) {
+        snprintf(buffer, sizeof(buffer), "%0*lld", std::min(width, 30),
+                 (long long) (i / options.fanIn));
+        key = buffer;
+        HadoopUtils::serializeInt(REDUCE_KEY, stream);
+        HadoopUtils::serializeString(key, stream);
+        bytes += key.length();
+      }
+      if (counts) {
+        value = HadoopUtils::toString(1 + (int) (random.next() % 9));
+      } else {
+        fillValue(random.nextBetween(options.minValue, options.maxValue));
+      }
+      HadoopUtils::serializeInt(REDUCE_VALUE, stream);
+      HadoopUtils::serializeString(value, stream);
+      bytes += value.length();
+    }
+  }
+
+public:
+  CommandGenerator(const Options& _options): options(_options), random(42) {
+    bytes = 0;
+    for(int i=0; i < options.vocabulary; ++i) {
+      fillKey(random.nextBetween(3, 10));
+      words.push_back(key);
+    }
+  }
+
+  /**
+   * Write the command file.
+   * @return the number of key and value bytes in it
+   */
+  int64_t generate() {
+    HADOOP_ASSERT(stream.open(options.commandFile, true),
+                  "problem opening " + options.commandFile);
+    writeHeader();
+    for(int i=0; i < options.tasks; ++i) {
+      if (i > 0) {
+        HadoopUtils::serializeInt(RESET, stream);
+      }
+      writeJobConf(i);
+      if (options.reduce) {
+        writeReduce();
+      } else {
+        writeMap();
+      }
+      HadoopUtils::serializeInt(CLOSE, stream);
+    }
+    if (options.tasks > 1) {
+      // a child that waits for another task is let go by a CLOSE
+      HadoopUtils::serializeInt(CLOSE, stream);
+    }
+    stream.close();
+    return bytes;
+  }
+};
+
+/**
+ * Reads a variable length integer, or returns false at the end of the data.
+ */
+static bool readVLong(const char*& data, const char* end, int64_t& t) {
+  if (data >= end) {
+    return false;
+  }
+  int8_t b = (int8_t) *data++;
+  if (b >= -112) {
+    t = b;
+    return true;
+  }
+  bool negative = b < -120;
+  int length = negative ? -120 - b : -112 - b;
+  HADOOP_ASSERT(data + length <= end, "truncated number in output");
+  t = 0;
+  for(int i=0; i < length; ++i) {
+    t = (t << 8) | (unsigned char) *data++;
+  }
+  if (negative) {
+    t ^= -1LL;
+  }
+  return true;
+}
+
+static int64_t readVLong(const char*& data, const char* end) {
+  int64_t t;
+  HADOOP_ASSERT(readVLong(data, end, t), "truncated output");
+  return t;
+}
+
+static size_t skipString(const char*& data, const char* end) {
+  int64_t length = readVLong(data, end);
+  HADOOP_ASSERT(length >= 0 && data + length <= end, "truncated string");
+  data += length;
+  return length;
+}
+
+static string readString(const char*& data, const char* end) {
+  size_t length = skipString(data, end);
+  return string(data - length, length);
+}
+
+/**
+ * What a task sent up.
+ */
+struct TaskOutput {
+  /**
+   * The number of tasks that were done.
+   */
+  int tasks;
+  int64_t records;
+  /**
+   * The bytes of the keys and values, without any framing.
+   */
+  int64_t bytes;
+  /**
+   * The counters of the phase timing group, by name.
+   */
+  map<string, int64_t> phases;
+
+  TaskOutput() {
+    tasks = 0;
+    records = 0;
+    bytes = 0;
+  }
+};
+
+/**
+ * Count a batch of OUTPUTS or PARTITIONED_OUTPUTS records.
+ */
+static void scanBatch(const char*& data, const char* end, int64_t command,
+                      int64_t count, TaskOutput& output) {
+  for(int64_t i=0; i < count; ++i) {
+    if (command == PARTITIONED_OUTPUTS) {
+      readVLong(data, end);
+    } else {
+      HADOOP_ASSERT(command == OUTPUTS, "bad batch command " +
+                    HadoopUtils::toString((int) command) + " in output");
+    }
+    output.bytes += skipString(data, end);
+    output.bytes += skipString(data, end);
+  }
+  output.records += count;
+}
+
+/**
+ * Count the records and their bytes in the upward file of a task, and add
+ * up its phase counters.
+ */
+static void scanOutput(const string& filename, TaskOutput& output) {
+  string contents;
+  FILE* file = fopen(filename.c_str(), "rb");
+  HADOOP_ASSERT(file != NULL, "problem opening " + filename);
+  char buffer[64 * 1024];
+  size_t length;
+  while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    contents.append(buffer, length);
+  }
+  fclose(file);
+  const char* data = contents.data();
+  const char* end = data + contents.length();
+  map<int64_t, string> phaseCounters;
+  string batch;
+  int64_t command;
+  while (readVLong(data, end, command)) {
+    switch (command) {
+    case OUTPUT:
+      output.bytes += skipString(data, end);
+      output.bytes += skipString(data, end);
+      output.records += 1;
+      break;
+    case PARTITIONED_OUTPUT:
+      readVLong(data, end);
+      output.bytes += skipString(data, end);
+      output.bytes += skipString(data, end);
+      output.records += 1;
+      break;
+    case OUTPUTS:
+    case PARTITIONED_OUTPUTS: {
+      int64_t count = readVLong(data, end);
+      scanBatch(data, end, command, count, output);
+      break;
+    }
+    case COMPRESSED_OUTPUTS: {
+      int64_t batchCommand = readVLong(data, end);
+      int64_t count = readVLong(data, end);
+      int64_t rawLength = readVLong(data, end);
+      int64_t compressedLength = readVLong(data, end);
+      HADOOP_ASSERT(rawLength >= 0 && compressedLength >= 0 &&
+                    data + compressedLength <= end,
+                    "truncated compressed batch");
+      batch.resize(rawLength);
+      HADOOP_ASSERT(LZ4_decompress_safe(data, &batch[0], compressedLength,
+                                        rawLength) == rawLength,
+                    "corrupt compressed batch");
+      data += compressedLength;
+      const char* batchData = batch.data();
+      scanBatch(batchData, batchData + batch.length(), batchCommand, count,
+                output);
+      break;
+    }
+    case STATUS:
+    case AUTHENTICATION_RESP:
+      skipString(data, end);
+      break;
+    case PROGRESS:
+      HADOOP_ASSERT(data + 4 <= end, "truncated progress");
+      data += 4;
+      break;
+    case DONE:
+      output.tasks += 1;
+      break;
+    case REGISTER_COUNTER: {
+      int64_t id = readVLong(data, end);
+      string group = readString(data, end);
+      string name = readString(data, end);
+      if (group == PHASE_GROUP) {
+        phaseCounters[id] = name;
+      }
+      break;
+    }
+    case INCREMENT_COUNTER: {
+      int64_t id = readVLong(data, end);
+      int64_t amount = readVLong(data, end);
+      map<int64_t, string>::const_iterator counter = phaseCounters.find(id);
+      if (counter != phaseCounters.end()) {
+        output.phases[counter->second] += amount;
+      }
+      break;
+    }
+    default:
+      throw HadoopUtils::Error("unknown command " +
+                               HadoopUtils::toString((int) command) +
+                               " in output");
+    }
+  }
+}
+
+/**
+ * Plays the task's side of the shared memory transport for one run: a
+ * thread copies the command file into the down ring and another copies
+ * the up ring into the output file, while the child runs on the main
+ * thread.
+ */
+class RingDriver {
+private:
+  HadoopPipes::SharedRingFile* ringFile;
+  string commandFile;
+  string outputFile;
+  pthread_t feeder;
+  pthread_t drainer;
+  string feedError;
+  string drainError;
+
+  void feed() {
+    FILE* file = fopen(commandFile.c_str(), "rb");
+    HADOOP_ASSERT(file != NULL, "problem opening " + commandFile);
+    char buffer[64 * 1024];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+      ringFile->getDownRing()->write(buffer, length);
+    }
+    fclose(file);
+    ringFile->getDownRing()->close();
+  }
+
+  void drain() {
+    FILE* file = fopen(outputFile.c_str(), "wb");
+    HADOOP_ASSERT(file != NULL, "problem opening " + outputFile);
+    char buffer[64 * 1024];
+    size_t length;
+    while ((length = ringFile->getUpRing()->read(buffer,
+                                                 sizeof(buffer))) > 0) {
+      HADOOP_ASSERT(fwrite(buffer, 1, length, file) == length,
+                    "problem writing " + outputFile);
+    }
+    HADOOP_ASSERT(fclose(file) == 0, "problem writing " + outputFile);
+  }
+
+  static void* runFeeder(void* arg) {
+    RingDriver* driver = (RingDriver*) arg;
+    try {
+      driver->feed();
+    } catch (HadoopUtils::Error& err) {
+      driver->feedError = err.getMessage();
+    }
+    return NULL;
+  }
+
+  static void* runDrainer(void* arg) {
+    RingDriver* driver = (RingDriver*) arg;
+    try {
+      driver->drain();
+    } catch (HadoopUtils::Error& err) {
+      driver->drainError = err.getMessage();
+    }
+    return NULL;
+  }
+
+public:
+  /**
+   * Create the ring file, with empty rings, and start copying.
+   */
+  RingDriver(const string& ringFilename, uint64_t ringSize,
+             const string& _commandFile, const string& _outputFile)
+    : commandFile(_commandFile), outputFile(_outputFile) {
+    ringFile = HadoopPipes::SharedRingFile::create(ringFilename, ringSize);
+    pthread_create(&feeder, NULL, runFeeder, this);
+    pthread_create(&drainer, NULL, runDrainer, this);
+  }
+
+  /**
+   * Wait until the child has closed the up ring and everything has been
+   * copied.
+   */
+  void finish() {
+    pthread_join(feeder, NULL);
+    pthread_join(drainer, NULL);
+    HADOOP_ASSERT(feedError.empty(), feedError);
+    HADOOP_ASSERT(drainError.empty(), drainError);
+  }
+
+  ~RingDriver() {
+    delete ringFile;
+  }
+};
+
+template <class mapper, class reducer>
+static HadoopPipes::Factory* makeFactory(bool combiner) {
+  if (combiner) {
+    return new HadoopPipes::TemplateFactory<mapper, reducer, void, reducer>();
+  }
+  return new HadoopPipes::TemplateFactory<mapper, reducer>();
+}
+
+static HadoopPipes::Factory* makeFactory(const Options& options) {
+  if (options.application == "wordcount") {
+    if (options.batch) {
+      return makeFactory<BatchWordCountMap, WordCountReduce>(options.combiner);
+    }
+    return makeFactory<WordCountMap, WordCountReduce>(options.combiner);
+  }
+  if (options.batch) {
+    return makeFactory<BatchIdentityMap, IdentityReduce>(options.combiner);
+  }
+  return makeFactory<IdentityMap, IdentityReduce>(options.combiner);
+}
+
+static void report(const char* phase, double seconds, int64_t records,
+                   int64_t bytes) {
+  printf("%-10s %10.3f %14.0f %14.0f\n", phase, seconds,
+         records / seconds, bytes / seconds);
+}
+
+/**
+ * Print how the time of a run was split between the phases, from the
+ * phase counters added up over all the runs.
+ */
+static void reportPhases(const Options& options,
+                         map<string, int64_t>& phases) {
+  // the counter of each phase and what it covers in the benchmark
+  static const char* PHASES[][2] = {
+    {"READ_MILLIS", "read"},
+    {"DECODE_MILLIS", "decode"},
+    {"USER_MILLIS", NULL},
+    {"SPILL_MILLIS", "combine"},
+    {"ENCODE_MILLIS", "emit"},
+    {"WRITE_MILLIS", "write"},
+    {"OTHER_MILLIS", "other"}};
+  static const int PHASE_COUNT = sizeof(PHASES) / sizeof(PHASES[0]);
+  int64_t total = 0;
+  for(int i=0; i < PHASE_COUNT; ++i) {
+    total += phases[PHASES[i][0]];
+  }
+  if (total == 0) {
+    return;
+  }
+  printf("%-10s %10s %9s\n", "split", "ms/run", "share");
+  for(int i=0; i < PHASE_COUNT; ++i) {
+    const char* name = PHASES[i][1];
+    if (name == NULL) {
+      name = options.reduce ? "reduce" : "map";
+    }
+    int64_t millis = phases[PHASES[i][0]];
+    printf("%-10s %10.1f %8.1f%%\n", name,
+           millis / (double) options.iterations, 100.0 * millis / total);
+  }
+  if (phases["SPILLS"] > 0) {
+    printf("spills: %lld, %lld records, %lld bytes per run\n",
+           (long long) (phases["SPILLS"] / options.iterations),
+           (long long) (phases["SPILLED_RECORDS"] / options.iterations),
+           (long long) (phases["SPILLED_BYTES"] / options.iterations));
+  }
+}
+
+/**
+ * Replay the task the options describe and report how fast it ran.
+ */
+static void runBench(const Options& options) {
+  HadoopPipes::Factory* factory = makeFactory(options);
+  double start = getSeconds();
+  CommandGenerator generator(options);
+  int64_t inputBytes = generator.generate();
+  int64_t inputRecords = options.records * options.tasks;
+  double generateTime = getSeconds() - start;
+  string outputFile = options.commandFile + ".out";
+  string ringFile = options.commandFile + ".ring";
+  if (options.ringSize != 0) {
+    unsetenv("mapreduce.pipes.commandfile");
+    setenv("mapreduce.pipes.command.ring", ringFile.c_str(), 1);
+  } else {
+    unsetenv("mapreduce.pipes.command.ring");
+    setenv("mapreduce.pipes.commandfile", options.commandFile.c_str(), 1);
+  }
+
+  printf("%-10s %10s %14s %14s\n", "phase", "seconds", "records/s",
+         "bytes/s");
+  report("generate", generateTime, inputRecords, inputBytes);
+  double best = 0;
+  double total = 0;
+  TaskOutput output;
+  map<string, int64_t> phases;
+  double scanTime = 0;
+  for(int i=0; i < options.iterations; ++i) {
+    start = getSeconds();
+    RingDriver* driver = NULL;
+    if (options.ringSize != 0) {
+      driver = new RingDriver(ringFile, options.ringSize,
+                              options.commandFile, outputFile);
+    }
+    if (!HadoopPipes::runTask(*factory)) {
+      throw HadoopUtils::Error("task failed");
+    }
+    if (driver != NULL) {
+      driver->finish();
+      delete driver;
+    }
+    double runTime = getSeconds() - start;
+    report("run", runTime, inputRecords, inputBytes);
+    total += runTime;
+    if (i == 0 || runTime < best) {
+      best = runTime;
+    }
+    start = getSeconds();
+    output = TaskOutput();
+    scanOutput(outputFile, output);
+    scanTime = getSeconds() - start;
+    HADOOP_ASSERT(output.tasks == options.tasks,
+                  "the child finished " +
+                  HadoopUtils::toString(output.tasks) + " of " +
+                  HadoopUtils::toString(options.tasks) + " tasks");
+    // the identity map and reduce, also as a combiner, send every record
+    HADOOP_ASSERT(options.application != "identity" ||
+                  output.records == inputRecords,
+                  "the child sent " +
+                  HadoopUtils::toString((int) output.records) + " of " +
+                  HadoopUtils::toString((int) inputRecords) + " records");
+    for(map<string, int64_t>::const_iterator itr = output.phases.begin();
+        itr != output.phases.end(); ++itr) {
+      phases[itr->first] += itr->second;
+    }
+  }
+  if (options.ringSize != 0) {
+    unlink(ringFile.c_str());
+  }
+  report("run best", best, inputRecords, inputBytes);
+  report("run mean", total / options.iterations, inputRecords,
+         inputBytes);
+  report("scan", scanTime, output.records, output.bytes);
+  reportPhases(options, phases);
+  if (options.tasks > 1) {
+    printf("tasks: %d per run\n", options.tasks);
+  }
+  printf("input: %lld records, %lld bytes\n", (long long) inputRecords,
+         (long long) inputBytes);
+  printf("output: %lld records, %lld bytes\n", (long long) output.records,
+         (long long) output.bytes);
+  delete factory;
+}
+
+/**
+ * The runs of --check. Each mixes the task's thread with the reader,
+ * writer or map threads, and a child that is reused for several tasks.
+ */
+static const char* CHECKS[] = {
+  "-n 50000 -i 3 -t 4 -p 2 -z -D mapreduce.pipes.io.threads=true",
+  "-m reduce -n 50000 -i 3 -t 4 -p 2 -z -D mapreduce.pipes.io.threads=true",
+  "-a wordcount -c -n 50000 -i 3 -t 4 -p 2 -D mapreduce.pipes.io.threads=true",
+  "-n 50000 -i 3 -t 4 -p 2 -r 3 -D mapreduce.pipes.io.threads=true "
+    "-D mapreduce.pipes.map.threads=3",
+  "-n 50000 -i 3 -t 3 -p 2 -z -R 65536",
+  NULL};
+
+/**
+ * Run each of the checks, stopping at the first that fails.
+ */
+static void runChecks(const char* program) {
+  for(int i=0; CHECKS[i] != NULL; ++i) {
+    printf("check: %s\n", CHECKS[i]);
+    vector<string> words = HadoopUtils::splitString(CHECKS[i], " ");
+    vector<char*> args;
+    args.push_back((char*) program);
+    for(size_t j=0; j < words.size(); ++j) {
+      args.push_back((char*) words[j].c_str());
+    }
+    args.push_back(NULL);
+    Options options;
+    parseOptions(args.size() - 1, &args[0], options);
+    runBench(options);
+  }
+  printf("check: passed\n");
+}
+
+int main(int argc, char *argv[]) {
+  try {
+    Options options;
+    if (parseOptions(argc, argv, options)) {
+      runBench(options);
+    } else {
+      runChecks(argv[0]);
+    }
+  } catch (HadoopUtils::Error& err) {
+    fprintf(stderr, "Error: %s\n", err.getMessage().c_str());
+    return 1;
+  }
+  return 0;
+}
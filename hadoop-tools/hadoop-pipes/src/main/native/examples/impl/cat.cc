@@ -0,0 +1,106 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Prints the records of a SequenceFile or of a map output file as
+ * "key<TAB>value" lines, to look at the data a C++ task reads or writes.
+ */
+
+#include "hadoop/IFile.hh"
+#include "hadoop/SequenceFile.hh"
+#include "hadoop/SerialUtils.hh"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static void usage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s seq <file>\n"
+          "       %s [-c <codec class>] ifile <file> [<index file>]\n"
+          "A map output file is read by partition if its index is given,\n"
+          "and as one segment if not.\n",
+          program, program);
+}
+
+static void printRecord(const char* key, size_t keyLength,
+                        const char* value, size_t valueLength) {
+  fwrite(key, 1, keyLength, stdout);
+  putchar('\t');
+  fwrite(value, 1, valueLength, stdout);
+  putchar('\n');
+}
+
+static void printSegment(HadoopPipes::IFileReader& reader) {
+  const char* key;
+  size_t keyLength;
+  const char* value;
+  size_t valueLength;
+  while (reader.next(key, keyLength, value, valueLength)) {
+    printRecord(key, keyLength, value, valueLength);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  const char* codecClass = NULL;
+  int option;
+  while ((option = getopt(argc, argv, "c:")) != -1) {
+    if (option == 'c') {
+      codecClass = optarg;
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  try {
+    if (argc - optind == 2 && strcmp(argv[optind], "seq") == 0) {
+      HadoopPipes::SequenceFileRecordReader reader(argv[optind + 1]);
+      const char* key;
+      size_t keyLength;
+      const char* value;
+      size_t valueLength;
+      while (reader.next(key, keyLength, value, valueLength)) {
+        printRecord(key, keyLength, value, valueLength);
+      }
+      return 0;
+    } else if ((argc - optind == 2 || argc - optind == 3) &&
+               strcmp(argv[optind], "ifile") == 0) {
+      const HadoopPipes::Codec* codec =
+        codecClass == NULL ? NULL : &HadoopPipes::Codec::get(codecClass);
+      if (argc - optind == 2) {
+        HadoopPipes::IFileReader reader(argv[optind + 1], 0, -1, codec);
+        printSegment(reader);
+        return 0;
+      }
+      std::vector<HadoopPipes::IndexRecord> index;
+      HadoopPipes::readSpillRecord(argv[optind + 2], index);
+      for(size_t i=0; i < index.size(); ++i) {
+        HadoopPipes::IFileReader reader(argv[optind + 1],
+                                        index[i].startOffset,
+                                        index[i].partLength, codec);
+        printSegment(reader);
+      }
+      return 0;
+    }
+    usage(argv[0]);
+    return 2;
+  } catch (HadoopUtils::Error& err) {
+    fprintf(stderr, "Error: %s\n", err.getMessage().c_str());
+    return 1;
+  }
+}
@@ -0,0 +1,96 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Builds a lookup table from a file of "key\tvalue" lines, to be shipped to
+ * the tasks with the distributed cache, and looks keys up in one.
+ */
+
+#include "hadoop/LookupTable.hh"
+#include "hadoop/SerialUtils.hh"
+#include "hadoop/StringUtils.hh"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void usage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s build <input> <table>\n"
+          "       %s get <table> <key>...\n"
+          "The input has one \"key<TAB>value\" record per line.\n",
+          program, program);
+}
+
+static int build(const char* input, const char* table) {
+  FILE* file = fopen(input, "r");
+  HADOOP_ASSERT(file != NULL, std::string("problem opening ") + input + ": " +
+                strerror(errno));
+  HadoopPipes::LookupTableWriter writer(table);
+  char* line = NULL;
+  size_t capacity = 0;
+  ssize_t length;
+  while ((length = getline(&line, &capacity, file)) != -1) {
+    if (length > 0 && line[length - 1] == '\n') {
+      length -= 1;
+    }
+    const char* tab = (const char*) memchr(line, '\t', length);
+    if (tab == NULL) {
+      writer.add(line, length, "", 0);
+    } else {
+      writer.add(line, tab - line, tab + 1, line + length - tab - 1);
+    }
+  }
+  free(line);
+  fclose(file);
+  writer.close();
+  printf("%llu records\n", (unsigned long long) writer.size());
+  return 0;
+}
+
+static int get(const char* table, int keys, char* key[]) {
+  HadoopPipes::LookupTable lookup(table);
+  int missing = 0;
+  for(int i=0; i < keys; ++i) {
+    const char* value;
+    size_t valueLength;
+    if (lookup.find(key[i], strlen(key[i]), value, valueLength)) {
+      printf("%s\t%.*s\n", key[i], (int) valueLength, value);
+    } else {
+      fprintf(stderr, "%s not found\n", key[i]);
+      missing += 1;
+    }
+  }
+  return missing == 0 ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+  try {
+    if (argc == 4 && strcmp(argv[1], "build") == 0) {
+      return build(argv[2], argv[3]);
+    } else if (argc >= 3 && strcmp(argv[1], "get") == 0) {
+      return get(argv[2], argc - 3, argv + 3);
+    }
+    usage(argv[0]);
+    return 2;
+  } catch (HadoopUtils::Error& err) {
+    fprintf(stderr, "Error: %s\n", err.getMessage().c_str());
+    return 1;
+  }
+}
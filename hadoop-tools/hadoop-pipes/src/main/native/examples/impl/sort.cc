@@ -45,9 +45,13 @@ public:
 
   void map(HadoopPipes::MapContext& context) {
     totalRecords += 1;
+    size_t keyLength;
+    size_t valueLength;
+    const char* key = context.getInputKey(keyLength);
+    const char* value = context.getInputValue(valueLength);
     while ((float) keptRecords / totalRecords < keepFraction) {
       keptRecords += 1;
-      context.emit(context.getInputKey(), context.getInputValue());
+      context.emit(key, keyLength, value, valueLength);
     }
   }
 };
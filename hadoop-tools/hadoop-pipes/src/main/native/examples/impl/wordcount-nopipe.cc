@@ -16,6 +16,8 @@
  * limitations under the License.
  */
 #include "hadoop/Pipes.hh"
+#include "hadoop/LineRecordReader.hh"
+#include "hadoop/LocalRunner.hh"
 #include "hadoop/TemplateFactory.hh"
 #include "hadoop/StringUtils.hh"
 #include "hadoop/SerialUtils.hh"
@@ -32,17 +34,23 @@ class WordCountMap: public HadoopPipes::Mapper {
 public:
   HadoopPipes::TaskContext::Counter* inputWords;
   
-  WordCountMap(HadoopPipes::TaskContext& context) {
+  HadoopUtils::Tokenizer tokenizer;
+  
+  WordCountMap(HadoopPipes::TaskContext& context): tokenizer(" ") {
     inputWords = context.getCounter(WORDCOUNT, INPUT_WORDS);
   }
   
   void map(HadoopPipes::MapContext& context) {
-    std::vector<std::string> words = 
-      HadoopUtils::splitString(context.getInputValue(), " ");
-    for(unsigned int i=0; i < words.size(); ++i) {
-      context.emit(words[i], "1");
+    size_t length;
+    const char* value = context.getInputValue(length);
+    tokenizer.reset(value, length);
+    const char* word;
+    int words = 0;
+    while (tokenizer.next(word, length)) {
+      context.emit(word, length, "1", 1);
+      words += 1;
     }
-    context.incrementCounter(inputWords, words.size());
+    context.incrementCounter(inputWords, words);
   }
 };
 
@@ -64,54 +72,6 @@ public:
   }
 };
 
-class WordCountReader: public HadoopPipes::RecordReader {
-private:
-  int64_t bytesTotal;
-  int64_t bytesRead;
-  FILE* file;
-public:
-  WordCountReader(HadoopPipes::MapContext& context) {
-    std::string filename;
-    HadoopUtils::StringInStream stream(context.getInputSplit());
-    HadoopUtils::deserializeString(filename, stream);
-    struct stat statResult;
-    stat(filename.c_str(), &statResult);
-    bytesTotal = statResult.st_size;
-    bytesRead = 0;
-    file = fopen(filename.c_str(), "rt");
-    HADOOP_ASSERT(file != NULL, "failed to open " + filename);
-  }
-
-  ~WordCountReader() {
-    fclose(file);
-  }
-
-  virtual bool next(std::string& key, std::string& value) {
-    key = HadoopUtils::toString(ftell(file));
-    int ch = getc(file);
-    bytesRead += 1;
-    value.clear();
-    while (ch != -1 && ch != '\n') {
-      value += ch;
-      ch = getc(file);
-      bytesRead += 1;
-    }
-    return ch != -1;
-  }
-
-  /**
-   * The progress of the record reader through the split as a value between
-   * 0.0 and 1.0.
-   */
-  virtual float getProgress() {
-    if (bytesTotal > 0) {
-      return (float)bytesRead / bytesTotal;
-    } else {
-      return 1.0f;
-    }
-  }
-};
-
 class WordCountWriter: public HadoopPipes::RecordWriter {
 private:
   FILE* file;
@@ -141,8 +101,16 @@ public:
 };
 
 int main(int argc, char *argv[]) {
+  if (argc > 1) {
+    // run the whole job here: wordcount-nopipe -o <output> <input>...
+    return HadoopPipes::runLocal(HadoopPipes::TemplateFactory<WordCountMap,
+                                 WordCountReduce, void, void,
+                                 HadoopPipes::LineRecordReader,
+                                 WordCountWriter>(), argc, argv);
+  }
   return HadoopPipes::runTask(HadoopPipes::TemplateFactory<WordCountMap, 
-                              WordCountReduce, void, void, WordCountReader,
+                              WordCountReduce, void, void,
+                              HadoopPipes::LineRecordReader,
                               WordCountWriter>());
 }
 
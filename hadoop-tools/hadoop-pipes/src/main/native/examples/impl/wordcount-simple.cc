@@ -28,17 +28,23 @@ class WordCountMap: public HadoopPipes::Mapper {
 public:
   HadoopPipes::TaskContext::Counter* inputWords;
   
-  WordCountMap(HadoopPipes::TaskContext& context) {
+  HadoopUtils::Tokenizer tokenizer;
+  
+  WordCountMap(HadoopPipes::TaskContext& context): tokenizer(" ") {
     inputWords = context.getCounter(WORDCOUNT, INPUT_WORDS);
   }
   
   void map(HadoopPipes::MapContext& context) {
-    std::vector<std::string> words = 
-      HadoopUtils::splitString(context.getInputValue(), " ");
-    for(unsigned int i=0; i < words.size(); ++i) {
-      context.emit(words[i], "1");
+    size_t length;
+    const char* value = context.getInputValue(length);
+    tokenizer.reset(value, length);
+    const char* word;
+    int words = 0;
+    while (tokenizer.next(word, length)) {
+      context.emit(word, length, "1", 1);
+      words += 1;
     }
-    context.incrementCounter(inputWords, words.size());
+    context.incrementCounter(inputWords, words);
   }
 };
 
@@ -0,0 +1,82 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hadoop/Pipes.hh"
+#include "hadoop/TemplateFactory.hh"
+#include "hadoop/TypedPipes.hh"
+#include "hadoop/StringUtils.hh"
+
+const std::string WORDCOUNT = "WORDCOUNT";
+const std::string INPUT_WORDS = "INPUT_WORDS";
+const std::string OUTPUT_WORDS = "OUTPUT_WORDS";
+
+/**
+ * A word count whose counts are sent as IntWritables rather than as text,
+ * so the reducer adds them up without parsing them.
+ */
+class WordCountMap: public HadoopPipes::TypedMapper<std::string, std::string,
+                                                    std::string, int32_t> {
+public:
+  HadoopPipes::TaskContext::Counter* inputWords;
+  HadoopUtils::Tokenizer tokenizer;
+  std::string word;
+  
+  WordCountMap(HadoopPipes::TaskContext& context): tokenizer(" ") {
+    inputWords = context.getCounter(WORDCOUNT, INPUT_WORDS);
+  }
+  
+  void map(const std::string& key, const std::string& value,
+           HadoopPipes::TypedOutput<std::string, int32_t>& output) {
+    tokenizer.reset(value.data(), value.length());
+    const char* wordBytes;
+    size_t length;
+    int words = 0;
+    while (tokenizer.next(wordBytes, length)) {
+      word.assign(wordBytes, length);
+      output.emit(word, 1);
+      words += 1;
+    }
+    output.getContext().incrementCounter(inputWords, words);
+  }
+};
+
+class WordCountReduce: public HadoopPipes::TypedReducer<std::string, int32_t,
+                                                        std::string, int32_t> {
+public:
+  HadoopPipes::TaskContext::Counter* outputWords;
+
+  WordCountReduce(HadoopPipes::TaskContext& context) {
+    outputWords = context.getCounter(WORDCOUNT, OUTPUT_WORDS);
+  }
+
+  void reduce(const std::string& key, 
+              HadoopPipes::TypedValues<int32_t>& values,
+              HadoopPipes::TypedOutput<std::string, int32_t>& output) {
+    int32_t sum = 0;
+    while (values.next()) {
+      sum += values.get();
+    }
+    output.emit(key, sum);
+    output.getContext().incrementCounter(outputWords, 1); 
+  }
+};
+
+int main(int argc, char *argv[]) {
+  return HadoopPipes::runTask(HadoopPipes::TemplateFactory<WordCountMap, 
+                              WordCountReduce, void, WordCountReduce>());
+}
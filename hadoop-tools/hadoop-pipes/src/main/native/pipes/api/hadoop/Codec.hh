@@ -0,0 +1,118 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef HADOOP_PIPES_CODEC_HH
+#define HADOOP_PIPES_CODEC_HH
+
+#include "hadoop/SerialUtils.hh"
+
+#include <stdint.h>
+#include <string>
+
+namespace HadoopPipes {
+
+/**
+ * Compresses a stream to an output stream.
+ */
+class Compressor {
+public:
+  virtual void write(const char* data, size_t length) = 0;
+
+  /**
+   * Write whatever is still buffered and the end of the stream. Nothing
+   * may be written after.
+   */
+  virtual void finish() = 0;
+
+  virtual ~Compressor() {}
+};
+
+/**
+ * Decompresses a stream that is all in memory, such as part of a mapped
+ * file.
+ */
+class Decompressor {
+public:
+  /**
+   * Decompress up to length bytes into the buffer.
+   * @return the number of bytes, which is 0 only at the end of the stream
+   * @throws HadoopUtils::Error if the stream is corrupt or truncated
+   */
+  virtual size_t read(char* buffer, size_t length) = 0;
+
+  virtual ~Decompressor() {}
+};
+
+/**
+ * The compression codecs of Hadoop's Java CompressionCodec classes, writing
+ * and reading the same streams, so that data compressed by one side can be
+ * read by the other:
+ *
+ *   org.apache.hadoop.io.compress.DefaultCodec  zlib
+ *   org.apache.hadoop.io.compress.GzipCodec     gzip
+ *   org.apache.hadoop.io.compress.Lz4Codec      LZ4 blocks
+ *   org.apache.hadoop.io.compress.SnappyCodec   Snappy blocks, if libsnappy
+ *                                               was found at build time
+ *
+ * The LZ4 and Snappy streams are in the framing of Java's
+ * BlockCompressorStream, with the default buffer size of 256KB. Codecs
+ * keep no state, so they are shared.
+ */
+class Codec {
+public:
+  static const std::string DEFAULT_CODEC;
+
+  /**
+   * Get the codec of a Java codec class.
+   * @throws HadoopUtils::Error if it isn't supported
+   */
+  static const Codec& get(const std::string& className);
+
+  virtual const std::string& getClassName() const = 0;
+
+  /**
+   * Create a compressor that writes to the given stream, which it doesn't
+   * flush.
+   */
+  virtual Compressor* createCompressor(HadoopUtils::OutStream& out)
+    const = 0;
+
+  /**
+   * Create a decompressor for the stream in the given bytes, which must
+   * stay valid while it is used.
+   */
+  virtual Decompressor* createDecompressor(const char* data, size_t length)
+    const = 0;
+
+  /**
+   * Compress the given bytes as a whole stream, replacing result.
+   */
+  void compress(const char* data, size_t length, std::string& result) const;
+
+  /**
+   * Decompress a whole stream, replacing result.
+   * @throws HadoopUtils::Error if the stream is corrupt or truncated
+   */
+  void decompress(const char* data, size_t length, std::string& result)
+    const;
+
+  virtual ~Codec() {}
+};
+
+}
+
+#endif
@@ -0,0 +1,159 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef HADOOP_PIPES_IFILE_HH
+#define HADOOP_PIPES_IFILE_HH
+
+#include "hadoop/Codec.hh"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+ * Reads and writes the IFile segments that hold the intermediate data of a
+ * MapReduce job: the map output files, one segment per partition, and the
+ * segments a reduce fetches and merges.
+ *
+ * A segment is its records, each the VInt lengths of the key and value and
+ * then their bytes, ended by two -1 lengths, all of it optionally
+ * compressed, and then the CRC32 of the compressed bytes. The key and value
+ * are serialized Writables, as in a SequenceFile.
+ */
+namespace HadoopPipes {
+
+class ChecksumOutStream;
+
+/**
+ * Writes one segment to a stream. Many segments may be written one after
+ * another, as in a map output file.
+ */
+class IFileWriter {
+private:
+  ChecksumOutStream* checksumStream;
+  Compressor* compressor;
+  uint64_t rawLength;
+  std::string lengths;
+  bool closed;
+
+  void write(const char* data, size_t length);
+public:
+  /**
+   * @param codec the codec to compress the segment with, or NULL
+   */
+  IFileWriter(HadoopUtils::OutStream& out, const Codec* codec = NULL);
+
+  void append(const char* key, size_t keyLength,
+              const char* value, size_t valueLength);
+
+  /**
+   * Write the end of the segment and its checksum. The stream isn't
+   * flushed.
+   */
+  void close();
+
+  /**
+   * The length of the segment before compression, without the checksum.
+   */
+  uint64_t getRawLength() const {
+    return rawLength;
+  }
+
+  /**
+   * The number of bytes written to the stream, which is the length of the
+   * segment once it is closed.
+   */
+  uint64_t getCompressedLength() const;
+
+  ~IFileWriter();
+};
+
+/**
+ * Reads one segment. The segment's checksum is checked before the first
+ * record is read.
+ */
+class IFileReader {
+private:
+  std::string path;
+  char* mapping;
+  size_t mappingLength;
+  Decompressor* decompressor;
+  /**
+   * The records, either in the segment itself or in a buffer of
+   * decompressed bytes, which is owned if there is a decompressor.
+   */
+  char* buffer;
+  size_t bufferCapacity;
+  size_t position;
+  size_t limit;
+  bool done;
+
+  void init(const char* data, size_t length, const Codec* codec);
+  const char* readBytes(size_t length);
+  int64_t readVLong();
+public:
+  /**
+   * Read a segment in memory, which must stay valid while it is read.
+   * @throws HadoopUtils::Error if its checksum is wrong
+   */
+  IFileReader(const char* data, size_t length, const Codec* codec = NULL);
+
+  /**
+   * Read a segment of a file, by mapping it.
+   * @param length the length of the segment, or -1 for the rest of the file
+   * @throws HadoopUtils::Error if it can't be read or its checksum is wrong
+   */
+  IFileReader(const std::string& path, int64_t offset = 0,
+              int64_t length = -1, const Codec* codec = NULL);
+
+  /**
+   * Read the next record, which stays valid until the next call.
+   * @throws HadoopUtils::Error if the segment is corrupt
+   */
+  bool next(const char*& key, size_t& keyLength,
+            const char*& value, size_t& valueLength);
+
+  ~IFileReader();
+};
+
+/**
+ * Where the segment of a partition is in a map output file.
+ */
+struct IndexRecord {
+  int64_t startOffset;
+  int64_t rawLength;
+  int64_t partLength;
+};
+
+/**
+ * Read a map output index file, "file.out.index", which has an IndexRecord
+ * for each partition.
+ * @throws HadoopUtils::Error if it can't be read or its checksum is wrong
+ */
+void readSpillRecord(const std::string& path,
+                     std::vector<IndexRecord>& result);
+
+/**
+ * Write a map output index file.
+ * @throws HadoopUtils::Error if it can't be written
+ */
+void writeSpillRecord(const std::string& path,
+                      const std::vector<IndexRecord>& records);
+
+}
+
+#endif
@@ -0,0 +1,105 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef HADOOP_PIPES_LINE_RECORD_READER_HH
+#define HADOOP_PIPES_LINE_RECORD_READER_HH
+
+#include "hadoop/Pipes.hh"
+#include "hadoop/StringUtils.hh"
+
+#include <stdint.h>
+#include <string>
+
+namespace HadoopPipes {
+
+/**
+ * Read the input split of a task that reads a file. It is either a
+ * serialized FileSplit, which is the path followed by the start and length
+ * of the split, or just the path of a file, which is read whole. A "file:"
+ * scheme is removed from the path.
+ * @param length set to the length of the split, or -1 for the whole file
+ * @throws HadoopUtils::Error if the split is neither
+ */
+void parseFileSplit(const std::string& split, std::string& filename,
+                    int64_t& start, int64_t& length);
+
+/**
+ * Reads the lines of a local text file. The key of each record is the
+ * byte offset of the line in the file, as a decimal string, and the value
+ * is the line without its "\n" or "\r\n".
+ *
+ * Splits are handled like Hadoop's LineRecordReader: unless a split starts
+ * at the beginning of the file, its first line is left to the previous
+ * split, and the reader keeps going while lines start at or before the
+ * split's end.
+ *
+ * The file is mapped into memory, and records are handed out without
+ * copying them.
+ */
+class LineRecordReader: public RecordReader {
+private:
+  int fd;
+  char* mapping;
+  size_t mappingLength;
+  /**
+   * The file offset of the first mapped byte.
+   */
+  int64_t mappingOffset;
+  /**
+   * The next byte to read and the end of the file, in the mapping.
+   */
+  const char* position;
+  const char* fileEnd;
+  /**
+   * The file offsets of the start and end of the split, and of the next
+   * byte to read.
+   */
+  int64_t start;
+  int64_t end;
+  int64_t filePosition;
+  char keyBuffer[HadoopUtils::MAX_NUMBER_LENGTH];
+
+  void open(const std::string& filename, int64_t start, int64_t length);
+
+public:
+  /**
+   * Read the input split of the task, as parsed by parseFileSplit.
+   */
+  LineRecordReader(MapContext& context);
+
+  /**
+   * Read the lines of the given part of a file.
+   * @param length the length of the split, or -1 for the rest of the file
+   */
+  LineRecordReader(const std::string& filename, int64_t start,
+                   int64_t length);
+
+  virtual bool next(std::string& key, std::string& value);
+
+  virtual bool next(const char*& key, size_t& keyLength,
+                    const char*& value, size_t& valueLength);
+
+  virtual float getProgress();
+
+  virtual void close();
+
+  virtual ~LineRecordReader();
+};
+
+}
+
+#endif
@@ -0,0 +1,128 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef HADOOP_PIPES_LOCAL_RUNNER_HH
+#define HADOOP_PIPES_LOCAL_RUNNER_HH
+
+#include "hadoop/Pipes.hh"
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace HadoopPipes {
+
+/**
+ * Runs a whole job inside this process, without the Java framework, so that
+ * an application can be tested and profiled on one machine.
+ *
+ * The input files are cut into splits, which are mapped by a pool of
+ * threads. Map output is partitioned, sorted in a buffer and spilled to
+ * files in the work directory, with the combiner run on each spill. Each
+ * reduce then merges its partition of the spills and runs the reducer, and
+ * the reduces share the same pool of threads.
+ *
+ * The application's RecordReader and RecordWriter are used if the factory
+ * has them. Otherwise the input is read by a LineRecordReader and the output
+ * is written as "key\tvalue" lines to part-NNNNN files in the output
+ * directory. The job configuration has "mapreduce.task.partition" and
+ * "mapreduce.task.output.dir" set for each task, like the Java framework
+ * does, and the factory's initialize is called once for the whole job.
+ */
+class LocalRunner {
+private:
+  const Factory* factory;
+  std::map<std::string, std::string> conf;
+  std::vector<std::string> inputs;
+  std::string output;
+  std::string workDirectory;
+  int reduces;
+  int threads;
+  int64_t memory;
+  int64_t splitSize;
+  std::map<std::pair<std::string, std::string>, uint64_t> counters;
+
+public:
+  LocalRunner(const Factory& factory);
+
+  /**
+   * Set a value in the job configuration.
+   */
+  void set(const std::string& key, const std::string& value);
+
+  void addInput(const std::string& path);
+
+  /**
+   * Set the directory that the output is written to, which is created if
+   * needed.
+   */
+  void setOutput(const std::string& directory);
+
+  /**
+   * Set the directory for the spill files. It defaults to "_local" in the
+   * output directory, and is removed when the job is done.
+   */
+  void setWorkDirectory(const std::string& directory);
+
+  /**
+   * Set the number of reduces. With none, the map output is the output.
+   */
+  void setReduces(int reduces);
+
+  /**
+   * Set the number of threads that run the tasks. It defaults to the
+   * number of processors.
+   */
+  void setThreads(int threads);
+
+  /**
+   * Set the memory for buffering map output, in bytes, which is shared by
+   * the map threads.
+   */
+  void setMemory(int64_t bytes);
+
+  /**
+   * Set the largest number of bytes of an input file given to one map.
+   */
+  void setSplitSize(int64_t bytes);
+
+  /**
+   * Run the job.
+   * @throws HadoopUtils::Error if a task fails
+   */
+  void run();
+
+  /**
+   * Get the job's counters by group and name, once it has run.
+   */
+  const std::map<std::pair<std::string, std::string>, uint64_t>&
+    getCounters() const {
+    return counters;
+  }
+};
+
+/**
+ * Run a job locally with the options on the command line, and print its
+ * counters. Run it with no arguments for the options.
+ * @return the exit code for main
+ */
+int runLocal(const Factory& factory, int argc, char* argv[]);
+
+}
+
+#endif
@@ -0,0 +1,135 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef HADOOP_PIPES_LOOKUP_TABLE_HH
+#define HADOOP_PIPES_LOOKUP_TABLE_HH
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Immutable key/value tables for side inputs, such as the small side of a
+ * map-side join. A table is built once, offline, and each task maps the
+ * file read-only instead of loading it into the heap, so the tasks on a
+ * node share one copy of it in the page cache and start without parsing
+ * anything.
+ *
+ * The file holds the records, each a 32 bit key length, a 32 bit value
+ * length, the key and the value, followed by an open addressing hash index
+ * of the records' offsets. All numbers are little-endian. A lookup hashes
+ * the key, probes the index and compares the key of each record whose hash
+ * matches, so it usually touches two pages.
+ */
+namespace HadoopPipes {
+
+/**
+ * Writes a table. The records are written as they are added, and the index
+ * when the table is closed.
+ */
+class LookupTableWriter {
+private:
+  std::string path;
+  /**
+   * The file is written here and renamed to path once it is complete, so a
+   * failed writer never leaves a partial table behind.
+   */
+  std::string tempPath;
+  FILE* file;
+  uint64_t offset;
+  /**
+   * The hash and offset of each record.
+   */
+  std::vector<std::pair<uint64_t, uint64_t> > entries;
+
+  void write(const void* data, size_t length);
+  void writeIndex();
+  /**
+   * Close and remove the temporary file, if it is still open.
+   */
+  void abandon();
+public:
+  /**
+   * Create the file, replacing any that is there when it is closed.
+   * @throws HadoopUtils::Error if it can't be created
+   */
+  LookupTableWriter(const std::string& path);
+
+  /**
+   * Add a record.
+   * @throws HadoopUtils::Error if the record can't be written
+   */
+  void add(const char* key, size_t keyLength,
+           const char* value, size_t valueLength);
+
+  /**
+   * Write the index, close the file and move it into place. If this throws,
+   * nothing is left at the path.
+   * @throws HadoopUtils::Error if a key was added twice or the index can't
+   *   be written
+   */
+  void close();
+
+  uint64_t size() const {
+    return entries.size();
+  }
+
+  ~LookupTableWriter();
+};
+
+/**
+ * Reads a table through a read-only mapping of its file. Lookups don't
+ * change it, so it may be shared by any number of threads.
+ */
+class LookupTable {
+private:
+  std::string path;
+  const char* data;
+  size_t length;
+  uint64_t records;
+  const char* slots;
+  uint64_t slotMask;
+  uint64_t seed;
+public:
+  /**
+   * Map a table.
+   * @throws HadoopUtils::Error if the file can't be mapped or isn't a table
+   */
+  LookupTable(const std::string& path);
+
+  /**
+   * Find the value of a key. The value points into the mapping, and stays
+   * valid as long as the table does.
+   * @return whether the key is in the table
+   */
+  bool find(const char* key, size_t keyLength,
+            const char*& value, size_t& valueLength) const;
+
+  bool find(const std::string& key, std::string& value) const;
+
+  uint64_t size() const {
+    return records;
+  }
+
+  ~LookupTable();
+};
+
+}
+
+#endif
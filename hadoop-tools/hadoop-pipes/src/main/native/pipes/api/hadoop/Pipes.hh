@@ -29,6 +29,7 @@
 %feature("director") Factory;
 #else
 #include <string>
+#include <vector>
 #endif
 
 #include <stdint.h>
@@ -88,11 +89,44 @@ public:
    */
   virtual const std::string& getInputValue() = 0;
 
+  /**
+   * Get the current key without copying it. The bytes belong to the
+   * framework and are only valid until the next record is read.
+   * @param length set to the number of bytes in the key
+   * @return a pointer to the first byte of the key
+   */
+  virtual const char* getInputKey(size_t& length) {
+    const std::string& key = getInputKey();
+    length = key.length();
+    return key.data();
+  }
+
+  /**
+   * Get the current value without copying it. The bytes belong to the
+   * framework and are only valid until the next record is read.
+   * @param length set to the number of bytes in the value
+   * @return a pointer to the first byte of the value
+   */
+  virtual const char* getInputValue(size_t& length) {
+    const std::string& value = getInputValue();
+    length = value.length();
+    return value.data();
+  }
+
   /**
    * Generate an output record
    */
   virtual void emit(const std::string& key, const std::string& value) = 0;
 
+  /**
+   * Generate an output record from raw bytes. The bytes are consumed before
+   * the call returns, so they may point into the current input record.
+   */
+  virtual void emit(const char* key, size_t keyLength,
+                    const char* value, size_t valueLength) {
+    emit(std::string(key, keyLength), std::string(value, valueLength));
+  }
+
   /**
    * Mark your task as having made progress without changing the status 
    * message.
@@ -105,13 +139,17 @@ public:
   virtual void setStatus(const std::string& status) = 0;
 
   /**
-   * Register a counter with the given group and name.
+   * Register a counter with the given group and name. Asking for the same
+   * group and name again returns the same counter. The counter is owned by
+   * the context.
    */
   virtual Counter* 
     getCounter(const std::string& group, const std::string& name) = 0;
 
   /**
-   * Increment the value of the counter with the given amount.
+   * Increment the value of the counter with the given amount. Increments
+   * may be added up locally and sent to the framework with the next progress
+   * report.
    */
   virtual void incrementCounter(const Counter* counter, uint64_t amount) = 0;
   
@@ -160,6 +198,111 @@ public:
   virtual void map(MapContext& context) = 0;
 };
 
+/**
+ * A batch of records, kept as two columns: all of the keys one after
+ * another in one block of bytes and all of the values in another. Record
+ * i's key is the bytes from getKeyOffsets()[i] to getKeyOffsets()[i+1] of
+ * getKeyData(), and likewise for its value, so both offset arrays have
+ * size() + 1 entries.
+ */
+class RecordBatch {
+private:
+  std::string keyData;
+  std::string valueData;
+  std::vector<size_t> keyOffsets;
+  std::vector<size_t> valueOffsets;
+public:
+  RecordBatch(): keyOffsets(1, 0), valueOffsets(1, 0) {}
+
+  void add(const char* key, size_t keyLength,
+           const char* value, size_t valueLength) {
+    keyData.append(key, keyLength);
+    keyOffsets.push_back(keyData.length());
+    valueData.append(value, valueLength);
+    valueOffsets.push_back(valueData.length());
+  }
+
+  /**
+   * The number of records in the batch.
+   */
+  size_t size() const {
+    return keyOffsets.size() - 1;
+  }
+
+  /**
+   * The number of bytes of keys and values in the batch.
+   */
+  size_t getDataLength() const {
+    return keyData.length() + valueData.length();
+  }
+
+  const char* getKeyData() const {
+    return keyData.data();
+  }
+
+  const size_t* getKeyOffsets() const {
+    return &keyOffsets[0];
+  }
+
+  const char* getValueData() const {
+    return valueData.data();
+  }
+
+  const size_t* getValueOffsets() const {
+    return &valueOffsets[0];
+  }
+
+  const char* getKey(size_t record, size_t& length) const {
+    length = keyOffsets[record + 1] - keyOffsets[record];
+    return keyData.data() + keyOffsets[record];
+  }
+
+  const char* getValue(size_t record, size_t& length) const {
+    length = valueOffsets[record + 1] - valueOffsets[record];
+    return valueData.data() + valueOffsets[record];
+  }
+
+  void clear() {
+    keyData.clear();
+    valueData.clear();
+    keyOffsets.resize(1);
+    valueOffsets.resize(1);
+  }
+};
+
+/**
+ * Passes the output of a BatchMapper on to the task's partitioner, combiner
+ * or output.
+ */
+class BatchEmitter {
+private:
+  MapContext& context;
+public:
+  BatchEmitter(MapContext& _context): context(_context) {}
+
+  void emit(const char* key, size_t keyLength,
+            const char* value, size_t valueLength) {
+    context.emit(key, keyLength, value, valueLength);
+  }
+
+  void emit(const std::string& key, const std::string& value) {
+    context.emit(key, value);
+  }
+};
+
+/**
+ * A mapper that is given its input many records at a time, instead of
+ * through one call of Mapper::map per record. The records of a batch are
+ * laid out as columns, which suits mappers that scan all of the values in
+ * one loop. The context is there for the job's configuration, counters and
+ * status; its current key and value are not set during map.
+ */
+class BatchMapper: public Closable {
+public:
+  virtual void map(MapContext& context, const RecordBatch& input,
+                   BatchEmitter& output) = 0;
+};
+
 /**
  * The application's reducer class to do reduce.
  */
@@ -174,6 +317,15 @@ public:
 class Partitioner {
 public:
   virtual int partition(const std::string& key, int numOfReduces) = 0;
+
+  /**
+   * Partition a key given as raw bytes. Override this to avoid building a
+   * string for every record emitted through the raw emit.
+   */
+  virtual int partition(const char* key, size_t keyLength, int numOfReduces) {
+    return partition(std::string(key, keyLength), numOfReduces);
+  }
+
   virtual ~Partitioner() {}
 };
 
@@ -182,9 +334,29 @@ public:
  * they can define RecordReaders in C++.
  */
 class RecordReader: public Closable {
+private:
+  std::string keyBuffer;
+  std::string valueBuffer;
 public:
   virtual bool next(std::string& key, std::string& value) = 0;
 
+  /**
+   * Read the next record as raw bytes, which must stay valid until the next
+   * call. Readers that can hand out their records without copying them
+   * should override this.
+   */
+  virtual bool next(const char*& key, size_t& keyLength,
+                    const char*& value, size_t& valueLength) {
+    if (!next(keyBuffer, valueBuffer)) {
+      return false;
+    }
+    key = keyBuffer.data();
+    keyLength = keyBuffer.length();
+    value = valueBuffer.data();
+    valueLength = valueBuffer.length();
+    return true;
+  }
+
   /**
    * The progress of the record reader through the split as a value between
    * 0.0 and 1.0.
@@ -199,6 +371,14 @@ class RecordWriter: public Closable {
 public:
   virtual void emit(const std::string& key,
                     const std::string& value) = 0;
+
+  /**
+   * Write a record given as raw bytes.
+   */
+  virtual void emit(const char* key, size_t keyLength,
+                    const char* value, size_t valueLength) {
+    emit(std::string(key, keyLength), std::string(value, valueLength));
+  }
 };
 
 /**
@@ -209,6 +389,14 @@ public:
   virtual Mapper* createMapper(MapContext& context) const = 0;
   virtual Reducer* createReducer(ReduceContext& context) const = 0;
 
+  /**
+   * Create a mapper that takes its input in batches.
+   * @return the new mapper or NULL, if createMapper should be used instead
+   */
+  virtual BatchMapper* createBatchMapper(MapContext& context) const {
+    return NULL;
+  }
+
   /**
    * Create a combiner, if this application has one.
    * @return the new combiner or NULL, if one is not needed
@@ -244,13 +432,25 @@ public:
     return NULL;
   }
 
+  /**
+   * Set up state that is shared by all of the tasks run by this process,
+   * such as a model or dictionary that the mappers look things up in. It is
+   * called once, with the configuration of the first task, before any of
+   * the objects above are created. Since a process may run several tasks
+   * when "mapreduce.pipes.task.reuse" is set, expensive setup belongs here
+   * rather than in the mapper's or reducer's constructor.
+   */
+  virtual void initialize(const JobConf& conf) const {}
+
   virtual ~Factory() {}
 };
 
 /**
  * Run the assigned task in the framework.
  * The user's main function should set the various functions using the 
- * set* functions above and then call this.
+ * set* functions above and then call this. If the job sets
+ * "mapreduce.pipes.task.reuse", the process keeps running tasks until the
+ * framework tells it to stop.
  * @return true, if the task succeeded.
  */
 bool runTask(const Factory& factory);
@@ -0,0 +1,267 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef HADOOP_PIPES_SEQUENCE_FILE_HH
+#define HADOOP_PIPES_SEQUENCE_FILE_HH
+
+#include "hadoop/Codec.hh"
+#include "hadoop/Pipes.hh"
+
+#include <stdint.h>
+#include <map>
+#include <string>
+
+/**
+ * Reads and writes Hadoop's SequenceFile format, version 6, uncompressed,
+ * record compressed or block compressed, in files that Java's
+ * SequenceFile.Reader and Writer can read and write.
+ *
+ * Keys and values are handled as the bytes of their serialized Writables,
+ * so the C++ side needn't know the classes. A Text is its VInt length and
+ * bytes, as written by HadoopUtils::serializeString.
+ */
+namespace HadoopPipes {
+
+extern const std::string TEXT_CLASS;
+extern const std::string BYTES_WRITABLE_CLASS;
+
+class SequenceFileWriter {
+public:
+  enum CompressionType { NONE, RECORD, BLOCK };
+
+private:
+  std::string path;
+  int fd;
+  HadoopUtils::FdOutStream* stream;
+  uint64_t position;
+  uint64_t lastSyncPosition;
+  char sync[16];
+  CompressionType compression;
+  const Codec* codec;
+  size_t blockSize;
+  /**
+   * The records buffered for the next block, or the compressed value of
+   * a record.
+   */
+  std::string keyLengths;
+  std::string keys;
+  std::string valueLengths;
+  std::string values;
+  uint32_t blockRecords;
+  std::string compressed;
+
+  void write(const void* data, size_t length);
+  void writeInt(uint32_t value);
+  void writeVLong(int64_t value);
+  void writeString(const std::string& value);
+  void writeSync();
+  void writeCompressed(const std::string& data);
+  void writeBlock();
+public:
+  /**
+   * Create a file, replacing any that is there.
+   * @param codecClass the Java class of the codec, if it is compressed
+   * @param metadata the file's metadata, as Text keys and values
+   * @throws HadoopUtils::Error if it can't be created
+   */
+  SequenceFileWriter(const std::string& path, const std::string& keyClass,
+                     const std::string& valueClass,
+                     CompressionType compression = NONE,
+                     const std::string& codecClass = Codec::DEFAULT_CODEC,
+                     const std::map<std::string, std::string>& metadata =
+                       std::map<std::string, std::string>());
+
+  /**
+   * Set the amount of key and value data buffered for a compressed block,
+   * which is "io.seqfile.compress.blocksize" in Java, 1000000 by default.
+   */
+  void setBlockSize(size_t bytes) {
+    blockSize = bytes;
+  }
+
+  /**
+   * Append a record, given as its serialized key and value.
+   */
+  void append(const char* key, size_t keyLength,
+              const char* value, size_t valueLength);
+
+  /**
+   * Write any buffered block and close the file.
+   */
+  void close();
+
+  ~SequenceFileWriter();
+};
+
+class SequenceFileReader {
+private:
+  std::string path;
+  const char* data;
+  size_t length;
+  size_t position;
+  size_t headerEnd;
+  /**
+   * The file offsets of the start and end of the split.
+   */
+  size_t start;
+  size_t end;
+  bool done;
+  std::string keyClass;
+  std::string valueClass;
+  bool compressed;
+  bool blockCompressed;
+  const Codec* codec;
+  std::map<std::string, std::string> metadata;
+  char sync[16];
+  /**
+   * The decompressed value of a record, or the decompressed block.
+   */
+  std::string value;
+  std::string keyLengths;
+  std::string keys;
+  std::string valueLengths;
+  std::string values;
+  const char* keyLengthPosition;
+  const char* keyPosition;
+  const char* valueLengthPosition;
+  const char* valuePosition;
+  uint32_t blockRecords;
+
+  void check(size_t bytes);
+  uint32_t readInt();
+  int64_t readVLong();
+  void readString(std::string& result);
+  void readSync();
+  void readBuffer(std::string& result);
+  void readBlock();
+  void seekToSync(size_t offset);
+public:
+  /**
+   * Read the records of a split of a file. Unless it is the first split,
+   * it starts at the first sync mark at or after start, and it ends with the
+   * last record before the first sync mark at or after start + length, so
+   * that the splits of a file read each record once, as they do in Java.
+   * @param length the length of the split, or -1 for the rest of the file
+   * @throws HadoopUtils::Error if it can't be read or isn't a SequenceFile
+   */
+  SequenceFileReader(const std::string& path, int64_t start = 0,
+                     int64_t length = -1);
+
+  const std::string& getKeyClass() const {
+    return keyClass;
+  }
+
+  const std::string& getValueClass() const {
+    return valueClass;
+  }
+
+  bool isCompressed() const {
+    return compressed;
+  }
+
+  bool isBlockCompressed() const {
+    return blockCompressed;
+  }
+
+  /**
+   * Get the codec, or NULL if the file isn't compressed.
+   */
+  const Codec* getCodec() const {
+    return codec;
+  }
+
+  const std::map<std::string, std::string>& getMetadata() const {
+    return metadata;
+  }
+
+  /**
+   * Read the next record as its serialized key and value, which stay valid
+   * until the next call.
+   * @throws HadoopUtils::Error if the file is corrupt
+   */
+  bool next(const char*& key, size_t& keyLength,
+            const char*& value, size_t& valueLength);
+
+  /**
+   * The part of the split that has been read, from 0.0 to 1.0.
+   */
+  float getProgress() const;
+
+  ~SequenceFileReader();
+};
+
+/**
+ * Reads the SequenceFile of the task's input split. Text and BytesWritable
+ * keys and values are given as their bytes, and any other Writable as its
+ * serialized form, which is how the Java side would send them.
+ */
+class SequenceFileRecordReader: public RecordReader {
+private:
+  SequenceFileReader* reader;
+  bool textKeys;
+  bool textValues;
+  bool bytesKeys;
+  bool bytesValues;
+
+  void init();
+public:
+  SequenceFileRecordReader(MapContext& context);
+
+  SequenceFileRecordReader(const std::string& filename, int64_t start = 0,
+                           int64_t length = -1);
+
+  virtual bool next(std::string& key, std::string& value);
+
+  virtual bool next(const char*& key, size_t& keyLength,
+                    const char*& value, size_t& valueLength);
+
+  virtual float getProgress();
+
+  virtual void close();
+
+  virtual ~SequenceFileRecordReader();
+};
+
+/**
+ * Writes the output of the task to a SequenceFile of Text keys and values,
+ * "part-NNNNN" in "mapreduce.task.output.dir". It is compressed as the Java
+ * SequenceFileOutputFormat would be, with
+ * "mapreduce.output.fileoutputformat.compress",
+ * "mapreduce.output.fileoutputformat.compress.type" and
+ * "mapreduce.output.fileoutputformat.compress.codec".
+ */
+class SequenceFileRecordWriter: public RecordWriter {
+private:
+  SequenceFileWriter* writer;
+  std::string key;
+  std::string value;
+public:
+  SequenceFileRecordWriter(ReduceContext& context);
+
+  virtual void emit(const std::string& key, const std::string& value);
+
+  virtual void emit(const char* key, size_t keyLength,
+                    const char* value, size_t valueLength);
+
+  virtual void close();
+
+  virtual ~SequenceFileRecordWriter();
+};
+
+}
+
+#endif
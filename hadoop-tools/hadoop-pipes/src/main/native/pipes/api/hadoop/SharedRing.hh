@@ -0,0 +1,167 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef HADOOP_PIPES_SHARED_RING_HH
+#define HADOOP_PIPES_SHARED_RING_HH
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <sys/types.h>
+
+/**
+ * The shared memory transport of the binary protocol. When the task sets
+ * mapreduce.pipes.command.ring to the name of a ring file, the child reads
+ * its commands from one ring in the file and writes its messages to the
+ * other, instead of using a socket. The task creates the file, feeds the
+ * down ring and drains the up ring.
+ */
+namespace HadoopPipes {
+
+/**
+ * The control block of one ring of the shared memory transport. The
+ * producer only changes head and the consumer only changes tail, and
+ * each is on its own cache line.
+ */
+struct RingControl {
+  /**
+   * The number of bytes written to the ring so far.
+   */
+  volatile uint64_t head;
+  char headPadding[56];
+  /**
+   * The number of bytes read from the ring so far.
+   */
+  volatile uint64_t tail;
+  char tailPadding[56];
+  /**
+   * Futex words that are bumped when data or space is made available
+   * while the other side is waiting for it.
+   */
+  volatile uint32_t dataFutex;
+  volatile uint32_t spaceFutex;
+  volatile uint32_t readerWaiting;
+  volatile uint32_t writerWaiting;
+  /**
+   * Set by the producer once it will not write any more.
+   */
+  volatile uint32_t closed;
+  char controlPadding[44];
+};
+
+/**
+ * The start of the file that holds the shared memory transport. It is
+ * followed, at RING_HEADER_SIZE, by the ring of commands to the child and
+ * then the ring of messages from the child, each ringSize bytes long.
+ * Everything is in the host's byte order.
+ */
+struct RingFileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t ringSize;
+  char headerPadding[48];
+  RingControl down;
+  RingControl up;
+};
+
+static const uint32_t RING_MAGIC = 0x50524e47;
+static const uint32_t RING_VERSION = 1;
+static const size_t RING_HEADER_SIZE = 4096;
+
+/**
+ * One direction of the shared memory transport: a ring of bytes with a
+ * single producer and a single consumer, which block on a futex when the
+ * ring is empty or full.
+ */
+class SharedRing {
+private:
+  RingControl* control;
+  char* data;
+  uint64_t size;
+  pid_t parent;
+
+  void checkParent();
+public:
+  SharedRing(RingControl* control, char* data, uint64_t size);
+
+  /**
+   * Read at least one and at most len bytes, waiting until some are
+   * written.
+   * @return the number of bytes read, or 0 once the producer has closed
+   *   the ring and everything has been read
+   */
+  size_t read(char* buf, size_t len);
+
+  /**
+   * Write all of buf, waiting for space whenever the ring is full.
+   */
+  void write(const char* buf, size_t len);
+
+  /**
+   * Tell the consumer that nothing more will be written.
+   */
+  void close();
+};
+
+/**
+ * The memory mapped file holding the rings of the shared memory
+ * transport.
+ */
+class SharedRingFile {
+private:
+  void* address;
+  size_t length;
+  SharedRing* down;
+  SharedRing* up;
+
+public:
+  /**
+   * Map a ring file that the task has created.
+   * @throws HadoopUtils::Error if the file can't be mapped or isn't a ring
+   *   file
+   */
+  SharedRingFile(const std::string& filename);
+
+  /**
+   * Create a ring file with empty rings, replacing any that is there, and
+   * map it. This is the task's side of the transport.
+   * @param ringSize the size of each ring, a power of two
+   * @throws HadoopUtils::Error if the file can't be created
+   */
+  static SharedRingFile* create(const std::string& filename,
+                                uint64_t ringSize);
+
+  /**
+   * The ring of commands from the task to the child.
+   */
+  SharedRing* getDownRing() {
+    return down;
+  }
+
+  /**
+   * The ring of messages from the child to the task.
+   */
+  SharedRing* getUpRing() {
+    return up;
+  }
+
+  ~SharedRingFile();
+};
+
+}
+
+#endif
@@ -0,0 +1,340 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef HADOOP_PIPES_SKETCHES_HH
+#define HADOOP_PIPES_SKETCHES_HH
+
+#include "hadoop/Pipes.hh"
+
+#include <stdint.h>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Mergeable sketches, which summarize the values of a key in a small, fixed
+ * amount of space, and the combiner and reducer that compute them.
+ *
+ * A mapper emits its items as ordinary values. The SketchCombiner turns the
+ * values of each key into a sketch and emits the sketch's serialized state,
+ * so only a few KB per key are shuffled instead of every item, and the
+ * SketchReducer merges the states and emits the result:
+ *
+ *   TemplateFactory<MyMapper, SketchReducer<HyperLogLog>, void,
+ *                   SketchCombiner<HyperLogLog> >
+ *
+ * A serialized state starts with a four byte header, "\0SK" and the type
+ * of sketch, and any value that doesn't is taken as an item, so the
+ * combiner may run any number of times, or not at all.
+ *
+ * Each sketch reads its parameters from the job configuration, under
+ * "mapreduce.pipes.sketch.*", and all of the states merged together must
+ * come from sketches with the same parameters.
+ */
+namespace HadoopPipes {
+
+/**
+ * Whether a value is the serialized state of the given type of sketch.
+ */
+bool isSketchState(const char* value, size_t length, char type);
+
+/**
+ * Counts the distinct items of a key, to within about 1.04 / sqrt(2^p),
+ * using 2^p one byte registers. Small counts are serialized sparsely.
+ *
+ * Parameter: "mapreduce.pipes.sketch.hll.precision", p, from 4 to 18
+ * (default 14, which is 16KB and 0.8%).
+ * Result: the estimated number of distinct items.
+ */
+class HyperLogLog {
+private:
+  int precision;
+  std::vector<uint8_t> registers;
+
+  void addHash(uint64_t hash);
+public:
+  static const char TYPE = 'H';
+
+  HyperLogLog(int precision = 14);
+  HyperLogLog(const JobConf& conf);
+
+  void add(const char* item, size_t length);
+
+  void merge(const HyperLogLog& other);
+
+  /**
+   * Merge a serialized state. An empty sketch takes on the state's
+   * precision.
+   * @throws HadoopUtils::Error if the state is bad or doesn't match
+   */
+  void merge(const char* state, size_t length);
+
+  void serialize(std::string& state) const;
+
+  uint64_t estimate() const;
+
+  void summarize(std::string& result) const;
+};
+
+/**
+ * Estimates how often each item occurs, never too low, and too high by at
+ * most e / width of the total with probability 1 - 1 / e^depth.
+ *
+ * Parameters: "mapreduce.pipes.sketch.cms.width" (default 2048) and
+ * "mapreduce.pipes.sketch.cms.depth" (default 4).
+ * Result: the total count. The sketch can only answer queries about items,
+ * so it is usually written out with "mapreduce.pipes.sketch.output" set to
+ * "state" and read back with merge.
+ */
+class CountMinSketch {
+private:
+  int width;
+  int depth;
+  uint64_t total;
+  std::vector<uint64_t> counts;
+public:
+  static const char TYPE = 'C';
+
+  CountMinSketch(int width = 2048, int depth = 4);
+  CountMinSketch(const JobConf& conf);
+
+  void add(const char* item, size_t length, uint64_t count = 1);
+
+  void merge(const CountMinSketch& other);
+
+  /**
+   * Merge a serialized state. An empty sketch takes on the state's width
+   * and depth.
+   * @throws HadoopUtils::Error if the state is bad or doesn't match
+   */
+  void merge(const char* state, size_t length);
+
+  void serialize(std::string& state) const;
+
+  uint64_t estimate(const char* item, size_t length) const;
+
+  uint64_t getTotal() const {
+    return total;
+  }
+
+  void summarize(std::string& result) const;
+};
+
+/**
+ * Finds the most frequent items with the Space-Saving algorithm, which
+ * keeps a fixed number of counters. An item's count is never too low, and
+ * too high by at most its error, which is also no more than the total
+ * divided by the capacity.
+ *
+ * Parameters: "mapreduce.pipes.sketch.topk.capacity", the number of
+ * counters (default 1000), and "mapreduce.pipes.sketch.topk" (default 10).
+ * Result: the top items as "item:count" separated by commas, with ",", ":"
+ * and "\" in the items quoted as by HadoopUtils::quoteString.
+ */
+class SpaceSaving {
+public:
+  struct Counter {
+    uint64_t count;
+    uint64_t error;
+  };
+private:
+  size_t capacity;
+  size_t top;
+  std::map<std::string, Counter> counters;
+  /**
+   * The counters by count, so the smallest can be replaced.
+   */
+  std::set<std::pair<uint64_t, std::string> > byCount;
+public:
+  static const char TYPE = 'S';
+
+  SpaceSaving(size_t capacity = 1000, size_t top = 10);
+  SpaceSaving(const JobConf& conf);
+
+  void add(const char* item, size_t length) {
+    add(std::string(item, length), 1, 0);
+  }
+
+  /**
+   * Add an item that was seen count times, of which error may not have
+   * been it.
+   */
+  void add(const std::string& item, uint64_t count, uint64_t error);
+
+  void merge(const SpaceSaving& other);
+
+  /**
+   * Merge a serialized state.
+   * @throws HadoopUtils::Error if the state is bad
+   */
+  void merge(const char* state, size_t length);
+
+  void serialize(std::string& state) const;
+
+  /**
+   * Get the items with the highest counts, highest first.
+   */
+  void getTop(size_t n, std::vector<std::pair<std::string, Counter> >& result)
+    const;
+
+  void summarize(std::string& result) const;
+};
+
+/**
+ * Estimates quantiles of numbers with a merging t-digest, which keeps
+ * clusters of nearby values that are smaller towards either end of the
+ * distribution, so extreme quantiles stay accurate.
+ *
+ * Items are decimal numbers. Parameters:
+ * "mapreduce.pipes.sketch.tdigest.compression", which bounds the number of
+ * clusters to about twice its value (default 100), and
+ * "mapreduce.pipes.sketch.quantiles" (default "0.5,0.9,0.99").
+ * Result: the estimates of the quantiles, separated by commas.
+ */
+class TDigest {
+private:
+  struct Centroid {
+    double mean;
+    uint64_t weight;
+
+    bool operator<(const Centroid& other) const {
+      return mean < other.mean;
+    }
+  };
+  double compression;
+  std::vector<double> quantiles;
+  std::vector<Centroid> centroids;
+  std::vector<Centroid> buffer;
+  uint64_t count;
+  double min;
+  double max;
+
+  void addCentroid(double mean, uint64_t weight);
+  void compress();
+public:
+  static const char TYPE = 'T';
+
+  TDigest(double compression = 100);
+  TDigest(const JobConf& conf);
+
+  /**
+   * Add an item, which must be a decimal number.
+   * @throws HadoopUtils::Error if it isn't
+   */
+  void add(const char* item, size_t length);
+
+  void add(double value, uint64_t weight = 1) {
+    addCentroid(value, weight);
+  }
+
+  void merge(const TDigest& other);
+
+  /**
+   * Merge a serialized state.
+   * @throws HadoopUtils::Error if the state is bad
+   */
+  void merge(const char* state, size_t length);
+
+  void serialize(std::string& state) const;
+
+  /**
+   * Estimate the value below which the given fraction of the values fall.
+   * @return the estimate, or NaN if there are no values
+   */
+  double quantile(double q);
+
+  uint64_t getCount() const {
+    return count;
+  }
+
+  void summarize(std::string& result);
+};
+
+/**
+ * Add the values of the current key to a sketch, merging those that are
+ * serialized states and adding the rest as items.
+ */
+template <class Sketch>
+void addSketchValues(Sketch& sketch, ReduceContext& context) {
+  while (context.nextValue()) {
+    size_t length;
+    const char* value = context.getInputValue(length);
+    if (isSketchState(value, length, Sketch::TYPE)) {
+      sketch.merge(value, length);
+    } else {
+      sketch.add(value, length);
+    }
+  }
+}
+
+/**
+ * A combiner that replaces the values of each key with one sketch of them.
+ */
+template <class Sketch>
+class SketchCombiner: public Reducer {
+private:
+  const JobConf* jobConf;
+  std::string state;
+public:
+  SketchCombiner(TaskContext& context): jobConf(context.getJobConf()) {}
+
+  void reduce(ReduceContext& context) {
+    Sketch sketch(*jobConf);
+    addSketchValues(sketch, context);
+    sketch.serialize(state);
+    size_t keyLength;
+    const char* key = context.getInputKey(keyLength);
+    context.emit(key, keyLength, state.data(), state.length());
+  }
+};
+
+/**
+ * A reducer that computes the sketch of each key's values and emits its
+ * result, or its serialized state if "mapreduce.pipes.sketch.output" is
+ * "state".
+ */
+template <class Sketch>
+class SketchReducer: public Reducer {
+private:
+  const JobConf* jobConf;
+  bool emitState;
+  std::string result;
+public:
+  SketchReducer(TaskContext& context): jobConf(context.getJobConf()) {
+    emitState = jobConf->hasKey("mapreduce.pipes.sketch.output") &&
+      jobConf->get("mapreduce.pipes.sketch.output") == "state";
+  }
+
+  void reduce(ReduceContext& context) {
+    Sketch sketch(*jobConf);
+    addSketchValues(sketch, context);
+    if (emitState) {
+      sketch.serialize(result);
+    } else {
+      sketch.summarize(result);
+    }
+    size_t keyLength;
+    const char* key = context.getInputKey(keyLength);
+    context.emit(key, keyLength, result.data(), result.length());
+  }
+};
+
+}
+
+#endif
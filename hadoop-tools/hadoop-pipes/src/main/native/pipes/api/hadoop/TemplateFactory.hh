@@ -20,11 +20,49 @@
 
 namespace HadoopPipes {
 
+  /**
+   * Whether the mapper class implements BatchMapper.
+   */
+  template <class mapper>
+  class IsBatchMapper {
+  private:
+    static char test(const BatchMapper*);
+    static long test(...);
+  public:
+    static const bool value = sizeof(test((mapper*) NULL)) == sizeof(char);
+  };
+
+  /**
+   * Creates the mapper through whichever interface it implements.
+   */
+  template <class mapper, bool isBatch = IsBatchMapper<mapper>::value>
+  struct MapperCreator {
+    static Mapper* createMapper(MapContext& context) {
+      return new mapper(context);
+    }
+    static BatchMapper* createBatchMapper(MapContext& context) {
+      return NULL;
+    }
+  };
+
+  template <class mapper>
+  struct MapperCreator<mapper, true> {
+    static Mapper* createMapper(MapContext& context) {
+      return NULL;
+    }
+    static BatchMapper* createBatchMapper(MapContext& context) {
+      return new mapper(context);
+    }
+  };
+
   template <class mapper, class reducer>
   class TemplateFactory2: public Factory {
   public:
     Mapper* createMapper(MapContext& context) const {
-      return new mapper(context);
+      return MapperCreator<mapper>::createMapper(context);
+    }
+    BatchMapper* createBatchMapper(MapContext& context) const {
+      return MapperCreator<mapper>::createBatchMapper(context);
     }
     Reducer* createReducer(ReduceContext& context) const {
       return new reducer(context);
@@ -0,0 +1,254 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef HADOOP_PIPES_TYPED_PIPES_HH
+#define HADOOP_PIPES_TYPED_PIPES_HH
+
+#include "hadoop/Pipes.hh"
+#include "hadoop/SerialUtils.hh"
+
+#include <string>
+#include <stdint.h>
+#include <string.h>
+
+namespace HadoopPipes {
+
+  /**
+   * Converts keys and values of type T to and from the bytes that are
+   * passed between the application and the framework. It is only defined
+   * for the types below, so any other type is rejected by the compiler.
+   * The encodings are the ones of the matching Java types:
+   *   std::string - Text or BytesWritable
+   *   int32_t - IntWritable
+   *   int64_t - LongWritable
+   *   double - DoubleWritable
+   */
+  template <class T>
+  struct Codec;
+
+  inline void encodeBigEndian(uint64_t t, char* bytes, size_t length) {
+    for(size_t i=length; i > 0; --i) {
+      bytes[i - 1] = (char) (t & 0xff);
+      t >>= 8;
+    }
+  }
+
+  inline uint64_t decodeBigEndian(const char* bytes, size_t length) {
+    uint64_t t = 0;
+    for(size_t i=0; i < length; ++i) {
+      t = (t << 8) | (unsigned char) bytes[i];
+    }
+    return t;
+  }
+
+  template <>
+  struct Codec<std::string> {
+    /**
+     * The bytes of a value, ready to be emitted.
+     */
+    class Encoded {
+    private:
+      const std::string& value;
+    public:
+      Encoded(const std::string& _value): value(_value) {}
+      const char* data() const {
+        return value.data();
+      }
+      size_t length() const {
+        return value.length();
+      }
+    };
+
+    static void decode(const char* data, size_t length, std::string& t) {
+      t.assign(data, length);
+    }
+  };
+
+  /**
+   * The codec of the integer types, which are written as big endian
+   * values of their own width.
+   */
+  template <class T>
+  struct IntegerCodec {
+    class Encoded {
+    private:
+      char bytes[sizeof(T)];
+    public:
+      Encoded(T t) {
+        encodeBigEndian((uint64_t) t, bytes, sizeof(T));
+      }
+      const char* data() const {
+        return bytes;
+      }
+      size_t length() const {
+        return sizeof(T);
+      }
+    };
+
+    static void decode(const char* data, size_t length, T& t) {
+      HADOOP_ASSERT(length == sizeof(T),
+                    "wrong number of bytes for an integer");
+      t = (T) decodeBigEndian(data, sizeof(T));
+    }
+  };
+
+  template <>
+  struct Codec<int32_t>: public IntegerCodec<int32_t> {
+  };
+
+  template <>
+  struct Codec<int64_t>: public IntegerCodec<int64_t> {
+  };
+
+  template <>
+  struct Codec<double> {
+    class Encoded {
+    private:
+      char bytes[8];
+    public:
+      Encoded(double t) {
+        uint64_t bits;
+        memcpy(&bits, &t, sizeof(bits));
+        encodeBigEndian(bits, bytes, sizeof(bytes));
+      }
+      const char* data() const {
+        return bytes;
+      }
+      size_t length() const {
+        return sizeof(bytes);
+      }
+    };
+
+    static void decode(const char* data, size_t length, double& t) {
+      HADOOP_ASSERT(length == 8, "wrong number of bytes for a double");
+      uint64_t bits = decodeBigEndian(data, 8);
+      memcpy(&t, &bits, sizeof(t));
+    }
+  };
+
+  /**
+   * Emits typed keys and values through a task's context.
+   */
+  template <class K, class V>
+  class TypedOutput {
+  private:
+    TaskContext& context;
+  public:
+    TypedOutput(TaskContext& _context): context(_context) {}
+
+    void emit(const K& key, const V& value) {
+      typename Codec<K>::Encoded keyBytes(key);
+      typename Codec<V>::Encoded valueBytes(value);
+      context.emit(keyBytes.data(), keyBytes.length(),
+                   valueBytes.data(), valueBytes.length());
+    }
+
+    /**
+     * Get the task's context, for its counters, status and configuration.
+     */
+    TaskContext& getContext() {
+      return context;
+    }
+  };
+
+  /**
+   * A Mapper whose input key and value are decoded as K1 and V1, and which
+   * emits keys of type K2 and values of type V2.
+   */
+  template <class K1, class V1, class K2, class V2>
+  class TypedMapper: public Mapper {
+  private:
+    K1 key;
+    V1 value;
+  public:
+    virtual void map(const K1& key, const V1& value,
+                     TypedOutput<K2, V2>& output) = 0;
+
+    virtual void map(MapContext& context) {
+      size_t length;
+      const char* data = context.getInputKey(length);
+      Codec<K1>::decode(data, length, key);
+      data = context.getInputValue(length);
+      Codec<V1>::decode(data, length, value);
+      TypedOutput<K2, V2> output(context);
+      map(key, value, output);
+    }
+  };
+
+  /**
+   * The values of the current key of a TypedReducer, decoded one at a time.
+   */
+  template <class V>
+  class TypedValues {
+  private:
+    ReduceContext* context;
+    V value;
+  public:
+    TypedValues(): context(NULL) {}
+
+    /**
+     * Start on the values of the context's current key.
+     */
+    void reset(ReduceContext& _context) {
+      context = &_context;
+    }
+
+    /**
+     * Move to the next value.
+     * @return false if there are no more values
+     */
+    bool next() {
+      if (!context->nextValue()) {
+        return false;
+      }
+      size_t length;
+      const char* data = context->getInputValue(length);
+      Codec<V>::decode(data, length, value);
+      return true;
+    }
+
+    const V& get() const {
+      return value;
+    }
+  };
+
+  /**
+   * A Reducer whose input keys and values are decoded as K2 and V2, and
+   * which emits keys of type K3 and values of type V3. It may also be used
+   * as a combiner when K3 and V3 are the same as K2 and V2.
+   */
+  template <class K2, class V2, class K3, class V3>
+  class TypedReducer: public Reducer {
+  private:
+    K2 key;
+    TypedValues<V2> values;
+  public:
+    virtual void reduce(const K2& key, TypedValues<V2>& values,
+                        TypedOutput<K3, V3>& output) = 0;
+
+    virtual void reduce(ReduceContext& context) {
+      size_t length;
+      const char* data = context.getInputKey(length);
+      Codec<K2>::decode(data, length, key);
+      values.reset(context);
+      TypedOutput<K3, V3> output(context);
+      reduce(key, values, output);
+    }
+  };
+}
+
+#endif
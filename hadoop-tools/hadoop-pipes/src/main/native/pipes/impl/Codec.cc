@@ -0,0 +1,541 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hadoop/Codec.hh"
+#include "hadoop/StringUtils.hh"
+
+#include "lz4.h"
+
+#include <algorithm>
+
+#include <pthread.h>
+#include <string.h>
+#include <zlib.h>
+
+#ifdef HADOOP_SNAPPY_LIBRARY
+#include <dlfcn.h>
+#include <snappy-c.h>
+#endif
+
+using std::string;
+
+using namespace HadoopUtils;
+
+namespace HadoopPipes {
+
+  const string Codec::DEFAULT_CODEC("org.apache.hadoop.io.compress.DefaultCodec");
+
+  /**
+   * The size of the buffer that zlib output goes through.
+   */
+  static const size_t ZLIB_BUFFER_SIZE = 64 * 1024;
+
+  /**
+   * The default buffer size of Java's Lz4Codec and SnappyCodec, which is
+   * the most uncompressed data in one block.
+   */
+  static const size_t BLOCK_BUFFER_SIZE = 256 * 1024;
+
+  static void writeJavaInt(OutStream& out, uint32_t value) {
+    char bytes[4];
+    for(int i=0; i < 4; ++i) {
+      bytes[i] = (char) (value >> (24 - 8 * i));
+    }
+    out.write(bytes, 4);
+  }
+
+  void Codec::compress(const char* data, size_t length, string& result)
+    const {
+    result.clear();
+    StringOutStream stream(result);
+    Compressor* compressor = createCompressor(stream);
+    try {
+      compressor->write(data, length);
+      compressor->finish();
+    } catch (Error& e) {
+      delete compressor;
+      throw;
+    }
+    delete compressor;
+  }
+
+  void Codec::decompress(const char* data, size_t length, string& result)
+    const {
+    result.clear();
+    Decompressor* decompressor = createDecompressor(data, length);
+    try {
+      size_t done = 0;
+      result.resize(std::max(length * 2, (size_t) 64));
+      while (true) {
+        if (done == result.length()) {
+          result.resize(result.length() * 2);
+        }
+        size_t bytes = decompressor->read(&result[done],
+                                          result.length() - done);
+        if (bytes == 0) {
+          break;
+        }
+        done += bytes;
+      }
+      result.resize(done);
+    } catch (Error& e) {
+      delete decompressor;
+      throw;
+    }
+    delete decompressor;
+  }
+
+  class ZlibCompressor: public Compressor {
+  private:
+    OutStream& out;
+    z_stream stream;
+    char* buffer;
+    bool finished;
+
+    void deflateAll(int flush) {
+      int result;
+      do {
+        stream.next_out = (Bytef*) buffer;
+        stream.avail_out = ZLIB_BUFFER_SIZE;
+        result = deflate(&stream, flush);
+        HADOOP_ASSERT(result != Z_STREAM_ERROR, "zlib compression failed");
+        if (stream.avail_out < ZLIB_BUFFER_SIZE) {
+          out.write(buffer, ZLIB_BUFFER_SIZE - stream.avail_out);
+        }
+      } while (stream.avail_out == 0 ||
+               (flush == Z_FINISH && result != Z_STREAM_END));
+    }
+
+  public:
+    ZlibCompressor(OutStream& _out, int windowBits): out(_out) {
+      memset(&stream, 0, sizeof(stream));
+      HADOOP_ASSERT(deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                                 windowBits, 8, Z_DEFAULT_STRATEGY) == Z_OK,
+                    "can't initialize zlib");
+      buffer = new char[ZLIB_BUFFER_SIZE];
+      finished = false;
+    }
+
+    virtual void write(const char* data, size_t length) {
+      HADOOP_ASSERT(!finished, "write to a finished compressor");
+      // avail_in is 32 bits, so feed big writes in pieces
+      while (length > 0) {
+        uInt piece = (uInt) std::min(length, (size_t) 1 << 30);
+        stream.next_in = (Bytef*) data;
+        stream.avail_in = piece;
+        deflateAll(Z_NO_FLUSH);
+        data += piece;
+        length -= piece;
+      }
+    }
+
+    virtual void finish() {
+      if (!finished) {
+        stream.next_in = NULL;
+        stream.avail_in = 0;
+        deflateAll(Z_FINISH);
+        finished = true;
+      }
+    }
+
+    virtual ~ZlibCompressor() {
+      deflateEnd(&stream);
+      delete [] buffer;
+    }
+  };
+
+  /**
+   * Inflates zlib or gzip streams, and any that follow them, as Java's
+   * decompressor streams do for concatenated files.
+   */
+  class ZlibDecompressor: public Decompressor {
+  private:
+    z_stream stream;
+    const char* data;
+    const char* end;
+    bool streamDone;
+
+  public:
+    ZlibDecompressor(const char* _data, size_t length) {
+      memset(&stream, 0, sizeof(stream));
+      // 32 adds detection of the gzip header
+      HADOOP_ASSERT(inflateInit2(&stream, 15 + 32) == Z_OK,
+                    "can't initialize zlib");
+      data = _data;
+      end = _data + length;
+      streamDone = false;
+    }
+
+    virtual size_t read(char* buffer, size_t length) {
+      length = std::min(length, (size_t) 1 << 30);
+      stream.next_out = (Bytef*) buffer;
+      stream.avail_out = (uInt) length;
+      while (stream.avail_out == length) {
+        if (streamDone) {
+          if (data == end) {
+            return 0;
+          }
+          HADOOP_ASSERT(inflateReset(&stream) == Z_OK, "can't reset zlib");
+          streamDone = false;
+        }
+        size_t available = std::min((size_t) (end - data), (size_t) 1 << 30);
+        stream.next_in = (Bytef*) data;
+        stream.avail_in = (uInt) available;
+        int result = inflate(&stream, Z_NO_FLUSH);
+        data += available - stream.avail_in;
+        if (result == Z_STREAM_END) {
+          streamDone = true;
+        } else {
+          HADOOP_ASSERT(result == Z_OK || (result == Z_BUF_ERROR &&
+                                           data != end),
+                        result == Z_BUF_ERROR ? "truncated zlib stream" :
+                        "corrupt zlib stream");
+        }
+      }
+      return length - stream.avail_out;
+    }
+
+    virtual ~ZlibDecompressor() {
+      inflateEnd(&stream);
+    }
+  };
+
+  class ZlibCodec: public Codec {
+  private:
+    string className;
+    int windowBits;
+  public:
+    ZlibCodec(const string& _className, int _windowBits):
+      className(_className), windowBits(_windowBits) {}
+
+    virtual const string& getClassName() const {
+      return className;
+    }
+
+    virtual Compressor* createCompressor(OutStream& out) const {
+      return new ZlibCompressor(out, windowBits);
+    }
+
+    virtual Decompressor* createDecompressor(const char* data, size_t length)
+      const {
+      return new ZlibDecompressor(data, length);
+    }
+  };
+
+  /**
+   * A codec that compresses blocks of data independently, in the framing
+   * of Java's BlockCompressorStream: each block is its uncompressed length,
+   * followed by compressed chunks, each with its length, until that much
+   * has been decompressed. All of the lengths are 4 byte big-endian ints.
+   */
+  class BlockCodec: public Codec {
+  private:
+    string className;
+  protected:
+    /**
+     * The most data compressed in one chunk, which Java limits to the buffer
+     * size less the worst case growth of the compressed data.
+     */
+    size_t maxInputSize;
+  public:
+    BlockCodec(const string& _className, size_t overhead):
+      className(_className), maxInputSize(BLOCK_BUFFER_SIZE - overhead) {}
+
+    virtual const string& getClassName() const {
+      return className;
+    }
+
+    virtual size_t getMaxCompressedLength(size_t length) const = 0;
+
+    /**
+     * Compress a chunk into the buffer, which has room for the largest.
+     * @return the compressed length
+     */
+    virtual size_t compressChunk(const char* data, size_t length,
+                                 char* buffer) const = 0;
+
+    /**
+     * Decompress a chunk into the buffer.
+     * @return the decompressed length, which is at most length
+     */
+    virtual size_t decompressChunk(const char* data, size_t dataLength,
+                                   char* buffer, size_t length) const = 0;
+
+    virtual Compressor* createCompressor(OutStream& out) const;
+
+    virtual Decompressor* createDecompressor(const char* data, size_t length)
+      const;
+  };
+
+  class BlockCompressor: public Compressor {
+  private:
+    const BlockCodec& codec;
+    OutStream& out;
+    size_t maxInputSize;
+    string pending;
+    char* buffer;
+    bool written;
+    bool finished;
+
+    void writeBlock(const char* data, size_t length) {
+      size_t compressedLength = codec.compressChunk(data, length, buffer);
+      writeJavaInt(out, length);
+      writeJavaInt(out, compressedLength);
+      out.write(buffer, compressedLength);
+      written = true;
+    }
+
+  public:
+    BlockCompressor(const BlockCodec& _codec, size_t _maxInputSize,
+                    OutStream& _out): codec(_codec), out(_out) {
+      maxInputSize = _maxInputSize;
+      pending.reserve(maxInputSize);
+      buffer = new char[codec.getMaxCompressedLength(maxInputSize)];
+      written = false;
+      finished = false;
+    }
+
+    virtual void write(const char* data, size_t length) {
+      HADOOP_ASSERT(!finished, "write to a finished compressor");
+      size_t capacity = maxInputSize;
+      while (length > 0) {
+        if (pending.empty() && length >= capacity) {
+          // compress straight from the caller's data
+          writeBlock(data, capacity);
+          data += capacity;
+          length -= capacity;
+        } else {
+          size_t piece = std::min(length, capacity - pending.length());
+          pending.append(data, piece);
+          data += piece;
+          length -= piece;
+          if (pending.length() == capacity) {
+            writeBlock(pending.data(), pending.length());
+            pending.clear();
+          }
+        }
+      }
+    }
+
+    virtual void finish() {
+      if (finished) {
+        return;
+      }
+      if (!pending.empty()) {
+        writeBlock(pending.data(), pending.length());
+        pending.clear();
+      } else if (!written) {
+        // Java writes an empty block for an empty stream
+        writeJavaInt(out, 0);
+      }
+      finished = true;
+    }
+
+    virtual ~BlockCompressor() {
+      delete [] buffer;
+    }
+  };
+
+  class BlockDecompressor: public Decompressor {
+  private:
+    const BlockCodec& codec;
+    const char* data;
+    const char* end;
+    /**
+     * The bytes of the current block that are still to be decompressed.
+     */
+    size_t blockRemaining;
+    string chunk;
+    size_t chunkPosition;
+
+    uint32_t readJavaInt() {
+      HADOOP_ASSERT(end - data >= 4, "truncated " + codec.getClassName() +
+                    " stream");
+      uint32_t value = 0;
+      for(int i=0; i < 4; ++i) {
+        value = (value << 8) | (unsigned char) *data++;
+      }
+      return value;
+    }
+
+  public:
+    BlockDecompressor(const BlockCodec& _codec, const char* _data,
+                      size_t length): codec(_codec) {
+      data = _data;
+      end = _data + length;
+      blockRemaining = 0;
+      chunkPosition = 0;
+    }
+
+    virtual size_t read(char* buffer, size_t length) {
+      while (chunkPosition == chunk.length()) {
+        if (blockRemaining == 0) {
+          if (data == end) {
+            return 0;
+          }
+          blockRemaining = readJavaInt();
+          continue;
+        }
+        size_t compressedLength = readJavaInt();
+        HADOOP_ASSERT((size_t) (end - data) >= compressedLength,
+                      "truncated " + codec.getClassName() + " stream");
+        chunk.resize(blockRemaining);
+        size_t chunkLength =
+          codec.decompressChunk(data, compressedLength, &chunk[0],
+                                blockRemaining);
+        data += compressedLength;
+        chunk.resize(chunkLength);
+        chunkPosition = 0;
+        blockRemaining -= chunkLength;
+      }
+      size_t result = std::min(length, chunk.length() - chunkPosition);
+      memcpy(buffer, chunk.data() + chunkPosition, result);
+      chunkPosition += result;
+      return result;
+    }
+  };
+
+  Compressor* BlockCodec::createCompressor(OutStream& out) const {
+    return new BlockCompressor(*this, maxInputSize, out);
+  }
+
+  Decompressor* BlockCodec::createDecompressor(const char* data,
+                                               size_t length) const {
+    return new BlockDecompressor(*this, data, length);
+  }
+
+  class Lz4Codec: public BlockCodec {
+  public:
+    Lz4Codec(): BlockCodec("org.apache.hadoop.io.compress.Lz4Codec",
+                           BLOCK_BUFFER_SIZE / 255 + 16) {}
+
+    virtual size_t getMaxCompressedLength(size_t length) const {
+      return LZ4_compressBound(length);
+    }
+
+    virtual size_t compressChunk(const char* data, size_t length,
+                                 char* buffer) const {
+      int result = LZ4_compress(data, buffer, length);
+      HADOOP_ASSERT(result > 0 || length == 0, "LZ4 compression failed");
+      return result;
+    }
+
+    virtual size_t decompressChunk(const char* data, size_t dataLength,
+                                   char* buffer, size_t length) const {
+      int result = LZ4_decompress_safe(data, buffer, dataLength, length);
+      HADOOP_ASSERT(result >= 0, "corrupt LZ4 stream");
+      return result;
+    }
+  };
+
+#ifdef HADOOP_SNAPPY_LIBRARY
+  static snappy_status (*dlsym_snappy_compress)(const char*, size_t, char*,
+                                                size_t*);
+  static snappy_status (*dlsym_snappy_uncompress)(const char*, size_t,
+                                                  char*, size_t*);
+  static size_t (*dlsym_snappy_max_compressed_length)(size_t);
+  static pthread_once_t snappyOnce = PTHREAD_ONCE_INIT;
+  static string snappyError;
+
+  /**
+   * Load libsnappy at run time, like libhadoop does, so that only jobs that
+   * use it need it installed.
+   */
+  static void loadSnappy() {
+    void* library = dlopen(HADOOP_SNAPPY_LIBRARY, RTLD_LAZY | RTLD_GLOBAL);
+    if (library == NULL) {
+      snappyError = string("cannot load " HADOOP_SNAPPY_LIBRARY ": ") +
+        dlerror();
+      return;
+    }
+    *(void**) &dlsym_snappy_compress = dlsym(library, "snappy_compress");
+    *(void**) &dlsym_snappy_uncompress = dlsym(library, "snappy_uncompress");
+    *(void**) &dlsym_snappy_max_compressed_length =
+      dlsym(library, "snappy_max_compressed_length");
+    if (dlsym_snappy_compress == NULL || dlsym_snappy_uncompress == NULL ||
+        dlsym_snappy_max_compressed_length == NULL) {
+      snappyError = "missing symbols in " HADOOP_SNAPPY_LIBRARY;
+    }
+  }
+
+  class SnappyCodec: public BlockCodec {
+  public:
+    SnappyCodec(): BlockCodec("org.apache.hadoop.io.compress.SnappyCodec",
+                              BLOCK_BUFFER_SIZE / 6 + 32) {}
+
+    void load() const {
+      pthread_once(&snappyOnce, loadSnappy);
+      HADOOP_ASSERT(snappyError.empty(), snappyError);
+    }
+
+    virtual size_t getMaxCompressedLength(size_t length) const {
+      return dlsym_snappy_max_compressed_length(length);
+    }
+
+    virtual size_t compressChunk(const char* data, size_t length,
+                                 char* buffer) const {
+      size_t result = getMaxCompressedLength(length);
+      HADOOP_ASSERT(dlsym_snappy_compress(data, length, buffer, &result) ==
+                    SNAPPY_OK, "Snappy compression failed");
+      return result;
+    }
+
+    virtual size_t decompressChunk(const char* data, size_t dataLength,
+                                   char* buffer, size_t length) const {
+      size_t result = length;
+      HADOOP_ASSERT(dlsym_snappy_uncompress(data, dataLength, buffer,
+                                            &result) == SNAPPY_OK,
+                    "corrupt Snappy stream");
+      return result;
+    }
+
+    virtual Compressor* createCompressor(OutStream& out) const {
+      load();
+      return BlockCodec::createCompressor(out);
+    }
+
+    virtual Decompressor* createDecompressor(const char* data, size_t length)
+      const {
+      load();
+      return BlockCodec::createDecompressor(data, length);
+    }
+  };
+#endif
+
+  const Codec& Codec::get(const string& className) {
+    static ZlibCodec defaultCodec(DEFAULT_CODEC, 15);
+    static ZlibCodec gzipCodec("org.apache.hadoop.io.compress.GzipCodec",
+                               15 + 16);
+    static Lz4Codec lz4Codec;
+#ifdef HADOOP_SNAPPY_LIBRARY
+    static SnappyCodec snappyCodec;
+#endif
+    if (className == defaultCodec.getClassName()) {
+      return defaultCodec;
+    } else if (className == gzipCodec.getClassName()) {
+      return gzipCodec;
+    } else if (className == lz4Codec.getClassName()) {
+      return lz4Codec;
+#ifdef HADOOP_SNAPPY_LIBRARY
+    } else if (className == snappyCodec.getClassName()) {
+      return snappyCodec;
+#endif
+    }
+    throw Error("unsupported compression codec " + className);
+  }
+}
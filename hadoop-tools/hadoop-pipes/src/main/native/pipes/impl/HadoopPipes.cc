@@ -18,20 +18,27 @@
 
 #include "hadoop/Pipes.hh"
 #include "hadoop/SerialUtils.hh"
+#include "hadoop/SharedRing.hh"
 #include "hadoop/StringUtils.hh"
 
+#include <algorithm>
+#include <deque>
 #include <map>
 #include <vector>
 
 #include <errno.h>
+#include <fcntl.h>
 #include <netinet/in.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <pthread.h>
 #include <iostream>
 #include <fstream>
@@ -39,6 +46,8 @@
 #include <openssl/hmac.h>
 #include <openssl/buffer.h>
 
+#include "lz4.h"
+
 using std::map;
 using std::string;
 using std::vector;
@@ -89,20 +98,24 @@ namespace HadoopPipes {
     virtual void setJobConf(vector<string> values) = 0;
     virtual void setInputTypes(string keyType, string valueType) = 0;
     virtual void runMap(string inputSplit, int numReduces, bool pipedInput)= 0;
-    virtual void mapItem(const string& key, const string& value) = 0;
+    virtual void mapItem(const char* key, size_t keyLength,
+                         const char* value, size_t valueLength) = 0;
     virtual void runReduce(int reduce, bool pipedOutput) = 0;
-    virtual void reduceKey(const string& key) = 0;
-    virtual void reduceValue(const string& value) = 0;
+    virtual void reduceKey(const char* key, size_t keyLength) = 0;
+    virtual void reduceValue(const char* value, size_t valueLength) = 0;
     virtual void close() = 0;
     virtual void abort() = 0;
+    virtual void reset() = 0;
     virtual ~DownwardProtocol() {}
   };
 
   class UpwardProtocol {
   public:
-    virtual void output(const string& key, const string& value) = 0;
-    virtual void partitionedOutput(int reduce, const string& key,
-                                   const string& value) = 0;
+    virtual void output(const char* key, size_t keyLength,
+                        const char* value, size_t valueLength) = 0;
+    virtual void partitionedOutput(int reduce, 
+                                   const char* key, size_t keyLength,
+                                   const char* value, size_t valueLength) = 0;
     virtual void status(const string& message) = 0;
     virtual void progress(float progress) = 0;
     virtual void done() = 0;
@@ -110,12 +123,40 @@ namespace HadoopPipes {
                                  const string& name) = 0;
     virtual void 
       incrementCounter(const TaskContext::Counter* counter, uint64_t amount) = 0;
+
+    /**
+     * Switch to the message formats of the given protocol version, if the
+     * protocol has more than one. This is only called on the task's thread,
+     * before the first task sends any output.
+     */
+    virtual void setVersion(int version) {
+    }
+
+    /**
+     * Compress the batches of outputs, if the protocol has them. This is
+     * only called on the task's thread, before the task sends any output.
+     */
+    virtual void setCompression(bool compress) {
+    }
+
     virtual ~UpwardProtocol() {}
   };
 
   class Protocol {
   public:
     virtual void nextEvent() = 0;
+
+    /**
+     * Read ahead the REDUCE_VALUE commands that come next, without passing
+     * them to the handler. Only commands that have started to arrive are
+     * read, so this does not wait for the other side. The values stay valid
+     * until the next call to nextEvent.
+     * @param values the values that were read are appended here
+     */
+    virtual void readValues(vector<std::pair<const char*, size_t> >& values,
+                            size_t maxValues, size_t maxBytes) {
+    }
+
     virtual UpwardProtocol* getUplink() = 0;
     virtual ~Protocol() {}
   };
@@ -126,28 +167,30 @@ namespace HadoopPipes {
     static const char fieldSeparator = '\t';
     static const char lineSeparator = '\n';
 
-    void writeBuffer(const string& buffer) {
-      fputs(quoteString(buffer, "\t\n").c_str(), stream);
+    void writeBuffer(const char* buffer, size_t length) {
+      fputs(quoteString(string(buffer, length), "\t\n").c_str(), stream);
     }
 
   public:
     TextUpwardProtocol(FILE* _stream): stream(_stream) {}
     
-    virtual void output(const string& key, const string& value) {
+    virtual void output(const char* key, size_t keyLength,
+                        const char* value, size_t valueLength) {
       fprintf(stream, "output%c", fieldSeparator);
-      writeBuffer(key);
+      writeBuffer(key, keyLength);
       fprintf(stream, "%c", fieldSeparator);
-      writeBuffer(value);
+      writeBuffer(value, valueLength);
       fprintf(stream, "%c", lineSeparator);
     }
 
-    virtual void partitionedOutput(int reduce, const string& key,
-                                   const string& value) {
+    virtual void partitionedOutput(int reduce, 
+                                   const char* key, size_t keyLength,
+                                   const char* value, size_t valueLength) {
       fprintf(stream, "parititionedOutput%c%d%c", fieldSeparator, reduce, 
               fieldSeparator);
-      writeBuffer(key);
+      writeBuffer(key, keyLength);
       fprintf(stream, "%c", fieldSeparator);
-      writeBuffer(value);
+      writeBuffer(value, valueLength);
       fprintf(stream, "%c", lineSeparator);
     }
 
@@ -223,17 +266,18 @@ namespace HadoopPipes {
         HADOOP_ASSERT(sep == '\t', "Short text protocol command " + command);
         sep = readUpto(value, delim);
         HADOOP_ASSERT(sep == '\n', "Long text protocol command " + command);
-        handler->mapItem(key, value);
+        handler->mapItem(key.data(), key.length(), 
+                         value.data(), value.length());
       } else if (command == "reduceValue") {
         HADOOP_ASSERT(sep == '\t', "Short text protocol command " + command);
         sep = readUpto(value, delim);
         HADOOP_ASSERT(sep == '\n', "Long text protocol command " + command);
-        handler->reduceValue(value);
+        handler->reduceValue(value.data(), value.length());
       } else if (command == "reduceKey") {
         HADOOP_ASSERT(sep == '\t', "Short text protocol command " + command);
         sep = readUpto(key, delim);
         HADOOP_ASSERT(sep == '\n', "Long text protocol command " + command);
-        handler->reduceKey(key);
+        handler->reduceKey(key.data(), key.length());
       } else if (command == "start") {
         HADOOP_ASSERT(sep == '\t', "Short text protocol command " + command);
         sep = readUpto(arg, delim);
@@ -283,6 +327,9 @@ namespace HadoopPipes {
       } else if (command == "close") {
         HADOOP_ASSERT(sep == '\n', "Long text protocol command " + command);
         handler->close();
+      } else if (command == "reset") {
+        HADOOP_ASSERT(sep == '\n', "Long text protocol command " + command);
+        handler->reset();
       } else {
         throw Error("Illegal text protocol command " + command);
       }
@@ -294,85 +341,241 @@ namespace HadoopPipes {
   };
   const char* TextProtocol::delim = "\t\n";
 
+  /**
+   * The newest protocol version we understand. Version 1 adds the MAP_ITEMS,
+   * OUTPUTS and PARTITIONED_OUTPUTS commands, which carry a count followed
+   * by that many records, so small records do not cost a command each.
+   * Version 2 adds RESET, which lets one process run several tasks.
+   */
+  static const int MAX_PROTOCOL_VERSION = 2;
+
+  /**
+   * The job configuration key that keeps the process for more tasks. Once
+   * a task is done, the driver either sends RESET followed by the next
+   * task's commands, starting with SET_JOB_CONF, or CLOSE to end the
+   * process. It needs protocol version 2.
+   */
+  static const char* TASK_REUSE = "mapreduce.pipes.task.reuse";
+
   enum MESSAGE_TYPE {START_MESSAGE, SET_JOB_CONF, SET_INPUT_TYPES, RUN_MAP, 
                      MAP_ITEM, RUN_REDUCE, REDUCE_KEY, REDUCE_VALUE, 
-                     CLOSE, ABORT, AUTHENTICATION_REQ,
+                     CLOSE, ABORT, AUTHENTICATION_REQ, MAP_ITEMS, RESET,
                      OUTPUT=50, PARTITIONED_OUTPUT, STATUS, PROGRESS, DONE,
-                     REGISTER_COUNTER, INCREMENT_COUNTER, AUTHENTICATION_RESP};
+                     REGISTER_COUNTER, INCREMENT_COUNTER, AUTHENTICATION_RESP,
+                     OUTPUTS, PARTITIONED_OUTPUTS, COMPRESSED_OUTPUTS};
+
+  /**
+   * The size of the buffers used on the binary protocol's file descriptors.
+   */
+  static const size_t BINARY_BUFFER_SIZE = 1024 * 1024;
+
+  /**
+   * The number of bytes of records collected before a batch of outputs is
+   * sent in protocol version 1.
+   */
+  static const size_t OUTPUT_BATCH_SIZE = 64 * 1024;
+
+  /**
+   * The largest batch of outputs that is compressed. This matches the
+   * default buffer of the Java LZ4 decompressor, and bigger batches, which
+   * only happen with very large records, are sent as they are.
+   */
+  static const size_t MAX_COMPRESSED_BATCH = 256 * 1024;
+
+  /**
+   * The job configuration key that turns on compression of output batches.
+   */
+  static const char* UPLINK_COMPRESS = "mapreduce.pipes.uplink.compress";
 
   class BinaryUpwardProtocol: public UpwardProtocol {
   private:
-    FileOutStream* stream;
+    FdOutStream* stream;
+    int version;
+    /**
+     * The command the buffered records will be sent with, either OUTPUT or
+     * PARTITIONED_OUTPUT.
+     */
+    int batchCommand;
+    int32_t batchRecords;
+    string batch;
+    StringOutStream batchStream;
+    bool compress;
+    char* compressBuffer;
+
+    void startRecord(int command) {
+      if (command != batchCommand) {
+        flushBatch();
+        batchCommand = command;
+      }
+      batchRecords += 1;
+    }
+
+    void endRecord() {
+      if (batch.length() >= OUTPUT_BATCH_SIZE) {
+        flushBatch();
+      }
+    }
+
+    /**
+     * Send the buffered records, which must go before any other command so
+     * that the order of messages is kept.
+     */
+    void flushBatch() {
+      if (batchRecords > 0) {
+        int command = batchCommand == OUTPUT ? OUTPUTS : PARTITIONED_OUTPUTS;
+        if (!compress || !writeCompressedBatch(command)) {
+          stream->writeVInt(command);
+          stream->writeVInt(batchRecords);
+          stream->write(batch.data(), batch.length());
+        }
+        batch.clear();
+        batchRecords = 0;
+      }
+    }
+
+    /**
+     * Send the buffered records LZ4 compressed, as the batch command,
+     * the number of records, the uncompressed length and the compressed
+     * bytes.
+     * @return false if the batch is too big or does not compress
+     */
+    bool writeCompressedBatch(int command) {
+      if (batch.length() > MAX_COMPRESSED_BATCH) {
+        return false;
+      }
+      if (compressBuffer == NULL) {
+        compressBuffer = new char[LZ4_compressBound(MAX_COMPRESSED_BATCH)];
+      }
+      int length = LZ4_compress(batch.data(), compressBuffer, batch.length());
+      if (length <= 0 || (size_t) length >= batch.length()) {
+        return false;
+      }
+      stream->writeVInt(COMPRESSED_OUTPUTS);
+      stream->writeVInt(command);
+      stream->writeVInt(batchRecords);
+      stream->writeVInt(batch.length());
+      stream->writeString(compressBuffer, length);
+      return true;
+    }
+
   public:
-    BinaryUpwardProtocol(FILE* _stream) {
-      stream = new FileOutStream();
-      HADOOP_ASSERT(stream->open(_stream), "problem opening stream");
+    BinaryUpwardProtocol(FdOutStream* _stream): batchStream(batch) {
+      stream = _stream;
+      version = 0;
+      batchCommand = OUTPUT;
+      batchRecords = 0;
+      compress = false;
+      compressBuffer = NULL;
+    }
+
+    /**
+     * Switch to the message formats of the given protocol version.
+     */
+    virtual void setVersion(int _version) {
+      flushBatch();
+      version = _version;
+    }
+
+    /**
+     * Compress the batches of outputs, which are only used from protocol
+     * version 1.
+     */
+    virtual void setCompression(bool _compress) {
+      flushBatch();
+      compress = _compress;
     }
 
     virtual void authenticate(const string &responseDigest) {
-      serializeInt(AUTHENTICATION_RESP, *stream);
-      serializeString(responseDigest, *stream);
+      flushBatch();
+      stream->writeVInt(AUTHENTICATION_RESP);
+      stream->writeString(responseDigest.data(), responseDigest.length());
       stream->flush();
     }
 
-    virtual void output(const string& key, const string& value) {
-      serializeInt(OUTPUT, *stream);
-      serializeString(key, *stream);
-      serializeString(value, *stream);
+    virtual void output(const char* key, size_t keyLength,
+                        const char* value, size_t valueLength) {
+      if (version == 0) {
+        stream->writeVInt(OUTPUT);
+        stream->writeString(key, keyLength);
+        stream->writeString(value, valueLength);
+      } else {
+        startRecord(OUTPUT);
+        serializeString(key, keyLength, batchStream);
+        serializeString(value, valueLength, batchStream);
+        endRecord();
+      }
     }
 
-    virtual void partitionedOutput(int reduce, const string& key,
-                                   const string& value) {
-      serializeInt(PARTITIONED_OUTPUT, *stream);
-      serializeInt(reduce, *stream);
-      serializeString(key, *stream);
-      serializeString(value, *stream);
+    virtual void partitionedOutput(int reduce, 
+                                   const char* key, size_t keyLength,
+                                   const char* value, size_t valueLength) {
+      if (version == 0) {
+        stream->writeVInt(PARTITIONED_OUTPUT);
+        stream->writeVInt(reduce);
+        stream->writeString(key, keyLength);
+        stream->writeString(value, valueLength);
+      } else {
+        startRecord(PARTITIONED_OUTPUT);
+        serializeInt(reduce, batchStream);
+        serializeString(key, keyLength, batchStream);
+        serializeString(value, valueLength, batchStream);
+        endRecord();
+      }
     }
 
     virtual void status(const string& message) {
-      serializeInt(STATUS, *stream);
-      serializeString(message, *stream);
+      flushBatch();
+      stream->writeVInt(STATUS);
+      stream->writeString(message.data(), message.length());
     }
 
     virtual void progress(float progress) {
-      serializeInt(PROGRESS, *stream);
+      flushBatch();
+      stream->writeVInt(PROGRESS);
       serializeFloat(progress, *stream);
       stream->flush();
     }
 
     virtual void done() {
-      serializeInt(DONE, *stream);
+      flushBatch();
+      stream->writeVInt(DONE);
+      stream->flush();
     }
 
     virtual void registerCounter(int id, const string& group, 
                                  const string& name) {
-      serializeInt(REGISTER_COUNTER, *stream);
-      serializeInt(id, *stream);
-      serializeString(group, *stream);
-      serializeString(name, *stream);
+      flushBatch();
+      stream->writeVInt(REGISTER_COUNTER);
+      stream->writeVInt(id);
+      stream->writeString(group.data(), group.length());
+      stream->writeString(name.data(), name.length());
     }
 
     virtual void incrementCounter(const TaskContext::Counter* counter, 
                                   uint64_t amount) {
-      serializeInt(INCREMENT_COUNTER, *stream);
-      serializeInt(counter->getId(), *stream);
-      serializeLong(amount, *stream);
+      flushBatch();
+      stream->writeVInt(INCREMENT_COUNTER);
+      stream->writeVInt(counter->getId());
+      stream->writeVLong(amount);
     }
     
     ~BinaryUpwardProtocol() {
       delete stream;
+      delete [] compressBuffer;
     }
   };
 
   class BinaryProtocol: public Protocol {
   private:
-    FileInStream* downStream;
+    FdInStream* downStream;
     DownwardProtocol* handler;
     BinaryUpwardProtocol * uplink;
-    string key;
-    string value;
     string password;
     bool authDone;
+    /**
+     * The number of records of the current MAP_ITEMS batch still to read.
+     */
+    int32_t mapItemsLeft;
     void getPassword(string &password) {
       const char *passwordFile = getenv("hadoop.pipes.shared.secret.location");
       if (passwordFile == NULL) {
@@ -448,13 +651,31 @@ namespace HadoopPipes {
       return string(digestBuffer);
     }
 
+    /**
+     * Hand the next record of a MAP_ITEMS batch to the handler. The handler
+     * takes one record per event, so a batch is spread over several events.
+     */
+    void nextMapItem() {
+      size_t keyLength;
+      size_t valueLength;
+      const char* key = downStream->readString(keyLength);
+      const char* value = downStream->readString(valueLength);
+      mapItemsLeft -= 1;
+      handler->mapItem(key, keyLength, value, valueLength);
+    }
+
   public:
-    BinaryProtocol(FILE* down, DownwardProtocol* _handler, FILE* up) {
-      downStream = new FileInStream();
-      downStream->open(down);
+    /**
+     * Speak the protocol over the given streams, which are owned by the
+     * protocol from now on.
+     */
+    BinaryProtocol(FdInStream* down, DownwardProtocol* _handler, 
+                   FdOutStream* up) {
+      downStream = down;
       uplink = new BinaryUpwardProtocol(up);
       handler = _handler;
       authDone = false;
+      mapItemsLeft = 0;
       getPassword(password);
     }
 
@@ -463,8 +684,14 @@ namespace HadoopPipes {
     }
 
     virtual void nextEvent() {
+      // the last record handed to the handler is no longer needed
+      downStream->mark();
+      if (mapItemsLeft > 0) {
+        nextMapItem();
+        return;
+      }
       int32_t cmd;
-      cmd = deserializeInt(*downStream);
+      cmd = downStream->readVInt();
       if (!authDone && cmd != AUTHENTICATION_REQ) {
         //Authentication request must be the first message if
         //authentication is not complete
@@ -476,24 +703,24 @@ namespace HadoopPipes {
       case AUTHENTICATION_REQ: {
         string digest;
         string challenge;
-        deserializeString(digest, *downStream);
-        deserializeString(challenge, *downStream);
+        downStream->readString(digest);
+        downStream->readString(challenge);
         verifyDigestAndRespond(digest, challenge);
         break;
       }
       case START_MESSAGE: {
         int32_t prot;
-        prot = deserializeInt(*downStream);
+        prot = downStream->readVInt();
         handler->start(prot);
         break;
       }
       case SET_JOB_CONF: {
         int32_t entries;
-        entries = deserializeInt(*downStream);
+        entries = downStream->readVInt();
         vector<string> result(entries);
         for(int i=0; i < entries; ++i) {
           string item;
-          deserializeString(item, *downStream);
+          downStream->readString(item);
           result.push_back(item);
         }
         handler->setJobConf(result);
@@ -502,8 +729,8 @@ namespace HadoopPipes {
       case SET_INPUT_TYPES: {
         string keyType;
         string valueType;
-        deserializeString(keyType, *downStream);
-        deserializeString(valueType, *downStream);
+        downStream->readString(keyType);
+        downStream->readString(valueType);
         handler->setInputTypes(keyType, valueType);
         break;
       }
@@ -511,34 +738,45 @@ namespace HadoopPipes {
         string split;
         int32_t numReduces;
         int32_t piped;
-        deserializeString(split, *downStream);
-        numReduces = deserializeInt(*downStream);
-        piped = deserializeInt(*downStream);
+        downStream->readString(split);
+        numReduces = downStream->readVInt();
+        piped = downStream->readVInt();
         handler->runMap(split, numReduces, piped);
         break;
       }
       case MAP_ITEM: {
-        deserializeString(key, *downStream);
-        deserializeString(value, *downStream);
-        handler->mapItem(key, value);
+        size_t keyLength;
+        size_t valueLength;
+        const char* key = downStream->readString(keyLength);
+        const char* value = downStream->readString(valueLength);
+        handler->mapItem(key, keyLength, value, valueLength);
+        break;
+      }
+      case MAP_ITEMS: {
+        mapItemsLeft = downStream->readVInt();
+        if (mapItemsLeft > 0) {
+          nextMapItem();
+        }
         break;
       }
       case RUN_REDUCE: {
         int32_t reduce;
         int32_t piped;
-        reduce = deserializeInt(*downStream);
-        piped = deserializeInt(*downStream);
+        reduce = downStream->readVInt();
+        piped = downStream->readVInt();
         handler->runReduce(reduce, piped);
         break;
       }
       case REDUCE_KEY: {
-        deserializeString(key, *downStream);
-        handler->reduceKey(key);
+        size_t keyLength;
+        const char* key = downStream->readString(keyLength);
+        handler->reduceKey(key, keyLength);
         break;
       }
       case REDUCE_VALUE: {
-        deserializeString(value, *downStream);
-        handler->reduceValue(value);
+        size_t valueLength;
+        const char* value = downStream->readString(valueLength);
+        handler->reduceValue(value, valueLength);
         break;
       }
       case CLOSE:
@@ -547,11 +785,36 @@ namespace HadoopPipes {
       case ABORT:
         handler->abort();
         break;
+      case RESET:
+        handler->reset();
+        break;
       default:
         HADOOP_ASSERT(false, "Unknown binary command " + toString(cmd));
       }
     }
 
+    virtual void readValues(vector<std::pair<const char*, size_t> >& values,
+                            size_t maxValues, size_t maxBytes) {
+      size_t bytes = 0;
+      size_t count = 0;
+      while (count < maxValues && bytes < maxBytes && authDone &&
+             mapItemsLeft == 0 && downStream->isNextByte(REDUCE_VALUE)) {
+        downStream->readVInt();
+        size_t valueLength;
+        const char* value = downStream->readString(valueLength);
+        values.push_back(std::make_pair(value, valueLength));
+        bytes += valueLength;
+        count += 1;
+      }
+    }
+
+    /**
+     * Whether reading the next event would have to wait for input.
+     */
+    bool isInputBufferEmpty() const {
+      return downStream->isBufferEmpty();
+    }
+
     virtual ~BinaryProtocol() {
       delete downStream;
       delete uplink;
@@ -559,164 +822,2066 @@ namespace HadoopPipes {
   };
 
   /**
-   * Define a context object to give to combiners that will let them
-   * go through the values and emit their results correctly.
+   * The job configuration key that turns on the phase timing counters.
    */
-  class CombineContext: public ReduceContext {
-  private:
-    ReduceContext* baseContext;
-    Partitioner* partitioner;
-    int numReduces;
-    UpwardProtocol* uplink;
-    bool firstKey;
-    bool firstValue;
-    map<string, vector<string> >::iterator keyItr;
-    map<string, vector<string> >::iterator endKeyItr;
-    vector<string>::iterator valueItr;
-    vector<string>::iterator endValueItr;
+  static const char* PHASE_TIMING = "mapreduce.pipes.phase.timing";
 
+  /**
+   * The key of the PhaseClock started on each thread.
+   */
+  static pthread_key_t threadClockKey;
+  static pthread_once_t threadClockOnce = PTHREAD_ONCE_INIT;
+
+  static void createThreadClockKey() {
+    pthread_key_create(&threadClockKey, NULL);
+  }
+
+  /**
+   * Adds up the time that one thread of a task spends in each phase, and
+   * the work done by its spills. The thread is always in exactly one phase
+   * and a PhaseTimer moves it to another one for a while, so time spent in
+   * a nested phase is only counted once. Nothing is measured until start
+   * is called. A clock belongs to the thread that started it and is only
+   * used on that thread; each thread that is timed has a clock of its own,
+   * and their totals are added up in the task's counters.
+   */
+  class PhaseClock {
   public:
-    CombineContext(ReduceContext* _baseContext,
-                   Partitioner* _partitioner,
-                   int _numReduces,
-                   UpwardProtocol* _uplink,
-                   map<string, vector<string> >& data) {
-      baseContext = _baseContext;
-      partitioner = _partitioner;
-      numReduces = _numReduces;
-      uplink = _uplink;
-      keyItr = data.begin();
-      endKeyItr = data.end();
-      firstKey = true;
-      firstValue = true;
+    enum Phase {
+      /** the framework's own bookkeeping */
+      OTHER,
+      /** waiting for input from the other side or the RecordReader */
+      READ,
+      /** decoding the downward commands */
+      DECODE,
+      /** the application's map and reduce */
+      USER,
+      /** buffering map output and spilling it, with the combiner */
+      SPILL,
+      /** partitioning and encoding the output */
+      ENCODE,
+      /** waiting for output to be written to the other side */
+      WRITE,
+      PHASE_COUNT
+    };
+
+  private:
+    bool started;
+    Phase current;
+    uint64_t since;
+    uint64_t ticks[PHASE_COUNT];
+    /**
+     * The ticks and the monotonic time when the clock was started, to
+     * convert ticks to time.
+     */
+    uint64_t startTicks;
+    uint64_t startNanos;
+    uint64_t spills;
+    uint64_t spilledRecords;
+    uint64_t spilledBytes;
+
+    static uint64_t getNanos() {
+      timespec time;
+      clock_gettime(CLOCK_MONOTONIC, &time);
+      return time.tv_sec * 1000000000ull + time.tv_nsec;
     }
 
-    virtual const JobConf* getJobConf() {
-      return baseContext->getJobConf();
+    /**
+     * Read the time stamp counter where there is one, since it is cheaper
+     * than the system clock, and the monotonic clock elsewhere.
+     */
+    static uint64_t getTicks() {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+      return __builtin_ia32_rdtsc();
+#else
+      return getNanos();
+#endif
     }
 
-    virtual const std::string& getInputKey() {
-      return keyItr->first;
+    /**
+     * Stop being the clock of the calling thread.
+     */
+    void release() {
+      if (started && getThreadClock() == this) {
+        pthread_setspecific(threadClockKey, NULL);
+      }
     }
 
-    virtual const std::string& getInputValue() {
-      return *valueItr;
+  public:
+    PhaseClock() {
+      started = false;
+      reset();
     }
 
-    virtual void emit(const std::string& key, const std::string& value) {
-      if (partitioner != NULL) {
-        uplink->partitionedOutput(partitioner->partition(key, numReduces),
-                                  key, value);
-      } else {
-        uplink->output(key, value);
+    ~PhaseClock() {
+      release();
+    }
+
+    /**
+     * Get the clock that was started on the calling thread.
+     * @return the clock or NULL if the thread isn't timed
+     */
+    static PhaseClock* getThreadClock() {
+      pthread_once(&threadClockOnce, createThreadClockKey);
+      return (PhaseClock*) pthread_getspecific(threadClockKey);
+    }
+
+    /**
+     * Stop the clock and forget the totals, for the next task.
+     */
+    void reset() {
+      release();
+      started = false;
+      current = OTHER;
+      since = 0;
+      startTicks = 0;
+      startNanos = 0;
+      for(int i=0; i < PHASE_COUNT; ++i) {
+        ticks[i] = 0;
       }
+      spills = 0;
+      spilledRecords = 0;
+      spilledBytes = 0;
     }
 
-    virtual void progress() {
-      baseContext->progress();
+    /**
+     * Start timing the calling thread, which becomes the clock's owner.
+     */
+    void start() {
+      pthread_once(&threadClockOnce, createThreadClockKey);
+      pthread_setspecific(threadClockKey, this);
+      started = true;
+      startNanos = getNanos();
+      startTicks = getTicks();
+      since = startTicks;
     }
 
-    virtual void setStatus(const std::string& status) {
-      baseContext->setStatus(status);
+    bool isStarted() const {
+      return started;
     }
 
-    bool nextKey() {
-      if (firstKey) {
-        firstKey = false;
-      } else {
-        ++keyItr;
+    /**
+     * Move to the given phase. This must only be called on the thread that
+     * owns the clock.
+     * @return the phase that was left
+     */
+    Phase enter(Phase phase) {
+      if (!started) {
+        return current;
       }
-      if (keyItr != endKeyItr) {
-        valueItr = keyItr->second.begin();
-        endValueItr = keyItr->second.end();
-        firstValue = true;
-        return true;
+      uint64_t time = getTicks();
+      ticks[current] += time - since;
+      since = time;
+      Phase previous = current;
+      current = phase;
+      return previous;
+    }
+
+    void addSpill(uint64_t records, uint64_t bytes) {
+      spills += 1;
+      spilledRecords += records;
+      spilledBytes += bytes;
+    }
+
+    /**
+     * Add the totals to the task's counters, if the clock was started.
+     */
+    void report(TaskContext& context) {
+      static const char* GROUP = "Pipes Phases";
+      static const char* NAMES[PHASE_COUNT] = {
+        "OTHER_MILLIS", "READ_MILLIS", "DECODE_MILLIS", "USER_MILLIS",
+        "SPILL_MILLIS", "ENCODE_MILLIS", "WRITE_MILLIS"};
+      if (!started) {
+        return;
       }
-      return false;
+      enter(current);
+      uint64_t elapsedTicks = getTicks() - startTicks;
+      double nanosPerTick = elapsedTicks == 0 ? 1.0 : 
+        (getNanos() - startNanos) / (double) elapsedTicks;
+      for(int i=0; i < PHASE_COUNT; ++i) {
+        context.incrementCounter(context.getCounter(GROUP, NAMES[i]),
+                                 (uint64_t) (ticks[i] * nanosPerTick / 1e6));
+        ticks[i] = 0;
+      }
+      context.incrementCounter(context.getCounter(GROUP, "SPILLS"), spills);
+      context.incrementCounter(context.getCounter(GROUP, "SPILLED_RECORDS"),
+                               spilledRecords);
+      context.incrementCounter(context.getCounter(GROUP, "SPILLED_BYTES"),
+                               spilledBytes);
+      spills = 0;
+      spilledRecords = 0;
+      spilledBytes = 0;
     }
+  };
 
-    virtual bool nextValue() {
-      if (firstValue) {
-        firstValue = false;
-      } else {
-        ++valueItr;
+  /**
+   * Moves a PhaseClock to a phase for the lifetime of the object. Without
+   * a clock, nothing is timed.
+   */
+  class PhaseTimer {
+  private:
+    PhaseClock* clock;
+    PhaseClock::Phase previous;
+  public:
+    PhaseTimer(PhaseClock* _clock, PhaseClock::Phase phase) {
+      clock = _clock;
+      if (clock != NULL) {
+        previous = clock->enter(phase);
       }
-      return valueItr != endValueItr;
     }
-    
-    virtual Counter* getCounter(const std::string& group, 
-                               const std::string& name) {
-      return baseContext->getCounter(group, name);
+
+    ~PhaseTimer() {
+      if (clock != NULL) {
+        clock->enter(previous);
+      }
     }
+  };
 
-    virtual void incrementCounter(const Counter* counter, uint64_t amount) {
-      baseContext->incrementCounter(counter, amount);
+  /**
+   * An input stream that counts the time spent reading its source, on the
+   * clock of the thread that reads, if it has one.
+   */
+  template <class Stream>
+  class TimedInStream: public Stream {
+  public:
+    template <class Source>
+    TimedInStream(Source source, size_t bufferSize)
+      : Stream(source, bufferSize) {
+    }
+
+  protected:
+    virtual size_t readSome(char* buf, size_t len) {
+      PhaseTimer timer(PhaseClock::getThreadClock(), PhaseClock::READ);
+      return Stream::readSome(buf, len);
     }
   };
 
   /**
-   * A RecordWriter that will take the map outputs, buffer them up and then
-   * combine then when the buffer is full.
+   * An output stream that counts the time spent writing its buffers, on
+   * the clock of the thread that writes, if it has one.
    */
-  class CombineRunner: public RecordWriter {
-  private:
-    map<string, vector<string> > data;
-    int64_t spillSize;
-    int64_t numBytes;
-    ReduceContext* baseContext;
-    Partitioner* partitioner;
-    int numReduces;
-    UpwardProtocol* uplink;
-    Reducer* combiner;
+  template <class Stream>
+  class TimedOutStream: public Stream {
   public:
-    CombineRunner(int64_t _spillSize, ReduceContext* _baseContext, 
-                  Reducer* _combiner, UpwardProtocol* _uplink, 
-                  Partitioner* _partitioner, int _numReduces) {
-      numBytes = 0;
-      spillSize = _spillSize;
-      baseContext = _baseContext;
-      partitioner = _partitioner;
-      numReduces = _numReduces;
-      uplink = _uplink;
-      combiner = _combiner;
+    template <class Sink>
+    TimedOutStream(Sink sink, size_t bufferSize)
+      : Stream(sink, bufferSize) {
     }
 
-    virtual void emit(const std::string& key,
-                      const std::string& value) {
-      numBytes += key.length() + value.length();
-      data[key].push_back(value);
-      if (numBytes >= spillSize) {
-        spillAll();
+  protected:
+    virtual void writeBuffers(const char* first, size_t firstLength,
+                              const char* second, size_t secondLength) {
+      PhaseTimer timer(PhaseClock::getThreadClock(), PhaseClock::WRITE);
+      Stream::writeBuffers(first, firstLength, second, secondLength);
+    }
+  };
+
+  /**
+   * The job configuration key that turns on the reader and writer threads
+   * of the binary protocol.
+   */
+  static const char* IO_THREADS = "mapreduce.pipes.io.threads";
+
+  /**
+   * An output stream whose full buffers can be written by a thread of its
+   * own, so that the task carries on while the bytes go to the descriptor.
+   * Until start is called it writes them itself.
+   */
+  class PipelinedOutStream: public FdOutStream {
+  private:
+    /**
+     * The most buffers waiting to be written before the task has to wait.
+     */
+    static const size_t MAX_PENDING = 4;
+    pthread_t thread;
+    bool running;
+    bool stopping;
+    bool writing;
+    string error;
+    std::deque<string*> pending;
+    vector<string*> spare;
+    pthread_mutex_t mutexQueue;
+    pthread_cond_t queueChanged;
+
+    static void* runWriter(void* ptr) {
+      ((PipelinedOutStream*) ptr)->writeLoop();
+      return NULL;
+    }
+
+    void writeLoop() {
+      pthread_mutex_lock(&mutexQueue);
+      while (true) {
+        while (pending.empty() && !stopping) {
+          pthread_cond_wait(&queueChanged, &mutexQueue);
+        }
+        if (pending.empty()) {
+          break;
+        }
+        string* buffer = pending.front();
+        pending.pop_front();
+        writing = true;
+        pthread_mutex_unlock(&mutexQueue);
+        string message;
+        try {
+          FdOutStream::writeBuffers(buffer->data(), buffer->length(), NULL, 0);
+        } catch (Error& err) {
+          message = err.getMessage();
+        }
+        pthread_mutex_lock(&mutexQueue);
+        writing = false;
+        if (!message.empty() && error.empty()) {
+          error = message;
+        }
+        spare.push_back(buffer);
+        pthread_cond_broadcast(&queueChanged);
       }
+      pthread_mutex_unlock(&mutexQueue);
     }
 
-    virtual void close() {
-      spillAll();
+    void checkError() {
+      if (!error.empty()) {
+        string message = error;
+        pthread_mutex_unlock(&mutexQueue);
+        throw Error("problem in the writer thread: " + message);
+      }
     }
 
-  private:
-    void spillAll() {
-      CombineContext context(baseContext, partitioner, numReduces, 
-                             uplink, data);
-      while (context.nextKey()) {
-        combiner->reduce(context);
+  protected:
+    virtual void writeBuffers(const char* first, size_t firstLength,
+                              const char* second, size_t secondLength) {
+      if (!running) {
+        FdOutStream::writeBuffers(first, firstLength, second, secondLength);
+        return;
       }
-      data.clear();
-      numBytes = 0;
+      pthread_mutex_lock(&mutexQueue);
+      while (pending.size() >= MAX_PENDING && error.empty()) {
+        pthread_cond_wait(&queueChanged, &mutexQueue);
+      }
+      checkError();
+      string* buffer;
+      if (spare.empty()) {
+        buffer = new string();
+      } else {
+        buffer = spare.back();
+        spare.pop_back();
+      }
+      pthread_mutex_unlock(&mutexQueue);
+      buffer->assign(first, firstLength);
+      buffer->append(second, secondLength);
+      pthread_mutex_lock(&mutexQueue);
+      pending.push_back(buffer);
+      pthread_cond_broadcast(&queueChanged);
+      pthread_mutex_unlock(&mutexQueue);
+    }
+
+  public:
+    PipelinedOutStream(int fd, size_t bufferSize): FdOutStream(fd, bufferSize) {
+      running = false;
+      stopping = false;
+      writing = false;
+      pthread_mutex_init(&mutexQueue, NULL);
+      pthread_cond_init(&queueChanged, NULL);
+    }
+
+    void start() {
+      running = true;
+      pthread_create(&thread, NULL, runWriter, this);
+    }
+
+    /**
+     * Hand over the buffered bytes and wait until they have been written.
+     */
+    virtual void flush() {
+      FdOutStream::flush();
+      if (running) {
+        pthread_mutex_lock(&mutexQueue);
+        while ((!pending.empty() || writing) && error.empty()) {
+          pthread_cond_wait(&queueChanged, &mutexQueue);
+        }
+        checkError();
+        pthread_mutex_unlock(&mutexQueue);
+      }
+    }
+
+    virtual ~PipelinedOutStream() {
+      if (running) {
+        pthread_mutex_lock(&mutexQueue);
+        stopping = true;
+        pthread_cond_broadcast(&queueChanged);
+        pthread_mutex_unlock(&mutexQueue);
+        pthread_join(thread, NULL);
+      }
+      for(size_t i=0; i < pending.size(); ++i) {
+        delete pending[i];
+      }
+      for(size_t i=0; i < spare.size(); ++i) {
+        delete spare[i];
+      }
+      pthread_cond_destroy(&queueChanged);
+      pthread_mutex_destroy(&mutexQueue);
+    }
+  };
+
+  /**
+   * A downward command read ahead by the reader thread. The strings of the
+   * command are kept in the data of its batch.
+   */
+  struct DownwardEvent {
+    int32_t command;
+    int32_t first;
+    int32_t second;
+    size_t keyOffset;
+    size_t keyLength;
+    size_t valueOffset;
+    size_t valueLength;
+  };
+
+  struct EventBatch {
+    string data;
+    vector<DownwardEvent> events;
+
+    void clear() {
+      data.clear();
+      events.clear();
+    }
+  };
+
+  /**
+   * Runs the binary protocol either directly or, when the job configuration
+   * sets mapreduce.pipes.io.threads, with a reader thread that decodes the
+   * downward commands into batches and a writer thread that sends the
+   * upward buffers. The task's thread then only runs the user's code
+   * between the two.
+   *
+   * The protocol is the handler of the binary protocol it wraps. Until the
+   * job configuration arrives, events are passed straight to the real
+   * handler; after that they are recorded by the reader thread and replayed
+   * by nextEvent. When the process is reused for more tasks, the threads
+   * keep running from one task to the next.
+   *
+   * The reader thread runs ahead of the task, into the commands of the
+   * next task once the process is reused, so decoding must not touch the
+   * uplink or the task's state. Those only change when the task's thread
+   * replays the events to the handler.
+   */
+  class PipelinedProtocol: public Protocol, public DownwardProtocol {
+  private:
+    /**
+     * The command of the event that reports a failure of the reader thread,
+     * whose message is in the batch data.
+     */
+    static const int32_t READ_ERROR = -1;
+    /**
+     * A batch is handed over once its data reaches this size.
+     */
+    static const size_t BATCH_DATA_SIZE = 256 * 1024;
+    /**
+     * The most batches read ahead before the reader thread has to wait.
+     */
+    static const size_t MAX_BATCHES = 4;
+    BinaryProtocol* protocol;
+    DownwardProtocol* handler;
+    PipelinedOutStream* writer;
+    /**
+     * The clock of the task's thread, which only times that thread's wait
+     * for the next batch. The reader thread isn't timed.
+     */
+    PhaseClock* clock;
+    bool pipelined;
+    bool startRequested;
+    /**
+     * The protocol version, and whether more tasks may follow this one, in
+     * which case CLOSE isn't the last command.
+     */
+    int version;
+    bool reusable;
+    pthread_t thread;
+    /**
+     * Set by the reader thread once it has read the last command.
+     */
+    bool lastRead;
+    bool readerDone;
+    bool stopping;
+    std::deque<EventBatch*> ready;
+    vector<EventBatch*> spare;
+    pthread_mutex_t mutexQueue;
+    pthread_cond_t queueChanged;
+    /**
+     * The batch being filled by the reader thread.
+     */
+    EventBatch* filling;
+    /**
+     * The batch being replayed by the task and the next event in it.
+     */
+    EventBatch* current;
+    size_t currentEvent;
+
+    static void* runReader(void* ptr) {
+      ((PipelinedProtocol*) ptr)->readLoop();
+      return NULL;
+    }
+
+    DownwardEvent& addEvent(int32_t command) {
+      filling->events.push_back(DownwardEvent());
+      DownwardEvent& event = filling->events.back();
+      event.command = command;
+      event.first = 0;
+      event.second = 0;
+      event.keyOffset = 0;
+      event.keyLength = 0;
+      event.valueOffset = 0;
+      event.valueLength = 0;
+      return event;
+    }
+
+    void addKey(DownwardEvent& event, const char* key, size_t keyLength) {
+      event.keyOffset = filling->data.length();
+      event.keyLength = keyLength;
+      filling->data.append(key, keyLength);
+    }
+
+    void addValue(DownwardEvent& event, const char* value, 
+                  size_t valueLength) {
+      event.valueOffset = filling->data.length();
+      event.valueLength = valueLength;
+      filling->data.append(value, valueLength);
+    }
+
+    /**
+     * Queue the batch being filled and start a new one.
+     * @return false if the protocol is being shut down
+     */
+    bool handOver() {
+      pthread_mutex_lock(&mutexQueue);
+      ready.push_back(filling);
+      pthread_cond_broadcast(&queueChanged);
+      while (ready.size() >= MAX_BATCHES && !stopping) {
+        pthread_cond_wait(&queueChanged, &mutexQueue);
+      }
+      if (spare.empty()) {
+        filling = new EventBatch();
+      } else {
+        filling = spare.back();
+        spare.pop_back();
+      }
+      bool result = !stopping;
+      pthread_mutex_unlock(&mutexQueue);
+      return result;
+    }
+
+    void readLoop() {
+      while (!lastRead) {
+        try {
+          protocol->nextEvent();
+        } catch (Error& err) {
+          DownwardEvent& event = addEvent(READ_ERROR);
+          string message = err.getMessage();
+          addKey(event, message.data(), message.length());
+          lastRead = true;
+        }
+        // don't hold records back while the reader waits for more input
+        if (lastRead || filling->data.length() >= BATCH_DATA_SIZE ||
+            protocol->isInputBufferEmpty()) {
+          if (!filling->events.empty() && !handOver()) {
+            break;
+          }
+        }
+      }
+      pthread_mutex_lock(&mutexQueue);
+      readerDone = true;
+      pthread_cond_broadcast(&queueChanged);
+      pthread_mutex_unlock(&mutexQueue);
+    }
+
+    void startThreads() {
+      pipelined = true;
+      filling = new EventBatch();
+      writer->start();
+      pthread_create(&thread, NULL, runReader, this);
+    }
+
+    /**
+     * Move to the next batch, giving the finished one back to the reader.
+     */
+    void nextBatch() {
+      PhaseTimer timer(clock, PhaseClock::READ);
+      pthread_mutex_lock(&mutexQueue);
+      if (current != NULL) {
+        current->clear();
+        spare.push_back(current);
+        current = NULL;
+      }
+      while (ready.empty() && !readerDone) {
+        pthread_cond_wait(&queueChanged, &mutexQueue);
+      }
+      if (ready.empty()) {
+        pthread_mutex_unlock(&mutexQueue);
+        throw Error("no more commands after the reader thread stopped");
+      }
+      current = ready.front();
+      ready.pop_front();
+      currentEvent = 0;
+      pthread_cond_broadcast(&queueChanged);
+      pthread_mutex_unlock(&mutexQueue);
+    }
+
+    void replay(const DownwardEvent& event) {
+      const char* data = current->data.data();
+      switch (event.command) {
+      case SET_JOB_CONF: {
+        string encoded(data + event.keyOffset, event.keyLength);
+        StringInStream stream(encoded);
+        vector<string> values(event.first);
+        for(int i=0; i < event.first; ++i) {
+          deserializeString(values[i], stream);
+        }
+        handler->setJobConf(values);
+        break;
+      }
+      case SET_INPUT_TYPES:
+        handler->setInputTypes(string(data + event.keyOffset, event.keyLength),
+                               string(data + event.valueOffset, 
+                                      event.valueLength));
+        break;
+      case RUN_MAP:
+        handler->runMap(string(data + event.keyOffset, event.keyLength),
+                        event.first, event.second != 0);
+        break;
+      case MAP_ITEM:
+        handler->mapItem(data + event.keyOffset, event.keyLength,
+                         data + event.valueOffset, event.valueLength);
+        break;
+      case RUN_REDUCE:
+        handler->runReduce(event.first, event.second != 0);
+        break;
+      case REDUCE_KEY:
+        handler->reduceKey(data + event.keyOffset, event.keyLength);
+        break;
+      case REDUCE_VALUE:
+        handler->reduceValue(data + event.valueOffset, event.valueLength);
+        break;
+      case CLOSE:
+        handler->close();
+        break;
+      case ABORT:
+        handler->abort();
+        break;
+      case RESET:
+        handler->reset();
+        break;
+      default:
+        throw Error(string(data + event.keyOffset, event.keyLength));
+      }
+    }
+
+  public:
+    PipelinedProtocol(DownwardProtocol* _handler, PhaseClock* _clock) {
+      protocol = NULL;
+      handler = _handler;
+      clock = _clock;
+      writer = NULL;
+      pipelined = false;
+      startRequested = false;
+      version = 0;
+      reusable = false;
+      lastRead = false;
+      readerDone = false;
+      stopping = false;
+      filling = NULL;
+      current = NULL;
+      currentEvent = 0;
+      pthread_mutex_init(&mutexQueue, NULL);
+      pthread_cond_init(&queueChanged, NULL);
+    }
+
+    /**
+     * Set the protocol to run, whose handler is this object, and the stream
+     * it writes to. The protocol is owned by this object from now on. The
+     * threads are only used when there is a writer stream.
+     */
+    void setProtocol(BinaryProtocol* _protocol, PipelinedOutStream* _writer) {
+      protocol = _protocol;
+      writer = _writer;
+    }
+
+    virtual void nextEvent() {
+      if (!pipelined) {
+        protocol->nextEvent();
+        if (startRequested && writer != NULL) {
+          startThreads();
+        }
+        return;
+      }
+      if (current == NULL || currentEvent == current->events.size()) {
+        nextBatch();
+      }
+      replay(current->events[currentEvent++]);
+    }
+
+    /**
+     * The values are taken from the batch being replayed, which is kept
+     * until nextEvent moves on to the next one.
+     */
+    virtual void readValues(vector<std::pair<const char*, size_t> >& values,
+                            size_t maxValues, size_t maxBytes) {
+      if (!pipelined) {
+        protocol->readValues(values, maxValues, maxBytes);
+        return;
+      }
+      if (current == NULL) {
+        return;
+      }
+      const char* data = current->data.data();
+      size_t bytes = 0;
+      size_t count = 0;
+      while (count < maxValues && bytes < maxBytes &&
+             currentEvent < current->events.size() &&
+             current->events[currentEvent].command == REDUCE_VALUE) {
+        const DownwardEvent& event = current->events[currentEvent++];
+        values.push_back(std::make_pair(data + event.valueOffset,
+                                        event.valueLength));
+        bytes += event.valueLength;
+        count += 1;
+      }
+    }
+
+    virtual UpwardProtocol* getUplink() {
+      return protocol->getUplink();
+    }
+
+    virtual void start(int protocol) {
+      version = protocol;
+      handler->start(protocol);
+    }
+
+    /**
+     * The threads are started by the first task's configuration, and those
+     * of later tasks are passed through them. Whether the task may be
+     * followed by another is needed by the reader, to know if its CLOSE is
+     * the last command.
+     */
+    virtual void setJobConf(vector<string> values) {
+      for(size_t i=0; i + 1 < values.size(); i += 2) {
+        if (values[i] == IO_THREADS) {
+          startRequested = toBool(values[i + 1]);
+        } else if (values[i] == TASK_REUSE) {
+          reusable = version >= 2 && toBool(values[i + 1]);
+        }
+      }
+      if (pipelined) {
+        string encoded;
+        StringOutStream stream(encoded);
+        for(size_t i=0; i < values.size(); ++i) {
+          serializeString(values[i], stream);
+        }
+        DownwardEvent& event = addEvent(SET_JOB_CONF);
+        addKey(event, encoded.data(), encoded.length());
+        event.first = values.size();
+        return;
+      }
+      handler->setJobConf(values);
+    }
+
+    virtual void setInputTypes(string keyType, string valueType) {
+      if (!pipelined) {
+        handler->setInputTypes(keyType, valueType);
+        return;
+      }
+      DownwardEvent& event = addEvent(SET_INPUT_TYPES);
+      addKey(event, keyType.data(), keyType.length());
+      addValue(event, valueType.data(), valueType.length());
+    }
+
+    virtual void runMap(string inputSplit, int numReduces, bool pipedInput) {
+      if (!pipelined) {
+        handler->runMap(inputSplit, numReduces, pipedInput);
+        return;
+      }
+      DownwardEvent& event = addEvent(RUN_MAP);
+      addKey(event, inputSplit.data(), inputSplit.length());
+      event.first = numReduces;
+      event.second = pipedInput;
+    }
+
+    virtual void mapItem(const char* key, size_t keyLength,
+                         const char* value, size_t valueLength) {
+      if (!pipelined) {
+        handler->mapItem(key, keyLength, value, valueLength);
+        return;
+      }
+      DownwardEvent& event = addEvent(MAP_ITEM);
+      addKey(event, key, keyLength);
+      addValue(event, value, valueLength);
+    }
+
+    virtual void runReduce(int reduce, bool pipedOutput) {
+      if (!pipelined) {
+        handler->runReduce(reduce, pipedOutput);
+        return;
+      }
+      DownwardEvent& event = addEvent(RUN_REDUCE);
+      event.first = reduce;
+      event.second = pipedOutput;
+    }
+
+    virtual void reduceKey(const char* key, size_t keyLength) {
+      if (!pipelined) {
+        handler->reduceKey(key, keyLength);
+        return;
+      }
+      DownwardEvent& event = addEvent(REDUCE_KEY);
+      addKey(event, key, keyLength);
+    }
+
+    virtual void reduceValue(const char* value, size_t valueLength) {
+      if (!pipelined) {
+        handler->reduceValue(value, valueLength);
+        return;
+      }
+      DownwardEvent& event = addEvent(REDUCE_VALUE);
+      addValue(event, value, valueLength);
+    }
+
+    virtual void close() {
+      if (!pipelined) {
+        handler->close();
+        return;
+      }
+      addEvent(CLOSE);
+      lastRead = !reusable;
+    }
+
+    virtual void abort() {
+      if (!pipelined) {
+        handler->abort();
+        return;
+      }
+      addEvent(ABORT);
+      lastRead = true;
+    }
+
+    virtual void reset() {
+      if (!pipelined) {
+        handler->reset();
+        return;
+      }
+      addEvent(RESET);
+    }
+
+    /**
+     * The reader thread has to have finished, which it does after the last
+     * command or when its descriptor is closed.
+     */
+    virtual ~PipelinedProtocol() {
+      if (pipelined) {
+        pthread_mutex_lock(&mutexQueue);
+        stopping = true;
+        pthread_cond_broadcast(&queueChanged);
+        pthread_mutex_unlock(&mutexQueue);
+        pthread_join(thread, NULL);
+        delete filling;
+        delete current;
+        for(size_t i=0; i < ready.size(); ++i) {
+          delete ready[i];
+        }
+        for(size_t i=0; i < spare.size(); ++i) {
+          delete spare[i];
+        }
+      }
+      delete protocol;
+      pthread_cond_destroy(&queueChanged);
+      pthread_mutex_destroy(&mutexQueue);
+    }
+  };
+
+  /**
+   * A buffered stream that reads from a shared ring instead of a file
+   * descriptor.
+   */
+  class RingInStream: public FdInStream {
+  private:
+    SharedRing* ring;
+  public:
+    RingInStream(SharedRing* _ring, size_t bufferSize)
+      : FdInStream(-1, bufferSize) {
+      ring = _ring;
+    }
+
+  protected:
+    virtual size_t readSome(char* buf, size_t len) {
+      size_t result = ring->read(buf, len);
+      HADOOP_ASSERT(result != 0, "end of file");
+      return result;
+    }
+  };
+
+  /**
+   * A buffered stream that writes to a shared ring instead of a file
+   * descriptor. The ring is closed when the stream is destroyed.
+   */
+  class RingOutStream: public FdOutStream {
+  private:
+    SharedRing* ring;
+  public:
+    RingOutStream(SharedRing* _ring, size_t bufferSize)
+      : FdOutStream(-1, bufferSize) {
+      ring = _ring;
+    }
+
+    virtual ~RingOutStream() {
+      ring->close();
+    }
+
+  protected:
+    virtual void writeBuffers(const char* first, size_t firstLength,
+                              const char* second, size_t secondLength) {
+      ring->write(first, firstLength);
+      ring->write(second, secondLength);
+    }
+  };
+
+  /**
+   * Hands out memory from large blocks that are released all at once.
+   */
+  class Arena {
+  private:
+    static const size_t ALIGNMENT = 8;
+    size_t blockSize;
+    vector<char*> blocks;
+    size_t currentBlock;
+    char* next;
+    size_t remaining;
+    /**
+     * Allocations bigger than a block get their own memory.
+     */
+    vector<char*> largeBlocks;
+    size_t largeBytes;
+
+  public:
+    Arena(size_t _blockSize) {
+      blockSize = _blockSize;
+      currentBlock = 0;
+      next = NULL;
+      remaining = 0;
+      largeBytes = 0;
+    }
+
+    char* allocate(size_t size) {
+      size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+      if (size > remaining) {
+        if (size > blockSize / 4) {
+          char* result = new char[size];
+          largeBlocks.push_back(result);
+          largeBytes += size;
+          return result;
+        }
+        if (next != NULL) {
+          currentBlock += 1;
+        }
+        if (currentBlock == blocks.size()) {
+          blocks.push_back(new char[blockSize]);
+        }
+        next = blocks[currentBlock];
+        remaining = blockSize;
+      }
+      char* result = next;
+      next += size;
+      remaining -= size;
+      return result;
+    }
+
+    /**
+     * Release everything that was allocated. The regular blocks are kept
+     * to be reused.
+     */
+    void clear() {
+      for(size_t i=0; i < largeBlocks.size(); ++i) {
+        delete [] largeBlocks[i];
+      }
+      largeBlocks.clear();
+      largeBytes = 0;
+      currentBlock = 0;
+      next = NULL;
+      remaining = 0;
+    }
+
+    /**
+     * Get the number of bytes of memory held for the current allocations.
+     */
+    size_t getMemoryUsed() const {
+      size_t used = largeBytes;
+      if (next != NULL) {
+        used += (currentBlock + 1) * blockSize;
+      }
+      return used;
+    }
+
+    ~Arena() {
+      clear();
+      for(size_t i=0; i < blocks.size(); ++i) {
+        delete [] blocks[i];
+      }
+    }
+  };
+
+  /**
+   * A value buffered by the combiner. The bytes follow the header.
+   */
+  struct CombineValue {
+    CombineValue* next;
+    size_t length;
+
+    const char* data() const {
+      return reinterpret_cast<const char*>(this + 1);
+    }
+  };
+
+  /**
+   * A key buffered by the combiner along with its list of values. The key
+   * bytes follow the header.
+   */
+  struct CombineKey {
+    CombineValue* firstValue;
+    CombineValue* lastValue;
+    size_t length;
+    uint32_t hash;
+
+    const char* data() const {
+      return reinterpret_cast<const char*>(this + 1);
+    }
+  };
+
+  /**
+   * Orders keys by their raw bytes, like a memcmp based raw comparator.
+   */
+  static bool compareCombineKeys(const CombineKey* left, 
+                                 const CombineKey* right) {
+    size_t length = left->length < right->length ? left->length 
+                                                 : right->length;
+    int cmp = memcmp(left->data(), right->data(), length);
+    if (cmp != 0) {
+      return cmp < 0;
+    }
+    return left->length < right->length;
+  }
+
+  /**
+   * An open addressing hash table from keys to lists of values, where the
+   * keys, values and list links all live in an arena.
+   */
+  class CombineTable {
+  private:
+    static const size_t INITIAL_SLOTS = 1024;
+    Arena arena;
+    /**
+     * Linear probing slots, a power of two in size and at most half full.
+     */
+    vector<CombineKey*> slots;
+    /**
+     * The keys in the order they were first seen.
+     */
+    vector<CombineKey*> keys;
+
+    static uint32_t hashBytes(const char* data, size_t length) {
+      // FNV-1a
+      uint32_t hash = 2166136261u;
+      const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+      for(size_t i=0; i < length; ++i) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+      }
+      return hash;
+    }
+
+    void growSlots() {
+      vector<CombineKey*> newSlots(slots.size() * 2, (CombineKey*) NULL);
+      size_t mask = newSlots.size() - 1;
+      for(size_t i=0; i < keys.size(); ++i) {
+        size_t slot = keys[i]->hash & mask;
+        while (newSlots[slot] != NULL) {
+          slot = (slot + 1) & mask;
+        }
+        newSlots[slot] = keys[i];
+      }
+      slots.swap(newSlots);
+    }
+
+  public:
+    CombineTable(size_t arenaBlockSize)
+      : arena(arenaBlockSize), slots(INITIAL_SLOTS, (CombineKey*) NULL) {
+    }
+
+    void add(const char* key, size_t keyLength, 
+             const char* value, size_t valueLength) {
+      uint32_t hash = hashBytes(key, keyLength);
+      size_t mask = slots.size() - 1;
+      size_t slot = hash & mask;
+      CombineKey* entry;
+      while ((entry = slots[slot]) != NULL) {
+        if (entry->hash == hash && entry->length == keyLength &&
+            memcmp(entry->data(), key, keyLength) == 0) {
+          break;
+        }
+        slot = (slot + 1) & mask;
+      }
+      if (entry == NULL) {
+        entry = reinterpret_cast<CombineKey*>(
+                  arena.allocate(sizeof(CombineKey) + keyLength));
+        memcpy(entry + 1, key, keyLength);
+        entry->firstValue = NULL;
+        entry->lastValue = NULL;
+        entry->length = keyLength;
+        entry->hash = hash;
+        slots[slot] = entry;
+        keys.push_back(entry);
+        if (keys.size() * 2 > slots.size()) {
+          growSlots();
+        }
+      }
+      CombineValue* node = reinterpret_cast<CombineValue*>(
+                             arena.allocate(sizeof(CombineValue) + 
+                                            valueLength));
+      memcpy(node + 1, value, valueLength);
+      node->next = NULL;
+      node->length = valueLength;
+      if (entry->lastValue == NULL) {
+        entry->firstValue = node;
+      } else {
+        entry->lastValue->next = node;
+      }
+      entry->lastValue = node;
+    }
+
+    /**
+     * Get the keys, in the order they were first added unless sortKeys has
+     * been called.
+     */
+    vector<CombineKey*>& getKeys() {
+      return keys;
+    }
+
+    void sortKeys() {
+      std::sort(keys.begin(), keys.end(), compareCombineKeys);
+    }
+
+    /**
+     * Get the number of bytes held by the table, including its own
+     * bookkeeping.
+     */
+    size_t getMemoryUsed() const {
+      return arena.getMemoryUsed() + 
+        (slots.capacity() + keys.capacity()) * sizeof(CombineKey*);
+    }
+
+    void clear() {
+      std::fill(slots.begin(), slots.end(), (CombineKey*) NULL);
+      keys.clear();
+      arena.clear();
+    }
+  };
+
+  /**
+   * Define a context object to give to combiners that will let them
+   * go through the values and emit their results correctly.
+   */
+  class CombineContext: public ReduceContext {
+  private:
+    TaskContext* baseContext;
+    Partitioner* partitioner;
+    int numReduces;
+    UpwardProtocol* uplink;
+    bool firstKey;
+    bool firstValue;
+    vector<CombineKey*>::const_iterator keyItr;
+    vector<CombineKey*>::const_iterator endKeyItr;
+    const CombineValue* valueItr;
+    string key;
+    string value;
+    bool keyCopied;
+    bool valueCopied;
+
+  public:
+    CombineContext(TaskContext* _baseContext,
+                   Partitioner* _partitioner,
+                   int _numReduces,
+                   UpwardProtocol* _uplink,
+                   const vector<CombineKey*>& keys) {
+      baseContext = _baseContext;
+      partitioner = _partitioner;
+      numReduces = _numReduces;
+      uplink = _uplink;
+      keyItr = keys.begin();
+      endKeyItr = keys.end();
+      valueItr = NULL;
+      firstKey = true;
+      firstValue = true;
+      keyCopied = false;
+      valueCopied = false;
+    }
+
+    virtual const JobConf* getJobConf() {
+      return baseContext->getJobConf();
+    }
+
+    virtual const std::string& getInputKey() {
+      if (!keyCopied) {
+        key.assign((*keyItr)->data(), (*keyItr)->length);
+        keyCopied = true;
+      }
+      return key;
+    }
+
+    virtual const char* getInputKey(size_t& length) {
+      length = (*keyItr)->length;
+      return (*keyItr)->data();
+    }
+
+    virtual const std::string& getInputValue() {
+      if (!valueCopied) {
+        value.assign(valueItr->data(), valueItr->length);
+        valueCopied = true;
+      }
+      return value;
+    }
+
+    virtual const char* getInputValue(size_t& length) {
+      length = valueItr->length;
+      return valueItr->data();
+    }
+
+    virtual void emit(const std::string& key, const std::string& value) {
+      emit(key.data(), key.length(), value.data(), value.length());
+    }
+
+    virtual void emit(const char* key, size_t keyLength,
+                      const char* value, size_t valueLength) {
+      if (partitioner != NULL) {
+        uplink->partitionedOutput(partitioner->partition(key, keyLength, 
+                                                         numReduces),
+                                  key, keyLength, value, valueLength);
+      } else {
+        uplink->output(key, keyLength, value, valueLength);
+      }
+    }
+
+    virtual void progress() {
+      baseContext->progress();
+    }
+
+    virtual void setStatus(const std::string& status) {
+      baseContext->setStatus(status);
+    }
+
+    bool nextKey() {
+      if (firstKey) {
+        firstKey = false;
+      } else {
+        ++keyItr;
+      }
+      if (keyItr != endKeyItr) {
+        valueItr = (*keyItr)->firstValue;
+        firstValue = true;
+        keyCopied = false;
+        valueCopied = false;
+        return true;
+      }
+      return false;
+    }
+
+    virtual bool nextValue() {
+      if (firstValue) {
+        firstValue = false;
+      } else {
+        valueItr = valueItr->next;
+        valueCopied = false;
+      }
+      return valueItr != NULL;
+    }
+    
+    virtual Counter* getCounter(const std::string& group, 
+                               const std::string& name) {
+      return baseContext->getCounter(group, name);
+    }
+
+    virtual void incrementCounter(const Counter* counter, uint64_t amount) {
+      baseContext->incrementCounter(counter, amount);
+    }
+  };
+
+  /**
+   * A RecordWriter that will take the map outputs, buffer them up and then
+   * combine then when the buffer is full. The buffer is bounded by the
+   * memory it really uses, not just by the bytes of the records.
+   */
+  class CombineRunner: public RecordWriter {
+  private:
+    CombineTable data;
+    int64_t spillSize;
+    bool sortKeys;
+    TaskContext* baseContext;
+    Partitioner* partitioner;
+    int numReduces;
+    UpwardProtocol* uplink;
+    Reducer* combiner;
+    PhaseClock* clock;
+    /**
+     * The records and bytes added since the last spill.
+     */
+    uint64_t records;
+    uint64_t bytes;
+  public:
+    CombineRunner(int64_t _spillSize, bool _sortKeys,
+                  TaskContext* _baseContext, 
+                  Reducer* _combiner, UpwardProtocol* _uplink, 
+                  Partitioner* _partitioner, int _numReduces,
+                  PhaseClock* _clock)
+      : data(std::min(_spillSize / 16, (int64_t) 1024 * 1024)) {
+      clock = _clock;
+      records = 0;
+      bytes = 0;
+      spillSize = _spillSize;
+      sortKeys = _sortKeys;
+      baseContext = _baseContext;
+      partitioner = _partitioner;
+      numReduces = _numReduces;
+      uplink = _uplink;
+      combiner = _combiner;
+    }
+
+    virtual void emit(const std::string& key,
+                      const std::string& value) {
+      emit(key.data(), key.length(), value.data(), value.length());
+    }
+
+    virtual void emit(const char* key, size_t keyLength,
+                      const char* value, size_t valueLength) {
+      data.add(key, keyLength, value, valueLength);
+      records += 1;
+      bytes += keyLength + valueLength;
+      if ((int64_t) data.getMemoryUsed() >= spillSize) {
+        spillAll();
+      }
+    }
+
+    virtual void close() {
+      spillAll();
+    }
+
+  private:
+    void spillAll() {
+      PhaseTimer timer(clock, PhaseClock::SPILL);
+      if (sortKeys) {
+        data.sortKeys();
+      }
+      CombineContext context(baseContext, partitioner, numReduces, 
+                             uplink, data.getKeys());
+      while (context.nextKey()) {
+        combiner->reduce(context);
+      }
+      data.clear();
+      clock->addSpill(records, bytes);
+      records = 0;
+      bytes = 0;
+    }
+  };
+
+  /**
+   * A map output record held by the MapOutputSorter. The first bytes of the
+   * key are kept in the entry, so that most comparisons do not have to
+   * follow the pointer to the key.
+   */
+  struct SortEntry {
+    uint64_t prefix;
+    const char* data;
+    uint32_t keyLength;
+    uint32_t valueLength;
+  };
+
+  /**
+   * Get the first 8 bytes of a key as an integer that orders like the
+   * bytes, padding short keys with zeros.
+   */
+  static uint64_t getKeyPrefix(const char* key, size_t length) {
+    uint64_t prefix = 0;
+    size_t bytes = std::min(length, (size_t) 8);
+    for(size_t i=0; i < bytes; ++i) {
+      prefix |= (uint64_t) (unsigned char) key[i] << (56 - 8 * i);
+    }
+    return prefix;
+  }
+
+  /**
+   * Order entries by their key bytes, then by the key length.
+   */
+  static bool compareSortEntries(const SortEntry& a, const SortEntry& b) {
+    if (a.prefix != b.prefix) {
+      return a.prefix < b.prefix;
+    }
+    if (a.keyLength > 8 && b.keyLength > 8) {
+      int result = memcmp(a.data + 8, b.data + 8, 
+                          std::min(a.keyLength, b.keyLength) - 8);
+      if (result != 0) {
+        return result < 0;
+      }
+    }
+    return a.keyLength < b.keyLength;
+  }
+
+  /**
+   * A RecordWriter that collects the map outputs, and when the buffer is
+   * full sends them up grouped by partition and sorted by the raw bytes of
+   * their keys. Without a partitioner all of the outputs are sorted
+   * together, which leaves each partition's outputs sorted too.
+   */
+  class MapOutputSorter: public RecordWriter {
+  private:
+    Arena data;
+    /**
+     * The records of each partition, in the order they were emitted.
+     */
+    vector<vector<SortEntry> > partitions;
+    size_t records;
+    int64_t spillSize;
+    TaskContext* baseContext;
+    Partitioner* partitioner;
+    int numReduces;
+    UpwardProtocol* uplink;
+    PhaseClock* clock;
+    /**
+     * The bytes of the records added since the last spill.
+     */
+    uint64_t bytes;
+
+  public:
+    MapOutputSorter(int64_t _spillSize, TaskContext* _baseContext,
+                    UpwardProtocol* _uplink, Partitioner* _partitioner, 
+                    int _numReduces, PhaseClock* _clock)
+      : data(std::min(_spillSize / 16, (int64_t) 1024 * 1024)),
+        partitions(_partitioner == NULL ? 1 : _numReduces) {
+      clock = _clock;
+      bytes = 0;
+      records = 0;
+      spillSize = _spillSize;
+      baseContext = _baseContext;
+      partitioner = _partitioner;
+      numReduces = _numReduces;
+      uplink = _uplink;
+    }
+
+    virtual void emit(const std::string& key,
+                      const std::string& value) {
+      emit(key.data(), key.length(), value.data(), value.length());
+    }
+
+    virtual void emit(const char* key, size_t keyLength,
+                      const char* value, size_t valueLength) {
+      int part = 0;
+      if (partitioner != NULL) {
+        part = partitioner->partition(key, keyLength, numReduces);
+        HADOOP_ASSERT(part >= 0 && part < numReduces, 
+                      "bad partition " + toString(part));
+      }
+      SortEntry entry;
+      char* buffer = data.allocate(keyLength + valueLength);
+      memcpy(buffer, key, keyLength);
+      memcpy(buffer + keyLength, value, valueLength);
+      entry.prefix = getKeyPrefix(key, keyLength);
+      entry.data = buffer;
+      entry.keyLength = keyLength;
+      entry.valueLength = valueLength;
+      partitions[part].push_back(entry);
+      records += 1;
+      bytes += keyLength + valueLength;
+      if ((int64_t) getMemoryUsed() >= spillSize) {
+        spillAll();
+      }
+    }
+
+    virtual void close() {
+      spillAll();
+    }
+
+  private:
+    size_t getMemoryUsed() const {
+      return data.getMemoryUsed() + records * sizeof(SortEntry);
+    }
+
+    void spillAll() {
+      PhaseTimer timer(clock, PhaseClock::SPILL);
+      for(size_t part=0; part < partitions.size(); ++part) {
+        vector<SortEntry>& entries = partitions[part];
+        std::sort(entries.begin(), entries.end(), compareSortEntries);
+        for(size_t i=0; i < entries.size(); ++i) {
+          const SortEntry& entry = entries[i];
+          if (partitioner != NULL) {
+            uplink->partitionedOutput(part, entry.data, entry.keyLength,
+                                      entry.data + entry.keyLength, 
+                                      entry.valueLength);
+          } else {
+            uplink->output(entry.data, entry.keyLength, 
+                           entry.data + entry.keyLength, entry.valueLength);
+          }
+        }
+        entries.clear();
+      }
+      baseContext->progress();
+      clock->addSpill(records, bytes);
+      records = 0;
+      bytes = 0;
+      data.clear();
+    }
+  };
+
+  /**
+   * Map input is copied into batches of about this many bytes or records,
+   * for the mapper threads or a BatchMapper.
+   */
+  static const size_t MAP_BATCH_DATA_SIZE = 256 * 1024;
+  static const size_t MAP_BATCH_RECORDS = 4096;
+
+  /**
+   * Holds a mutex for the lifetime of the object, if it was given one.
+   */
+  class OptionalLock {
+  private:
+    pthread_mutex_t* mutex;
+  public:
+    OptionalLock(pthread_mutex_t* _mutex): mutex(_mutex) {
+      if (mutex != NULL) {
+        pthread_mutex_lock(mutex);
+      }
+    }
+
+    ~OptionalLock() {
+      if (mutex != NULL) {
+        pthread_mutex_unlock(mutex);
+      }
+    }
+  };
+
+  /**
+   * An uplink for one of several threads that share a connection. Records
+   * are collected in a private buffer and written to the shared uplink in
+   * bulk, under the lock that guards it.
+   */
+  class ThreadUplink: public UpwardProtocol {
+  private:
+    static const size_t FLUSH_SIZE = 256 * 1024;
+    UpwardProtocol* uplink;
+    pthread_mutex_t* lock;
+    RecordBatch records;
+    /**
+     * The partition of each buffered record, or -1 for unpartitioned output.
+     */
+    vector<int> partitions;
+
+  public:
+    ThreadUplink(UpwardProtocol* _uplink, pthread_mutex_t* _lock) {
+      uplink = _uplink;
+      lock = _lock;
+    }
+
+    virtual void output(const char* key, size_t keyLength,
+                        const char* value, size_t valueLength) {
+      partitionedOutput(-1, key, keyLength, value, valueLength);
+    }
+
+    virtual void partitionedOutput(int reduce, 
+                                   const char* key, size_t keyLength,
+                                   const char* value, size_t valueLength) {
+      records.add(key, keyLength, value, valueLength);
+      partitions.push_back(reduce);
+      if (records.getDataLength() >= FLUSH_SIZE) {
+        flush();
+      }
+    }
+
+    /**
+     * Write the buffered records to the shared uplink.
+     */
+    void flush() {
+      OptionalLock guard(lock);
+      for(size_t i=0; i < records.size(); ++i) {
+        size_t keyLength;
+        size_t valueLength;
+        const char* key = records.getKey(i, keyLength);
+        const char* value = records.getValue(i, valueLength);
+        if (partitions[i] < 0) {
+          uplink->output(key, keyLength, value, valueLength);
+        } else {
+          uplink->partitionedOutput(partitions[i], key, keyLength, 
+                                    value, valueLength);
+        }
+      }
+      records.clear();
+      partitions.clear();
+    }
+
+    virtual void status(const string& message) {
+      OptionalLock guard(lock);
+      uplink->status(message);
+    }
+
+    virtual void progress(float progress) {
+      OptionalLock guard(lock);
+      uplink->progress(progress);
+    }
+
+    virtual void done() {
+      flush();
+    }
+
+    virtual void registerCounter(int id, const string& group, 
+                                 const string& name) {
+      OptionalLock guard(lock);
+      uplink->registerCounter(id, group, name);
+    }
+
+    virtual void incrementCounter(const TaskContext::Counter* counter, 
+                                  uint64_t amount) {
+      OptionalLock guard(lock);
+      uplink->incrementCounter(counter, amount);
+    }
+  };
+
+  /**
+   * The context of one mapper thread. Records come from batches handed out
+   * by the MapThreadPool and emits go to a private ThreadUplink, while
+   * progress, status and counters are passed on to the task's context.
+   */
+  class MapWorker: public MapContext {
+  private:
+    MapContext* baseContext;
+    Mapper* mapper;
+    BatchMapper* batchMapper;
+    BatchEmitter batchOutput;
+    Partitioner* partitioner;
+    RecordWriter* writer;
+    Reducer* combiner;
+    int numReduces;
+    ThreadUplink uplink;
+    const RecordBatch* batch;
+    size_t record;
+    string key;
+    string value;
+    bool keyCopied;
+    bool valueCopied;
+    uint64_t lastProgress;
+    bool timing;
+    PhaseClock clock;
+
+  public:
+    MapWorker(MapContext* _baseContext, const Factory& factory,
+              UpwardProtocol* _uplink, pthread_mutex_t* lock,
+              int _numReduces, int64_t spillSize, bool sortKeys,
+              bool sortOutput, bool _timing)
+      : batchOutput(*this), uplink(_uplink, lock) {
+      timing = _timing;
+      baseContext = _baseContext;
+      numReduces = _numReduces;
+      batch = NULL;
+      record = 0;
+      keyCopied = false;
+      valueCopied = false;
+      lastProgress = 0;
+      writer = NULL;
+      combiner = NULL;
+      partitioner = NULL;
+      mapper = NULL;
+      batchMapper = factory.createBatchMapper(*this);
+      if (batchMapper == NULL) {
+        mapper = factory.createMapper(*this);
+      }
+      if (numReduces != 0) {
+        combiner = factory.createCombiner(*this);
+        partitioner = factory.createPartitioner(*this);
+      }
+      if (combiner != NULL) {
+        writer = new CombineRunner(spillSize, sortKeys, this, combiner, 
+                                   &uplink, partitioner, numReduces, &clock);
+      } else if (sortOutput && numReduces != 0) {
+        writer = new MapOutputSorter(spillSize, this, &uplink, partitioner, 
+                                     numReduces, &clock);
+      }
+    }
+
+    /**
+     * Start timing the phases, on the thread that runs this worker.
+     */
+    void startClock() {
+      if (timing) {
+        clock.start();
+      }
+    }
+
+    /**
+     * Run the mapper over every record of a batch.
+     */
+    void map(const RecordBatch& _batch) {
+      PhaseTimer timer(&clock, PhaseClock::USER);
+      if (batchMapper != NULL) {
+        batchMapper->map(*this, _batch, batchOutput);
+        return;
+      }
+      batch = &_batch;
+      for(record = 0; record < batch->size(); ++record) {
+        keyCopied = false;
+        valueCopied = false;
+        mapper->map(*this);
+      }
+      batch = NULL;
+    }
+
+    void close() {
+      if (mapper != NULL) {
+        mapper->close();
+      } else {
+        batchMapper->close();
+      }
+      if (combiner != NULL) {
+        combiner->close();
+      }
+      if (writer != NULL) {
+        writer->close();
+      }
+      {
+        PhaseTimer timer(&clock, PhaseClock::ENCODE);
+        uplink.flush();
+      }
+      clock.report(*this);
+    }
+
+    virtual const JobConf* getJobConf() {
+      return baseContext->getJobConf();
+    }
+
+    virtual const string& getInputKey() {
+      if (!keyCopied) {
+        size_t length;
+        const char* data = batch->getKey(record, length);
+        key.assign(data, length);
+        keyCopied = true;
+      }
+      return key;
+    }
+
+    virtual const char* getInputKey(size_t& length) {
+      return batch->getKey(record, length);
+    }
+
+    virtual const string& getInputValue() {
+      if (!valueCopied) {
+        size_t length;
+        const char* data = batch->getValue(record, length);
+        value.assign(data, length);
+        valueCopied = true;
+      }
+      return value;
+    }
+
+    virtual const char* getInputValue(size_t& length) {
+      return batch->getValue(record, length);
+    }
+
+    virtual const string& getInputSplit() {
+      return baseContext->getInputSplit();
+    }
+
+    virtual const string& getInputKeyClass() {
+      return baseContext->getInputKeyClass();
+    }
+
+    virtual const string& getInputValueClass() {
+      return baseContext->getInputValueClass();
+    }
+
+    virtual void emit(const string& key, const string& value) {
+      if (writer != NULL) {
+        progress();
+        PhaseTimer timer(&clock, PhaseClock::SPILL);
+        writer->emit(key, value);
+      } else {
+        emit(key.data(), key.length(), value.data(), value.length());
+      }
+    }
+
+    virtual void emit(const char* key, size_t keyLength,
+                      const char* value, size_t valueLength) {
+      progress();
+      PhaseTimer timer(&clock, writer != NULL ? PhaseClock::SPILL
+                                              : PhaseClock::ENCODE);
+      if (writer != NULL) {
+        writer->emit(key, keyLength, value, valueLength);
+      } else if (partitioner != NULL) {
+        int part = partitioner->partition(key, keyLength, numReduces);
+        uplink.partitionedOutput(part, key, keyLength, value, valueLength);
+      } else {
+        uplink.output(key, keyLength, value, valueLength);
+      }
+    }
+
+    /**
+     * Only pass progress on about once a second, so that the threads do not
+     * contend for the task's context on every emit.
+     */
+    virtual void progress() {
+      uint64_t now = getCurrentMillis();
+      if (now - lastProgress > 1000) {
+        lastProgress = now;
+        baseContext->progress();
+      }
+    }
+
+    virtual void setStatus(const string& status) {
+      baseContext->setStatus(status);
+    }
+
+    virtual Counter* getCounter(const string& group, const string& name) {
+      return baseContext->getCounter(group, name);
+    }
+
+    virtual void incrementCounter(const Counter* counter, uint64_t amount) {
+      baseContext->incrementCounter(counter, amount);
+    }
+
+    virtual ~MapWorker() {
+      delete mapper;
+      delete batchMapper;
+      delete writer;
+      delete combiner;
+      delete partitioner;
+    }
+  };
+
+  /**
+   * Runs several mappers, each on its own thread. The protocol thread copies
+   * records into batches and queues them, and whichever thread is free
+   * takes the next batch. Batches are recycled once they are mapped, so the
+   * amount of buffered input is bounded.
+   */
+  class MapThreadPool {
+  private:
+    vector<MapWorker*> workers;
+    vector<pthread_t> threads;
+    vector<RecordBatch*> freeBatches;
+    std::deque<RecordBatch*> fullBatches;
+    RecordBatch* current;
+    size_t numBatches;
+    bool closed;
+    bool failed;
+    string failure;
+    pthread_mutex_t mutexQueue;
+    pthread_cond_t batchFree;
+    pthread_cond_t batchFull;
+
+    struct WorkerStart {
+      MapThreadPool* pool;
+      MapWorker* worker;
+    };
+    vector<WorkerStart> starts;
+
+    static void* runWorker(void* ptr) {
+      WorkerStart* start = (WorkerStart*) ptr;
+      start->pool->work(start->worker);
+      return NULL;
+    }
+
+    void work(MapWorker* worker) {
+      worker->startClock();
+      try {
+        RecordBatch* batch;
+        while ((batch = takeBatch()) != NULL) {
+          worker->map(*batch);
+          returnBatch(batch);
+        }
+        pthread_mutex_lock(&mutexQueue);
+        bool isFailed = failed;
+        pthread_mutex_unlock(&mutexQueue);
+        if (!isFailed) {
+          worker->close();
+        }
+      } catch (Error& err) {
+        pthread_mutex_lock(&mutexQueue);
+        if (!failed) {
+          failed = true;
+          failure = err.getMessage();
+        }
+        pthread_cond_broadcast(&batchFree);
+        pthread_cond_broadcast(&batchFull);
+        pthread_mutex_unlock(&mutexQueue);
+      }
+    }
+
+    RecordBatch* takeBatch() {
+      pthread_mutex_lock(&mutexQueue);
+      while (fullBatches.empty() && !closed && !failed) {
+        pthread_cond_wait(&batchFull, &mutexQueue);
+      }
+      RecordBatch* result = NULL;
+      if (!fullBatches.empty() && !failed) {
+        result = fullBatches.front();
+        fullBatches.pop_front();
+      }
+      pthread_mutex_unlock(&mutexQueue);
+      return result;
+    }
+
+    void returnBatch(RecordBatch* batch) {
+      batch->clear();
+      pthread_mutex_lock(&mutexQueue);
+      freeBatches.push_back(batch);
+      pthread_cond_signal(&batchFree);
+      pthread_mutex_unlock(&mutexQueue);
+    }
+
+    /**
+     * Queue the current batch and wait for an empty one to fill next.
+     */
+    void queueCurrent() {
+      pthread_mutex_lock(&mutexQueue);
+      fullBatches.push_back(current);
+      pthread_cond_signal(&batchFull);
+      current = NULL;
+      while (freeBatches.empty() && !failed) {
+        pthread_cond_wait(&batchFree, &mutexQueue);
+      }
+      if (!failed) {
+        current = freeBatches.back();
+        freeBatches.pop_back();
+      }
+      pthread_mutex_unlock(&mutexQueue);
+      checkFailure();
+    }
+
+    void checkFailure() {
+      pthread_mutex_lock(&mutexQueue);
+      bool isFailed = failed;
+      string message = failure;
+      pthread_mutex_unlock(&mutexQueue);
+      if (isFailed) {
+        throw Error("Mapper thread failed: " + message);
+      }
+    }
+
+  public:
+    MapThreadPool(int numThreads, MapContext* baseContext, 
+                  const Factory& factory, UpwardProtocol* uplink,
+                  pthread_mutex_t* uplinkLock, int numReduces,
+                  int64_t spillSize, bool sortKeys, bool sortOutput,
+                  bool timing) {
+      closed = false;
+      failed = false;
+      pthread_mutex_init(&mutexQueue, NULL);
+      pthread_cond_init(&batchFree, NULL);
+      pthread_cond_init(&batchFull, NULL);
+      for(int i=0; i < numThreads; ++i) {
+        workers.push_back(new MapWorker(baseContext, factory, uplink,
+                                        uplinkLock, numReduces,
+                                        spillSize / numThreads, sortKeys,
+                                        sortOutput, timing));
+      }
+      // two batches per thread lets the protocol thread fill one while the
+      // other is being mapped
+      numBatches = 2 * numThreads;
+      for(size_t i=0; i < numBatches - 1; ++i) {
+        freeBatches.push_back(new RecordBatch());
+      }
+      current = new RecordBatch();
+      starts.resize(numThreads);
+      threads.resize(numThreads);
+      for(int i=0; i < numThreads; ++i) {
+        starts[i].pool = this;
+        starts[i].worker = workers[i];
+        int result = pthread_create(&threads[i], NULL, runWorker, &starts[i]);
+        HADOOP_ASSERT(result == 0, string("problem creating map thread: ") +
+                      strerror(result));
+      }
+    }
+
+    void add(const char* key, size_t keyLength, 
+             const char* value, size_t valueLength) {
+      current->add(key, keyLength, value, valueLength);
+      if (current->getDataLength() >= MAP_BATCH_DATA_SIZE ||
+          current->size() >= MAP_BATCH_RECORDS) {
+        queueCurrent();
+      }
+    }
+
+    /**
+     * Map the remaining records, then close the mappers and wait for all
+     * of their output to be written.
+     */
+    void close() {
+      pthread_mutex_lock(&mutexQueue);
+      if (current != NULL && current->size() > 0) {
+        fullBatches.push_back(current);
+        current = NULL;
+      }
+      closed = true;
+      pthread_cond_broadcast(&batchFull);
+      pthread_mutex_unlock(&mutexQueue);
+      for(size_t i=0; i < threads.size(); ++i) {
+        pthread_join(threads[i], NULL);
+      }
+      threads.clear();
+      checkFailure();
+    }
+
+    ~MapThreadPool() {
+      for(size_t i=0; i < workers.size(); ++i) {
+        delete workers[i];
+      }
+      for(size_t i=0; i < freeBatches.size(); ++i) {
+        delete freeBatches[i];
+      }
+      for(size_t i=0; i < fullBatches.size(); ++i) {
+        delete fullBatches[i];
+      }
+      delete current;
+      pthread_cond_destroy(&batchFull);
+      pthread_cond_destroy(&batchFree);
+      pthread_mutex_destroy(&mutexQueue);
     }
   };
 
   class TaskContextImpl: public MapContext, public ReduceContext, 
                          public DownwardProtocol {
   private:
+    /**
+     * The most values, and bytes of values, read ahead at once.
+     */
+    static const size_t VALUE_RUN_LENGTH = 1024;
+    static const size_t VALUE_RUN_BYTES = 256 * 1024;
+    static const int VALUES_PER_PROGRESS = 64;
     bool done;
     JobConf* jobConf;
+    /**
+     * The current record. Unless the key or value has been copied into the
+     * matching string, the bytes belong to the protocol.
+     */
+    const char* inputKey;
+    size_t inputKeyLength;
+    const char* inputValue;
+    size_t inputValueLength;
     string key;
-    const string* newKey;
-    const string* value;
+    string value;
+    bool keyCopied;
+    bool valueCopied;
+    const char* newKey;
+    size_t newKeyLength;
     bool hasTask;
     bool isNewKey;
     bool isNewValue;
+    /**
+     * Values of the current key read ahead from the protocol, and the next
+     * one to hand to the reducer.
+     */
+    vector<std::pair<const char*, size_t> > valueRun;
+    size_t nextRunValue;
+    /**
+     * The values left before nextValue next reports progress.
+     */
+    int valuesUntilProgress;
     string* inputKeyClass;
     string* inputValueClass;
     string status;
@@ -728,37 +2893,141 @@ namespace HadoopPipes {
     string* inputSplit;
     RecordReader* reader;
     Mapper* mapper;
+    /**
+     * A mapper that takes its input in batches, which are collected in
+     * mapInput.
+     */
+    BatchMapper* batchMapper;
+    RecordBatch mapInput;
+    BatchEmitter* mapOutput;
     Reducer* reducer;
     RecordWriter* writer;
     Partitioner* partitioner;
     int numReduces;
     const Factory* factory;
     pthread_mutex_t mutexDone;
-    std::vector<int> registeredCounterIds;
-
-  public:
+    pthread_cond_t condDone;
+    /**
+     * The registered counters, indexed by id, and the ids by group and name.
+     */
+    vector<Counter*> counters;
+    map<std::pair<string, string>, int> counterIds;
+    /**
+     * The amounts added to each counter since they were last sent up.
+     */
+    vector<uint64_t> pendingCounts;
+    MapThreadPool* mapPool;
+    /**
+     * Guards the uplink and the progress, status and counter state when
+     * several mapper threads share them. It is NULL otherwise.
+     */
+    pthread_mutex_t* uplinkLock;
+    pthread_mutex_t mutexUplink;
+    /**
+     * The time spent in each phase by the task's thread.
+     */
+    PhaseClock clock;
+    /**
+     * Whether the factory's initialize has been called, which happens once
+     * for all of the tasks of the process.
+     */
+    bool initialized;
+    int protocolVersion;
+    /**
+     * Whether the process may run another task after this one, whether it
+     * is waiting for the driver to send one, and whether the driver has.
+     */
+    bool reusable;
+    bool betweenTasks;
+    bool resetRequested;
 
-    TaskContextImpl(const Factory& _factory) {
+    /**
+     * Set up the state of a new task.
+     */
+    void initTask() {
       statusSet = false;
       done = false;
+      inputKey = NULL;
+      inputKeyLength = 0;
+      inputValue = NULL;
+      inputValueLength = 0;
+      keyCopied = true;
+      valueCopied = true;
       newKey = NULL;
-      factory = &_factory;
+      newKeyLength = 0;
       jobConf = NULL;
       inputKeyClass = NULL;
       inputValueClass = NULL;
       inputSplit = NULL;
       mapper = NULL;
+      batchMapper = NULL;
+      mapOutput = NULL;
       reducer = NULL;
       reader = NULL;
       writer = NULL;
       partitioner = NULL;
-      protocol = NULL;
+      numReduces = 0;
       isNewKey = false;
       isNewValue = false;
+      nextRunValue = 0;
+      valuesUntilProgress = 1;
       lastProgress = 0;
       progressFloat = 0.0f;
       hasTask = false;
+      mapPool = NULL;
+      uplinkLock = NULL;
+      reusable = false;
+    }
+
+    /**
+     * Delete the objects of the current task.
+     */
+    void deleteTask() {
+      delete jobConf;
+      delete inputKeyClass;
+      delete inputValueClass;
+      delete inputSplit;
+      delete reader;
+      delete mapper;
+      delete batchMapper;
+      delete mapOutput;
+      delete reducer;
+      delete writer;
+      delete partitioner;
+      delete mapPool;
+      for(size_t i=0; i < counters.size(); ++i) {
+        delete counters[i];
+      }
+      counters.clear();
+      counterIds.clear();
+      pendingCounts.clear();
+      mapInput.clear();
+      valueRun.clear();
+    }
+
+  public:
+
+    TaskContextImpl(const Factory& _factory) {
+      factory = &_factory;
+      protocol = NULL;
+      uplink = NULL;
+      initialized = false;
+      protocolVersion = 0;
+      betweenTasks = false;
+      resetRequested = false;
+      initTask();
       pthread_mutex_init(&mutexDone, NULL);
+      pthread_cond_init(&condDone, NULL);
+      // progress() is called again from setStatus, so the lock is recursive
+      pthread_mutexattr_t attr;
+      pthread_mutexattr_init(&attr);
+      pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+      pthread_mutex_init(&mutexUplink, &attr);
+      pthread_mutexattr_destroy(&attr);
+    }
+
+    PhaseClock* getPhaseClock() {
+      return &clock;
     }
 
     void setProtocol(Protocol* _protocol, UpwardProtocol* _uplink) {
@@ -768,10 +3037,12 @@ namespace HadoopPipes {
     }
 
     virtual void start(int protocol) {
-      if (protocol != 0) {
+      if (protocol < 0 || protocol > MAX_PROTOCOL_VERSION) {
         throw Error("Protocol version " + toString(protocol) + 
                     " not supported");
       }
+      protocolVersion = protocol;
+      uplink->setVersion(protocol);
     }
 
     virtual void setJobConf(vector<string> values) {
@@ -782,6 +3053,20 @@ namespace HadoopPipes {
         result->set(values[i], values[i+1]);
       }
       jobConf = result;
+      if (jobConf->hasKey(PHASE_TIMING) && jobConf->getBoolean(PHASE_TIMING)) {
+        clock.start();
+      }
+      reusable = protocolVersion >= 2 && jobConf->hasKey(TASK_REUSE) &&
+        jobConf->getBoolean(TASK_REUSE);
+      // each task's configuration says whether its outputs are compressed.
+      // This isn't done while decoding, since the reader thread decodes the
+      // next task's configuration while this one may still be sending.
+      uplink->setCompression(jobConf->hasKey(UPLINK_COMPRESS) &&
+                             jobConf->getBoolean(UPLINK_COMPRESS));
+      if (!initialized) {
+        initialized = true;
+        factory->initialize(*jobConf);
+      }
     }
 
     virtual void setInputTypes(string keyType, string valueType) {
@@ -795,29 +3080,60 @@ namespace HadoopPipes {
       HADOOP_ASSERT((reader == NULL) == pipedInput,
                     pipedInput ? "RecordReader defined when not needed.":
                     "RecordReader not defined");
-      if (reader != NULL) {
-        value = new string();
-      }
-      mapper = factory->createMapper(*this);
       numReduces = _numReduces;
-      if (numReduces != 0) { 
-        reducer = factory->createCombiner(*this);
-        partitioner = factory->createPartitioner(*this);
-      }
-      if (reducer != NULL) {
-        int64_t spillSize = 100;
-        if (jobConf->hasKey("mapreduce.task.io.sort.mb")) {
-          spillSize = jobConf->getInt("mapreduce.task.io.sort.mb");
+      int64_t spillSize = 100;
+      if (jobConf->hasKey("mapreduce.task.io.sort.mb")) {
+        spillSize = jobConf->getInt("mapreduce.task.io.sort.mb");
+      }
+      spillSize *= 1024 * 1024;
+      bool sortKeys = false;
+      if (jobConf->hasKey("mapreduce.pipes.combiner.sort")) {
+        sortKeys = jobConf->getBoolean("mapreduce.pipes.combiner.sort");
+      }
+      bool sortOutput = false;
+      if (jobConf->hasKey("mapreduce.pipes.map.sort")) {
+        sortOutput = jobConf->getBoolean("mapreduce.pipes.map.sort");
+      }
+      int mapThreads = 1;
+      if (jobConf->hasKey("mapreduce.pipes.map.threads")) {
+        mapThreads = jobConf->getInt("mapreduce.pipes.map.threads");
+      }
+      if (mapThreads > 1) {
+        uplinkLock = &mutexUplink;
+        mapPool = new MapThreadPool(mapThreads, this, *factory, uplink, 
+                                    uplinkLock, numReduces, spillSize,
+                                    sortKeys, sortOutput, clock.isStarted());
+      } else {
+        batchMapper = factory->createBatchMapper(*this);
+        if (batchMapper != NULL) {
+          mapOutput = new BatchEmitter(*this);
+        } else {
+          mapper = factory->createMapper(*this);
+        }
+        if (numReduces != 0) { 
+          reducer = factory->createCombiner(*this);
+          partitioner = factory->createPartitioner(*this);
+        }
+        if (reducer != NULL) {
+          writer = new CombineRunner(spillSize, sortKeys, 
+                                     (ReduceContext*) this, reducer, 
+                                     uplink, partitioner, numReduces,
+                                     &clock);
+        } else if (sortOutput && numReduces != 0) {
+          writer = new MapOutputSorter(spillSize, (MapContext*) this, uplink,
+                                       partitioner, numReduces, &clock);
         }
-        writer = new CombineRunner(spillSize * 1024 * 1024, this, reducer, 
-                                   uplink, partitioner, numReduces);
       }
       hasTask = true;
     }
 
-    virtual void mapItem(const string& _key, const string& _value) {
-      newKey = &_key;
-      value = &_value;
+    virtual void mapItem(const char* _key, size_t keyLength,
+                         const char* _value, size_t valueLength) {
+      newKey = _key;
+      newKeyLength = keyLength;
+      inputValue = _value;
+      inputValueLength = valueLength;
+      valueCopied = false;
       isNewKey = true;
     }
 
@@ -830,14 +3146,17 @@ namespace HadoopPipes {
       hasTask = true;
     }
 
-    virtual void reduceKey(const string& _key) {
+    virtual void reduceKey(const char* _key, size_t keyLength) {
       isNewKey = true;
-      newKey = &_key;
+      newKey = _key;
+      newKeyLength = keyLength;
     }
 
-    virtual void reduceValue(const string& _value) {
+    virtual void reduceValue(const char* _value, size_t valueLength) {
       isNewValue = true;
-      value = &_value;
+      inputValue = _value;
+      inputValueLength = valueLength;
+      valueCopied = false;
     }
     
     virtual bool isDone() {
@@ -847,18 +3166,83 @@ namespace HadoopPipes {
       return doneCopy;
     }
 
-    virtual void close() {
+    /**
+     * Wait until the task is done or the given number of seconds have
+     * passed.
+     * @return true if the task is done
+     */
+    bool waitForDone(int seconds) {
+      timespec deadline;
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_sec += seconds;
+      pthread_mutex_lock(&mutexDone);
+      while (!done) {
+        if (pthread_cond_timedwait(&condDone, &mutexDone, &deadline) 
+              == ETIMEDOUT) {
+          break;
+        }
+      }
+      bool doneCopy = done;
+      pthread_mutex_unlock(&mutexDone);
+      return doneCopy;
+    }
+
+    void setDone() {
       pthread_mutex_lock(&mutexDone);
       done = true;
+      pthread_cond_broadcast(&condDone);
       pthread_mutex_unlock(&mutexDone);
     }
 
+    /**
+     * End the task's input, or the process when it is between tasks.
+     */
+    virtual void close() {
+      betweenTasks = false;
+      setDone();
+    }
+
     virtual void abort() {
       throw Error("Aborted by driver");
     }
 
+    /**
+     * Forget the task that is done, keeping the process-wide state, so the
+     * next task's commands can follow.
+     */
+    virtual void reset() {
+      HADOOP_ASSERT(betweenTasks,
+                    "RESET is only allowed after a reusable task is done");
+      deleteTask();
+      initTask();
+      clock.reset();
+      uplink->setCompression(false);
+      resetRequested = true;
+    }
+
+    /**
+     * Once the task is done and has sent DONE, wait for the driver to send
+     * another task if the process is reusable.
+     * @return true if the next task has been started with RESET, or false
+     *    if the process should exit
+     */
+    bool waitForNextTask() {
+      if (!reusable) {
+        return false;
+      }
+      betweenTasks = true;
+      while (betweenTasks && !resetRequested) {
+        protocol->nextEvent();
+      }
+      betweenTasks = false;
+      bool result = resetRequested;
+      resetRequested = false;
+      return result;
+    }
+
     void waitForTask() {
       while (!done && !hasTask) {
+        PhaseTimer timer(&clock, PhaseClock::DECODE);
         protocol->nextEvent();
       }
     }
@@ -871,35 +3255,89 @@ namespace HadoopPipes {
             return false;
           }
         }
-        key = *newKey;
+        if (mapper != NULL || batchMapper != NULL || mapPool != NULL) {
+          // the record stays in the protocol's receive buffer until the
+          // next event is read, which is after map() returns
+          inputKey = newKey;
+          inputKeyLength = newKeyLength;
+          keyCopied = false;
+        } else {
+          // the reducer reads ahead to the next key before it is done with
+          // this one, so the key has to be kept
+          key.assign(newKey, newKeyLength);
+          inputKey = key.data();
+          inputKeyLength = key.length();
+          keyCopied = true;
+        }
       } else {
-        if (!reader->next(key, const_cast<string&>(*value))) {
-          pthread_mutex_lock(&mutexDone);
-          done = true;
-          pthread_mutex_unlock(&mutexDone);
+        PhaseTimer timer(&clock, PhaseClock::READ);
+        if (!reader->next(inputKey, inputKeyLength, 
+                          inputValue, inputValueLength)) {
+          setDone();
           return false;
         }
+        keyCopied = false;
+        valueCopied = false;
         progressFloat = reader->getProgress();
       }
       isNewKey = false;
-      if (mapper != NULL) {
+      if (mapPool != NULL) {
+        // waiting for the mapper threads counts as their time
+        PhaseTimer timer(&clock, PhaseClock::USER);
+        mapPool->add(inputKey, inputKeyLength, inputValue, inputValueLength);
+      } else if (batchMapper != NULL) {
+        mapInput.add(inputKey, inputKeyLength, inputValue, inputValueLength);
+        if (mapInput.getDataLength() >= MAP_BATCH_DATA_SIZE ||
+            mapInput.size() >= MAP_BATCH_RECORDS) {
+          mapBatch();
+        }
+      } else if (mapper != NULL) {
+        PhaseTimer timer(&clock, PhaseClock::USER);
         mapper->map(*this);
       } else {
+        PhaseTimer timer(&clock, PhaseClock::USER);
         reducer->reduce(*this);
       }
       return true;
     }
 
     /**
-     * Advance to the next value.
+     * Run the batch mapper over the collected input.
+     */
+    void mapBatch() {
+      PhaseTimer timer(&clock, PhaseClock::USER);
+      batchMapper->map(*this, mapInput, *mapOutput);
+      mapInput.clear();
+    }
+
+    /**
+     * Advance to the next value. Values that have already arrived are read
+     * ahead in runs, and progress, which reads the clock, is only reported
+     * every VALUES_PER_PROGRESS values.
      */
     virtual bool nextValue() {
       if (isNewKey || done) {
         return false;
       }
+      if (--valuesUntilProgress == 0) {
+        valuesUntilProgress = VALUES_PER_PROGRESS;
+        progress();
+      }
+      if (nextRunValue < valueRun.size()) {
+        inputValue = valueRun[nextRunValue].first;
+        inputValueLength = valueRun[nextRunValue].second;
+        valueCopied = false;
+        nextRunValue += 1;
+        return true;
+      }
+      PhaseTimer timer(&clock, PhaseClock::DECODE);
       isNewValue = false;
-      progress();
       protocol->nextEvent();
+      if (isNewValue) {
+        valueRun.clear();
+        nextRunValue = 0;
+        protocol->readValues(valueRun, VALUE_RUN_LENGTH, VALUE_RUN_BYTES);
+      }
       return isNewValue;
     }
 
@@ -915,16 +3353,34 @@ namespace HadoopPipes {
      * @return the current key or NULL if called before the first map or reduce
      */
     virtual const string& getInputKey() {
+      if (!keyCopied) {
+        key.assign(inputKey, inputKeyLength);
+        keyCopied = true;
+      }
       return key;
     }
 
+    virtual const char* getInputKey(size_t& length) {
+      length = inputKeyLength;
+      return inputKey;
+    }
+
     /**
      * Get the current value. 
      * @return the current value or NULL if called before the first map or 
      *    reduce
      */
     virtual const string& getInputValue() {
-      return *value;
+      if (!valueCopied) {
+        value.assign(inputValue, inputValueLength);
+        valueCopied = true;
+      }
+      return value;
+    }
+
+    virtual const char* getInputValue(size_t& length) {
+      length = inputValueLength;
+      return inputValue;
     }
 
     /**
@@ -933,6 +3389,7 @@ namespace HadoopPipes {
      */
     virtual void progress() {
       if (uplink != 0) {
+        OptionalLock guard(uplinkLock);
         uint64_t now = getCurrentMillis();
         if (now - lastProgress > 1000) {
           lastProgress = now;
@@ -940,6 +3397,7 @@ namespace HadoopPipes {
             uplink->status(status);
             statusSet = false;
           }
+          flushCounters();
           uplink->progress(progressFloat);
         }
       }
@@ -949,6 +3407,7 @@ namespace HadoopPipes {
      * Set the status message and call progress.
      */
     virtual void setStatus(const string& status) {
+      OptionalLock guard(uplinkLock);
       this->status = status;
       statusSet = true;
       progress();
@@ -976,63 +3435,113 @@ namespace HadoopPipes {
     }
 
     virtual void emit(const string& key, const string& value) {
-      progress();
       if (writer != NULL) {
+        progress();
+        PhaseTimer timer(&clock, PhaseClock::SPILL);
         writer->emit(key, value);
+      } else {
+        emit(key.data(), key.length(), value.data(), value.length());
+      }
+    }
+
+    virtual void emit(const char* key, size_t keyLength,
+                      const char* value, size_t valueLength) {
+      progress();
+      PhaseTimer timer(&clock, writer != NULL ? PhaseClock::SPILL
+                                              : PhaseClock::ENCODE);
+      if (writer != NULL) {
+        writer->emit(key, keyLength, value, valueLength);
       } else if (partitioner != NULL) {
-        int part = partitioner->partition(key, numReduces);
-        uplink->partitionedOutput(part, key, value);
+        int part = partitioner->partition(key, keyLength, numReduces);
+        uplink->partitionedOutput(part, key, keyLength, value, valueLength);
       } else {
-        uplink->output(key, value);
+        uplink->output(key, keyLength, value, valueLength);
       }
     }
 
     /**
-     * Register a counter with the given group and name.
+     * Register a counter with the given group and name. A counter is only
+     * registered with the framework once, so asking for the same group and
+     * name again returns the same counter, which belongs to the context.
      */
     virtual Counter* getCounter(const std::string& group, 
                                const std::string& name) {
-      int id = registeredCounterIds.size();
-      registeredCounterIds.push_back(id);
+      OptionalLock guard(uplinkLock);
+      std::pair<string, string> counterName(group, name);
+      map<std::pair<string, string>, int>::iterator itr = 
+        counterIds.find(counterName);
+      if (itr != counterIds.end()) {
+        return counters[itr->second];
+      }
+      int id = counters.size();
+      counterIds[counterName] = id;
+      counters.push_back(new Counter(id));
+      pendingCounts.push_back(0);
       uplink->registerCounter(id, group, name);
-      return new Counter(id);
+      return counters[id];
     }
 
     /**
-     * Increment the value of the counter with the given amount.
+     * Increment the value of the counter with the given amount. The amount
+     * is added locally and sent to the framework with the next progress
+     * report, or when the task is closed.
      */
     virtual void incrementCounter(const Counter* counter, uint64_t amount) {
-      uplink->incrementCounter(counter, amount); 
+      OptionalLock guard(uplinkLock);
+      int id = counter->getId();
+      if (id < 0 || (size_t) id >= pendingCounts.size()) {
+        // not one of ours, so pass it straight through
+        uplink->incrementCounter(counter, amount);
+      } else {
+        pendingCounts[id] += amount;
+      }
+    }
+
+    /**
+     * Send the counter increments that have been added up since the last
+     * call.
+     */
+    void flushCounters() {
+      OptionalLock guard(uplinkLock);
+      for(size_t i=0; i < pendingCounts.size(); ++i) {
+        if (pendingCounts[i] != 0) {
+          uplink->incrementCounter(counters[i], pendingCounts[i]);
+          pendingCounts[i] = 0;
+        }
+      }
     }
 
     void closeAll() {
+      if (mapPool) {
+        PhaseTimer timer(&clock, PhaseClock::USER);
+        mapPool->close();
+      }
       if (reader) {
         reader->close();
       }
       if (mapper) {
         mapper->close();
       }
+      if (batchMapper) {
+        if (mapInput.size() > 0) {
+          mapBatch();
+        }
+        batchMapper->close();
+      }
       if (reducer) {
         reducer->close();
       }
       if (writer) {
         writer->close();
       }
+      clock.report(*(MapContext*) this);
+      flushCounters();
     }
 
     virtual ~TaskContextImpl() {
-      delete jobConf;
-      delete inputKeyClass;
-      delete inputValueClass;
-      delete inputSplit;
-      if (reader) {
-        delete value;
-      }
-      delete reader;
-      delete mapper;
-      delete reducer;
-      delete writer;
-      delete partitioner;
+      deleteTask();
+      pthread_mutex_destroy(&mutexUplink);
+      pthread_cond_destroy(&condDone);
       pthread_mutex_destroy(&mutexDone);
     }
   };
@@ -1047,7 +3556,9 @@ namespace HadoopPipes {
     int remaining_retries = MAX_RETRIES;
     while (!context->isDone()) {
       try{
-        sleep(5);
+        if (context->waitForDone(5)) {
+          break;
+        }
         int sock = -1;
         if (portStr) {
           sock = socket(PF_INET, SOCK_STREAM, 0);
@@ -1085,6 +3596,22 @@ namespace HadoopPipes {
     return NULL;
   }
 
+  /**
+   * Speak the binary protocol over the given descriptors, using reader and
+   * writer threads if the job asks for them.
+   */
+  static Protocol* createFdProtocol(int inFd, int outFd, 
+                                    TaskContextImpl* context) {
+    PipelinedProtocol* result = 
+      new PipelinedProtocol(context, context->getPhaseClock());
+    PipelinedOutStream* up = 
+      new TimedOutStream<PipelinedOutStream>(outFd, BINARY_BUFFER_SIZE);
+    FdInStream* down = 
+      new TimedInStream<FdInStream>(inFd, BINARY_BUFFER_SIZE);
+    result->setProtocol(new BinaryProtocol(down, result, up), up);
+    return result;
+  }
+
   /**
    * Run the assigned task in the framework.
    * The user's main function should set the various functions using the 
@@ -1097,10 +3624,9 @@ namespace HadoopPipes {
       Protocol* connection;
       char* portStr = getenv("mapreduce.pipes.command.port");
       int sock = -1;
-      FILE* stream = NULL;
-      FILE* outStream = NULL;
-      char *bufin = NULL;
-      char *bufout = NULL;
+      int inFd = -1;
+      int outFd = -1;
+      SharedRingFile* ringFile = NULL;
       if (portStr) {
         sock = socket(PF_INET, SOCK_STREAM, 0);
         HADOOP_ASSERT(sock != - 1,
@@ -1112,65 +3638,60 @@ namespace HadoopPipes {
         HADOOP_ASSERT(connect(sock, (sockaddr*) &addr, sizeof(addr)) == 0,
                       string("problem connecting command socket: ") +
                       strerror(errno));
-
-        stream = fdopen(sock, "r");
-        outStream = fdopen(sock, "w");
-
-        // increase buffer size
-        int bufsize = 128*1024;
-        int setbuf;
-        bufin = new char[bufsize];
-        bufout = new char[bufsize];
-        setbuf = setvbuf(stream, bufin, _IOFBF, bufsize);
-        HADOOP_ASSERT(setbuf == 0, string("problem with setvbuf for inStream: ")
-                                     + strerror(errno));
-        setbuf = setvbuf(outStream, bufout, _IOFBF, bufsize);
-        HADOOP_ASSERT(setbuf == 0, string("problem with setvbuf for outStream: ")
-                                     + strerror(errno));
-        connection = new BinaryProtocol(stream, context, outStream);
+        connection = createFdProtocol(sock, sock, context);
+      } else if (getenv("mapreduce.pipes.command.ring")) {
+        ringFile = new SharedRingFile(getenv("mapreduce.pipes.command.ring"));
+        connection = new BinaryProtocol(
+                 new TimedInStream<RingInStream>(ringFile->getDownRing(),
+                                                 BINARY_BUFFER_SIZE),
+                 context,
+                 new TimedOutStream<RingOutStream>(ringFile->getUpRing(),
+                                                   BINARY_BUFFER_SIZE));
       } else if (getenv("mapreduce.pipes.commandfile")) {
         char* filename = getenv("mapreduce.pipes.commandfile");
         string outFilename = filename;
         outFilename += ".out";
-        stream = fopen(filename, "r");
-        outStream = fopen(outFilename.c_str(), "w");
-        connection = new BinaryProtocol(stream, context, outStream);
+        inFd = open(filename, O_RDONLY);
+        HADOOP_ASSERT(inFd != -1, string("problem opening command file: ") +
+                                  strerror(errno));
+        outFd = open(outFilename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        HADOOP_ASSERT(outFd != -1, string("problem opening output file: ") +
+                                   strerror(errno));
+        connection = createFdProtocol(inFd, outFd, context);
       } else {
         connection = new TextProtocol(stdin, context, stdout);
       }
       context->setProtocol(connection, connection->getUplink());
-      pthread_t pingThread;
-      pthread_create(&pingThread, NULL, ping, (void*)(context));
-      context->waitForTask();
-      while (!context->isDone()) {
-        context->nextKey();
-      }
-      context->closeAll();
-      connection->getUplink()->done();
-      pthread_join(pingThread,NULL);
+      do {
+        pthread_t pingThread;
+        pthread_create(&pingThread, NULL, ping, (void*)(context));
+        context->waitForTask();
+        while (!context->isDone()) {
+          context->nextKey();
+        }
+        context->closeAll();
+        connection->getUplink()->done();
+        pthread_join(pingThread,NULL);
+      } while (context->waitForNextTask());
+      if (sock != -1) {
+        // this also wakes up a reader thread that is waiting for input
+        int result = shutdown(sock, SHUT_RDWR);
+        HADOOP_ASSERT(result == 0, "problem shutting socket");
+      }
       delete context;
       delete connection;
-      if (stream != NULL) {
-        fflush(stream);
-      }
-      if (outStream != NULL) {
-        fflush(outStream);
-      }
+      delete ringFile;
       fflush(stdout);
       if (sock != -1) {
-        int result = shutdown(sock, SHUT_RDWR);
-        HADOOP_ASSERT(result == 0, "problem shutting socket");
-        result = close(sock);
+        int result = close(sock);
         HADOOP_ASSERT(result == 0, "problem closing socket");
       }
-      if (stream != NULL) {
-        //fclose(stream);
+      if (inFd != -1) {
+        close(inFd);
+      }
+      if (outFd != -1) {
+        close(outFd);
       }
-      if (outStream != NULL) {
-        //fclose(outStream);
-      } 
-      delete bufin;
-      delete bufout;
       return true;
     } catch (Error& err) {
       fprintf(stderr, "Hadoop Pipes Exception: %s\n", 
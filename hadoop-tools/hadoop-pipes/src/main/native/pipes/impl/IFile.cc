@@ -0,0 +1,384 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hadoop/IFile.hh"
+#include "hadoop/StringUtils.hh"
+
+#include <algorithm>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+using std::string;
+using std::vector;
+
+using namespace HadoopUtils;
+
+namespace HadoopPipes {
+
+  /**
+   * The key and value lengths that end a segment.
+   */
+  static const int EOF_MARKER = -1;
+  static const size_t CHECKSUM_LENGTH = 4;
+  static const size_t INDEX_RECORD_LENGTH = 24;
+
+  /**
+   * Decompressed records are read through a buffer of at least this size.
+   */
+  static const size_t MIN_BUFFER_SIZE = 64 * 1024;
+
+  static uint32_t readJavaInt(const char* bytes) {
+    uint32_t value = 0;
+    for(int i=0; i < 4; ++i) {
+      value = (value << 8) | (unsigned char) bytes[i];
+    }
+    return value;
+  }
+
+  static void writeJavaLong(char* bytes, uint64_t value) {
+    for(int i=0; i < 8; ++i) {
+      bytes[i] = (char) (value >> (56 - 8 * i));
+    }
+  }
+
+  static int64_t readJavaLong(const char* bytes) {
+    uint64_t value = 0;
+    for(int i=0; i < 8; ++i) {
+      value = (value << 8) | (unsigned char) bytes[i];
+    }
+    return (int64_t) value;
+  }
+
+  /**
+   * Passes bytes on to another stream, keeping their CRC32 and count, like
+   * Java's IFileOutputStream.
+   */
+  class ChecksumOutStream: public OutStream {
+  private:
+    OutStream& out;
+    uLong checksum;
+    uint64_t length;
+  public:
+    ChecksumOutStream(OutStream& _out): out(_out) {
+      checksum = crc32(0L, Z_NULL, 0);
+      length = 0;
+    }
+
+    virtual void write(const void* data, size_t size) {
+      // some streams take an empty write as an error
+      if (size == 0) {
+        return;
+      }
+      const Bytef* bytes = (const Bytef*) data;
+      for(size_t done=0; done < size; ) {
+        uInt piece = (uInt) std::min(size - done, (size_t) 1 << 30);
+        checksum = crc32(checksum, bytes + done, piece);
+        done += piece;
+      }
+      out.write(data, size);
+      length += size;
+    }
+
+    virtual void flush() {
+      out.flush();
+    }
+
+    void writeChecksum() {
+      char bytes[CHECKSUM_LENGTH];
+      for(size_t i=0; i < CHECKSUM_LENGTH; ++i) {
+        bytes[i] = (char) (checksum >> (24 - 8 * i));
+      }
+      out.write(bytes, CHECKSUM_LENGTH);
+      length += CHECKSUM_LENGTH;
+    }
+
+    uint64_t getLength() const {
+      return length;
+    }
+  };
+
+  static uLong checksumBytes(const char* data, size_t length) {
+    uLong checksum = crc32(0L, Z_NULL, 0);
+    for(size_t done=0; done < length; ) {
+      uInt piece = (uInt) std::min(length - done, (size_t) 1 << 30);
+      checksum = crc32(checksum, (const Bytef*) data + done, piece);
+      done += piece;
+    }
+    return checksum;
+  }
+
+  IFileWriter::IFileWriter(OutStream& out, const Codec* codec) {
+    checksumStream = new ChecksumOutStream(out);
+    compressor = codec == NULL ? NULL :
+      codec->createCompressor(*checksumStream);
+    rawLength = 0;
+    closed = false;
+  }
+
+  void IFileWriter::write(const char* data, size_t length) {
+    if (compressor != NULL) {
+      compressor->write(data, length);
+    } else {
+      checksumStream->write(data, length);
+    }
+    rawLength += length;
+  }
+
+  void IFileWriter::append(const char* key, size_t keyLength,
+                           const char* value, size_t valueLength) {
+    HADOOP_ASSERT(!closed, "append to a closed IFile segment");
+    HADOOP_ASSERT(keyLength <= 0x7fffffff && valueLength <= 0x7fffffff,
+                  "record too large for an IFile segment");
+    lengths.clear();
+    StringOutStream lengthStream(lengths);
+    serializeInt(keyLength, lengthStream);
+    serializeInt(valueLength, lengthStream);
+    write(lengths.data(), lengths.length());
+    write(key, keyLength);
+    write(value, valueLength);
+  }
+
+  void IFileWriter::close() {
+    if (closed) {
+      return;
+    }
+    lengths.clear();
+    StringOutStream lengthStream(lengths);
+    serializeInt(EOF_MARKER, lengthStream);
+    serializeInt(EOF_MARKER, lengthStream);
+    write(lengths.data(), lengths.length());
+    if (compressor != NULL) {
+      compressor->finish();
+    }
+    checksumStream->writeChecksum();
+    closed = true;
+  }
+
+  uint64_t IFileWriter::getCompressedLength() const {
+    return checksumStream->getLength();
+  }
+
+  IFileWriter::~IFileWriter() {
+    delete compressor;
+    delete checksumStream;
+  }
+
+  IFileReader::IFileReader(const char* data, size_t length,
+                           const Codec* codec): path("IFile segment") {
+    mapping = NULL;
+    mappingLength = 0;
+    init(data, length, codec);
+  }
+
+  IFileReader::IFileReader(const string& _path, int64_t offset,
+                           int64_t length, const Codec* codec): path(_path) {
+    mapping = NULL;
+    mappingLength = 0;
+    decompressor = NULL;
+    buffer = NULL;
+    int fd = open(path.c_str(), O_RDONLY);
+    HADOOP_ASSERT(fd != -1, "problem opening " + path + ": " +
+                  strerror(errno));
+    struct stat status;
+    if (fstat(fd, &status) != 0) {
+      int error = errno;
+      ::close(fd);
+      throw Error("problem reading " + path + ": " + strerror(error));
+    }
+    if (length < 0) {
+      length = status.st_size - offset;
+    }
+    if (offset < 0 || length < (int64_t) CHECKSUM_LENGTH ||
+        offset + length > status.st_size) {
+      ::close(fd);
+      throw Error("IFile segment is outside of " + path);
+    }
+    // the mapping has to start on a page
+    int64_t mappingOffset = offset - offset % sysconf(_SC_PAGESIZE);
+    mappingLength = offset + length - mappingOffset;
+    void* result = mmap(NULL, mappingLength, PROT_READ, MAP_SHARED, fd,
+                        mappingOffset);
+    int error = errno;
+    ::close(fd);
+    HADOOP_ASSERT(result != MAP_FAILED, "problem mapping " + path + ": " +
+                  strerror(error));
+    mapping = (char*) result;
+    madvise(mapping, mappingLength, MADV_SEQUENTIAL);
+    try {
+      init(mapping + (offset - mappingOffset), length, codec);
+    } catch (Error& e) {
+      munmap(mapping, mappingLength);
+      throw;
+    }
+  }
+
+  void IFileReader::init(const char* data, size_t length,
+                         const Codec* codec) {
+    decompressor = NULL;
+    buffer = NULL;
+    bufferCapacity = 0;
+    position = 0;
+    limit = 0;
+    done = false;
+    HADOOP_ASSERT(length >= CHECKSUM_LENGTH, "truncated " + path);
+    length -= CHECKSUM_LENGTH;
+    HADOOP_ASSERT(checksumBytes(data, length) ==
+                  readJavaInt(data + length), "checksum error in " + path);
+    if (codec == NULL) {
+      buffer = (char*) data;
+      limit = length;
+    } else {
+      decompressor = codec->createDecompressor(data, length);
+    }
+  }
+
+  /**
+   * Get the next bytes of the records, decompressing more if they aren't
+   * in the buffer yet.
+   */
+  const char* IFileReader::readBytes(size_t length) {
+    if (limit - position < length) {
+      HADOOP_ASSERT(decompressor != NULL, "truncated " + path);
+      size_t buffered = limit - position;
+      if (length > bufferCapacity) {
+        size_t capacity = std::max(std::max(length, bufferCapacity * 2),
+                                   MIN_BUFFER_SIZE);
+        char* bigger = new char[capacity];
+        memcpy(bigger, buffer + position, buffered);
+        delete [] buffer;
+        buffer = bigger;
+        bufferCapacity = capacity;
+      } else {
+        memmove(buffer, buffer + position, buffered);
+      }
+      position = 0;
+      limit = buffered;
+      while (limit < length) {
+        size_t bytes = decompressor->read(buffer + limit,
+                                          bufferCapacity - limit);
+        HADOOP_ASSERT(bytes > 0, "truncated " + path);
+        limit += bytes;
+      }
+    }
+    const char* result = buffer + position;
+    position += length;
+    return result;
+  }
+
+  int64_t IFileReader::readVLong() {
+    int8_t first = *readBytes(1);
+    if (first >= -112) {
+      return first;
+    }
+    bool negative = first < -120;
+    int length = negative ? -120 - first : -112 - first;
+    const char* bytes = readBytes(length);
+    uint64_t value = 0;
+    for(int i=0; i < length; ++i) {
+      value = (value << 8) | (unsigned char) bytes[i];
+    }
+    return negative ? (int64_t) ~value : (int64_t) value;
+  }
+
+  bool IFileReader::next(const char*& key, size_t& keyLength,
+                         const char*& value, size_t& valueLength) {
+    if (done) {
+      return false;
+    }
+    int64_t keyBytes = readVLong();
+    int64_t valueBytes = readVLong();
+    if (keyBytes == EOF_MARKER && valueBytes == EOF_MARKER) {
+      done = true;
+      return false;
+    }
+    HADOOP_ASSERT(keyBytes >= 0 && valueBytes >= 0 &&
+                  keyBytes <= 0x7fffffff && valueBytes <= 0x7fffffff,
+                  "corrupt record lengths in " + path);
+    key = readBytes(keyBytes + valueBytes);
+    keyLength = keyBytes;
+    value = key + keyBytes;
+    valueLength = valueBytes;
+    return true;
+  }
+
+  IFileReader::~IFileReader() {
+    if (decompressor != NULL) {
+      delete decompressor;
+      delete [] buffer;
+    }
+    if (mapping != NULL) {
+      munmap(mapping, mappingLength);
+    }
+  }
+
+  void readSpillRecord(const string& path, vector<IndexRecord>& result) {
+    string contents;
+    FILE* file = fopen(path.c_str(), "rb");
+    HADOOP_ASSERT(file != NULL, "problem opening " + path + ": " +
+                  strerror(errno));
+    char block[4096];
+    size_t bytes;
+    while ((bytes = fread(block, 1, sizeof(block), file)) > 0) {
+      contents.append(block, bytes);
+    }
+    bool failed = ferror(file) != 0;
+    fclose(file);
+    HADOOP_ASSERT(!failed, "problem reading " + path);
+    size_t partitions = contents.length() / INDEX_RECORD_LENGTH;
+    size_t size = partitions * INDEX_RECORD_LENGTH;
+    HADOOP_ASSERT(contents.length() >= size + 8 &&
+                  checksumBytes(contents.data(), size) ==
+                  (uint64_t) readJavaLong(contents.data() + size),
+                  "checksum error reading spill index " + path);
+    result.resize(partitions);
+    for(size_t i=0; i < partitions; ++i) {
+      const char* entry = contents.data() + i * INDEX_RECORD_LENGTH;
+      result[i].startOffset = readJavaLong(entry);
+      result[i].rawLength = readJavaLong(entry + 8);
+      result[i].partLength = readJavaLong(entry + 16);
+    }
+  }
+
+  void writeSpillRecord(const string& path,
+                        const vector<IndexRecord>& records) {
+    string contents(records.size() * INDEX_RECORD_LENGTH + 8, '\0');
+    for(size_t i=0; i < records.size(); ++i) {
+      char* entry = &contents[i * INDEX_RECORD_LENGTH];
+      writeJavaLong(entry, records[i].startOffset);
+      writeJavaLong(entry + 8, records[i].rawLength);
+      writeJavaLong(entry + 16, records[i].partLength);
+    }
+    size_t size = records.size() * INDEX_RECORD_LENGTH;
+    writeJavaLong(&contents[size], checksumBytes(contents.data(), size));
+    FILE* file = fopen(path.c_str(), "wb");
+    HADOOP_ASSERT(file != NULL, "problem creating " + path + ": " +
+                  strerror(errno));
+    bool failed = fwrite(contents.data(), 1, contents.length(), file) !=
+      contents.length();
+    failed = fclose(file) != 0 || failed;
+    HADOOP_ASSERT(!failed, "problem writing " + path + ": " +
+                  strerror(errno));
+  }
+}
@@ -0,0 +1,179 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hadoop/LineRecordReader.hh"
+#include "hadoop/SerialUtils.hh"
+#include "hadoop/StringUtils.hh"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using std::string;
+
+namespace HadoopPipes {
+
+  /**
+   * Read a long written by Java's DataOutput.writeLong.
+   */
+  static int64_t readJavaLong(const char* bytes) {
+    uint64_t result = 0;
+    for(int i=0; i < 8; ++i) {
+      result = (result << 8) | (unsigned char) bytes[i];
+    }
+    return (int64_t) result;
+  }
+
+  void parseFileSplit(const string& split, string& filename,
+                      int64_t& start, int64_t& length) {
+    HadoopUtils::StringInStream stream(split);
+    HadoopUtils::deserializeString(filename, stream);
+    // find out how long the path was, to see if a start and length follow
+    string path;
+    HadoopUtils::StringOutStream pathStream(path);
+    HadoopUtils::serializeString(filename, pathStream);
+    start = 0;
+    length = -1;
+    if (split.length() == path.length() + 16) {
+      start = readJavaLong(split.data() + path.length());
+      length = readJavaLong(split.data() + path.length() + 8);
+    } else {
+      HADOOP_ASSERT(split.length() == path.length(),
+                    "unrecognized input split for " + filename);
+    }
+    if (filename.compare(0, 5, "file:") == 0) {
+      filename.erase(0, 5);
+    }
+  }
+
+  LineRecordReader::LineRecordReader(MapContext& context) {
+    string filename;
+    int64_t splitStart;
+    int64_t splitLength;
+    parseFileSplit(context.getInputSplit(), filename, splitStart,
+                   splitLength);
+    open(filename, splitStart, splitLength);
+  }
+
+  LineRecordReader::LineRecordReader(const string& filename, int64_t start,
+                                     int64_t length) {
+    open(filename, start, length);
+  }
+
+  void LineRecordReader::open(const string& filename, int64_t splitStart,
+                              int64_t splitLength) {
+    fd = -1;
+    mapping = NULL;
+    mappingLength = 0;
+    mappingOffset = 0;
+    position = NULL;
+    fileEnd = NULL;
+    start = splitStart;
+    filePosition = splitStart;
+    fd = ::open(filename.c_str(), O_RDONLY);
+    HADOOP_ASSERT(fd != -1, "failed to open " + filename + ": " +
+                  strerror(errno));
+    struct stat statResult;
+    HADOOP_ASSERT(fstat(fd, &statResult) == 0, "failed to stat " + filename +
+                  ": " + strerror(errno));
+    int64_t fileLength = statResult.st_size;
+    end = splitLength < 0 ? fileLength : splitStart + splitLength;
+    if (splitStart >= fileLength) {
+      return;
+    }
+    // the last line may run past the end of the split, so map up to the end
+    // of the file
+    mappingOffset = splitStart & ~((int64_t) sysconf(_SC_PAGESIZE) - 1);
+    mappingLength = fileLength - mappingOffset;
+    void* result = mmap(NULL, mappingLength, PROT_READ, MAP_PRIVATE, fd,
+                        mappingOffset);
+    HADOOP_ASSERT(result != MAP_FAILED, "failed to map " + filename + ": " +
+                  strerror(errno));
+    mapping = (char*) result;
+    madvise(mapping, mappingLength, MADV_SEQUENTIAL);
+    position = mapping + (splitStart - mappingOffset);
+    fileEnd = mapping + mappingLength;
+    if (start != 0) {
+      // the line that runs into this split belongs to the previous one
+      const char* newline = HadoopUtils::findByte(position, fileEnd, '\n');
+      position = newline == fileEnd ? fileEnd : newline + 1;
+      start = mappingOffset + (position - mapping);
+      filePosition = start;
+    }
+  }
+
+  bool LineRecordReader::next(const char*& key, size_t& keyLength,
+                              const char*& value, size_t& valueLength) {
+    if (position >= fileEnd || filePosition > end) {
+      return false;
+    }
+    key = keyBuffer;
+    keyLength = HadoopUtils::formatLong(filePosition, keyBuffer);
+    const char* newline = HadoopUtils::findByte(position, fileEnd, '\n');
+    const char* lineEnd = newline;
+    if (lineEnd > position && lineEnd[-1] == '\r') {
+      --lineEnd;
+    }
+    value = position;
+    valueLength = lineEnd - position;
+    position = newline == fileEnd ? fileEnd : newline + 1;
+    filePosition = mappingOffset + (position - mapping);
+    return true;
+  }
+
+  bool LineRecordReader::next(string& key, string& value) {
+    const char* keyBytes;
+    size_t keyLength;
+    const char* valueBytes;
+    size_t valueLength;
+    if (!next(keyBytes, keyLength, valueBytes, valueLength)) {
+      return false;
+    }
+    key.assign(keyBytes, keyLength);
+    value.assign(valueBytes, valueLength);
+    return true;
+  }
+
+  float LineRecordReader::getProgress() {
+    if (start >= end) {
+      return 0.0f;
+    }
+    float progress = (filePosition - start) / (float) (end - start);
+    return progress < 1.0f ? progress : 1.0f;
+  }
+
+  void LineRecordReader::close() {
+    if (mapping != NULL) {
+      munmap(mapping, mappingLength);
+      mapping = NULL;
+    }
+    if (fd != -1) {
+      ::close(fd);
+      fd = -1;
+    }
+    position = NULL;
+    fileEnd = NULL;
+  }
+
+  LineRecordReader::~LineRecordReader() {
+    close();
+  }
+}
@@ -0,0 +1,1441 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hadoop/LocalRunner.hh"
+#include "hadoop/LineRecordReader.hh"
+#include "hadoop/SerialUtils.hh"
+#include "hadoop/StringUtils.hh"
+
+#include <algorithm>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+using std::map;
+using std::pair;
+using std::string;
+using std::vector;
+
+using namespace HadoopUtils;
+
+namespace HadoopPipes {
+
+  /**
+   * The buffer size of the streams that write and read the spill files.
+   */
+  static const size_t STREAM_BUFFER_SIZE = 64 * 1024;
+
+  /**
+   * Map input is collected into batches of about this many bytes or records
+   * for a BatchMapper.
+   */
+  static const size_t MAP_BATCH_DATA_SIZE = 256 * 1024;
+  static const size_t MAP_BATCH_RECORDS = 4096;
+
+  static const char* TEXT_CLASS = "org.apache.hadoop.io.Text";
+
+  class LocalJobConf: public JobConf {
+  private:
+    map<string, string> values;
+  public:
+    LocalJobConf(const map<string, string>& _values): values(_values) {}
+
+    void set(const string& key, const string& value) {
+      values[key] = value;
+    }
+
+    virtual bool hasKey(const string& key) const {
+      return values.find(key) != values.end();
+    }
+
+    virtual const string& get(const string& key) const {
+      map<string,string>::const_iterator itr = values.find(key);
+      if (itr == values.end()) {
+        throw Error("Key " + key + " not found in JobConf");
+      }
+      return itr->second;
+    }
+
+    virtual int getInt(const string& key) const {
+      return toInt(get(key));
+    }
+
+    virtual float getFloat(const string& key) const {
+      return toFloat(get(key));
+    }
+
+    virtual bool getBoolean(const string&key) const {
+      return toBool(get(key));
+    }
+  };
+
+  /**
+   * The counters of a job, which its tasks add to when they finish.
+   */
+  class CounterTable {
+  private:
+    pthread_mutex_t mutex;
+    map<pair<string, string>, int> ids;
+    vector<pair<string, string> > names;
+    vector<uint64_t> values;
+  public:
+    CounterTable() {
+      pthread_mutex_init(&mutex, NULL);
+    }
+
+    int getId(const string& group, const string& name) {
+      pthread_mutex_lock(&mutex);
+      pair<string, string> key(group, name);
+      map<pair<string, string>, int>::iterator itr = ids.find(key);
+      int id;
+      if (itr != ids.end()) {
+        id = itr->second;
+      } else {
+        id = names.size();
+        ids[key] = id;
+        names.push_back(key);
+        values.push_back(0);
+      }
+      pthread_mutex_unlock(&mutex);
+      return id;
+    }
+
+    /**
+     * Add amounts to the counters, indexed by their ids.
+     */
+    void add(const vector<uint64_t>& amounts) {
+      pthread_mutex_lock(&mutex);
+      for(size_t i=0; i < amounts.size(); ++i) {
+        values[i] += amounts[i];
+      }
+      pthread_mutex_unlock(&mutex);
+    }
+
+    void getAll(map<pair<string, string>, uint64_t>& result) {
+      pthread_mutex_lock(&mutex);
+      for(size_t i=0; i < names.size(); ++i) {
+        result[names[i]] += values[i];
+      }
+      pthread_mutex_unlock(&mutex);
+    }
+
+    ~CounterTable() {
+      pthread_mutex_destroy(&mutex);
+    }
+  };
+
+  /**
+   * The sorted records of one partition in a spill file.
+   */
+  struct Segment {
+    string path;
+    int64_t offset;
+    int64_t records;
+  };
+
+  /**
+   * What the tasks of a job share.
+   */
+  struct LocalJob {
+    const Factory* factory;
+    map<string, string> conf;
+    string output;
+    string workDirectory;
+    int reduces;
+    int64_t sortMemory;
+    int mergeFactor;
+    CounterTable counters;
+    pthread_mutex_t mutexSegments;
+    /**
+     * The segments of each partition, and every file that was written to
+     * the work directory.
+     */
+    vector<vector<Segment> > segments;
+    vector<string> files;
+
+    LocalJob() {
+      pthread_mutex_init(&mutexSegments, NULL);
+    }
+
+    void addSegments(int partition, const vector<Segment>& added) {
+      pthread_mutex_lock(&mutexSegments);
+      segments[partition].insert(segments[partition].end(), added.begin(),
+                                 added.end());
+      pthread_mutex_unlock(&mutexSegments);
+    }
+
+    void addFile(const string& path) {
+      pthread_mutex_lock(&mutexSegments);
+      files.push_back(path);
+      pthread_mutex_unlock(&mutexSegments);
+    }
+
+    ~LocalJob() {
+      pthread_mutex_destroy(&mutexSegments);
+    }
+  };
+
+  static int openFile(const string& path, int flags) {
+    int fd = open(path.c_str(), flags, 0666);
+    HADOOP_ASSERT(fd != -1, "problem opening " + path + ": " +
+                  strerror(errno));
+    return fd;
+  }
+
+  static void makeDirectory(const string& path) {
+    if (mkdir(path.c_str(), 0777) != 0) {
+      HADOOP_ASSERT(errno == EEXIST, "problem creating " + path + ": " +
+                    strerror(errno));
+    }
+  }
+
+  static string stripScheme(const string& path) {
+    return path.compare(0, 5, "file:") == 0 ? path.substr(5) : path;
+  }
+
+  /**
+   * Pick the partition of a key the way Java's HashPartitioner does for a
+   * Text key.
+   */
+  static int hashPartition(const char* key, size_t length, int reduces) {
+    uint32_t hash = 1;
+    for(size_t i=0; i < length; ++i) {
+      hash = 31 * hash + (uint32_t) (int32_t) (signed char) key[i];
+    }
+    return (int) ((hash & 0x7fffffff) % (uint32_t) reduces);
+  }
+
+  /**
+   * Compare keys by their bytes, and then by their lengths.
+   */
+  static int compareKeys(const char* a, size_t aLength,
+                         const char* b, size_t bLength) {
+    int result = memcmp(a, b, std::min(aLength, bLength));
+    if (result != 0) {
+      return result;
+    }
+    return aLength < bLength ? -1 : (aLength > bLength ? 1 : 0);
+  }
+
+  /**
+   * Writes records as "key\tvalue" lines to a file.
+   */
+  class TextRecordWriter: public RecordWriter {
+  private:
+    int fd;
+    FdOutStream* stream;
+  public:
+    TextRecordWriter(const string& path) {
+      fd = openFile(path, O_WRONLY | O_CREAT | O_TRUNC);
+      stream = new FdOutStream(fd, STREAM_BUFFER_SIZE);
+    }
+
+    virtual void emit(const string& key, const string& value) {
+      emit(key.data(), key.length(), value.data(), value.length());
+    }
+
+    virtual void emit(const char* key, size_t keyLength,
+                      const char* value, size_t valueLength) {
+      stream->write(key, keyLength);
+      stream->write("\t", 1);
+      stream->write(value, valueLength);
+      stream->write("\n", 1);
+    }
+
+    virtual void close() {
+      if (stream != NULL) {
+        stream->flush();
+        delete stream;
+        stream = NULL;
+        ::close(fd);
+      }
+    }
+
+    virtual ~TextRecordWriter() {
+      if (stream != NULL) {
+        delete stream;
+        ::close(fd);
+      }
+    }
+  };
+
+  static string getPartFile(const string& directory, int partition) {
+    char name[32];
+    snprintf(name, sizeof(name), "/part-%05d", partition);
+    return directory + name;
+  }
+
+  static const char* TASK_COUNTER_GROUP =
+    "org.apache.hadoop.mapreduce.TaskCounter";
+
+  class LocalTask {
+  public:
+    virtual void run() = 0;
+    virtual ~LocalTask() {}
+  };
+
+  /**
+   * The parts of a task's context that are the same for maps and reduces:
+   * its own copy of the job configuration, and counters that are added up
+   * in the task and given to the job when it finishes.
+   */
+  template <class Context>
+  class LocalContext: public Context {
+  protected:
+    LocalJob& job;
+    LocalJobConf jobConf;
+  private:
+    /**
+     * The counters handed out by getCounter and the amounts added to them,
+     * both indexed by the counter's id in the job.
+     */
+    vector<TaskContext::Counter*> counters;
+    vector<uint64_t> amounts;
+
+    void reserveCounter(int id) {
+      if (amounts.size() <= (size_t) id) {
+        amounts.resize(id + 1, 0);
+        counters.resize(id + 1, NULL);
+      }
+    }
+
+  public:
+    LocalContext(LocalJob& _job): job(_job), jobConf(_job.conf) {}
+
+    virtual const JobConf* getJobConf() {
+      return &jobConf;
+    }
+
+    virtual void progress() {}
+
+    virtual void setStatus(const string& status) {}
+
+    virtual TaskContext::Counter* getCounter(const string& group,
+                                             const string& name) {
+      int id = job.counters.getId(group, name);
+      reserveCounter(id);
+      if (counters[id] == NULL) {
+        counters[id] = new TaskContext::Counter(id);
+      }
+      return counters[id];
+    }
+
+    virtual void incrementCounter(const TaskContext::Counter* counter,
+                                  uint64_t amount) {
+      amounts[counter->getId()] += amount;
+    }
+
+    /**
+     * Add to one of the framework's counters.
+     */
+    void incrementTaskCounter(const string& name, uint64_t amount) {
+      int id = job.counters.getId(TASK_COUNTER_GROUP, name);
+      reserveCounter(id);
+      amounts[id] += amount;
+    }
+
+    /**
+     * Give the amounts counted so far to the job.
+     */
+    void flushCounters() {
+      job.counters.add(amounts);
+      amounts.assign(amounts.size(), 0);
+    }
+
+    virtual ~LocalContext() {
+      for(size_t i=0; i < counters.size(); ++i) {
+        delete counters[i];
+      }
+    }
+  };
+
+  /**
+   * A part of an input file that is given to one map.
+   */
+  struct Split {
+    string path;
+    int64_t start;
+    int64_t length;
+  };
+
+  /**
+   * A record in a map's sort buffer. The key and then the value are stored
+   * in the buffer at offset. The first bytes of the key are kept here too,
+   * so most comparisons don't have to look in the buffer.
+   */
+  struct SpillEntry {
+    int partition;
+    uint32_t prefix;
+    size_t offset;
+    uint32_t keyLength;
+    uint32_t valueLength;
+  };
+
+  class SpillEntryComparator {
+  private:
+    const char* buffer;
+  public:
+    SpillEntryComparator(const char* _buffer): buffer(_buffer) {}
+
+    bool operator()(const SpillEntry& a, const SpillEntry& b) const {
+      if (a.partition != b.partition) {
+        return a.partition < b.partition;
+      }
+      if (a.prefix != b.prefix) {
+        return a.prefix < b.prefix;
+      }
+      return compareKeys(buffer + a.offset, a.keyLength,
+                         buffer + b.offset, b.keyLength) < 0;
+    }
+  };
+
+  /**
+   * Get the first four bytes of a key as a big-endian number, padded with
+   * zeros, which sorts the same way as the key's bytes.
+   */
+  static uint32_t getKeyPrefix(const char* key, size_t length) {
+    uint32_t prefix = 0;
+    for(size_t i=0; i < 4; ++i) {
+      prefix <<= 8;
+      if (i < length) {
+        prefix |= (unsigned char) key[i];
+      }
+    }
+    return prefix;
+  }
+
+  /**
+   * The context the combiner is run in while a map spills. It goes through
+   * the values of one key of the sorted buffer at a time, and writes what
+   * the combiner emits to the spill file.
+   */
+  class SpillCombineContext: public ReduceContext {
+  private:
+    MapContext& task;
+    const char* buffer;
+    const SpillEntry* first;
+    const SpillEntry* current;
+    const SpillEntry* end;
+    string key;
+    string value;
+    FdOutStream* stream;
+    int64_t records;
+  public:
+    SpillCombineContext(MapContext& _task, const char* _buffer,
+                        FdOutStream* _stream): task(_task) {
+      buffer = _buffer;
+      first = NULL;
+      current = NULL;
+      end = NULL;
+      stream = _stream;
+      records = 0;
+    }
+
+    /**
+     * Set the records of the next key to combine.
+     */
+    void setRecords(const SpillEntry* _first, const SpillEntry* _end) {
+      first = _first;
+      current = NULL;
+      end = _end;
+      key.assign(buffer + first->offset, first->keyLength);
+    }
+
+    int64_t getRecords() const {
+      return records;
+    }
+
+    void resetRecords() {
+      records = 0;
+    }
+
+    virtual bool nextValue() {
+      current = current == NULL ? first : current + 1;
+      return current < end;
+    }
+
+    virtual const JobConf* getJobConf() {
+      return task.getJobConf();
+    }
+
+    virtual const string& getInputKey() {
+      return key;
+    }
+
+    virtual const string& getInputValue() {
+      value.assign(buffer + current->offset + current->keyLength,
+                   current->valueLength);
+      return value;
+    }
+
+    virtual const char* getInputKey(size_t& length) {
+      length = key.length();
+      return key.data();
+    }
+
+    virtual const char* getInputValue(size_t& length) {
+      length = current->valueLength;
+      return buffer + current->offset + current->keyLength;
+    }
+
+    virtual void emit(const string& key, const string& value) {
+      emit(key.data(), key.length(), value.data(), value.length());
+    }
+
+    virtual void emit(const char* key, size_t keyLength,
+                      const char* value, size_t valueLength) {
+      stream->writeString(key, keyLength);
+      stream->writeString(value, valueLength);
+      records += 1;
+    }
+
+    virtual void progress() {}
+
+    virtual void setStatus(const string& status) {}
+
+    virtual Counter* getCounter(const string& group, const string& name) {
+      return task.getCounter(group, name);
+    }
+
+    virtual void incrementCounter(const Counter* counter, uint64_t amount) {
+      task.incrementCounter(counter, amount);
+    }
+  };
+
+  /**
+   * Runs the mapper over one split. With no reduces the map output is
+   * written to the output directory. Otherwise it is partitioned into a
+   * sort buffer, which is sorted and spilled to the work directory whenever
+   * it reaches the map's share of the memory.
+   */
+  class LocalMapTask: public LocalContext<MapContext>, public LocalTask {
+  private:
+    Split split;
+    int index;
+    string inputSplit;
+    RecordReader* reader;
+    Mapper* mapper;
+    BatchMapper* batchMapper;
+    RecordBatch batch;
+    BatchEmitter* batchOutput;
+    Partitioner* partitioner;
+    Reducer* combiner;
+    RecordWriter* writer;
+    const char* inputKey;
+    size_t inputKeyLength;
+    const char* inputValue;
+    size_t inputValueLength;
+    string inputKeyString;
+    string inputValueString;
+    vector<char> buffer;
+    vector<SpillEntry> entries;
+    int spills;
+    uint64_t inputRecords;
+    uint64_t outputRecords;
+    uint64_t spilledRecords;
+    uint64_t combineInputRecords;
+    uint64_t combineOutputRecords;
+
+    void spill() {
+      std::sort(entries.begin(), entries.end(),
+                SpillEntryComparator(&buffer[0]));
+      string path = job.workDirectory + "/map-" + toString(index) + "-" +
+        toString(spills++);
+      job.addFile(path);
+      int fd = openFile(path, O_WRONLY | O_CREAT | O_TRUNC);
+      FdOutStream* stream = new FdOutStream(fd, STREAM_BUFFER_SIZE);
+      SpillCombineContext combineContext(*this, &buffer[0], stream);
+      vector<vector<Segment> > added(job.reduces);
+      try {
+        const SpillEntry* entry = entries.empty() ? NULL : &entries[0];
+        const SpillEntry* end = entry + entries.size();
+        while (entry < end) {
+          int partition = entry->partition;
+          stream->flush();
+          Segment segment;
+          segment.path = path;
+          segment.offset = lseek(fd, 0, SEEK_CUR);
+          const SpillEntry* partitionEnd = entry;
+          while (partitionEnd < end && partitionEnd->partition == partition) {
+            ++partitionEnd;
+          }
+          if (combiner == NULL) {
+            segment.records = partitionEnd - entry;
+            for(; entry < partitionEnd; ++entry) {
+              const char* key = &buffer[entry->offset];
+              stream->writeString(key, entry->keyLength);
+              stream->writeString(key + entry->keyLength, entry->valueLength);
+            }
+          } else {
+            combineContext.resetRecords();
+            while (entry < partitionEnd) {
+              const SpillEntry* keyEnd = entry + 1;
+              while (keyEnd < partitionEnd &&
+                     compareKeys(&buffer[entry->offset], entry->keyLength,
+                                 &buffer[keyEnd->offset],
+                                 keyEnd->keyLength) == 0) {
+                ++keyEnd;
+              }
+              combineContext.setRecords(entry, keyEnd);
+              combiner->reduce(combineContext);
+              combineInputRecords += keyEnd - entry;
+              entry = keyEnd;
+            }
+            segment.records = combineContext.getRecords();
+            combineOutputRecords += segment.records;
+          }
+          spilledRecords += segment.records;
+          if (segment.records > 0) {
+            added[partition].push_back(segment);
+          }
+        }
+        stream->flush();
+      } catch (Error& err) {
+        delete stream;
+        close(fd);
+        throw;
+      }
+      delete stream;
+      close(fd);
+      for(int i=0; i < job.reduces; ++i) {
+        job.addSegments(i, added[i]);
+      }
+      buffer.clear();
+      entries.clear();
+    }
+
+    void mapBatch() {
+      batchMapper->map(*this, batch, *batchOutput);
+      batch.clear();
+    }
+
+  public:
+    LocalMapTask(LocalJob& job, const Split& _split, int _index
+                 ): LocalContext<MapContext>(job), split(_split) {
+      index = _index;
+      StringOutStream stream(inputSplit);
+      serializeString(split.path, stream);
+      for(int shift=56; shift >= 0; shift -= 8) {
+        inputSplit += (char) (split.start >> shift);
+      }
+      for(int shift=56; shift >= 0; shift -= 8) {
+        inputSplit += (char) (split.length >> shift);
+      }
+      jobConf.set("mapreduce.task.partition", toString(index));
+      jobConf.set("mapreduce.task.ismap", "true");
+      jobConf.set("mapreduce.task.output.dir", "file:" + job.output);
+      jobConf.set("mapreduce.map.input.file", "file:" + split.path);
+      reader = NULL;
+      mapper = NULL;
+      batchMapper = NULL;
+      batchOutput = NULL;
+      partitioner = NULL;
+      combiner = NULL;
+      writer = NULL;
+      inputKey = NULL;
+      inputKeyLength = 0;
+      inputValue = NULL;
+      inputValueLength = 0;
+      spills = 0;
+      inputRecords = 0;
+      outputRecords = 0;
+      spilledRecords = 0;
+      combineInputRecords = 0;
+      combineOutputRecords = 0;
+    }
+
+    virtual void run() {
+      const Factory* factory = job.factory;
+      reader = factory->createRecordReader(*this);
+      if (reader == NULL) {
+        reader = new LineRecordReader(*this);
+      }
+      batchMapper = factory->createBatchMapper(*this);
+      if (batchMapper != NULL) {
+        batchOutput = new BatchEmitter(*this);
+      } else {
+        mapper = factory->createMapper(*this);
+      }
+      if (job.reduces == 0) {
+        writer = new TextRecordWriter(getPartFile(job.output, index));
+      } else {
+        partitioner = factory->createPartitioner(*this);
+        combiner = factory->createCombiner(*this);
+      }
+      while (reader->next(inputKey, inputKeyLength,
+                          inputValue, inputValueLength)) {
+        inputRecords += 1;
+        if (batchMapper != NULL) {
+          batch.add(inputKey, inputKeyLength, inputValue, inputValueLength);
+          if (batch.size() >= MAP_BATCH_RECORDS ||
+              batch.getDataLength() >= MAP_BATCH_DATA_SIZE) {
+            mapBatch();
+          }
+        } else {
+          mapper->map(*this);
+        }
+      }
+      if (batchMapper != NULL) {
+        if (batch.size() > 0) {
+          mapBatch();
+        }
+        batchMapper->close();
+      } else {
+        mapper->close();
+      }
+      reader->close();
+      if (writer != NULL) {
+        writer->close();
+      } else if (!entries.empty()) {
+        spill();
+      }
+      if (combiner != NULL) {
+        combiner->close();
+      }
+      incrementTaskCounter("MAP_INPUT_RECORDS", inputRecords);
+      incrementTaskCounter("MAP_OUTPUT_RECORDS", outputRecords);
+      incrementTaskCounter("SPILLED_RECORDS", spilledRecords);
+      incrementTaskCounter("COMBINE_INPUT_RECORDS", combineInputRecords);
+      incrementTaskCounter("COMBINE_OUTPUT_RECORDS", combineOutputRecords);
+      flushCounters();
+    }
+
+    virtual const string& getInputSplit() {
+      return inputSplit;
+    }
+
+    virtual const string& getInputKeyClass() {
+      static const string textClass = TEXT_CLASS;
+      return textClass;
+    }
+
+    virtual const string& getInputValueClass() {
+      return getInputKeyClass();
+    }
+
+    virtual const string& getInputKey() {
+      inputKeyString.assign(inputKey, inputKeyLength);
+      return inputKeyString;
+    }
+
+    virtual const string& getInputValue() {
+      inputValueString.assign(inputValue, inputValueLength);
+      return inputValueString;
+    }
+
+    virtual const char* getInputKey(size_t& length) {
+      length = inputKeyLength;
+      return inputKey;
+    }
+
+    virtual const char* getInputValue(size_t& length) {
+      length = inputValueLength;
+      return inputValue;
+    }
+
+    virtual void emit(const string& key, const string& value) {
+      emit(key.data(), key.length(), value.data(), value.length());
+    }
+
+    virtual void emit(const char* key, size_t keyLength,
+                      const char* value, size_t valueLength) {
+      outputRecords += 1;
+      if (writer != NULL) {
+        writer->emit(key, keyLength, value, valueLength);
+        return;
+      }
+      int partition = partitioner == NULL ?
+        hashPartition(key, keyLength, job.reduces) :
+        partitioner->partition(key, keyLength, job.reduces);
+      HADOOP_ASSERT(partition >= 0 && partition < job.reduces,
+                    "illegal partition " + toString(partition));
+      HADOOP_ASSERT(keyLength <= 0xffffffffU && valueLength <= 0xffffffffU,
+                    "record too large for the sort buffer");
+      SpillEntry entry;
+      entry.partition = partition;
+      entry.prefix = getKeyPrefix(key, keyLength);
+      entry.offset = buffer.size();
+      entry.keyLength = keyLength;
+      entry.valueLength = valueLength;
+      buffer.insert(buffer.end(), key, key + keyLength);
+      buffer.insert(buffer.end(), value, value + valueLength);
+      entries.push_back(entry);
+      if ((int64_t) (buffer.size() + entries.size() * sizeof(SpillEntry)) >=
+          job.sortMemory) {
+        spill();
+      }
+    }
+
+    virtual ~LocalMapTask() {
+      delete reader;
+      delete mapper;
+      delete batchMapper;
+      delete batchOutput;
+      delete partitioner;
+      delete combiner;
+      delete writer;
+    }
+  };
+
+  /**
+   * Reads the records of one segment of a spill file.
+   */
+  class SegmentReader {
+  private:
+    int fd;
+    FdInStream* stream;
+    int64_t remaining;
+    const char* key;
+    size_t keyLength;
+    const char* value;
+    size_t valueLength;
+  public:
+    SegmentReader(const Segment& segment) {
+      fd = openFile(segment.path, O_RDONLY);
+      HADOOP_ASSERT(lseek(fd, segment.offset, SEEK_SET) == segment.offset,
+                    "problem seeking in " + segment.path);
+      stream = new FdInStream(fd, STREAM_BUFFER_SIZE);
+      remaining = segment.records;
+      key = NULL;
+      keyLength = 0;
+      value = NULL;
+      valueLength = 0;
+    }
+
+    /**
+     * Move to the next record. The last record's bytes are no longer valid.
+     * @return false if there are no more records
+     */
+    bool next() {
+      if (remaining == 0) {
+        return false;
+      }
+      remaining -= 1;
+      stream->mark();
+      key = stream->readString(keyLength);
+      value = stream->readString(valueLength);
+      return true;
+    }
+
+    const char* getKey(size_t& length) const {
+      length = keyLength;
+      return key;
+    }
+
+    const char* getValue(size_t& length) const {
+      length = valueLength;
+      return value;
+    }
+
+    ~SegmentReader() {
+      delete stream;
+      close(fd);
+    }
+  };
+
+  /**
+   * Merges sorted segments into one sorted sequence of records. Records with
+   * equal keys come out in the order of their segments.
+   */
+  class SegmentMerger {
+  private:
+    vector<SegmentReader*> readers;
+    /**
+     * A heap of the readers that have a record, with the least key on top,
+     * and the reader of the current record, which isn't in the heap.
+     */
+    vector<int> heap;
+    int current;
+
+    /**
+     * Order the heap so that the least key is on top.
+     */
+    bool isAfter(int a, int b) const {
+      size_t aLength;
+      size_t bLength;
+      const char* aKey = readers[a]->getKey(aLength);
+      const char* bKey = readers[b]->getKey(bLength);
+      int result = compareKeys(aKey, aLength, bKey, bLength);
+      return result > 0 || (result == 0 && a > b);
+    }
+
+    class HeapOrder {
+    private:
+      const SegmentMerger* merger;
+    public:
+      HeapOrder(const SegmentMerger* _merger): merger(_merger) {}
+
+      bool operator()(int a, int b) const {
+        return merger->isAfter(a, b);
+      }
+    };
+
+  public:
+    SegmentMerger(const vector<Segment>& segments) {
+      current = -1;
+      try {
+        for(size_t i=0; i < segments.size(); ++i) {
+          readers.push_back(new SegmentReader(segments[i]));
+          if (readers.back()->next()) {
+            heap.push_back(i);
+          }
+        }
+      } catch (Error& err) {
+        for(size_t i=0; i < readers.size(); ++i) {
+          delete readers[i];
+        }
+        throw;
+      }
+      std::make_heap(heap.begin(), heap.end(), HeapOrder(this));
+    }
+
+    /**
+     * Move to the next record. The last record's bytes are no longer valid.
+     * @return false if there are no more records
+     */
+    bool next() {
+      if (current >= 0 && readers[current]->next()) {
+        heap.push_back(current);
+        std::push_heap(heap.begin(), heap.end(), HeapOrder(this));
+      }
+      if (heap.empty()) {
+        current = -1;
+        return false;
+      }
+      std::pop_heap(heap.begin(), heap.end(), HeapOrder(this));
+      current = heap.back();
+      heap.pop_back();
+      return true;
+    }
+
+    const char* getKey(size_t& length) const {
+      return readers[current]->getKey(length);
+    }
+
+    const char* getValue(size_t& length) const {
+      return readers[current]->getValue(length);
+    }
+
+    ~SegmentMerger() {
+      for(size_t i=0; i < readers.size(); ++i) {
+        delete readers[i];
+      }
+    }
+  };
+
+  static bool hasFewerRecords(const Segment& a, const Segment& b) {
+    return a.records < b.records;
+  }
+
+  /**
+   * Merges one partition of the map output and runs the reducer on it. If
+   * there are more segments than the merge factor, the smallest ones are
+   * first merged into files of their own.
+   */
+  class LocalReduceTask: public LocalContext<ReduceContext>,
+                         public LocalTask {
+  private:
+    int partition;
+    Reducer* reducer;
+    RecordWriter* writer;
+    SegmentMerger* merger;
+    /**
+     * Whether the merger has a record, whether that record is yet to be
+     * given to the reducer, and whether the current key has run out of
+     * values.
+     */
+    bool hasRecord;
+    bool isPending;
+    bool isKeyDone;
+    string key;
+    const char* value;
+    size_t valueLength;
+    string valueString;
+    uint64_t inputRecords;
+    uint64_t inputGroups;
+    uint64_t outputRecords;
+
+    /**
+     * Merge some of the segments into a new one in the work directory.
+     */
+    Segment mergeSegments(const vector<Segment>& segments, int pass) {
+      Segment result;
+      result.path = job.workDirectory + "/reduce-" + toString(partition) +
+        "-" + toString(pass);
+      result.offset = 0;
+      result.records = 0;
+      job.addFile(result.path);
+      SegmentMerger merger(segments);
+      int fd = openFile(result.path, O_WRONLY | O_CREAT | O_TRUNC);
+      FdOutStream stream(fd, STREAM_BUFFER_SIZE);
+      try {
+        while (merger.next()) {
+          size_t length;
+          const char* bytes = merger.getKey(length);
+          stream.writeString(bytes, length);
+          bytes = merger.getValue(length);
+          stream.writeString(bytes, length);
+          result.records += 1;
+        }
+        stream.flush();
+      } catch (Error& err) {
+        close(fd);
+        throw;
+      }
+      close(fd);
+      return result;
+    }
+
+  public:
+    LocalReduceTask(LocalJob& job, int _partition
+                    ): LocalContext<ReduceContext>(job) {
+      partition = _partition;
+      jobConf.set("mapreduce.task.partition", toString(partition));
+      jobConf.set("mapreduce.task.ismap", "false");
+      jobConf.set("mapreduce.task.output.dir", "file:" + job.output);
+      reducer = NULL;
+      writer = NULL;
+      merger = NULL;
+      hasRecord = false;
+      isPending = false;
+      isKeyDone = true;
+      value = NULL;
+      valueLength = 0;
+      inputRecords = 0;
+      inputGroups = 0;
+      outputRecords = 0;
+    }
+
+    virtual void run() {
+      vector<Segment> segments = job.segments[partition];
+      int passes = 0;
+      while (segments.size() > (size_t) job.mergeFactor) {
+        std::stable_sort(segments.begin(), segments.end(), hasFewerRecords);
+        vector<Segment> merged(segments.begin(),
+                               segments.begin() + job.mergeFactor);
+        segments.erase(segments.begin(), segments.begin() + job.mergeFactor);
+        segments.push_back(mergeSegments(merged, passes++));
+      }
+      merger = new SegmentMerger(segments);
+      reducer = job.factory->createReducer(*this);
+      writer = job.factory->createRecordWriter(*this);
+      if (writer == NULL) {
+        writer = new TextRecordWriter(getPartFile(job.output, partition));
+      }
+      hasRecord = merger->next();
+      isPending = hasRecord;
+      while (hasRecord) {
+        size_t keyLength;
+        const char* bytes = merger->getKey(keyLength);
+        key.assign(bytes, keyLength);
+        isKeyDone = false;
+        inputGroups += 1;
+        reducer->reduce(*this);
+        while (nextValue()) {
+          // skip the values the reducer didn't read
+        }
+      }
+      reducer->close();
+      writer->close();
+      incrementTaskCounter("REDUCE_INPUT_GROUPS", inputGroups);
+      incrementTaskCounter("REDUCE_INPUT_RECORDS", inputRecords);
+      incrementTaskCounter("REDUCE_OUTPUT_RECORDS", outputRecords);
+      flushCounters();
+    }
+
+    virtual bool nextValue() {
+      if (isKeyDone) {
+        return false;
+      }
+      if (!isPending) {
+        hasRecord = merger->next();
+        size_t keyLength;
+        const char* bytes = hasRecord ? merger->getKey(keyLength) : NULL;
+        if (!hasRecord ||
+            compareKeys(bytes, keyLength, key.data(), key.length()) != 0) {
+          isKeyDone = true;
+          isPending = hasRecord;
+          return false;
+        }
+      }
+      isPending = false;
+      value = merger->getValue(valueLength);
+      inputRecords += 1;
+      return true;
+    }
+
+    virtual const string& getInputKey() {
+      return key;
+    }
+
+    virtual const string& getInputValue() {
+      valueString.assign(value, valueLength);
+      return valueString;
+    }
+
+    virtual const char* getInputKey(size_t& length) {
+      length = key.length();
+      return key.data();
+    }
+
+    virtual const char* getInputValue(size_t& length) {
+      length = valueLength;
+      return value;
+    }
+
+    virtual void emit(const string& key, const string& value) {
+      writer->emit(key, value);
+      outputRecords += 1;
+    }
+
+    virtual void emit(const char* key, size_t keyLength,
+                      const char* value, size_t valueLength) {
+      writer->emit(key, keyLength, value, valueLength);
+      outputRecords += 1;
+    }
+
+    virtual ~LocalReduceTask() {
+      delete reducer;
+      delete writer;
+      delete merger;
+    }
+  };
+
+  /**
+   * Runs tasks on a number of threads, each taking the next task that
+   * hasn't been started. Once a task fails, the rest are not started.
+   */
+  class TaskPool {
+  private:
+    vector<LocalTask*> tasks;
+    size_t next;
+    bool failed;
+    string error;
+    pthread_mutex_t mutex;
+
+    static void* work(void* arg) {
+      TaskPool* pool = (TaskPool*) arg;
+      while (true) {
+        pthread_mutex_lock(&pool->mutex);
+        size_t index = pool->next;
+        bool isDone = pool->failed || index == pool->tasks.size();
+        if (!isDone) {
+          pool->next += 1;
+        }
+        pthread_mutex_unlock(&pool->mutex);
+        if (isDone) {
+          return NULL;
+        }
+        LocalTask* task = pool->tasks[index];
+        try {
+          task->run();
+        } catch (Error& err) {
+          pool->fail(err.getMessage());
+        }
+        // free the task's buffers while the others run
+        delete task;
+        pool->tasks[index] = NULL;
+      }
+    }
+
+    void fail(const string& message) {
+      pthread_mutex_lock(&mutex);
+      if (!failed) {
+        failed = true;
+        error = message;
+      }
+      pthread_mutex_unlock(&mutex);
+    }
+
+  public:
+    TaskPool() {
+      next = 0;
+      failed = false;
+      pthread_mutex_init(&mutex, NULL);
+    }
+
+    /**
+     * Add a task to run, which the pool deletes once it has run.
+     */
+    void add(LocalTask* task) {
+      tasks.push_back(task);
+    }
+
+    /**
+     * Run the tasks.
+     * @throws Error if one of the tasks failed
+     */
+    void run(int threads) {
+      if ((size_t) threads > tasks.size()) {
+        threads = tasks.size();
+      }
+      vector<pthread_t> workers;
+      for(int i=0; i < threads; ++i) {
+        pthread_t worker;
+        if (pthread_create(&worker, NULL, work, this) != 0) {
+          fail("problem creating a task thread");
+          break;
+        }
+        workers.push_back(worker);
+      }
+      for(size_t i=0; i < workers.size(); ++i) {
+        pthread_join(workers[i], NULL);
+      }
+      if (failed) {
+        throw Error(error);
+      }
+    }
+
+    ~TaskPool() {
+      for(size_t i=0; i < tasks.size(); ++i) {
+        delete tasks[i];
+      }
+      pthread_mutex_destroy(&mutex);
+    }
+  };
+
+  /**
+   * Add the splits of a file, or of the files in a directory. Like the Java
+   * FileInputFormat, names starting with "_" or "." are skipped, and the
+   * last split may be up to 10% larger than the split size.
+   */
+  static void addSplits(const string& path, int64_t splitSize,
+                        vector<Split>& splits) {
+    struct stat status;
+    HADOOP_ASSERT(stat(path.c_str(), &status) == 0,
+                  "problem reading " + path + ": " + strerror(errno));
+    if (S_ISDIR(status.st_mode)) {
+      DIR* directory = opendir(path.c_str());
+      HADOOP_ASSERT(directory != NULL,
+                    "problem reading " + path + ": " + strerror(errno));
+      vector<string> names;
+      struct dirent* entry;
+      while ((entry = readdir(directory)) != NULL) {
+        if (entry->d_name[0] != '_' && entry->d_name[0] != '.') {
+          names.push_back(entry->d_name);
+        }
+      }
+      closedir(directory);
+      std::sort(names.begin(), names.end());
+      for(size_t i=0; i < names.size(); ++i) {
+        string child = path + "/" + names[i];
+        HADOOP_ASSERT(stat(child.c_str(), &status) == 0,
+                      "problem reading " + child + ": " + strerror(errno));
+        if (S_ISREG(status.st_mode)) {
+          addSplits(child, splitSize, splits);
+        }
+      }
+      return;
+    }
+    Split split;
+    split.path = path;
+    split.start = 0;
+    int64_t remaining = status.st_size;
+    while (remaining > splitSize + splitSize / 10) {
+      split.length = splitSize;
+      splits.push_back(split);
+      split.start += splitSize;
+      remaining -= splitSize;
+    }
+    split.length = remaining;
+    splits.push_back(split);
+  }
+
+  LocalRunner::LocalRunner(const Factory& _factory) {
+    factory = &_factory;
+    reduces = 1;
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = processors > 0 ? processors : 1;
+    memory = 256 * 1024 * 1024;
+    splitSize = 64 * 1024 * 1024;
+  }
+
+  void LocalRunner::set(const string& key, const string& value) {
+    conf[key] = value;
+  }
+
+  void LocalRunner::addInput(const string& path) {
+    inputs.push_back(stripScheme(path));
+  }
+
+  void LocalRunner::setOutput(const string& directory) {
+    output = stripScheme(directory);
+  }
+
+  void LocalRunner::setWorkDirectory(const string& directory) {
+    workDirectory = stripScheme(directory);
+  }
+
+  void LocalRunner::setReduces(int _reduces) {
+    HADOOP_ASSERT(_reduces >= 0, "negative number of reduces");
+    reduces = _reduces;
+  }
+
+  void LocalRunner::setThreads(int _threads) {
+    HADOOP_ASSERT(_threads > 0, "need at least one thread");
+    threads = _threads;
+  }
+
+  void LocalRunner::setMemory(int64_t bytes) {
+    HADOOP_ASSERT(bytes > 0, "need some memory for the map output");
+    memory = bytes;
+  }
+
+  void LocalRunner::setSplitSize(int64_t bytes) {
+    HADOOP_ASSERT(bytes > 0, "split size must be positive");
+    splitSize = bytes;
+  }
+
+  /**
+   * Remove the spill files and the work directory.
+   */
+  static void removeWorkFiles(LocalJob& job) {
+    for(size_t i=0; i < job.files.size(); ++i) {
+      unlink(job.files[i].c_str());
+    }
+    rmdir(job.workDirectory.c_str());
+  }
+
+  void LocalRunner::run() {
+    HADOOP_ASSERT(!inputs.empty(), "no input given");
+    HADOOP_ASSERT(!output.empty(), "no output directory given");
+    vector<Split> splits;
+    for(size_t i=0; i < inputs.size(); ++i) {
+      addSplits(inputs[i], splitSize, splits);
+    }
+    LocalJob job;
+    job.factory = factory;
+    job.conf = conf;
+    job.conf["mapreduce.job.reduces"] = toString(reduces);
+    job.output = output;
+    job.workDirectory = workDirectory.empty() ? output + "/_local" :
+      workDirectory;
+    job.reduces = reduces;
+    int mapThreads = std::min((size_t) threads, splits.size());
+    job.sortMemory = memory / std::max(mapThreads, 1);
+    job.mergeFactor = 100;
+    if (conf.find("mapreduce.task.io.sort.factor") != conf.end()) {
+      job.mergeFactor = toInt(conf["mapreduce.task.io.sort.factor"]);
+      HADOOP_ASSERT(job.mergeFactor > 1, "merge factor must be at least 2");
+    }
+    job.segments.resize(reduces);
+    factory->initialize(LocalJobConf(job.conf));
+    makeDirectory(output);
+    makeDirectory(job.workDirectory);
+    try {
+      TaskPool maps;
+      for(size_t i=0; i < splits.size(); ++i) {
+        maps.add(new LocalMapTask(job, splits[i], i));
+      }
+      maps.run(threads);
+      TaskPool reduceTasks;
+      for(int i=0; i < reduces; ++i) {
+        reduceTasks.add(new LocalReduceTask(job, i));
+      }
+      reduceTasks.run(threads);
+    } catch (Error& err) {
+      removeWorkFiles(job);
+      throw;
+    }
+    removeWorkFiles(job);
+    counters.clear();
+    job.counters.getAll(counters);
+  }
+
+  static void printUsage(const char* program) {
+    fprintf(stderr,
+            "Usage: %s -o <output> [options] <input>...\n"
+            "  -r <reduces>     number of reduces (default 1)\n"
+            "  -t <threads>     threads that run the tasks (default: one per"
+            " processor)\n"
+            "  -m <megabytes>   memory for the map output (default 256)\n"
+            "  -s <megabytes>   largest split of an input file (default 64)\n"
+            "  -w <directory>   work directory (default <output>/_local)\n"
+            "  -D <key>=<value> set a value in the job configuration\n",
+            program);
+  }
+
+  int runLocal(const Factory& factory, int argc, char* argv[]) {
+    try {
+      LocalRunner runner(factory);
+      bool hasOutput = false;
+      int option;
+      while ((option = getopt(argc, argv, "o:r:t:m:s:w:D:")) != -1) {
+        switch (option) {
+        case 'o':
+          runner.setOutput(optarg);
+          hasOutput = true;
+          break;
+        case 'r':
+          runner.setReduces(toInt(optarg));
+          break;
+        case 't':
+          runner.setThreads(toInt(optarg));
+          break;
+        case 'm':
+          runner.setMemory(toLong(optarg) * 1024 * 1024);
+          break;
+        case 's':
+          runner.setSplitSize(toLong(optarg) * 1024 * 1024);
+          break;
+        case 'w':
+          runner.setWorkDirectory(optarg);
+          break;
+        case 'D': {
+          string setting = optarg;
+          string::size_type equals = setting.find('=');
+          HADOOP_ASSERT(equals != string::npos,
+                        "expected key=value after -D: " + setting);
+          runner.set(setting.substr(0, equals), setting.substr(equals + 1));
+          break;
+        }
+        default:
+          printUsage(argv[0]);
+          return 1;
+        }
+      }
+      if (!hasOutput || optind == argc) {
+        printUsage(argv[0]);
+        return 1;
+      }
+      for(int i=optind; i < argc; ++i) {
+        runner.addInput(argv[i]);
+      }
+      runner.run();
+      const map<pair<string, string>, uint64_t>& counters =
+        runner.getCounters();
+      for(map<pair<string, string>, uint64_t>::const_iterator itr =
+            counters.begin(); itr != counters.end(); ++itr) {
+        printf("%s\t%s\t%llu\n", itr->first.first.c_str(),
+               itr->first.second.c_str(), (unsigned long long) itr->second);
+      }
+      return 0;
+    } catch (Error& err) {
+      fprintf(stderr, "Hadoop Pipes Exception: %s\n",
+              err.getMessage().c_str());
+      return 1;
+    }
+  }
+}
@@ -0,0 +1,312 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hadoop/LookupTable.hh"
+#include "hadoop/SerialUtils.hh"
+#include "hadoop/StringUtils.hh"
+
+#include <algorithm>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using std::pair;
+using std::string;
+using std::vector;
+
+using namespace HadoopUtils;
+
+namespace HadoopPipes {
+
+  /**
+   * The header is the magic number, the version, the number of records,
+   * the number of slots in the index, the offset of the index and the hash
+   * seed, padded to HEADER_LENGTH.
+   */
+  static const char MAGIC[] = "HPLT";
+  static const uint32_t VERSION = 1;
+  static const size_t HEADER_LENGTH = 64;
+  static const uint64_t HASH_SEED = 0x4c6f6f6b75705462ULL;
+
+  /**
+   * Each slot of the index is the top bits of the record's hash above its
+   * offset, or zero if the slot is empty. No record is at offset zero.
+   */
+  static const int OFFSET_BITS = 48;
+  static const uint64_t OFFSET_MASK = ((uint64_t) 1 << OFFSET_BITS) - 1;
+
+  /**
+   * The index has at least this many slots per record, so probes are short.
+   */
+  static const uint64_t SLOTS_PER_RECORD = 2;
+  static const uint64_t MIN_SLOTS = 8;
+
+  static void putLittle(char* buffer, uint64_t value, int bytes) {
+    for(int i=0; i < bytes; ++i) {
+      buffer[i] = (char) (value >> (8 * i));
+    }
+  }
+
+  static uint64_t getLittle(const char* buffer, int bytes) {
+    uint64_t value = 0;
+    for(int i=bytes - 1; i >= 0; --i) {
+      value = (value << 8) | (unsigned char) buffer[i];
+    }
+    return value;
+  }
+
+  static uint64_t getSlotCount(uint64_t records) {
+    uint64_t slots = MIN_SLOTS;
+    while (slots < records * SLOTS_PER_RECORD) {
+      slots <<= 1;
+    }
+    return slots;
+  }
+
+  LookupTableWriter::LookupTableWriter(const string& _path)
+    : path(_path), tempPath(_path + "." + toString(getpid()) + ".tmp") {
+    // the records are read back to check keys whose hashes collide
+    file = fopen(tempPath.c_str(), "w+b");
+    HADOOP_ASSERT(file != NULL, "problem creating " + tempPath + ": " +
+                  strerror(errno));
+    char header[HEADER_LENGTH];
+    memset(header, 0, HEADER_LENGTH);
+    offset = 0;
+    write(header, HEADER_LENGTH);
+  }
+
+  void LookupTableWriter::write(const void* data, size_t length) {
+    HADOOP_ASSERT(file != NULL, "write to closed lookup table " + path);
+    HADOOP_ASSERT(fwrite(data, 1, length, file) == length,
+                  "problem writing " + path + ": " + strerror(errno));
+    offset += length;
+  }
+
+  void LookupTableWriter::add(const char* key, size_t keyLength,
+                              const char* value, size_t valueLength) {
+    HADOOP_ASSERT(keyLength <= 0xffffffffU && valueLength <= 0xffffffffU,
+                  "record too large for lookup table " + path);
+    HADOOP_ASSERT(offset + 8 + keyLength + valueLength <= OFFSET_MASK,
+                  "lookup table " + path + " is too large");
+    entries.push_back(pair<uint64_t, uint64_t>(hashBytes(key, keyLength,
+                                                         HASH_SEED),
+                                               offset));
+    char lengths[8];
+    putLittle(lengths, keyLength, 4);
+    putLittle(lengths + 4, valueLength, 4);
+    write(lengths, sizeof(lengths));
+    write(key, keyLength);
+    write(value, valueLength);
+  }
+
+  /**
+   * Read the key of the record at the given offset.
+   */
+  static void readKey(FILE* file, const string& path, uint64_t offset,
+                      string& key) {
+    char lengths[8];
+    HADOOP_ASSERT(fseeko(file, offset, SEEK_SET) == 0 &&
+                  fread(lengths, 1, sizeof(lengths), file) == sizeof(lengths),
+                  "problem reading " + path + ": " + strerror(errno));
+    key.resize(getLittle(lengths, 4));
+    HADOOP_ASSERT(key.empty() ||
+                  fread(&key[0], 1, key.size(), file) == key.size(),
+                  "problem reading " + path + ": " + strerror(errno));
+  }
+
+  void LookupTableWriter::close() {
+    if (file == NULL) {
+      return;
+    }
+    try {
+      writeIndex();
+    } catch (Error&) {
+      abandon();
+      throw;
+    }
+    int result = fclose(file);
+    file = NULL;
+    if (result != 0) {
+      int error = errno;
+      unlink(tempPath.c_str());
+      throw Error("problem writing " + path + ": " + strerror(error));
+    }
+    if (rename(tempPath.c_str(), path.c_str()) != 0) {
+      int error = errno;
+      unlink(tempPath.c_str());
+      throw Error("problem renaming " + tempPath + " to " + path + ": " +
+                  strerror(error));
+    }
+  }
+
+  void LookupTableWriter::abandon() {
+    if (file != NULL) {
+      fclose(file);
+      file = NULL;
+      unlink(tempPath.c_str());
+    }
+  }
+
+  void LookupTableWriter::writeIndex() {
+    // keys with the same hash are the only ones that can be the same
+    vector<pair<uint64_t, uint64_t> > sorted(entries);
+    std::sort(sorted.begin(), sorted.end());
+    string key;
+    string otherKey;
+    for(size_t i=1; i < sorted.size(); ++i) {
+      if (sorted[i].first == sorted[i - 1].first) {
+        readKey(file, path, sorted[i - 1].second, key);
+        readKey(file, path, sorted[i].second, otherKey);
+        HADOOP_ASSERT(key != otherKey,
+                      "duplicate key " + quoteString(key, "") +
+                      " in lookup table " + path);
+      }
+    }
+    vector<pair<uint64_t, uint64_t> >().swap(sorted);
+    HADOOP_ASSERT(fseeko(file, 0, SEEK_END) == 0,
+                  "problem writing " + path + ": " + strerror(errno));
+
+    // pad the records so the index is aligned in the mapping
+    char padding[8];
+    memset(padding, 0, sizeof(padding));
+    write(padding, (8 - offset % 8) % 8);
+    uint64_t indexOffset = offset;
+    uint64_t slotCount = getSlotCount(entries.size());
+    vector<uint64_t> slots(slotCount);
+    for(size_t i=0; i < entries.size(); ++i) {
+      uint64_t hash = entries[i].first;
+      uint64_t slot = hash & (slotCount - 1);
+      while (slots[slot] != 0) {
+        slot = (slot + 1) & (slotCount - 1);
+      }
+      slots[slot] = (hash & ~OFFSET_MASK) | entries[i].second;
+    }
+    char buffer[8];
+    for(size_t i=0; i < slotCount; ++i) {
+      putLittle(buffer, slots[i], 8);
+      write(buffer, sizeof(buffer));
+    }
+
+    char header[HEADER_LENGTH];
+    memset(header, 0, HEADER_LENGTH);
+    memcpy(header, MAGIC, 4);
+    putLittle(header + 4, VERSION, 4);
+    putLittle(header + 8, entries.size(), 8);
+    putLittle(header + 16, slotCount, 8);
+    putLittle(header + 24, indexOffset, 8);
+    putLittle(header + 32, HASH_SEED, 8);
+    HADOOP_ASSERT(fseeko(file, 0, SEEK_SET) == 0 &&
+                  fwrite(header, 1, HEADER_LENGTH, file) == HEADER_LENGTH,
+                  "problem writing " + path + ": " + strerror(errno));
+  }
+
+  LookupTableWriter::~LookupTableWriter() {
+    abandon();
+  }
+
+  LookupTable::LookupTable(const string& _path): path(_path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    HADOOP_ASSERT(fd != -1, "problem opening " + path + ": " +
+                  strerror(errno));
+    struct stat status;
+    if (fstat(fd, &status) != 0) {
+      int error = errno;
+      ::close(fd);
+      throw Error("problem reading " + path + ": " + strerror(error));
+    }
+    length = status.st_size;
+    if (length < HEADER_LENGTH) {
+      ::close(fd);
+      throw Error(path + " is not a lookup table");
+    }
+    void* mapping = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+    int error = errno;
+    ::close(fd);
+    HADOOP_ASSERT(mapping != MAP_FAILED, "problem mapping " + path + ": " +
+                  strerror(error));
+    data = (const char*) mapping;
+    // lookups jump around the file, so reading ahead just wastes the cache
+    madvise(mapping, length, MADV_RANDOM);
+
+    records = getLittle(data + 8, 8);
+    uint64_t slotCount = getLittle(data + 16, 8);
+    uint64_t indexOffset = getLittle(data + 24, 8);
+    seed = getLittle(data + 32, 8);
+    if (memcmp(data, MAGIC, 4) != 0 || getLittle(data + 4, 4) != VERSION ||
+        slotCount < MIN_SLOTS || (slotCount & (slotCount - 1)) != 0 ||
+        slotCount <= records || indexOffset < HEADER_LENGTH ||
+        indexOffset % 8 != 0 || indexOffset > length ||
+        (length - indexOffset) / 8 != slotCount ||
+        (length - indexOffset) % 8 != 0) {
+      munmap(mapping, length);
+      throw Error(path + " is not a lookup table");
+    }
+    slots = data + indexOffset;
+    slotMask = slotCount - 1;
+  }
+
+  bool LookupTable::find(const char* key, size_t keyLength,
+                         const char*& value, size_t& valueLength) const {
+    uint64_t hash = hashBytes(key, keyLength, seed);
+    uint64_t fingerprint = hash & ~OFFSET_MASK;
+    uint64_t slot = hash & slotMask;
+    while (true) {
+      uint64_t entry = getLittle(slots + slot * 8, 8);
+      if (entry == 0) {
+        return false;
+      }
+      if ((entry & ~OFFSET_MASK) == fingerprint) {
+        uint64_t offset = entry & OFFSET_MASK;
+        HADOOP_ASSERT(offset >= HEADER_LENGTH &&
+                      offset + 8 <= (uint64_t) (slots - data),
+                      "corrupt lookup table " + path);
+        const char* record = data + offset;
+        uint64_t recordKeyLength = getLittle(record, 4);
+        uint64_t recordValueLength = getLittle(record + 4, 4);
+        HADOOP_ASSERT(offset + 8 + recordKeyLength + recordValueLength <=
+                      (uint64_t) (slots - data),
+                      "corrupt lookup table " + path);
+        if (recordKeyLength == keyLength &&
+            memcmp(record + 8, key, keyLength) == 0) {
+          value = record + 8 + keyLength;
+          valueLength = recordValueLength;
+          return true;
+        }
+      }
+      slot = (slot + 1) & slotMask;
+    }
+  }
+
+  bool LookupTable::find(const string& key, string& value) const {
+    const char* result;
+    size_t resultLength;
+    if (!find(key.data(), key.length(), result, resultLength)) {
+      return false;
+    }
+    value.assign(result, resultLength);
+    return true;
+  }
+
+  LookupTable::~LookupTable() {
+    munmap((void*) data, length);
+  }
+}
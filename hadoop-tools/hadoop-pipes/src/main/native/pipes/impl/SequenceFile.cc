@@ -0,0 +1,613 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hadoop/SequenceFile.hh"
+#include "hadoop/LineRecordReader.hh"
+#include "hadoop/StringUtils.hh"
+
+#include <algorithm>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using std::map;
+using std::string;
+
+using namespace HadoopUtils;
+
+namespace HadoopPipes {
+
+  const string TEXT_CLASS("org.apache.hadoop.io.Text");
+  const string BYTES_WRITABLE_CLASS("org.apache.hadoop.io.BytesWritable");
+
+  static const char MAGIC[] = "SEQ";
+  static const char VERSION = 6;
+  static const int32_t SYNC_ESCAPE = -1;
+  static const size_t SYNC_HASH_SIZE = 16;
+  static const size_t SYNC_SIZE = 4 + SYNC_HASH_SIZE;
+  /**
+   * The least number of bytes between the sync marks of a record compressed
+   * file, which Java's readers and writers also use.
+   */
+  static const size_t SYNC_INTERVAL = 100 * SYNC_SIZE;
+  static const size_t STREAM_BUFFER_SIZE = 64 * 1024;
+
+  /**
+   * Decode a Hadoop VLong from memory, checking that it is all there.
+   */
+  static int64_t decodeVLong(const char*& position, const char* end,
+                             const string& path) {
+    HADOOP_ASSERT(position < end, "truncated SequenceFile " + path);
+    int8_t first = *position++;
+    if (first >= -112) {
+      return first;
+    }
+    bool negative = first < -120;
+    int length = negative ? -120 - first : -112 - first;
+    HADOOP_ASSERT(end - position >= length,
+                  "truncated SequenceFile " + path);
+    uint64_t value = 0;
+    for(int i=0; i < length; ++i) {
+      value = (value << 8) | (unsigned char) *position++;
+    }
+    return negative ? (int64_t) ~value : (int64_t) value;
+  }
+
+  SequenceFileWriter::SequenceFileWriter(const string& _path,
+                                         const string& keyClass,
+                                         const string& valueClass,
+                                         CompressionType _compression,
+                                         const string& codecClass,
+                                         const map<string, string>& metadata
+                                         ): path(_path) {
+    compression = _compression;
+    codec = compression == NONE ? NULL : &Codec::get(codecClass);
+    blockSize = 1000000;
+    blockRecords = 0;
+    position = 0;
+    lastSyncPosition = 0;
+    stream = NULL;
+    fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    HADOOP_ASSERT(fd != -1, "problem creating " + path + ": " +
+                  strerror(errno));
+    stream = new FdOutStream(fd, STREAM_BUFFER_SIZE);
+
+    // like Java, make the sync mark from a hash of the file and the time
+    char seed[64];
+    int seedLength = snprintf(seed, sizeof(seed), "@%llu:%d",
+                              (unsigned long long) getCurrentMillis(),
+                              (int) getpid());
+    string identity = path + string(seed, seedLength);
+    for(int half=0; half < 2; ++half) {
+      uint64_t hash = hashBytes(identity.data(), identity.length(), half);
+      memcpy(sync + 8 * half, &hash, 8);
+    }
+
+    write(MAGIC, 3);
+    write(&VERSION, 1);
+    writeString(keyClass);
+    writeString(valueClass);
+    char flags[2] = {compression != NONE, compression == BLOCK};
+    write(flags, 2);
+    if (codec != NULL) {
+      writeString(codec->getClassName());
+    }
+    writeInt(metadata.size());
+    for(map<string, string>::const_iterator itr = metadata.begin();
+        itr != metadata.end(); ++itr) {
+      writeString(itr->first);
+      writeString(itr->second);
+    }
+    write(sync, SYNC_HASH_SIZE);
+  }
+
+  void SequenceFileWriter::write(const void* data, size_t length) {
+    HADOOP_ASSERT(stream != NULL, "write to closed SequenceFile " + path);
+    stream->write(data, length);
+    position += length;
+  }
+
+  void SequenceFileWriter::writeInt(uint32_t value) {
+    char bytes[4];
+    for(int i=0; i < 4; ++i) {
+      bytes[i] = (char) (value >> (24 - 8 * i));
+    }
+    write(bytes, 4);
+  }
+
+  void SequenceFileWriter::writeVLong(int64_t value) {
+    string bytes;
+    StringOutStream out(bytes);
+    serializeLong(value, out);
+    write(bytes.data(), bytes.length());
+  }
+
+  void SequenceFileWriter::writeString(const string& value) {
+    writeVLong(value.length());
+    write(value.data(), value.length());
+  }
+
+  void SequenceFileWriter::writeSync() {
+    if (position != lastSyncPosition) {
+      writeInt(SYNC_ESCAPE);
+      write(sync, SYNC_HASH_SIZE);
+      lastSyncPosition = position;
+    }
+  }
+
+  void SequenceFileWriter::writeCompressed(const string& data) {
+    codec->compress(data.data(), data.length(), compressed);
+    writeString(compressed);
+  }
+
+  void SequenceFileWriter::writeBlock() {
+    if (blockRecords == 0) {
+      return;
+    }
+    writeSync();
+    writeVLong(blockRecords);
+    writeCompressed(keyLengths);
+    writeCompressed(keys);
+    writeCompressed(valueLengths);
+    writeCompressed(values);
+    keyLengths.clear();
+    keys.clear();
+    valueLengths.clear();
+    values.clear();
+    blockRecords = 0;
+  }
+
+  void SequenceFileWriter::append(const char* key, size_t keyLength,
+                                  const char* value, size_t valueLength) {
+    if (compression == BLOCK) {
+      StringOutStream keyLengthStream(keyLengths);
+      serializeLong(keyLength, keyLengthStream);
+      keys.append(key, keyLength);
+      StringOutStream valueLengthStream(valueLengths);
+      serializeLong(valueLength, valueLengthStream);
+      values.append(value, valueLength);
+      blockRecords += 1;
+      if (keys.length() + values.length() >= blockSize) {
+        writeBlock();
+      }
+      return;
+    }
+    if (compression == RECORD) {
+      codec->compress(value, valueLength, compressed);
+      value = compressed.data();
+      valueLength = compressed.length();
+    }
+    HADOOP_ASSERT(keyLength + valueLength <= 0x7fffffff,
+                  "record too large for SequenceFile " + path);
+    if (position >= lastSyncPosition + SYNC_INTERVAL) {
+      writeSync();
+    }
+    writeInt(keyLength + valueLength);
+    writeInt(keyLength);
+    write(key, keyLength);
+    write(value, valueLength);
+  }
+
+  void SequenceFileWriter::close() {
+    if (stream == NULL) {
+      return;
+    }
+    if (compression == BLOCK) {
+      writeBlock();
+    }
+    stream->flush();
+    delete stream;
+    stream = NULL;
+    int result = ::close(fd);
+    HADOOP_ASSERT(result == 0, "problem writing " + path + ": " +
+                  strerror(errno));
+  }
+
+  SequenceFileWriter::~SequenceFileWriter() {
+    if (stream != NULL) {
+      delete stream;
+      ::close(fd);
+    }
+  }
+
+  SequenceFileReader::SequenceFileReader(const string& _path,
+                                         int64_t splitStart,
+                                         int64_t splitLength): path(_path) {
+    data = NULL;
+    length = 0;
+    int fd = open(path.c_str(), O_RDONLY);
+    HADOOP_ASSERT(fd != -1, "problem opening " + path + ": " +
+                  strerror(errno));
+    struct stat status;
+    if (fstat(fd, &status) != 0) {
+      int error = errno;
+      ::close(fd);
+      throw Error("problem reading " + path + ": " + strerror(error));
+    }
+    length = status.st_size;
+    if (length > 0) {
+      void* mapping = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+      int error = errno;
+      ::close(fd);
+      HADOOP_ASSERT(mapping != MAP_FAILED, "problem mapping " + path + ": " +
+                    strerror(error));
+      data = (const char*) mapping;
+      madvise(mapping, length, MADV_SEQUENTIAL);
+    } else {
+      ::close(fd);
+    }
+    position = 0;
+    try {
+      check(4);
+      HADOOP_ASSERT(memcmp(data, MAGIC, 3) == 0,
+                    path + " is not a SequenceFile");
+      HADOOP_ASSERT(data[3] == VERSION,
+                    "unsupported SequenceFile version " +
+                    toString(data[3]) + " in " + path);
+      position = 4;
+      readString(keyClass);
+      readString(valueClass);
+      check(2);
+      compressed = data[position++] != 0;
+      blockCompressed = data[position++] != 0;
+      codec = NULL;
+      if (compressed) {
+        string codecClass;
+        readString(codecClass);
+        codec = &Codec::get(codecClass);
+      }
+      int32_t entries = readInt();
+      HADOOP_ASSERT(entries >= 0, "corrupt SequenceFile " + path);
+      for(int32_t i=0; i < entries; ++i) {
+        string key;
+        readString(key);
+        readString(metadata[key]);
+      }
+      check(SYNC_HASH_SIZE);
+      memcpy(sync, data + position, SYNC_HASH_SIZE);
+      position += SYNC_HASH_SIZE;
+    } catch (Error& e) {
+      if (data != NULL) {
+        munmap((void*) data, length);
+      }
+      throw;
+    }
+    headerEnd = position;
+    // only the first split reads the records before the first sync mark
+    if (splitStart > 0) {
+      seekToSync(std::max((size_t) splitStart, headerEnd));
+    }
+    start = position;
+    if (splitLength < 0 ||
+        (uint64_t) splitStart + splitLength > (uint64_t) length) {
+      end = length;
+    } else {
+      end = splitStart + splitLength;
+    }
+    done = false;
+    blockRecords = 0;
+  }
+
+  void SequenceFileReader::check(size_t bytes) {
+    HADOOP_ASSERT(length - position >= bytes,
+                  "truncated SequenceFile " + path);
+  }
+
+  uint32_t SequenceFileReader::readInt() {
+    check(4);
+    uint32_t value = 0;
+    for(int i=0; i < 4; ++i) {
+      value = (value << 8) | (unsigned char) data[position++];
+    }
+    return value;
+  }
+
+  int64_t SequenceFileReader::readVLong() {
+    const char* next = data + position;
+    int64_t value = decodeVLong(next, data + length, path);
+    position = next - data;
+    return value;
+  }
+
+  void SequenceFileReader::readString(string& result) {
+    int64_t stringLength = readVLong();
+    HADOOP_ASSERT(stringLength >= 0, "corrupt SequenceFile " + path);
+    check(stringLength);
+    result.assign(data + position, stringLength);
+    position += stringLength;
+  }
+
+  void SequenceFileReader::readSync() {
+    check(SYNC_HASH_SIZE);
+    HADOOP_ASSERT(memcmp(data + position, sync, SYNC_HASH_SIZE) == 0,
+                  "bad sync mark in SequenceFile " + path);
+    position += SYNC_HASH_SIZE;
+  }
+
+  /**
+   * Find the first sync mark that starts at or after the offset.
+   */
+  void SequenceFileReader::seekToSync(size_t offset) {
+    if (offset + SYNC_SIZE >= length) {
+      position = length;
+      return;
+    }
+    const char* found = (const char*) memmem(data + offset + 4,
+                                             length - offset - 4,
+                                             sync, SYNC_HASH_SIZE);
+    position = found == NULL ? length : found - 4 - data;
+  }
+
+  /**
+   * Read a compressed buffer of a block.
+   */
+  void SequenceFileReader::readBuffer(string& result) {
+    int64_t bufferLength = readVLong();
+    HADOOP_ASSERT(bufferLength >= 0, "corrupt SequenceFile " + path);
+    check(bufferLength);
+    codec->decompress(data + position, bufferLength, result);
+    position += bufferLength;
+  }
+
+  void SequenceFileReader::readBlock() {
+    HADOOP_ASSERT((int32_t) readInt() == SYNC_ESCAPE,
+                  "missing sync mark in SequenceFile " + path);
+    readSync();
+    int64_t records = readVLong();
+    HADOOP_ASSERT(records >= 0 && records <= 0xffffffffLL,
+                  "corrupt SequenceFile " + path);
+    readBuffer(keyLengths);
+    readBuffer(keys);
+    readBuffer(valueLengths);
+    readBuffer(values);
+    blockRecords = records;
+    keyLengthPosition = keyLengths.data();
+    keyPosition = keys.data();
+    valueLengthPosition = valueLengths.data();
+    valuePosition = values.data();
+  }
+
+  bool SequenceFileReader::next(const char*& key, size_t& keyLength,
+                                const char*& value, size_t& valueLength) {
+    if (done) {
+      return false;
+    }
+    if (blockCompressed) {
+      if (blockRecords == 0) {
+        // a block that starts in the next split belongs to it
+        if (position >= length || position >= end) {
+          done = true;
+          return false;
+        }
+        readBlock();
+        if (blockRecords == 0) {
+          return next(key, keyLength, value, valueLength);
+        }
+      }
+      int64_t keyBytes = decodeVLong(keyLengthPosition,
+                                     keyLengths.data() + keyLengths.length(),
+                                     path);
+      int64_t valueBytes =
+        decodeVLong(valueLengthPosition,
+                    valueLengths.data() + valueLengths.length(), path);
+      HADOOP_ASSERT(keyBytes >= 0 && valueBytes >= 0 &&
+                    keyBytes <= keys.data() + keys.length() - keyPosition &&
+                    valueBytes <=
+                    values.data() + values.length() - valuePosition,
+                    "corrupt SequenceFile " + path);
+      key = keyPosition;
+      keyLength = keyBytes;
+      value = valuePosition;
+      valueLength = valueBytes;
+      keyPosition += keyBytes;
+      valuePosition += valueBytes;
+      blockRecords -= 1;
+      return true;
+    }
+
+    if (position >= length) {
+      done = true;
+      return false;
+    }
+    size_t recordStart = position;
+    int32_t recordLength = readInt();
+    if (recordLength == SYNC_ESCAPE) {
+      readSync();
+      // a record after a sync mark in the next split belongs to it
+      if (position >= length || recordStart >= end) {
+        done = true;
+        return false;
+      }
+      recordLength = readInt();
+    }
+    int32_t keyBytes = readInt();
+    HADOOP_ASSERT(recordLength >= 0 && keyBytes >= 0 &&
+                  keyBytes <= recordLength,
+                  "corrupt SequenceFile " + path);
+    check(recordLength);
+    key = data + position;
+    keyLength = keyBytes;
+    value = key + keyBytes;
+    valueLength = recordLength - keyBytes;
+    position += recordLength;
+    if (compressed) {
+      codec->decompress(value, valueLength, this->value);
+      value = this->value.data();
+      valueLength = this->value.length();
+    }
+    return true;
+  }
+
+  float SequenceFileReader::getProgress() const {
+    if (end <= start) {
+      return 1.0f;
+    }
+    return std::min(1.0f, (float) (position - start) / (end - start));
+  }
+
+  SequenceFileReader::~SequenceFileReader() {
+    if (data != NULL) {
+      munmap((void*) data, length);
+    }
+  }
+
+  SequenceFileRecordReader::SequenceFileRecordReader(MapContext& context) {
+    string filename;
+    int64_t start;
+    int64_t length;
+    parseFileSplit(context.getInputSplit(), filename, start, length);
+    reader = new SequenceFileReader(filename, start, length);
+    init();
+  }
+
+  SequenceFileRecordReader::SequenceFileRecordReader(const string& filename,
+                                                     int64_t start,
+                                                     int64_t length) {
+    reader = new SequenceFileReader(filename, start, length);
+    init();
+  }
+
+  void SequenceFileRecordReader::init() {
+    textKeys = reader->getKeyClass() == TEXT_CLASS;
+    textValues = reader->getValueClass() == TEXT_CLASS;
+    bytesKeys = reader->getKeyClass() == BYTES_WRITABLE_CLASS;
+    bytesValues = reader->getValueClass() == BYTES_WRITABLE_CLASS;
+  }
+
+  /**
+   * Strip the length from a serialized Text or BytesWritable.
+   */
+  static void unwrap(const char*& data, size_t& length, bool text,
+                     bool bytes) {
+    const char* end = data + length;
+    int64_t contentLength;
+    if (text) {
+      contentLength = decodeVLong(data, end, "record");
+    } else if (bytes) {
+      HADOOP_ASSERT(length >= 4, "truncated BytesWritable");
+      contentLength = 0;
+      for(int i=0; i < 4; ++i) {
+        contentLength = (contentLength << 8) | (unsigned char) *data++;
+      }
+    } else {
+      return;
+    }
+    HADOOP_ASSERT(contentLength == end - data,
+                  "bad length in serialized Writable");
+    length = contentLength;
+  }
+
+  bool SequenceFileRecordReader::next(const char*& key, size_t& keyLength,
+                                      const char*& value,
+                                      size_t& valueLength) {
+    if (!reader->next(key, keyLength, value, valueLength)) {
+      return false;
+    }
+    unwrap(key, keyLength, textKeys, bytesKeys);
+    unwrap(value, valueLength, textValues, bytesValues);
+    return true;
+  }
+
+  bool SequenceFileRecordReader::next(string& key, string& value) {
+    const char* keyData;
+    size_t keyLength;
+    const char* valueData;
+    size_t valueLength;
+    if (!next(keyData, keyLength, valueData, valueLength)) {
+      return false;
+    }
+    key.assign(keyData, keyLength);
+    value.assign(valueData, valueLength);
+    return true;
+  }
+
+  float SequenceFileRecordReader::getProgress() {
+    return reader->getProgress();
+  }
+
+  void SequenceFileRecordReader::close() {
+  }
+
+  SequenceFileRecordReader::~SequenceFileRecordReader() {
+    delete reader;
+  }
+
+  SequenceFileRecordWriter::SequenceFileRecordWriter(ReduceContext& context) {
+    const JobConf* conf = context.getJobConf();
+    string directory = conf->get("mapreduce.task.output.dir");
+    if (directory.compare(0, 5, "file:") == 0) {
+      directory.erase(0, 5);
+    }
+    mkdir(directory.c_str(), 0777);
+    char name[32];
+    snprintf(name, sizeof(name), "/part-%05d",
+             conf->getInt("mapreduce.task.partition"));
+    SequenceFileWriter::CompressionType compression = SequenceFileWriter::NONE;
+    string codecClass = Codec::DEFAULT_CODEC;
+    if (conf->hasKey("mapreduce.output.fileoutputformat.compress") &&
+        conf->getBoolean("mapreduce.output.fileoutputformat.compress")) {
+      compression = SequenceFileWriter::RECORD;
+      const char* typeKey = "mapreduce.output.fileoutputformat.compress.type";
+      if (conf->hasKey(typeKey)) {
+        const string& type = conf->get(typeKey);
+        if (type == "BLOCK") {
+          compression = SequenceFileWriter::BLOCK;
+        } else if (type == "NONE") {
+          compression = SequenceFileWriter::NONE;
+        } else {
+          HADOOP_ASSERT(type == "RECORD", "unknown compression type " + type);
+        }
+      }
+      const char* codecKey = "mapreduce.output.fileoutputformat.compress.codec";
+      if (conf->hasKey(codecKey)) {
+        codecClass = conf->get(codecKey);
+      }
+    }
+    writer = new SequenceFileWriter(directory + name, TEXT_CLASS, TEXT_CLASS,
+                                    compression, codecClass);
+  }
+
+  void SequenceFileRecordWriter::emit(const string& key, const string& value) {
+    emit(key.data(), key.length(), value.data(), value.length());
+  }
+
+  void SequenceFileRecordWriter::emit(const char* keyData, size_t keyLength,
+                                      const char* valueData,
+                                      size_t valueLength) {
+    key.clear();
+    StringOutStream keyStream(key);
+    serializeString(keyData, keyLength, keyStream);
+    value.clear();
+    StringOutStream valueStream(value);
+    serializeString(valueData, valueLength, valueStream);
+    writer->append(key.data(), key.length(), value.data(), value.length());
+  }
+
+  void SequenceFileRecordWriter::close() {
+    writer->close();
+  }
+
+  SequenceFileRecordWriter::~SequenceFileRecordWriter() {
+    delete writer;
+  }
+}
@@ -0,0 +1,213 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hadoop/SharedRing.hh"
+#include "hadoop/SerialUtils.hh"
+#include "hadoop/StringUtils.hh"
+
+#include <algorithm>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+using std::string;
+
+using namespace HadoopUtils;
+
+namespace HadoopPipes {
+
+  /**
+   * How long to wait for the other side before checking that the task is
+   * still alive. This also bounds the latency with a peer that polls the
+   * ring rather than waking us up.
+   */
+  static const long RING_WAIT_NANOS = 10 * 1000 * 1000;
+
+  static void wait(volatile uint32_t* futex, uint32_t value) {
+#ifdef __linux__
+    struct timespec timeout;
+    timeout.tv_sec = 0;
+    timeout.tv_nsec = RING_WAIT_NANOS;
+    syscall(SYS_futex, futex, FUTEX_WAIT, value, &timeout, NULL, 0);
+#else
+    usleep(RING_WAIT_NANOS / 1000);
+#endif
+  }
+
+  static void wake(volatile uint32_t* futex) {
+    __sync_fetch_and_add(futex, 1);
+#ifdef __linux__
+    syscall(SYS_futex, futex, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
+  }
+
+  SharedRing::SharedRing(RingControl* _control, char* _data, uint64_t _size) {
+    control = _control;
+    data = _data;
+    size = _size;
+    parent = getppid();
+  }
+
+  void SharedRing::checkParent() {
+    HADOOP_ASSERT(getppid() == parent, "task process went away");
+  }
+
+  size_t SharedRing::read(char* buf, size_t len) {
+    uint64_t tail = control->tail;
+    uint64_t head;
+    while (true) {
+      bool closed = control->closed;
+      head = control->head;
+      if (head != tail) {
+        break;
+      }
+      if (closed) {
+        return 0;
+      }
+      uint32_t seen = control->dataFutex;
+      control->readerWaiting = 1;
+      __sync_synchronize();
+      if (control->head == tail && !control->closed) {
+        wait(&control->dataFutex, seen);
+        checkParent();
+      }
+      control->readerWaiting = 0;
+    }
+    // the bytes must not be read before head is
+    __sync_synchronize();
+    size_t length = std::min((uint64_t) len, head - tail);
+    size_t offset = tail & (size - 1);
+    size_t first = std::min((uint64_t) length, size - offset);
+    memcpy(buf, data + offset, first);
+    memcpy(buf + first, data, length - first);
+    __sync_synchronize();
+    control->tail = tail + length;
+    __sync_synchronize();
+    if (control->writerWaiting) {
+      wake(&control->spaceFutex);
+    }
+    return length;
+  }
+
+  void SharedRing::write(const char* buf, size_t len) {
+    uint64_t head = control->head;
+    while (len > 0) {
+      uint64_t tail = control->tail;
+      if (head - tail == size) {
+        uint32_t seen = control->spaceFutex;
+        control->writerWaiting = 1;
+        __sync_synchronize();
+        if (head - control->tail == size) {
+          wait(&control->spaceFutex, seen);
+          checkParent();
+        }
+        control->writerWaiting = 0;
+        continue;
+      }
+      // the space must not be reused before tail is read
+      __sync_synchronize();
+      size_t length = std::min((uint64_t) len, size - (head - tail));
+      size_t offset = head & (size - 1);
+      size_t first = std::min((uint64_t) length, size - offset);
+      memcpy(data + offset, buf, first);
+      memcpy(data, buf + first, length - first);
+      __sync_synchronize();
+      head += length;
+      control->head = head;
+      __sync_synchronize();
+      if (control->readerWaiting) {
+        wake(&control->dataFutex);
+      }
+      buf += length;
+      len -= length;
+    }
+  }
+
+  void SharedRing::close() {
+    __sync_synchronize();
+    control->closed = 1;
+    __sync_synchronize();
+    wake(&control->dataFutex);
+  }
+
+  SharedRingFile::SharedRingFile(const string& filename) {
+    int fd = open(filename.c_str(), O_RDWR);
+    HADOOP_ASSERT(fd != -1, string("problem opening ring file: ") +
+                            strerror(errno));
+    struct stat status;
+    int result = fstat(fd, &status);
+    HADOOP_ASSERT(result == 0, string("problem reading ring file: ") +
+                               strerror(errno));
+    length = status.st_size;
+    HADOOP_ASSERT(length >= RING_HEADER_SIZE, "ring file is too short");
+    address = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    HADOOP_ASSERT(address != MAP_FAILED,
+                  string("problem mapping ring file: ") + strerror(errno));
+    RingFileHeader* header = (RingFileHeader*) address;
+    uint64_t size = header->ringSize;
+    HADOOP_ASSERT(header->magic == RING_MAGIC &&
+                  header->version == RING_VERSION,
+                  "bad ring file header");
+    HADOOP_ASSERT(size > 0 && (size & (size - 1)) == 0 &&
+                  length >= RING_HEADER_SIZE + 2 * size,
+                  "bad ring size " + toString(size));
+    char* rings = (char*) address + RING_HEADER_SIZE;
+    down = new SharedRing(&header->down, rings, size);
+    up = new SharedRing(&header->up, rings + size, size);
+  }
+
+  SharedRingFile* SharedRingFile::create(const string& filename,
+                                         uint64_t ringSize) {
+    HADOOP_ASSERT(ringSize > 0 && (ringSize & (ringSize - 1)) == 0,
+                  "bad ring size " + toString(ringSize));
+    int fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    HADOOP_ASSERT(fd != -1, "problem creating " + filename + ": " +
+                  strerror(errno));
+    // the truncated file reads as zeros, so both rings start out empty
+    RingFileHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = RING_MAGIC;
+    header.version = RING_VERSION;
+    header.ringSize = ringSize;
+    if (ftruncate(fd, RING_HEADER_SIZE + 2 * ringSize) != 0 ||
+        pwrite(fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header)) {
+      int error = errno;
+      ::close(fd);
+      throw Error("problem writing " + filename + ": " + strerror(error));
+    }
+    ::close(fd);
+    return new SharedRingFile(filename);
+  }
+
+  SharedRingFile::~SharedRingFile() {
+    delete down;
+    delete up;
+    munmap(address, length);
+  }
+}
@@ -0,0 +1,646 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hadoop/Sketches.hh"
+#include "hadoop/SerialUtils.hh"
+#include "hadoop/StringUtils.hh"
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+using std::map;
+using std::pair;
+using std::set;
+using std::string;
+using std::vector;
+
+using namespace HadoopUtils;
+
+namespace HadoopPipes {
+
+  /**
+   * The length of the header of a serialized state.
+   */
+  static const size_t HEADER_LENGTH = 4;
+
+  bool isSketchState(const char* value, size_t length, char type) {
+    return length >= HEADER_LENGTH && value[0] == '\0' && value[1] == 'S' &&
+      value[2] == 'K' && value[3] == type;
+  }
+
+  static void writeHeader(string& state, char type) {
+    state.assign("\0SK", 3);
+    state += type;
+  }
+
+  static void writeVLong(string& state, int64_t value) {
+    StringOutStream stream(state);
+    serializeLong(value, stream);
+  }
+
+  static void writeDouble(string& state, double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    for(int shift=56; shift >= 0; shift -= 8) {
+      state += (char) (bits >> shift);
+    }
+  }
+
+  /**
+   * Reads the fields of a serialized state, checking that they are all
+   * there.
+   */
+  class StateReader {
+  private:
+    const char* position;
+    const char* end;
+
+    void check(size_t length) {
+      HADOOP_ASSERT((size_t) (end - position) >= length,
+                    "truncated sketch state");
+    }
+
+  public:
+    StateReader(const char* state, size_t length, char type) {
+      HADOOP_ASSERT(isSketchState(state, length, type),
+                    string("not a serialized sketch of type ") + type);
+      position = state + HEADER_LENGTH;
+      end = state + length;
+    }
+
+    int64_t readVLong() {
+      check(1);
+      int8_t first = *position++;
+      if (first >= -112) {
+        return first;
+      }
+      bool negative = first < -120;
+      int length = negative ? -120 - first : -112 - first;
+      check(length);
+      uint64_t value = 0;
+      for(int i=0; i < length; ++i) {
+        value = (value << 8) | (unsigned char) *position++;
+      }
+      return negative ? (int64_t) ~value : (int64_t) value;
+    }
+
+    uint8_t readByte() {
+      check(1);
+      return *position++;
+    }
+
+    double readDouble() {
+      check(8);
+      uint64_t bits = 0;
+      for(int i=0; i < 8; ++i) {
+        bits = (bits << 8) | (unsigned char) *position++;
+      }
+      double value;
+      memcpy(&value, &bits, sizeof(value));
+      return value;
+    }
+
+    const char* readBytes(size_t length) {
+      check(length);
+      const char* result = position;
+      position += length;
+      return result;
+    }
+
+    /**
+     * Check that the whole state has been read.
+     */
+    void finish() {
+      HADOOP_ASSERT(position == end, "trailing bytes in sketch state");
+    }
+  };
+
+  static int getInt(const JobConf& conf, const char* key, int defaultValue) {
+    return conf.hasKey(key) ? conf.getInt(key) : defaultValue;
+  }
+
+  static void appendNumber(string& result, int64_t value) {
+    char buffer[MAX_NUMBER_LENGTH];
+    result.append(buffer, formatLong(value, buffer));
+  }
+
+  static void appendNumber(string& result, double value) {
+    char buffer[MAX_NUMBER_LENGTH];
+    result.append(buffer, formatDouble(value, buffer));
+  }
+
+  static const uint64_t HASH_SEED = 0x5bd1e9955bd1e995ULL;
+
+  HyperLogLog::HyperLogLog(int _precision) {
+    HADOOP_ASSERT(_precision >= 4 && _precision <= 18,
+                  "HyperLogLog precision must be from 4 to 18");
+    precision = _precision;
+    registers.resize(1 << precision);
+  }
+
+  HyperLogLog::HyperLogLog(const JobConf& conf) {
+    precision = getInt(conf, "mapreduce.pipes.sketch.hll.precision", 14);
+    HADOOP_ASSERT(precision >= 4 && precision <= 18,
+                  "HyperLogLog precision must be from 4 to 18");
+    registers.resize(1 << precision);
+  }
+
+  void HyperLogLog::addHash(uint64_t hash) {
+    size_t index = hash >> (64 - precision);
+    // the rank is the position of the first 1 bit after the index bits
+    uint64_t rest = (hash << precision) | ((uint64_t) 1 << (precision - 1));
+    uint8_t rank = 1;
+    while ((rest & 0x8000000000000000ULL) == 0) {
+      rest <<= 1;
+      rank += 1;
+    }
+    if (rank > registers[index]) {
+      registers[index] = rank;
+    }
+  }
+
+  void HyperLogLog::add(const char* item, size_t length) {
+    addHash(hashBytes(item, length, HASH_SEED));
+  }
+
+  void HyperLogLog::merge(const HyperLogLog& other) {
+    HADOOP_ASSERT(precision == other.precision,
+                  "merging HyperLogLogs of different precisions");
+    for(size_t i=0; i < registers.size(); ++i) {
+      registers[i] = std::max(registers[i], other.registers[i]);
+    }
+  }
+
+  void HyperLogLog::merge(const char* state, size_t length) {
+    StateReader reader(state, length, TYPE);
+    int statePrecision = reader.readByte();
+    if (statePrecision != precision) {
+      HADOOP_ASSERT(std::count(registers.begin(), registers.end(), 0) ==
+                    (std::ptrdiff_t) registers.size(),
+                    "merging HyperLogLogs of different precisions");
+      HADOOP_ASSERT(statePrecision >= 4 && statePrecision <= 18,
+                    "bad HyperLogLog precision");
+      precision = statePrecision;
+      registers.assign(1 << precision, 0);
+    }
+    bool sparse = reader.readByte() != 0;
+    if (sparse) {
+      int64_t entries = reader.readVLong();
+      int64_t index = 0;
+      for(int64_t i=0; i < entries; ++i) {
+        index += reader.readVLong();
+        HADOOP_ASSERT(index >= 0 && (size_t) index < registers.size(),
+                      "bad HyperLogLog register");
+        registers[index] = std::max(registers[index], reader.readByte());
+      }
+    } else {
+      const char* bytes = reader.readBytes(registers.size());
+      for(size_t i=0; i < registers.size(); ++i) {
+        registers[i] = std::max(registers[i], (uint8_t) bytes[i]);
+      }
+    }
+    reader.finish();
+  }
+
+  /**
+   * The registers are written as a list of the ones that are set while
+   * that takes less space than all of them.
+   */
+  void HyperLogLog::serialize(string& state) const {
+    writeHeader(state, TYPE);
+    state += (char) precision;
+    size_t used = registers.size() -
+      std::count(registers.begin(), registers.end(), 0);
+    if (used * 3 < registers.size()) {
+      state += (char) 1;
+      writeVLong(state, used);
+      size_t last = 0;
+      for(size_t i=0; i < registers.size(); ++i) {
+        if (registers[i] != 0) {
+          writeVLong(state, i - last);
+          state += (char) registers[i];
+          last = i;
+        }
+      }
+    } else {
+      state += (char) 0;
+      state.append((const char*) &registers[0], registers.size());
+    }
+  }
+
+  uint64_t HyperLogLog::estimate() const {
+    double m = registers.size();
+    double sum = 0;
+    size_t zeros = 0;
+    for(size_t i=0; i < registers.size(); ++i) {
+      sum += ldexp(1.0, -registers[i]);
+      if (registers[i] == 0) {
+        zeros += 1;
+      }
+    }
+    double alpha = 0.7213 / (1 + 1.079 / m);
+    double estimate = alpha * m * m / sum;
+    if (estimate <= 2.5 * m && zeros != 0) {
+      // linear counting is more accurate for small counts
+      estimate = m * log(m / zeros);
+    }
+    return (uint64_t) (estimate + 0.5);
+  }
+
+  void HyperLogLog::summarize(string& result) const {
+    result.clear();
+    appendNumber(result, (int64_t) estimate());
+  }
+
+  CountMinSketch::CountMinSketch(int _width, int _depth) {
+    HADOOP_ASSERT(_width > 0 && _depth > 0,
+                  "Count-Min width and depth must be positive");
+    width = _width;
+    depth = _depth;
+    total = 0;
+    counts.resize((size_t) width * depth);
+  }
+
+  CountMinSketch::CountMinSketch(const JobConf& conf) {
+    width = getInt(conf, "mapreduce.pipes.sketch.cms.width", 2048);
+    depth = getInt(conf, "mapreduce.pipes.sketch.cms.depth", 4);
+    HADOOP_ASSERT(width > 0 && depth > 0,
+                  "Count-Min width and depth must be positive");
+    total = 0;
+    counts.resize((size_t) width * depth);
+  }
+
+  /**
+   * The rows use the hashes h1 + i * h2, from the two halves of one 64 bit
+   * hash.
+   */
+  void CountMinSketch::add(const char* item, size_t length, uint64_t count) {
+    uint64_t hash = hashBytes(item, length, HASH_SEED);
+    uint32_t first = hash;
+    uint32_t second = hash >> 32;
+    for(int i=0; i < depth; ++i) {
+      counts[(size_t) i * width + (first + i * second) % width] += count;
+    }
+    total += count;
+  }
+
+  uint64_t CountMinSketch::estimate(const char* item, size_t length) const {
+    uint64_t hash = hashBytes(item, length, HASH_SEED);
+    uint32_t first = hash;
+    uint32_t second = hash >> 32;
+    uint64_t result = 0;
+    for(int i=0; i < depth; ++i) {
+      uint64_t count = counts[(size_t) i * width + (first + i * second) % width];
+      if (i == 0 || count < result) {
+        result = count;
+      }
+    }
+    return result;
+  }
+
+  void CountMinSketch::merge(const CountMinSketch& other) {
+    HADOOP_ASSERT(width == other.width && depth == other.depth,
+                  "merging Count-Min sketches of different sizes");
+    for(size_t i=0; i < counts.size(); ++i) {
+      counts[i] += other.counts[i];
+    }
+    total += other.total;
+  }
+
+  void CountMinSketch::merge(const char* state, size_t length) {
+    StateReader reader(state, length, TYPE);
+    int64_t stateWidth = reader.readVLong();
+    int64_t stateDepth = reader.readVLong();
+    if (stateWidth != width || stateDepth != depth) {
+      HADOOP_ASSERT(total == 0,
+                    "merging Count-Min sketches of different sizes");
+      HADOOP_ASSERT(stateWidth > 0 && stateDepth > 0 &&
+                    stateWidth * stateDepth <= 0x7fffffff,
+                    "bad Count-Min sketch size");
+      width = stateWidth;
+      depth = stateDepth;
+      counts.assign((size_t) width * depth, 0);
+    }
+    total += reader.readVLong();
+    for(size_t i=0; i < counts.size(); ++i) {
+      counts[i] += reader.readVLong();
+    }
+    reader.finish();
+  }
+
+  void CountMinSketch::serialize(string& state) const {
+    writeHeader(state, TYPE);
+    writeVLong(state, width);
+    writeVLong(state, depth);
+    writeVLong(state, total);
+    for(size_t i=0; i < counts.size(); ++i) {
+      writeVLong(state, counts[i]);
+    }
+  }
+
+  void CountMinSketch::summarize(string& result) const {
+    result.clear();
+    appendNumber(result, (int64_t) total);
+  }
+
+  SpaceSaving::SpaceSaving(size_t _capacity, size_t _top) {
+    HADOOP_ASSERT(_capacity > 0, "Space-Saving capacity must be positive");
+    capacity = _capacity;
+    top = _top;
+  }
+
+  SpaceSaving::SpaceSaving(const JobConf& conf) {
+    int configured = getInt(conf, "mapreduce.pipes.sketch.topk.capacity", 1000);
+    HADOOP_ASSERT(configured > 0, "Space-Saving capacity must be positive");
+    capacity = configured;
+    top = getInt(conf, "mapreduce.pipes.sketch.topk", 10);
+  }
+
+  /**
+   * When all of the counters are in use, the item takes over the one with
+   * the smallest count, whose count it may have had all along.
+   */
+  void SpaceSaving::add(const string& item, uint64_t count, uint64_t error) {
+    map<string, Counter>::iterator itr = counters.find(item);
+    if (itr != counters.end()) {
+      byCount.erase(std::make_pair(itr->second.count, item));
+      itr->second.count += count;
+      itr->second.error += error;
+      byCount.insert(std::make_pair(itr->second.count, item));
+      return;
+    }
+    Counter counter;
+    counter.count = count;
+    counter.error = error;
+    if (counters.size() == capacity) {
+      set<pair<uint64_t, string> >::iterator smallest = byCount.begin();
+      counter.count += smallest->first;
+      counter.error += smallest->first;
+      counters.erase(smallest->second);
+      byCount.erase(smallest);
+    }
+    counters[item] = counter;
+    byCount.insert(std::make_pair(counter.count, item));
+  }
+
+  void SpaceSaving::merge(const SpaceSaving& other) {
+    for(map<string, Counter>::const_iterator itr = other.counters.begin();
+        itr != other.counters.end(); ++itr) {
+      add(itr->first, itr->second.count, itr->second.error);
+    }
+  }
+
+  void SpaceSaving::merge(const char* state, size_t length) {
+    StateReader reader(state, length, TYPE);
+    int64_t entries = reader.readVLong();
+    HADOOP_ASSERT(entries >= 0, "bad Space-Saving state");
+    string item;
+    for(int64_t i=0; i < entries; ++i) {
+      int64_t itemLength = reader.readVLong();
+      HADOOP_ASSERT(itemLength >= 0, "bad Space-Saving state");
+      item.assign(reader.readBytes(itemLength), itemLength);
+      uint64_t count = reader.readVLong();
+      uint64_t error = reader.readVLong();
+      add(item, count, error);
+    }
+    reader.finish();
+  }
+
+  void SpaceSaving::serialize(string& state) const {
+    writeHeader(state, TYPE);
+    writeVLong(state, counters.size());
+    for(map<string, Counter>::const_iterator itr = counters.begin();
+        itr != counters.end(); ++itr) {
+      writeVLong(state, itr->first.length());
+      state += itr->first;
+      writeVLong(state, itr->second.count);
+      writeVLong(state, itr->second.error);
+    }
+  }
+
+  void SpaceSaving::getTop(size_t n, vector<pair<string, Counter> >& result)
+    const {
+    result.clear();
+    for(set<pair<uint64_t, string> >::const_reverse_iterator itr =
+          byCount.rbegin(); itr != byCount.rend() && result.size() < n;
+        ++itr) {
+      result.push_back(std::make_pair(itr->second,
+                                      counters.find(itr->second)->second));
+    }
+  }
+
+  void SpaceSaving::summarize(string& result) const {
+    vector<pair<string, Counter> > items;
+    getTop(top, items);
+    result.clear();
+    for(size_t i=0; i < items.size(); ++i) {
+      if (i != 0) {
+        result += ',';
+      }
+      result += quoteString(items[i].first, ",:");
+      result += ':';
+      appendNumber(result, (int64_t) items[i].second.count);
+    }
+  }
+
+  TDigest::TDigest(double _compression) {
+    HADOOP_ASSERT(_compression >= 10, "t-digest compression must be >= 10");
+    compression = _compression;
+    quantiles.push_back(0.5);
+    quantiles.push_back(0.9);
+    quantiles.push_back(0.99);
+    count = 0;
+    min = INFINITY;
+    max = -INFINITY;
+  }
+
+  TDigest::TDigest(const JobConf& conf) {
+    compression = 100;
+    if (conf.hasKey("mapreduce.pipes.sketch.tdigest.compression")) {
+      compression = conf.getFloat("mapreduce.pipes.sketch.tdigest.compression");
+    }
+    HADOOP_ASSERT(compression >= 10, "t-digest compression must be >= 10");
+    string configured = "0.5,0.9,0.99";
+    if (conf.hasKey("mapreduce.pipes.sketch.quantiles")) {
+      configured = conf.get("mapreduce.pipes.sketch.quantiles");
+    }
+    vector<string> parts = splitString(configured, ",");
+    for(size_t i=0; i < parts.size(); ++i) {
+      quantiles.push_back(toDouble(parts[i]));
+    }
+    count = 0;
+    min = INFINITY;
+    max = -INFINITY;
+  }
+
+  void TDigest::addCentroid(double mean, uint64_t weight) {
+    Centroid centroid;
+    centroid.mean = mean;
+    centroid.weight = weight;
+    buffer.push_back(centroid);
+    count += weight;
+    min = std::min(min, mean);
+    max = std::max(max, mean);
+    if (buffer.size() >= 5 * compression) {
+      compress();
+    }
+  }
+
+  void TDigest::add(const char* item, size_t length) {
+    double value;
+    HADOOP_ASSERT(parseDouble(item, length, value),
+                  "not a number: " + string(item, length));
+    addCentroid(value, 1);
+  }
+
+  /**
+   * Merge the buffered values into the clusters. Going through everything
+   * in order, neighbours are combined while the cluster stays within
+   * 4 * n * q * (1 - q) / compression values, where q is the fraction of the
+   * values below its middle, which keeps the clusters small at the ends.
+   */
+  void TDigest::compress() {
+    if (buffer.empty()) {
+      return;
+    }
+    buffer.insert(buffer.end(), centroids.begin(), centroids.end());
+    std::sort(buffer.begin(), buffer.end());
+    centroids.clear();
+    double total = count;
+    Centroid current = buffer[0];
+    double before = 0;
+    for(size_t i=1; i < buffer.size(); ++i) {
+      const Centroid& next = buffer[i];
+      double weight = current.weight + next.weight;
+      double q = (before + weight / 2) / total;
+      if (weight <= 4 * total * q * (1 - q) / compression) {
+        current.mean += (next.mean - current.mean) * next.weight / weight;
+        current.weight += next.weight;
+      } else {
+        before += current.weight;
+        centroids.push_back(current);
+        current = next;
+      }
+    }
+    centroids.push_back(current);
+    buffer.clear();
+  }
+
+  void TDigest::merge(const TDigest& other) {
+    for(size_t i=0; i < other.centroids.size(); ++i) {
+      addCentroid(other.centroids[i].mean, other.centroids[i].weight);
+    }
+    for(size_t i=0; i < other.buffer.size(); ++i) {
+      addCentroid(other.buffer[i].mean, other.buffer[i].weight);
+    }
+    min = std::min(min, other.min);
+    max = std::max(max, other.max);
+  }
+
+  void TDigest::merge(const char* state, size_t length) {
+    StateReader reader(state, length, TYPE);
+    int64_t entries = reader.readVLong();
+    HADOOP_ASSERT(entries >= 0, "bad t-digest state");
+    if (entries == 0) {
+      reader.finish();
+      return;
+    }
+    double stateMin = reader.readDouble();
+    double stateMax = reader.readDouble();
+    for(int64_t i=0; i < entries; ++i) {
+      double mean = reader.readDouble();
+      int64_t weight = reader.readVLong();
+      HADOOP_ASSERT(weight > 0, "bad t-digest state");
+      addCentroid(mean, weight);
+    }
+    reader.finish();
+    min = std::min(min, stateMin);
+    max = std::max(max, stateMax);
+  }
+
+  /**
+   * The buffered values are written as clusters of their own, and merged
+   * by whoever reads the state.
+   */
+  void TDigest::serialize(string& state) const {
+    writeHeader(state, TYPE);
+    writeVLong(state, centroids.size() + buffer.size());
+    if (count == 0) {
+      return;
+    }
+    writeDouble(state, min);
+    writeDouble(state, max);
+    for(size_t i=0; i < centroids.size(); ++i) {
+      writeDouble(state, centroids[i].mean);
+      writeVLong(state, centroids[i].weight);
+    }
+    for(size_t i=0; i < buffer.size(); ++i) {
+      writeDouble(state, buffer[i].mean);
+      writeVLong(state, buffer[i].weight);
+    }
+  }
+
+  /**
+   * Each cluster's values are taken to be spread around its mean, so the
+   * estimate is interpolated between the means of neighbouring clusters,
+   * and between the outer clusters and the smallest and largest values.
+   */
+  double TDigest::quantile(double q) {
+    compress();
+    if (centroids.empty()) {
+      return NAN;
+    }
+    if (q <= 0) {
+      return min;
+    }
+    if (q >= 1) {
+      return max;
+    }
+    double index = q * count;
+    const Centroid& first = centroids.front();
+    if (index < first.weight / 2.0) {
+      return min + (first.mean - min) * index / (first.weight / 2.0);
+    }
+    double before = 0;
+    for(size_t i=0; i + 1 < centroids.size(); ++i) {
+      double left = before + centroids[i].weight / 2.0;
+      double right = before + centroids[i].weight +
+        centroids[i + 1].weight / 2.0;
+      if (index < right) {
+        return centroids[i].mean + (centroids[i + 1].mean -
+          centroids[i].mean) * (index - left) / (right - left);
+      }
+      before += centroids[i].weight;
+    }
+    const Centroid& last = centroids.back();
+    double left = count - last.weight / 2.0;
+    return last.mean + (max - last.mean) * (index - left) /
+      (last.weight / 2.0);
+  }
+
+  void TDigest::summarize(string& result) {
+    result.clear();
+    for(size_t i=0; i < quantiles.size(); ++i) {
+      if (i != 0) {
+        result += ',';
+      }
+      appendNumber(result, quantile(quantiles[i]));
+    }
+  }
+}
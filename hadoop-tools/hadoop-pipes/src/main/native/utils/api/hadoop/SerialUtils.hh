@@ -19,6 +19,8 @@
 #define HADOOP_SERIAL_UTILS_HH
 
 #include <string>
+#include <utility>
+#include <vector>
 #include <stdint.h>
 
 namespace HadoopUtils {
@@ -157,6 +159,160 @@ namespace HadoopUtils {
     std::string::const_iterator itr;
   };
 
+  /**
+   * A stream that appends to a string.
+   */
+  class StringOutStream: public OutStream {
+  public:
+    StringOutStream(std::string& str);
+    virtual void write(const void* buf, size_t len);
+    virtual void flush();
+  private:
+    std::string& buffer;
+  };
+
+  /**
+   * A stream that reads a file descriptor, usually the task's command
+   * socket, through one large buffer. The buffer is refilled with as much
+   * as the descriptor has ready, and VInts and strings are decoded straight
+   * out of it rather than through a virtual read per field.
+   */
+  class FdInStream: public InStream {
+  public:
+    FdInStream(int fd, size_t bufferSize);
+    virtual void read(void *buf, size_t len);
+
+    /**
+     * Read a Hadoop VLong. Single byte values are decoded inline.
+     */
+    int64_t readVLong() {
+      if (position < limit && (int8_t) buffer[position] >= -112) {
+        return (int8_t) buffer[position++];
+      }
+      return readMultiByteVLong();
+    }
+
+    int32_t readVInt() {
+      return readVLong();
+    }
+
+    /**
+     * Read a length-prefixed string into t, reusing its capacity.
+     */
+    void readString(std::string& t);
+
+    /**
+     * Read len bytes and return a pointer to them inside the stream's
+     * buffer. The bytes stay valid until the next call to mark().
+     */
+    const char* readBytes(size_t len);
+
+    /**
+     * Read a length-prefixed string without copying it. The bytes stay
+     * valid until the next call to mark().
+     * @param length set to the length of the string
+     */
+    const char* readString(size_t& length);
+
+    /**
+     * Allow the bytes returned by readBytes so far to be discarded.
+     */
+    void mark();
+
+    /**
+     * Whether the next read has to wait for the descriptor.
+     */
+    bool isBufferEmpty() const {
+      return position == limit;
+    }
+
+    /**
+     * Whether the next byte is already buffered and equal to the given one.
+     */
+    bool isNextByte(char byte) const {
+      return position < limit && buffer[position] == byte;
+    }
+
+    virtual ~FdInStream();
+  protected:
+    /**
+     * Read at least one and at most len bytes from the descriptor, waiting
+     * if none are ready. Subclasses may read from somewhere else.
+     * @return the number of bytes read
+     */
+    virtual size_t readSome(char* buf, size_t len);
+
+  private:
+    int64_t readMultiByteVLong();
+    void fill(size_t len);
+
+    int fd;
+    char* buffer;
+    size_t capacity;
+    size_t position;
+    size_t limit;
+    size_t markPosition;
+    /**
+     * Buffers that still back bytes handed out since the last mark. One of
+     * them is kept as the spare buffer once mark is called.
+     */
+    std::vector<std::pair<char*, size_t> > retired;
+    char* spare;
+    size_t spareCapacity;
+  };
+
+  /**
+   * A stream that writes a file descriptor through one large buffer. Large
+   * writes go out together with the buffered bytes in a single writev, so
+   * they are never copied into the buffer.
+   */
+  class FdOutStream: public OutStream {
+  public:
+    FdOutStream(int fd, size_t bufferSize);
+    virtual void write(const void* buf, size_t len);
+
+    /**
+     * Write a Hadoop VLong. Single byte values are encoded inline.
+     */
+    void writeVLong(int64_t t) {
+      if (t >= -112 && t <= 127 && limit < capacity) {
+        buffer[limit++] = (char) t;
+      } else {
+        writeMultiByteVLong(t);
+      }
+    }
+
+    void writeVInt(int32_t t) {
+      writeVLong(t);
+    }
+
+    /**
+     * Write a length-prefixed string.
+     */
+    void writeString(const char* str, size_t len) {
+      writeVLong(len);
+      write(str, len);
+    }
+
+    virtual void flush();
+    virtual ~FdOutStream();
+  protected:
+    /**
+     * Write all of first and then all of second to the descriptor.
+     * Subclasses may write somewhere else.
+     */
+    virtual void writeBuffers(const char* first, size_t firstLength,
+                              const char* second, size_t secondLength);
+
+  private:
+    void writeMultiByteVLong(int64_t t);
+
+    int fd;
+    char* buffer;
+    size_t capacity;
+    size_t limit;
+  };
+
   void serializeInt(int32_t t, OutStream& stream);
   int32_t deserializeInt(InStream& stream);
   void serializeLong(int64_t t, OutStream& stream);
@@ -164,6 +320,7 @@ namespace HadoopUtils {
   void serializeFloat(float t, OutStream& stream);
   float deserializeFloat(InStream& stream);
   void serializeString(const std::string& t, OutStream& stream);
+  void serializeString(const char* str, size_t length, OutStream& stream);
   void deserializeString(std::string& t, InStream& stream);
 }
 
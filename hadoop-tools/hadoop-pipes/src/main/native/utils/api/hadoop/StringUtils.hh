@@ -35,12 +35,64 @@ namespace HadoopUtils {
    */
   int32_t toInt(const std::string& val);
 
+  /**
+   * Convert a string to a 64 bit integer.
+   * @throws Error if the string is not a valid integer
+   */
+  int64_t toLong(const std::string& val);
+
   /**
    * Convert the string to a float.
    * @throws Error if the string is not a valid float
    */
   float toFloat(const std::string& val);
 
+  /**
+   * Convert the string to a double.
+   * @throws Error if the string is not a valid double
+   */
+  double toDouble(const std::string& val);
+
+  /**
+   * The most bytes written by formatLong and formatDouble.
+   */
+  const size_t MAX_NUMBER_LENGTH = 32;
+
+  /**
+   * Write an integer in decimal. No terminating null is written.
+   * @param buffer where to write, with room for MAX_NUMBER_LENGTH bytes
+   * @return the number of bytes written
+   */
+  size_t formatLong(int64_t x, char* buffer);
+
+  /**
+   * Write a double with the fewest digits that read back as the same value,
+   * in plain notation for moderate exponents ("12.5", "100.0", "0.001")
+   * and scientific notation otherwise ("1.5e-7", "1e300"). Infinities and
+   * NaN are written as "Infinity", "-Infinity" and "NaN", as Java does. No
+   * terminating null is written. The digits come from the Grisu2
+   * algorithm, which for about one double in a thousand writes one digit
+   * more than needed.
+   * @param buffer where to write, with room for MAX_NUMBER_LENGTH bytes
+   * @return the number of bytes written
+   */
+  size_t formatDouble(double x, char* buffer);
+
+  /**
+   * Read a decimal integer with an optional sign, which has to make up all
+   * of the given bytes.
+   * @return false if the bytes are not an integer or it does not fit
+   */
+  bool parseLong(const char* str, size_t length, int64_t& result);
+
+  /**
+   * Read a double, which has to make up all of the given bytes. Plain
+   * decimal numbers are read without going through the C library, which
+   * only handles the rest, in the "C" locale.
+   * @return false if the bytes are not a number
+   */
+  bool parseDouble(const char* str, size_t length, double& result);
+
   /**
    * Convert the string to a boolean.
    * @throws Error if the string is not a valid boolean value
@@ -52,6 +104,75 @@ namespace HadoopUtils {
    */
   uint64_t getCurrentMillis();
 
+  /**
+   * Hash bytes to 64 bits with MurmurHash64A. The hash is the same on every
+   * platform, so it may be stored in files.
+   */
+  uint64_t hashBytes(const char* data, size_t length, uint64_t seed);
+
+  /**
+   * Splits bytes into "words" without copying them. Multiple deliminators
+   * are treated as a single word break, so no zero-length words are
+   * returned. A tokenizer can be reset to new bytes as often as needed,
+   * which does not allocate.
+   */
+  class Tokenizer {
+  private:
+    /**
+     * A bit for each byte value that divides words.
+     */
+    uint32_t separatorTable[8];
+    /**
+     * The separators, if there are few enough to compare against them with
+     * vector instructions.
+     */
+    char separatorList[8];
+    int separatorCount;
+    const char* position;
+    const char* end;
+
+    bool isSeparator(char ch) const {
+      unsigned char byte = (unsigned char) ch;
+      return (separatorTable[byte >> 5] >> (byte & 31)) & 1;
+    }
+
+    const char* findSeparator(const char* start) const;
+
+  public:
+    /**
+     * @param separator a list of characters that divide words
+     */
+    Tokenizer(const char* separator);
+
+    /**
+     * Start on the given bytes, which must stay valid while the words are
+     * read.
+     */
+    void reset(const char* data, size_t length) {
+      position = data;
+      end = data + length;
+    }
+
+    /**
+     * Get the next word.
+     * @param word set to the first byte of the word
+     * @param length set to the length of the word
+     * @return false if there are no more words
+     */
+    bool next(const char*& word, size_t& length) {
+      while (position < end && isSeparator(*position)) {
+        ++position;
+      }
+      if (position == end) {
+        return false;
+      }
+      word = position;
+      position = findSeparator(position + 1);
+      length = position - word;
+      return true;
+    }
+  };
+
   /**
    * Split a string into "words". Multiple deliminators are treated as a single
    * word break, so no zero-length words are returned.
@@ -61,6 +182,16 @@ namespace HadoopUtils {
   std::vector<std::string> splitString(const std::string& str,
                                        const char* separator);
 
+  /**
+   * Find the first occurrence of a byte in a range of memory, using vector
+   * instructions where the processor has them.
+   * @param start the first byte to look at
+   * @param end the byte after the last one to look at
+   * @param byte the byte to look for
+   * @return the byte's position, or end if it is not in the range
+   */
+  const char* findByte(const char* start, const char* end, char byte);
+
   /**
    * Quote a string to avoid "\", non-printable characters, and the 
    * deliminators.
@@ -23,8 +23,12 @@
 #include <rpc/xdr.h>
 #include <string>
 #include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
 
+using std::pair;
 using std::string;
+using std::vector;
 
 namespace HadoopUtils {
 
@@ -175,16 +179,31 @@ namespace HadoopUtils {
     HADOOP_ASSERT(bytes == buflen, "unexpected end of string reached");
   }
 
-  void serializeInt(int32_t t, OutStream& stream) {
-    serializeLong(t,stream);
+  StringOutStream::StringOutStream(std::string& str): buffer(str) {
   }
 
-  void serializeLong(int64_t t, OutStream& stream)
+  void StringOutStream::write(const void* buf, size_t len) {
+    buffer.append((const char*) buf, len);
+  }
+
+  void StringOutStream::flush() {
+  }
+
+  /**
+   * The longest encoding of a VLong: a length byte and 8 data bytes.
+   */
+  static const size_t MAX_VLONG_SIZE = 9;
+
+  /**
+   * Encode t as a Hadoop VLong.
+   * @param buf a buffer of at least MAX_VLONG_SIZE bytes
+   * @return the number of bytes used
+   */
+  static size_t encodeVLong(int64_t t, char* buf)
   {
     if (t >= -112 && t <= 127) {
-      int8_t b = t;
-      stream.write(&b, 1);
-      return;
+      buf[0] = (int8_t) t;
+      return 1;
     }
         
     int8_t len = -112;
@@ -199,17 +218,277 @@ namespace HadoopUtils {
       len--;
     }
   
-    stream.write(&len, 1);      
+    buf[0] = len;
     len = (len < -120) ? -(len + 120) : -(len + 112);
         
     for (uint32_t idx = len; idx != 0; idx--) {
       uint32_t shiftbits = (idx - 1) * 8;
       uint64_t mask = 0xFFll << shiftbits;
-      uint8_t b = (t & mask) >> shiftbits;
-      stream.write(&b, 1);
+      buf[1 + len - idx] = (uint8_t) ((t & mask) >> shiftbits);
+    }
+    return 1 + len;
+  }
+
+  /**
+   * Write the whole of the given buffers to fd, retrying short writes.
+   */
+  static void writeVector(int fd, struct iovec* vec, int count)
+  {
+    while (count > 0) {
+      ssize_t result = writev(fd, vec, count);
+      if (result < 0) {
+        HADOOP_ASSERT(errno == EINTR,
+                      string("write error to file: ") + strerror(errno));
+        continue;
+      }
+      size_t written = result;
+      while (count > 0 && written >= vec->iov_len) {
+        written -= vec->iov_len;
+        ++vec;
+        --count;
+      }
+      if (count > 0) {
+        vec->iov_base = (char*) vec->iov_base + written;
+        vec->iov_len -= written;
+      }
+    }
+  }
+
+  FdInStream::FdInStream(int _fd, size_t bufferSize)
+  {
+    fd = _fd;
+    capacity = bufferSize;
+    buffer = new char[capacity];
+    position = 0;
+    limit = 0;
+    markPosition = 0;
+    spare = NULL;
+    spareCapacity = 0;
+  }
+
+  void FdInStream::fill(size_t len)
+  {
+    if (limit - position >= len) {
+      return;
+    }
+    if (capacity - position < len) {
+      // Bytes after the mark may have been handed out by readBytes, so they
+      // are only moved when nothing has been handed out yet. Otherwise they
+      // are copied to another buffer and the old one is kept until mark.
+      size_t keep = markPosition;
+      size_t needed = position - keep + len;
+      if (keep == position && needed <= capacity) {
+        memmove(buffer, buffer + keep, limit - keep);
+      } else {
+        size_t newCapacity = capacity;
+        while (newCapacity < needed) {
+          newCapacity *= 2;
+        }
+        char* newBuffer;
+        if (spare != NULL && spareCapacity >= newCapacity) {
+          newBuffer = spare;
+          newCapacity = spareCapacity;
+          spare = NULL;
+        } else {
+          newBuffer = new char[newCapacity];
+        }
+        memcpy(newBuffer, buffer + keep, limit - keep);
+        if (keep == position) {
+          delete [] buffer;
+        } else {
+          retired.push_back(pair<char*, size_t>(buffer, capacity));
+        }
+        buffer = newBuffer;
+        capacity = newCapacity;
+      }
+      position -= keep;
+      limit -= keep;
+      markPosition = 0;
+    }
+    while (limit - position < len) {
+      limit += readSome(buffer + limit, capacity - limit);
+    }
+  }
+
+  size_t FdInStream::readSome(char* buf, size_t len)
+  {
+    while (true) {
+      ssize_t result = ::read(fd, buf, len);
+      if (result < 0) {
+        HADOOP_ASSERT(errno == EINTR, 
+                      string("read error on file: ") + strerror(errno));
+        continue;
+      }
+      HADOOP_ASSERT(result != 0, "end of file");
+      return result;
+    }
+  }
+
+  void FdInStream::read(void *buf, size_t len)
+  {
+    char* output = (char*) buf;
+    size_t available = limit - position;
+    if (len > available && len - available >= capacity / 2) {
+      // large reads skip the buffer once it has been drained
+      memcpy(output, buffer + position, available);
+      position = limit;
+      output += available;
+      len -= available;
+      while (len > 0) {
+        size_t result = readSome(output, len);
+        output += result;
+        len -= result;
+      }
+      return;
+    }
+    fill(len);
+    memcpy(output, buffer + position, len);
+    position += len;
+  }
+
+  int64_t FdInStream::readMultiByteVLong()
+  {
+    fill(1);
+    int8_t b = buffer[position];
+    if (b >= -112) {
+      position += 1;
+      return b;
+    }
+    bool negative = b < -120;
+    int len = negative ? -120 - b : -112 - b;
+    fill(1 + len);
+    const uint8_t* bytes = (const uint8_t*) buffer + position + 1;
+    int64_t t = 0;
+    for (int idx = 0; idx < len; idx++) {
+      t = t << 8;
+      t |= bytes[idx];
+    }
+    position += 1 + len;
+    if (negative) {
+      t ^= -1ll;
+    }
+    return t;
+  }
+
+  void FdInStream::readString(std::string& t)
+  {
+    int32_t len = readVInt();
+    if (len > 0) {
+      t.resize(len);
+      read(&t[0], len);
+    } else {
+      t.clear();
+    }
+  }
+
+  const char* FdInStream::readBytes(size_t len)
+  {
+    fill(len);
+    const char* result = buffer + position;
+    position += len;
+    return result;
+  }
+
+  const char* FdInStream::readString(size_t& length)
+  {
+    int32_t len = readVInt();
+    HADOOP_ASSERT(len >= 0, "negative string length " + toString(len));
+    length = len;
+    return readBytes(length);
+  }
+
+  void FdInStream::mark()
+  {
+    markPosition = position;
+    for(size_t i=0; i < retired.size(); ++i) {
+      if (retired[i].second > spareCapacity) {
+        delete [] spare;
+        spare = retired[i].first;
+        spareCapacity = retired[i].second;
+      } else {
+        delete [] retired[i].first;
+      }
+    }
+    retired.clear();
+  }
+
+  FdInStream::~FdInStream()
+  {
+    mark();
+    delete [] spare;
+    delete [] buffer;
+  }
+
+  FdOutStream::FdOutStream(int _fd, size_t bufferSize)
+  {
+    fd = _fd;
+    capacity = bufferSize;
+    buffer = new char[capacity];
+    limit = 0;
+  }
+
+  void FdOutStream::write(const void* buf, size_t len)
+  {
+    if (len <= capacity - limit) {
+      memcpy(buffer + limit, buf, len);
+      limit += len;
+    } else if (len < capacity / 2) {
+      flush();
+      memcpy(buffer, buf, len);
+      limit = len;
+    } else {
+      // send the buffered bytes and the caller's bytes in one system call
+      writeBuffers(buffer, limit, (const char*) buf, len);
+      limit = 0;
+    }
+  }
+
+  void FdOutStream::writeMultiByteVLong(int64_t t)
+  {
+    if (capacity - limit < MAX_VLONG_SIZE) {
+      flush();
+    }
+    limit += encodeVLong(t, buffer + limit);
+  }
+
+  void FdOutStream::flush()
+  {
+    if (limit > 0) {
+      writeBuffers(buffer, limit, NULL, 0);
+      limit = 0;
     }
   }
 
+  void FdOutStream::writeBuffers(const char* first, size_t firstLength,
+                                 const char* second, size_t secondLength)
+  {
+    struct iovec vec[2];
+    vec[0].iov_base = const_cast<char*>(first);
+    vec[0].iov_len = firstLength;
+    vec[1].iov_base = const_cast<char*>(second);
+    vec[1].iov_len = secondLength;
+    writeVector(fd, vec, secondLength > 0 ? 2 : 1);
+  }
+
+  /**
+   * The descriptor is not owned by the stream, and the buffer is not 
+   * flushed, so callers must call flush before destroying it.
+   */
+  FdOutStream::~FdOutStream()
+  {
+    delete [] buffer;
+  }
+
+  void serializeInt(int32_t t, OutStream& stream) {
+    serializeLong(t,stream);
+  }
+
+  void serializeLong(int64_t t, OutStream& stream)
+  {
+    char buf[MAX_VLONG_SIZE];
+    stream.write(buf, encodeVLong(t, buf));
+  }
+
   int32_t deserializeInt(InStream& stream) {
     return deserializeLong(stream);
   }
@@ -263,9 +542,14 @@ namespace HadoopUtils {
 
   void serializeString(const std::string& t, OutStream& stream)
   {
-    serializeInt(t.length(), stream);
-    if (t.length() > 0) {
-      stream.write(t.data(), t.length());
+    serializeString(t.data(), t.length(), stream);
+  }
+
+  void serializeString(const char* str, size_t length, OutStream& stream)
+  {
+    serializeInt(length, stream);
+    if (length > 0) {
+      stream.write(str, length);
     }
   }
 
@@ -273,19 +557,10 @@ namespace HadoopUtils {
   {
     int32_t len = deserializeInt(stream);
     if (len > 0) {
-      // resize the string to the right length
+      // resize keeps the existing capacity, so a string that is reused as a
+      // receive buffer stops allocating once it has seen the largest record
       t.resize(len);
-      // read into the string in 64k chunks
-      const int bufSize = 65536;
-      int offset = 0;
-      char buf[bufSize];
-      while (len > 0) {
-        int chunkLength = len > bufSize ? bufSize : len;
-        stream.read(buf, chunkLength);
-        t.replace(offset, chunkLength, buf, chunkLength);
-        offset += chunkLength;
-        len -= chunkLength;
-      }
+      stream.read(&t[0], len);
     } else {
       t.clear();
     }
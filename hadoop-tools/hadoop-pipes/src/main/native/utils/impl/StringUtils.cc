@@ -18,7 +18,9 @@
 #include "hadoop/StringUtils.hh"
 #include "hadoop/SerialUtils.hh"
 
+#include <ctype.h>
 #include <errno.h>
+#include <float.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -26,35 +28,611 @@
 #include <strings.h>
 #include <sys/time.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) && defined(__GNUC__) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+// AVX2 code is compiled for a target attribute and picked at run time
+#define HADOOP_AVX2_DISPATCH
+#include <immintrin.h>
+#endif
+
+// a single double operation is only correctly rounded when it is not
+// evaluated with extended precision
+#if defined(FLT_EVAL_METHOD)
+#define HADOOP_EXACT_FLOAT_EVAL (FLT_EVAL_METHOD == 0)
+#else
+#define HADOOP_EXACT_FLOAT_EVAL (__FLT_EVAL_METHOD__ == 0)
+#endif
+
 using std::string;
 using std::vector;
 
 namespace HadoopUtils {
 
-  string toString(int32_t x) {
-    char str[100];
-    sprintf(str, "%d", x);
+  static const char DIGIT_PAIRS[] =
+    "00010203040506070809101112131415161718192021222324"
+    "25262728293031323334353637383940414243444546474849"
+    "50515253545556575859606162636465666768697071727374"
+    "75767778798081828384858687888990919293949596979899";
+
+  /**
+   * Write the digits of a number so that they end just before end.
+   * @return the first digit
+   */
+  static char* writeDigitsBackwards(uint64_t value, char* end) {
+    while (value >= 100) {
+      unsigned int pair = (unsigned int) (value % 100) * 2;
+      value /= 100;
+      end -= 2;
+      end[0] = DIGIT_PAIRS[pair];
+      end[1] = DIGIT_PAIRS[pair + 1];
+    }
+    if (value >= 10) {
+      unsigned int pair = (unsigned int) value * 2;
+      end -= 2;
+      end[0] = DIGIT_PAIRS[pair];
+      end[1] = DIGIT_PAIRS[pair + 1];
+    } else {
+      *--end = (char) ('0' + value);
+    }
+    return end;
+  }
+
+  size_t formatLong(int64_t x, char* buffer) {
+    char digits[20];
+    char* end = digits + sizeof(digits);
+    uint64_t value = x < 0 ? 0 - (uint64_t) x : (uint64_t) x;
+    char* first = writeDigitsBackwards(value, end);
+    size_t length = 0;
+    if (x < 0) {
+      buffer[length++] = '-';
+    }
+    memcpy(buffer + length, first, end - first);
+    return length + (end - first);
+  }
+
+  /**
+   * A floating point number with a 64 bit significand, used by the Grisu2
+   * algorithm of Florian Loitsch ("Printing Floating-Point Numbers Quickly
+   * and Accurately with Integers") to find the shortest digits of a double.
+   */
+  struct DiyFp {
+    uint64_t f;
+    int e;
+
+    DiyFp(uint64_t _f, int _e): f(_f), e(_e) {}
+
+    DiyFp minus(const DiyFp& other) const {
+      return DiyFp(f - other.f, e);
+    }
+
+    /**
+     * The product, rounded to the upper 64 bits.
+     */
+    DiyFp times(const DiyFp& other) const {
+      const uint64_t M32 = 0xFFFFFFFFULL;
+      uint64_t a = f >> 32;
+      uint64_t b = f & M32;
+      uint64_t c = other.f >> 32;
+      uint64_t d = other.f & M32;
+      uint64_t ac = a * c;
+      uint64_t bc = b * c;
+      uint64_t ad = a * d;
+      uint64_t bd = b * d;
+      uint64_t middle = (bd >> 32) + (ad & M32) + (bc & M32);
+      middle += 1ULL << 31;
+      return DiyFp(ac + (ad >> 32) + (bc >> 32) + (middle >> 32),
+                   e + other.e + 64);
+    }
+
+    DiyFp normalize() const {
+      DiyFp result = *this;
+      while (!(result.f & (1ULL << 63))) {
+        result.f <<= 1;
+        result.e -= 1;
+      }
+      return result;
+    }
+  };
+
+  static const uint64_t DOUBLE_HIDDEN_BIT = 0x0010000000000000ULL;
+  static const int DOUBLE_SIGNIFICAND_SIZE = 52;
+
+  /**
+   * The powers of ten from 10^-348 to 10^340 in steps of 8, as normalized
+   * significands and binary exponents.
+   */
+  static const uint64_t CACHED_POWER_SIGNIFICANDS[] = {
+    0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL,
+    0xcf42894a5dce35eaULL, 0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL,
+    0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL, 0xbe5691ef416bd60cULL,
+    0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+    0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL,
+    0xc21094364dfb5637ULL, 0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL,
+    0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL, 0xb23867fb2a35b28eULL,
+    0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+    0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL,
+    0xb5b5ada8aaff80b8ULL, 0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL,
+    0x964e858c91ba2655ULL, 0xdff9772470297ebdULL, 0xa6dfbd9fb8e5b88fULL,
+    0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+    0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL,
+    0xaa242499697392d3ULL, 0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL,
+    0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL, 0x9c40000000000000ULL,
+    0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+    0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL,
+    0x9f4f2726179a2245ULL, 0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL,
+    0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL, 0x924d692ca61be758ULL,
+    0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+    0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL,
+    0x952ab45cfa97a0b3ULL, 0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL,
+    0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL, 0x88fcf317f22241e2ULL,
+    0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+    0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL,
+    0x8bab8eefb6409c1aULL, 0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL,
+    0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL, 0x80444b5e7aa7cf85ULL,
+    0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+    0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL
+  };
+
+  static const int16_t CACHED_POWER_EXPONENTS[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+    -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+    -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+    -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+    -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+    109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+    641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+    907, 933, 960, 986, 1013, 1039, 1066
+  };
+
+  static const uint32_t POWERS_OF_TEN[] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+    1000000000
+  };
+
+  /**
+   * Get a cached power of ten c such that the binary exponent of e + c is
+   * in the range Grisu2 needs.
+   * @param k set to the decimal exponent of the result, negated
+   */
+  static DiyFp getCachedPower(int e, int& k) {
+    double dk = (-61 - e) * 0.30102999566398114 + 347;
+    int exponent = (int) dk;
+    if (dk - exponent > 0.0) {
+      exponent += 1;
+    }
+    unsigned int index = (unsigned int) ((exponent >> 3) + 1);
+    k = -(-348 + (int) (index << 3));
+    return DiyFp(CACHED_POWER_SIGNIFICANDS[index],
+                 CACHED_POWER_EXPONENTS[index]);
+  }
+
+  static int countDigits(uint32_t n) {
+    int digits = 1;
+    while (digits < 10 && n >= POWERS_OF_TEN[digits]) {
+      digits += 1;
+    }
+    return digits;
+  }
+
+  /**
+   * Move the last digit down while that brings it closer to the value and
+   * stays inside the range that reads back as the value.
+   */
+  static void grisuRound(char* buffer, int length, uint64_t delta,
+                         uint64_t rest, uint64_t tenKappa, uint64_t distance) {
+    while (rest < distance && delta - rest >= tenKappa &&
+           (rest + tenKappa < distance ||
+            distance - rest > rest + tenKappa - distance)) {
+      buffer[length - 1] -= 1;
+      rest += tenKappa;
+    }
+  }
+
+  static void generateDigits(const DiyFp& w, const DiyFp& upper,
+                             uint64_t delta, char* buffer, int& length,
+                             int& k) {
+    const DiyFp one(1ULL << -upper.e, upper.e);
+    const DiyFp distance = upper.minus(w);
+    uint32_t p1 = (uint32_t) (upper.f >> -one.e);
+    uint64_t p2 = upper.f & (one.f - 1);
+    int kappa = countDigits(p1);
+    length = 0;
+    while (kappa > 0) {
+      uint32_t power = POWERS_OF_TEN[kappa - 1];
+      uint32_t digit = p1 / power;
+      p1 %= power;
+      if (digit != 0 || length != 0) {
+        buffer[length++] = (char) ('0' + digit);
+      }
+      kappa -= 1;
+      uint64_t rest = ((uint64_t) p1 << -one.e) + p2;
+      if (rest <= delta) {
+        k += kappa;
+        grisuRound(buffer, length, delta, rest,
+                   (uint64_t) POWERS_OF_TEN[kappa] << -one.e, distance.f);
+        return;
+      }
+    }
+    while (true) {
+      p2 *= 10;
+      delta *= 10;
+      char digit = (char) (p2 >> -one.e);
+      if (digit != 0 || length != 0) {
+        buffer[length++] = (char) ('0' + digit);
+      }
+      p2 &= one.f - 1;
+      kappa -= 1;
+      if (p2 < delta) {
+        k += kappa;
+        int index = -kappa;
+        grisuRound(buffer, length, delta, p2, one.f,
+                   distance.f * (index < 10 ? POWERS_OF_TEN[index] : 0));
+        return;
+      }
+    }
+  }
+
+  /**
+   * Find the shortest digits of a positive double.
+   * @param buffer set to the digits
+   * @param length set to the number of digits
+   * @param k set to the decimal exponent, so the value is digits * 10^k
+   */
+  static void grisu2(double value, char* buffer, int& length, int& k) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    int biasedExponent = (int) ((bits >> DOUBLE_SIGNIFICAND_SIZE) & 0x7FF);
+    uint64_t significand = bits & (DOUBLE_HIDDEN_BIT - 1);
+    DiyFp v(0, 0);
+    if (biasedExponent != 0) {
+      v = DiyFp(significand + DOUBLE_HIDDEN_BIT, biasedExponent - 1075);
+    } else {
+      v = DiyFp(significand, -1074);
+    }
+    // the boundaries half way to the neighbouring doubles
+    DiyFp plus = DiyFp((v.f << 1) + 1, v.e - 1).normalize();
+    DiyFp minus = v.f == DOUBLE_HIDDEN_BIT ?
+      DiyFp((v.f << 2) - 1, v.e - 2) : DiyFp((v.f << 1) - 1, v.e - 1);
+    minus.f <<= minus.e - plus.e;
+    minus.e = plus.e;
+    DiyFp power = getCachedPower(plus.e, k);
+    DiyFp w = v.normalize().times(power);
+    DiyFp upper = plus.times(power);
+    DiyFp lower = minus.times(power);
+    lower.f += 1;
+    upper.f -= 1;
+    generateDigits(w, upper, upper.f - lower.f, buffer, length, k);
+  }
+
+  static size_t writeExponent(int exponent, char* buffer) {
+    size_t length = 0;
+    if (exponent < 0) {
+      buffer[length++] = '-';
+      exponent = -exponent;
+    }
+    char digits[4];
+    char* end = digits + sizeof(digits);
+    char* first = writeDigitsBackwards(exponent, end);
+    memcpy(buffer + length, first, end - first);
+    return length + (end - first);
+  }
+
+  /**
+   * Lay out the digits of digits * 10^k, which are at the start of the
+   * buffer.
+   * @return the length of the result
+   */
+  static size_t layoutDigits(char* buffer, int length, int k) {
+    // the position of the decimal point, from the first digit
+    int point = length + k;
+    if (length <= point && point <= 21) {
+      // 1234e7 -> 12340000000.0
+      for(int i=length; i < point; ++i) {
+        buffer[i] = '0';
+      }
+      buffer[point] = '.';
+      buffer[point + 1] = '0';
+      return point + 2;
+    } else if (0 < point && point <= 21) {
+      // 1234e-2 -> 12.34
+      memmove(buffer + point + 1, buffer + point, length - point);
+      buffer[point] = '.';
+      return length + 1;
+    } else if (-6 < point && point <= 0) {
+      // 1234e-6 -> 0.001234
+      int offset = 2 - point;
+      memmove(buffer + offset, buffer, length);
+      buffer[0] = '0';
+      buffer[1] = '.';
+      for(int i=2; i < offset; ++i) {
+        buffer[i] = '0';
+      }
+      return length + offset;
+    } else if (length == 1) {
+      // 1e30
+      buffer[1] = 'e';
+      return 2 + writeExponent(point - 1, buffer + 2);
+    } else {
+      // 1234e30 -> 1.234e33
+      memmove(buffer + 2, buffer + 1, length - 1);
+      buffer[1] = '.';
+      buffer[length + 1] = 'e';
+      return length + 2 + writeExponent(point - 1, buffer + length + 2);
+    }
+  }
+
+  size_t formatDouble(double x, char* buffer) {
+    uint64_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    bool negative = (bits >> 63) != 0;
+    size_t length = 0;
+    if (x != x) {
+      memcpy(buffer, "NaN", 3);
+      return 3;
+    }
+    if (negative) {
+      buffer[length++] = '-';
+      x = -x;
+    }
+    if (x == 0.0) {
+      memcpy(buffer + length, "0.0", 3);
+      return length + 3;
+    }
+    if (x > 1.7976931348623157e308) {
+      memcpy(buffer + length, "Infinity", 8);
+      return length + 8;
+    }
+    int digits;
+    int k;
+    grisu2(x, buffer + length, digits, k);
+    return length + layoutDigits(buffer + length, digits, k);
+  }
+
+  bool parseLong(const char* str, size_t length, int64_t& result) {
+    size_t i = 0;
+    bool negative = false;
+    if (length > 0 && (str[0] == '-' || str[0] == '+')) {
+      negative = str[0] == '-';
+      i += 1;
+    }
+    if (i == length) {
+      return false;
+    }
+    uint64_t limit = negative ? 1ULL << 63 : (1ULL << 63) - 1;
+    uint64_t value = 0;
+    for(; i < length; ++i) {
+      unsigned int digit = (unsigned char) str[i] - '0';
+      if (digit > 9 || value > (limit - digit) / 10) {
+        return false;
+      }
+      value = value * 10 + digit;
+    }
+    result = negative ? (int64_t) (0 - value) : (int64_t) value;
+    return true;
+  }
+
+  /**
+   * A decimal number, as digits * 10^exponent.
+   */
+  struct DecimalNumber {
+    bool negative;
+    uint64_t digits;
+    int exponent;
+    /**
+     * Whether there were too many digits to keep them all.
+     */
+    bool truncated;
+  };
+
+  /**
+   * Read a plain decimal number, like "-12.5e3".
+   * @return false if the bytes are not one
+   */
+  static bool scanDecimal(const char* str, size_t length,
+                          DecimalNumber& number) {
+    const char* end = str + length;
+    number.negative = false;
+    number.digits = 0;
+    number.exponent = 0;
+    number.truncated = false;
+    if (str < end && (*str == '-' || *str == '+')) {
+      number.negative = *str == '-';
+      ++str;
+    }
+    int significantDigits = 0;
+    bool seenDigit = false;
+    bool seenPoint = false;
+    for(; str < end; ++str) {
+      if (*str == '.' && !seenPoint) {
+        seenPoint = true;
+        continue;
+      }
+      unsigned int digit = (unsigned char) *str - '0';
+      if (digit > 9) {
+        break;
+      }
+      seenDigit = true;
+      if (significantDigits < 19) {
+        number.digits = number.digits * 10 + digit;
+        if (number.digits != 0) {
+          significantDigits += 1;
+        }
+        if (seenPoint) {
+          number.exponent -= 1;
+        }
+      } else {
+        if (digit != 0) {
+          number.truncated = true;
+        }
+        if (!seenPoint) {
+          number.exponent += 1;
+        }
+      }
+    }
+    if (!seenDigit) {
+      return false;
+    }
+    if (str < end && (*str == 'e' || *str == 'E')) {
+      ++str;
+      bool negativeExponent = false;
+      if (str < end && (*str == '-' || *str == '+')) {
+        negativeExponent = *str == '-';
+        ++str;
+      }
+      if (str == end) {
+        return false;
+      }
+      int exponent = 0;
+      for(; str < end; ++str) {
+        unsigned int digit = (unsigned char) *str - '0';
+        if (digit > 9) {
+          return false;
+        }
+        if (exponent < 100000) {
+          exponent = exponent * 10 + digit;
+        }
+      }
+      number.exponent += negativeExponent ? -exponent : exponent;
+    }
+    return str == end;
+  }
+
+  static const double EXACT_POWERS_OF_TEN[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12,
+    1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+
+  /**
+   * Run strtod or strtof on a null terminated copy of the bytes.
+   */
+  template <class T>
+  static bool parseWithLibrary(const char* str, size_t length, T& result,
+                               T (*convert)(const char*, char**)) {
+    char buffer[64];
+    string copy;
+    const char* terminated;
+    if (length < sizeof(buffer)) {
+      memcpy(buffer, str, length);
+      buffer[length] = '\0';
+      terminated = buffer;
+    } else {
+      copy.assign(str, length);
+      terminated = copy.c_str();
+    }
+    if (length == 0 || isspace((unsigned char) terminated[0])) {
+      return false;
+    }
+    char* end;
+    result = convert(terminated, &end);
+    return end == terminated + length;
+  }
+
+  bool parseDouble(const char* str, size_t length, double& result) {
+#if HADOOP_EXACT_FLOAT_EVAL
+    DecimalNumber number;
+    // when the digits and the power of ten are both exact doubles, one
+    // correctly rounded operation gives the correctly rounded result
+    if (scanDecimal(str, length, number) && !number.truncated &&
+        number.digits <= (1ULL << 53) &&
+        number.exponent >= -22 && number.exponent <= 22) {
+      result = (double) number.digits;
+      if (number.exponent < 0) {
+        result /= EXACT_POWERS_OF_TEN[-number.exponent];
+      } else {
+        result *= EXACT_POWERS_OF_TEN[number.exponent];
+      }
+      if (number.negative) {
+        result = -result;
+      }
+      return true;
+    }
+#endif
+    return parseWithLibrary(str, length, result, strtod);
+  }
+
+  /**
+   * Read a float, the same way as parseDouble.
+   */
+  static bool parseFloat(const char* str, size_t length, float& result) {
+#if HADOOP_EXACT_FLOAT_EVAL
+    DecimalNumber number;
+    if (scanDecimal(str, length, number) && !number.truncated &&
+        number.digits <= (1ULL << 24) &&
+        number.exponent >= -10 && number.exponent <= 10) {
+      result = (float) number.digits;
+      if (number.exponent < 0) {
+        result /= (float) EXACT_POWERS_OF_TEN[-number.exponent];
+      } else {
+        result *= (float) EXACT_POWERS_OF_TEN[number.exponent];
+      }
+      if (number.negative) {
+        result = -result;
+      }
+      return true;
+    }
+#endif
+    return parseWithLibrary(str, length, result, strtof);
+  }
+
+  /**
+   * Skip the leading white space that sscanf used to allow.
+   */
+  static const char* skipSpace(const string& val, size_t& length) {
+    const char* str = val.data();
+    const char* end = str + val.length();
+    while (str < end && isspace((unsigned char) *str)) {
+      ++str;
+    }
+    length = end - str;
     return str;
   }
 
+  string toString(int32_t x) {
+    char buffer[MAX_NUMBER_LENGTH];
+    return string(buffer, formatLong(x, buffer));
+  }
+
   int toInt(const string& val) {
-    int result;
-    char trash;
-    int num = sscanf(val.c_str(), "%d%c", &result, &trash);
-    HADOOP_ASSERT(num == 1,
+    size_t length;
+    const char* str = skipSpace(val, length);
+    int64_t result;
+    HADOOP_ASSERT(parseLong(str, length, result) &&
+                  result >= -2147483648LL && result <= 2147483647LL,
                   "Problem converting " + val + " to integer.");
+    return (int) result;
+  }
+
+  int64_t toLong(const string& val) {
+    size_t length;
+    const char* str = skipSpace(val, length);
+    int64_t result;
+    HADOOP_ASSERT(parseLong(str, length, result),
+                  "Problem converting " + val + " to long.");
     return result;
   }
 
   float toFloat(const string& val) {
+    size_t length;
+    const char* str = skipSpace(val, length);
     float result;
-    char trash;
-    int num = sscanf(val.c_str(), "%f%c", &result, &trash);
-    HADOOP_ASSERT(num == 1,
+    HADOOP_ASSERT(parseFloat(str, length, result),
                   "Problem converting " + val + " to float.");
     return result;
   }
 
+  double toDouble(const string& val) {
+    size_t length;
+    const char* str = skipSpace(val, length);
+    double result;
+    HADOOP_ASSERT(parseDouble(str, length, result),
+                  "Problem converting " + val + " to double.");
+    return result;
+  }
+
   bool toBool(const string& val) {
     if (val == "true") {
       return true;
@@ -77,19 +655,161 @@ namespace HadoopUtils {
     return tv.tv_sec * 1000 + tv.tv_usec / 1000;
   }
 
+  /**
+   * MurmurHash64A by Austin Appleby, which is in the public domain. The
+   * words are read as little-endian, whatever the platform.
+   */
+  uint64_t hashBytes(const char* data, size_t length, uint64_t seed) {
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+    const unsigned char* bytes = (const unsigned char*) data;
+    uint64_t h = seed ^ (length * m);
+    const unsigned char* end = bytes + (length & ~(size_t) 7);
+    for(; bytes < end; bytes += 8) {
+      uint64_t k = 0;
+      for(int i=7; i >= 0; --i) {
+        k = (k << 8) | bytes[i];
+      }
+      k *= m;
+      k ^= k >> r;
+      k *= m;
+      h ^= k;
+      h *= m;
+    }
+    switch (length & 7) {
+    case 7: h ^= (uint64_t) bytes[6] << 48;
+    case 6: h ^= (uint64_t) bytes[5] << 40;
+    case 5: h ^= (uint64_t) bytes[4] << 32;
+    case 4: h ^= (uint64_t) bytes[3] << 24;
+    case 3: h ^= (uint64_t) bytes[2] << 16;
+    case 2: h ^= (uint64_t) bytes[1] << 8;
+    case 1: h ^= (uint64_t) bytes[0];
+      h *= m;
+    }
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+  }
+
+#ifdef __SSE2__
+  static const char* findByteSse2(const char* start, const char* end,
+                                  char byte) {
+    __m128i pattern = _mm_set1_epi8(byte);
+    while (end - start >= 16) {
+      __m128i block = _mm_loadu_si128((const __m128i*) start);
+      int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, pattern));
+      if (mask != 0) {
+        return start + __builtin_ctz(mask);
+      }
+      start += 16;
+    }
+    while (start < end && *start != byte) {
+      ++start;
+    }
+    return start;
+  }
+#endif
+
+#ifdef HADOOP_AVX2_DISPATCH
+  __attribute__((target("avx2")))
+  static const char* findByteAvx2(const char* start, const char* end,
+                                  char byte) {
+    __m256i pattern = _mm256_set1_epi8(byte);
+    while (end - start >= 32) {
+      __m256i block = _mm256_loadu_si256((const __m256i*) start);
+      int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, pattern));
+      if (mask != 0) {
+        return start + __builtin_ctz(mask);
+      }
+      start += 32;
+    }
+    return findByteSse2(start, end, byte);
+  }
+
+  static bool checkAvx2() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+  }
+
+  static const bool haveAvx2 = checkAvx2();
+#endif
+
+  const char* findByte(const char* start, const char* end, char byte) {
+#if defined(HADOOP_AVX2_DISPATCH)
+    if (haveAvx2) {
+      return findByteAvx2(start, end, byte);
+    }
+    return findByteSse2(start, end, byte);
+#elif defined(__SSE2__)
+    return findByteSse2(start, end, byte);
+#else
+    const void* result = memchr(start, byte, end - start);
+    return result == NULL ? end : (const char*) result;
+#endif
+  }
+
+  Tokenizer::Tokenizer(const char* separator) {
+    memset(separatorTable, 0, sizeof(separatorTable));
+    separatorCount = 0;
+    for(const char* ch = separator; *ch != '\0'; ++ch) {
+      unsigned char byte = (unsigned char) *ch;
+      if (!isSeparator(byte)) {
+        if (separatorCount < (int) sizeof(separatorList)) {
+          separatorList[separatorCount] = *ch;
+        }
+        separatorCount += 1;
+        separatorTable[byte >> 5] |= 1u << (byte & 31);
+      }
+    }
+    position = NULL;
+    end = NULL;
+  }
+
+  /**
+   * Find the first separator at or after start, or the end of the bytes.
+   */
+  const char* Tokenizer::findSeparator(const char* start) const {
+    if (separatorCount == 0) {
+      return end;
+    } else if (separatorCount == 1) {
+      return findByte(start, end, separatorList[0]);
+    }
+#ifdef __SSE2__
+    if (separatorCount <= (int) sizeof(separatorList)) {
+      __m128i patterns[sizeof(separatorList)];
+      for(int i=0; i < separatorCount; ++i) {
+        patterns[i] = _mm_set1_epi8(separatorList[i]);
+      }
+      while (end - start >= 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*) start);
+        __m128i matches = _mm_cmpeq_epi8(block, patterns[0]);
+        for(int i=1; i < separatorCount; ++i) {
+          matches = _mm_or_si128(matches, _mm_cmpeq_epi8(block, patterns[i]));
+        }
+        int mask = _mm_movemask_epi8(matches);
+        if (mask != 0) {
+          return start + __builtin_ctz(mask);
+        }
+        start += 16;
+      }
+    }
+#endif
+    while (start < end && !isSeparator(*start)) {
+      ++start;
+    }
+    return start;
+  }
+
   vector<string> splitString(const std::string& str,
 			     const char* separator) {
     vector<string> result;
-    string::size_type prev_pos=0;
-    string::size_type pos=0;
-    while ((pos = str.find_first_of(separator, prev_pos)) != string::npos) {
-      if (prev_pos < pos) {
-	result.push_back(str.substr(prev_pos, pos-prev_pos));
-      }
-      prev_pos = pos + 1;
-    }
-    if (prev_pos < str.size()) {
-      result.push_back(str.substr(prev_pos));
+    Tokenizer tokenizer(separator);
+    tokenizer.reset(str.data(), str.length());
+    const char* word;
+    size_t length;
+    while (tokenizer.next(word, length)) {
+      result.push_back(string(word, length));
     }
     return result;
   }